@@ -0,0 +1,384 @@
+#pragma once
+#include <set>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+#include "Target.h"
+#include "Types.h"
+
+// ALLOCATORS
+// the arenas, pools and size class caches behind the memory builtins, linked into every program that calls them
+// whatever it's built as. memory comes from mmap on linux and VirtualAlloc on windows. they take their inputs in
+// the target's first two argument registers and only write rax, rcx, rdx, r8 to r11 and those two, which every
+// calling convention lets a callee change. programs are single threaded, so the size class table is the one
+// thread's cache and is never locked
+//
+// an arena's first chunk holds its header at chunk + 16: the cursor, the limit, the current chunk and how big a
+// chunk is. every chunk starts with the one before it and where it ends, so a reset can hand back the newer ones.
+// a pool's header is the start of its first slab: the free list, the cursor, the limit, the block size and how
+// big a slab is. freed blocks are pushed on the free list through their first 8 bytes
+
+const int allocator_page = 4096;
+const std::string allocator_cache_label = "allocator_cache"; // a pool per 16 byte size class, made when first used
+
+bool uses_allocators = false;
+bool uses_allocator_cache = false;
+
+// rounds a register up to a multiple of a power of two
+void emit_round_up(std::vector<Instruction>& code, Operand value, int multiple) {
+	emit(code, Opcode::ADD, value, immediate_operand(multiple - 1));
+	emit(code, Opcode::AND, value, immediate_operand(-multiple));
+}
+
+// raises a register to at least minimum, compared signed so negative sizes get it too
+void emit_at_least(std::vector<Instruction>& code, Operand value, int minimum, const std::string& label) {
+	emit(code, Opcode::CMP, value, immediate_operand(minimum));
+	emit_condition(code, Opcode::JCC, Condition::GE, label_operand(label));
+	emit(code, Opcode::MOV, value, immediate_operand(minimum));
+	emit_label(code, label);
+}
+
+// the system calls take their inputs in registers the callers are using, so everything but rax is put back.
+// windows needs the stack aligned and 32 bytes of shadow space under the call
+const Register linux_system_saved[] = { Register::RCX, Register::RDX, Register::RSI, Register::RDI, Register::R8, Register::R9, Register::R10, Register::R11 };
+const Register windows_system_saved[] = { Register::RCX, Register::RDX, Register::R8, Register::R9, Register::R10, Register::R11 };
+
+void enter_system_call(std::vector<Instruction>& code) {
+	if (target.platform == Platform::WINDOWS) {
+		for (Register saved : windows_system_saved) emit(code, Opcode::PUSH, register_operand(saved));
+		emit(code, Opcode::PUSH, register_operand(Register::RBP));
+		emit(code, Opcode::MOV, register_operand(Register::RBP), register_operand(Register::RSP));
+		emit(code, Opcode::AND, register_operand(Register::RSP), immediate_operand(-16));
+		emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(32));
+		return;
+	}
+	for (Register saved : linux_system_saved) emit(code, Opcode::PUSH, register_operand(saved));
+}
+
+void leave_system_call(std::vector<Instruction>& code) {
+	if (target.platform == Platform::WINDOWS) {
+		emit(code, Opcode::LEAVE);
+		for (int i = sizeof(windows_system_saved) / sizeof(Register) - 1; i >= 0; i--) emit(code, Opcode::POP, register_operand(windows_system_saved[i]));
+	}
+	else {
+		for (int i = sizeof(linux_system_saved) / sizeof(Register) - 1; i >= 0; i--) emit(code, Opcode::POP, register_operand(linux_system_saved[i]));
+	}
+	emit(code, Opcode::RET);
+}
+
+// rax bytes of zeroed read write memory, its address comes back in rax
+void allocator_map(std::vector<Instruction>& code) {
+	emit_label(code, "allocator_map");
+	enter_system_call(code);
+	if (target.platform == Platform::WINDOWS) {
+		emit(code, Opcode::MOV, register_operand(Register::RDX), register_operand(Register::RAX));
+		emit(code, Opcode::XOR, register_operand(Register::RCX, 4), register_operand(Register::RCX, 4));
+		emit(code, Opcode::MOV, register_operand(Register::R8, 4), immediate_operand(0x3000)); // commit and reserve
+		emit(code, Opcode::MOV, register_operand(Register::R9, 4), immediate_operand(4)); // read write
+		emit(code, Opcode::CALL, label_operand("VirtualAlloc"));
+	}
+	else {
+		emit(code, Opcode::MOV, register_operand(Register::RSI), register_operand(Register::RAX));
+		emit(code, Opcode::XOR, register_operand(Register::RDI, 4), register_operand(Register::RDI, 4));
+		emit(code, Opcode::MOV, register_operand(Register::RDX, 4), immediate_operand(3)); // read write
+		emit(code, Opcode::MOV, register_operand(Register::R10, 4), immediate_operand(0x22)); // private and anonymous
+		emit(code, Opcode::MOV, register_operand(Register::R8), immediate_operand(-1));
+		emit(code, Opcode::XOR, register_operand(Register::R9, 4), register_operand(Register::R9, 4));
+		emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(9)); // mmap
+		emit(code, Opcode::SYSCALL);
+	}
+	leave_system_call(code);
+}
+
+// gives back the rax bytes at rcx
+void allocator_unmap(std::vector<Instruction>& code) {
+	emit_label(code, "allocator_unmap");
+	enter_system_call(code);
+	if (target.platform == Platform::WINDOWS) {
+		emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4)); // the whole reservation
+		emit(code, Opcode::MOV, register_operand(Register::R8, 4), immediate_operand(0x8000)); // release
+		emit(code, Opcode::CALL, label_operand("VirtualFree"));
+	}
+	else {
+		emit(code, Opcode::MOV, register_operand(Register::RDI), register_operand(Register::RCX));
+		emit(code, Opcode::MOV, register_operand(Register::RSI), register_operand(Register::RAX));
+		emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(11)); // munmap
+		emit(code, Opcode::SYSCALL);
+	}
+	leave_system_call(code);
+}
+
+// arena(bytes), chunks are at least a page
+void allocator_arena(std::vector<Instruction>& code) {
+	Operand chunk_bytes = register_operand(Register::R9);
+	Operand chunk = register_operand(Register::RAX);
+	Operand scratch = register_operand(Register::RCX);
+	emit_label(code, "arena");
+	emit(code, Opcode::MOV, chunk_bytes, register_operand(target.argument_registers[0]));
+	emit_at_least(code, chunk_bytes, allocator_page, ".sized");
+	emit_round_up(code, chunk_bytes, allocator_page);
+	emit(code, Opcode::MOV, chunk, chunk_bytes);
+	emit(code, Opcode::CALL, label_operand("allocator_map"));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 0), immediate_operand(0)); // no chunk before it
+	emit(code, Opcode::LEA, scratch, indexed_memory_operand(Register::RAX, Register::R9, 1, 0));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 8), scratch);
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 24), scratch); // limit
+	emit(code, Opcode::LEA, scratch, memory_operand(Register::RAX, 48));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 16), scratch); // cursor, past the header
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 32), chunk);
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 40), chunk_bytes);
+	emit(code, Opcode::ADD, chunk, immediate_operand(16));
+	emit(code, Opcode::RET);
+}
+
+// arena_alloc(a, n), 16 byte aligned. what doesn't fit in the current chunk starts a new one big enough for it
+void allocator_arena_alloc(std::vector<Instruction>& code) {
+	Operand arena = register_operand(Register::R9);
+	Operand size = register_operand(Register::R10);
+	Operand bytes = register_operand(Register::R8);
+	Operand result = register_operand(Register::RAX);
+	Operand end = register_operand(Register::RCX);
+	emit_label(code, "arena_alloc");
+	emit(code, Opcode::MOV, arena, register_operand(target.argument_registers[0]));
+	emit(code, Opcode::MOV, size, register_operand(target.argument_registers[1]));
+	emit_round_up(code, size, 16);
+	emit(code, Opcode::MOV, result, memory_operand(Register::R9, 0));
+	emit(code, Opcode::LEA, end, indexed_memory_operand(Register::RAX, Register::R10, 1, 0));
+	emit(code, Opcode::CMP, end, memory_operand(Register::R9, 8));
+	emit_condition(code, Opcode::JCC, Condition::A, label_operand(".grow"));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 0), end);
+	emit(code, Opcode::RET);
+
+	emit_label(code, ".grow");
+	emit(code, Opcode::LEA, bytes, memory_operand(Register::R10, 16));
+	emit_round_up(code, bytes, allocator_page);
+	emit(code, Opcode::CMP, bytes, memory_operand(Register::R9, 24));
+	emit_condition(code, Opcode::JCC, Condition::AE, label_operand(".map"));
+	emit(code, Opcode::MOV, bytes, memory_operand(Register::R9, 24));
+	emit_label(code, ".map");
+	emit(code, Opcode::MOV, result, bytes);
+	emit(code, Opcode::CALL, label_operand("allocator_map"));
+	emit(code, Opcode::MOV, end, memory_operand(Register::R9, 16));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 0), end);
+	emit(code, Opcode::LEA, end, indexed_memory_operand(Register::RAX, Register::R8, 1, 0));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 8), end);
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 8), end);
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 16), result);
+	emit(code, Opcode::ADD, result, immediate_operand(16));
+	emit(code, Opcode::LEA, end, indexed_memory_operand(Register::RAX, Register::R10, 1, 0));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 0), end);
+	emit(code, Opcode::RET);
+}
+
+// arena_mark(a) is the cursor
+void allocator_arena_mark(std::vector<Instruction>& code) {
+	emit_label(code, "arena_mark");
+	emit(code, Opcode::MOV, register_operand(Register::RAX), memory_operand(target.argument_registers[0], 0));
+	emit(code, Opcode::RET);
+}
+
+// arena_reset(a, mark) unmaps the chunks made since the mark until it's in the current one, the first chunk
+// is never given back
+void allocator_arena_reset(std::vector<Instruction>& code) {
+	Operand arena = register_operand(Register::R9);
+	Operand mark = register_operand(Register::R10);
+	Operand chunk = register_operand(Register::RAX);
+	Operand previous = register_operand(Register::RCX);
+	emit_label(code, "arena_reset");
+	emit(code, Opcode::MOV, arena, register_operand(target.argument_registers[0]));
+	emit(code, Opcode::MOV, mark, register_operand(target.argument_registers[1]));
+	emit_label(code, ".check");
+	emit(code, Opcode::MOV, chunk, memory_operand(Register::R9, 16));
+	emit(code, Opcode::CMP, memory_operand(Register::RAX, 0), immediate_operand(0));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".set"));
+	emit(code, Opcode::CMP, mark, chunk);
+	emit_condition(code, Opcode::JCC, Condition::BE, label_operand(".release"));
+	emit(code, Opcode::CMP, mark, memory_operand(Register::RAX, 8));
+	emit_condition(code, Opcode::JCC, Condition::BE, label_operand(".set"));
+	emit_label(code, ".release");
+	emit(code, Opcode::MOV, previous, memory_operand(Register::RAX, 0));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 16), previous);
+	emit(code, Opcode::MOV, register_operand(Register::RDX), memory_operand(Register::RCX, 8));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 8), register_operand(Register::RDX));
+	emit(code, Opcode::MOV, register_operand(Register::RCX), chunk);
+	emit(code, Opcode::MOV, chunk, memory_operand(Register::RCX, 8));
+	emit(code, Opcode::SUB, chunk, register_operand(Register::RCX));
+	emit(code, Opcode::CALL, label_operand("allocator_unmap"));
+	emit(code, Opcode::JMP, label_operand(".check"));
+	emit_label(code, ".set");
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 0), mark);
+	emit(code, Opcode::XOR, register_operand(Register::RAX, 4), register_operand(Register::RAX, 4));
+	emit(code, Opcode::RET);
+}
+
+// pool(size), blocks are at least 16 bytes and 16 byte aligned, a slab holds 256 of them
+void allocator_pool(std::vector<Instruction>& code) {
+	Operand block = register_operand(Register::R9);
+	Operand slab_bytes = register_operand(Register::R10);
+	Operand slab = register_operand(Register::RAX);
+	Operand scratch = register_operand(Register::RCX);
+	emit_label(code, "pool");
+	emit(code, Opcode::MOV, block, register_operand(target.argument_registers[0]));
+	emit_round_up(code, block, 16);
+	emit_at_least(code, block, 16, ".sized");
+	emit(code, Opcode::MOV, slab_bytes, block);
+	emit(code, Opcode::SHL, slab_bytes, immediate_operand(8));
+	emit_round_up(code, slab_bytes, allocator_page);
+	emit(code, Opcode::MOV, slab, slab_bytes);
+	emit(code, Opcode::CALL, label_operand("allocator_map"));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 0), immediate_operand(0)); // nothing freed yet
+	emit(code, Opcode::LEA, scratch, memory_operand(Register::RAX, 48));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 8), scratch);
+	emit(code, Opcode::LEA, scratch, indexed_memory_operand(Register::RAX, Register::R10, 1, 0));
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 16), scratch);
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 24), block);
+	emit(code, Opcode::MOV, memory_operand(Register::RAX, 32), slab_bytes);
+	emit(code, Opcode::RET);
+}
+
+// pool_alloc(p), the last freed block first, then the next one in the slab, then a new slab
+void allocator_pool_alloc(std::vector<Instruction>& code) {
+	Operand pool = register_operand(Register::R9);
+	Operand result = register_operand(Register::RAX);
+	Operand next = register_operand(Register::RCX);
+	emit_label(code, "pool_alloc");
+	emit(code, Opcode::MOV, pool, register_operand(target.argument_registers[0]));
+	emit(code, Opcode::MOV, result, memory_operand(Register::R9, 0));
+	emit(code, Opcode::TEST, result, result);
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".bump"));
+	emit(code, Opcode::MOV, next, memory_operand(Register::RAX, 0));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 0), next);
+	emit(code, Opcode::RET);
+
+	emit_label(code, ".bump");
+	emit(code, Opcode::MOV, result, memory_operand(Register::R9, 8));
+	emit(code, Opcode::MOV, next, result);
+	emit(code, Opcode::ADD, next, memory_operand(Register::R9, 24));
+	emit(code, Opcode::CMP, next, memory_operand(Register::R9, 16));
+	emit_condition(code, Opcode::JCC, Condition::A, label_operand(".slab"));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 8), next);
+	emit(code, Opcode::RET);
+
+	emit_label(code, ".slab");
+	emit(code, Opcode::MOV, result, memory_operand(Register::R9, 32));
+	emit(code, Opcode::CALL, label_operand("allocator_map"));
+	emit(code, Opcode::MOV, next, memory_operand(Register::R9, 32));
+	emit(code, Opcode::ADD, next, result);
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 16), next);
+	emit(code, Opcode::MOV, next, result);
+	emit(code, Opcode::ADD, next, memory_operand(Register::R9, 24));
+	emit(code, Opcode::MOV, memory_operand(Register::R9, 8), next);
+	emit(code, Opcode::RET);
+}
+
+// pool_free(p, x)
+void allocator_pool_free(std::vector<Instruction>& code) {
+	Register pool = target.argument_registers[0];
+	Register block = target.argument_registers[1];
+	emit_label(code, "pool_free");
+	emit(code, Opcode::MOV, register_operand(Register::RAX), memory_operand(pool, 0));
+	emit(code, Opcode::MOV, memory_operand(block, 0), register_operand(Register::RAX));
+	emit(code, Opcode::MOV, memory_operand(pool, 0), register_operand(block));
+	emit(code, Opcode::XOR, register_operand(Register::RAX, 4), register_operand(Register::RAX, 4));
+	emit(code, Opcode::RET);
+}
+
+// the size class of a byte count in a register, 1 for up to 16 bytes to 32 for up to 512
+void emit_size_class(std::vector<Instruction>& code, Operand bytes) {
+	emit_at_least(code, bytes, 1, ".sized");
+	emit(code, Opcode::ADD, bytes, immediate_operand(15));
+	emit(code, Opcode::SHR, bytes, immediate_operand(4));
+}
+
+// cached_alloc(n) takes a block from its size class's pool, making the pool the first time
+void allocator_cached_alloc(std::vector<Instruction>& code) {
+	Operand bytes = register_operand(Register::R9);
+	Operand slot = register_operand(Register::R10);
+	Operand pool = register_operand(Register::RAX);
+	Operand first = register_operand(target.argument_registers[0]);
+	emit_label(code, "cached_alloc");
+	emit(code, Opcode::MOV, bytes, first);
+	emit(code, Opcode::CMP, bytes, immediate_operand(cached_size_limit));
+	emit_condition(code, Opcode::JCC, Condition::G, label_operand(".large"));
+	emit_size_class(code, bytes);
+	emit(code, Opcode::LEA, slot, label_memory_operand(allocator_cache_label));
+	emit(code, Opcode::LEA, slot, indexed_memory_operand(Register::R10, Register::R9, 8, -8));
+	emit(code, Opcode::MOV, pool, memory_operand(Register::R10, 0));
+	emit(code, Opcode::TEST, pool, pool);
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".take"));
+	emit(code, Opcode::PUSH, slot);
+	emit(code, Opcode::SHL, bytes, immediate_operand(4));
+	emit(code, Opcode::MOV, first, bytes);
+	emit(code, Opcode::CALL, label_operand("pool"));
+	emit(code, Opcode::POP, slot);
+	emit(code, Opcode::MOV, memory_operand(Register::R10, 0), pool);
+	emit_label(code, ".take");
+	emit(code, Opcode::MOV, first, pool);
+	emit(code, Opcode::JMP, label_operand("pool_alloc"));
+
+	emit_label(code, ".large");
+	emit(code, Opcode::MOV, register_operand(Register::RAX), bytes);
+	emit(code, Opcode::JMP, label_operand("allocator_map"));
+}
+
+// cached_free(x, n) needs the same n the block was asked for with
+void allocator_cached_free(std::vector<Instruction>& code) {
+	Operand block = register_operand(Register::R9);
+	Operand bytes = register_operand(Register::R10);
+	emit_label(code, "cached_free");
+	emit(code, Opcode::MOV, block, register_operand(target.argument_registers[0]));
+	emit(code, Opcode::MOV, bytes, register_operand(target.argument_registers[1]));
+	emit(code, Opcode::CMP, bytes, immediate_operand(cached_size_limit));
+	emit_condition(code, Opcode::JCC, Condition::G, label_operand(".large"));
+	emit_size_class(code, bytes);
+	emit(code, Opcode::LEA, register_operand(Register::RAX), label_memory_operand(allocator_cache_label));
+	emit(code, Opcode::MOV, register_operand(target.argument_registers[0]), indexed_memory_operand(Register::RAX, Register::R10, 8, -8));
+	emit(code, Opcode::MOV, register_operand(target.argument_registers[1]), block);
+	emit(code, Opcode::JMP, label_operand("pool_free"));
+
+	emit_label(code, ".large");
+	emit(code, Opcode::MOV, register_operand(Register::RAX), bytes);
+	emit(code, Opcode::MOV, register_operand(Register::RCX), block);
+	emit(code, Opcode::CALL, label_operand("allocator_unmap"));
+	emit(code, Opcode::XOR, register_operand(Register::RAX, 4), register_operand(Register::RAX, 4));
+	emit(code, Opcode::RET);
+}
+
+struct AllocatorProcedure {
+	const char* name;
+	void (*generate)(std::vector<Instruction>& code);
+};
+
+const AllocatorProcedure allocator_procedure_list[] = {
+	{ "arena", allocator_arena }, { "arena_alloc", allocator_arena_alloc }, { "arena_mark", allocator_arena_mark }, { "arena_reset", allocator_arena_reset },
+	{ "pool", allocator_pool }, { "pool_alloc", allocator_pool_alloc }, { "pool_free", allocator_pool_free },
+	{ "cached_alloc", allocator_cached_alloc }, { "cached_free", allocator_cached_free }
+};
+
+// only what the program calls but doesn't declare is added, with the pools the caches are built on
+std::vector<std::vector<Instruction>> allocator_procedures(const std::set<std::string>& called) {
+	std::set<std::string> needed;
+	for (const AllocatorProcedure& procedure : allocator_procedure_list) {
+		if (called.count(procedure.name) > 0) needed.insert(procedure.name);
+	}
+	uses_allocator_cache = needed.count("cached_alloc") > 0 || needed.count("cached_free") > 0;
+	if (uses_allocator_cache) {
+		needed.insert({ "pool", "pool_alloc", "pool_free" });
+	}
+	uses_allocators = needed.size() > 0;
+
+	std::vector<std::vector<Instruction>> procedures;
+	if (!uses_allocators) return procedures;
+	for (auto generate : { allocator_map, allocator_unmap }) {
+		std::vector<Instruction> code;
+		generate(code);
+		procedures.push_back(code);
+	}
+	for (const AllocatorProcedure& procedure : allocator_procedure_list) {
+		if (needed.count(procedure.name) == 0) continue;
+		std::vector<Instruction> code;
+		procedure.generate(code);
+		procedures.push_back(code);
+	}
+	return procedures;
+}
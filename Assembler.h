@@ -0,0 +1,656 @@
+#pragma once
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+
+// ASSEMBLER
+// encodes the instruction list straight into x86-64 machine code so no external assembler is needed.
+// labels starting with a dot are local to the procedure they're in, like in nasm. references to anything
+// else (other procedures, data, externals) are left as relocations for whoever places the sections
+
+struct Relocation {
+	int offset; // of the 32 bit field in the text
+	int instruction_end; // the cpu measures relative addresses from the end of the instruction
+	std::string symbol;
+	int addend = 0; // bytes past the symbol, for an element of a static array
+};
+
+// from this offset in the text on, the code is for this line
+struct SourceLine {
+	int offset;
+	int file; // counting from 1 into source_files, 0 for code that has no source
+	int line;
+};
+
+struct Assembly {
+	std::vector<unsigned char> text;
+	std::map<std::string, int> symbols; // procedure labels to text offsets
+	std::map<std::string, int> symbol_sizes;
+	std::vector<std::string> symbol_order; // the order procedures were placed in
+	std::vector<Relocation> relocations;
+	std::string source_name; // the file the program was compiled from
+	std::vector<std::string> source_files;
+	std::vector<SourceLine> source_lines; // in text order, only where the line changes
+	std::map<std::string, SourceLine> symbol_sources; // where each procedure with a source was declared
+};
+
+int source_file_index(Assembly& assembly, const std::string& source_file) {
+	if (source_file.length() == 0) return 0;
+	auto found = std::find(assembly.source_files.begin(), assembly.source_files.end(), source_file);
+	if (found != assembly.source_files.end()) return (int)(found - assembly.source_files.begin()) + 1;
+	assembly.source_files.push_back(source_file);
+	return assembly.source_files.size();
+}
+
+// the bytes of one instruction, with a zeroed placeholder where a label's address goes
+struct Encoding {
+	std::vector<unsigned char> bytes;
+	int label_offset = -1;
+	std::string label;
+	bool short_label = false; // 8 bit displacement
+	int label_addend = 0;
+};
+
+bool fits_int8(long long value) {
+	return value >= -128 && value <= 127;
+}
+
+bool fits_int32(long long value) {
+	return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+bool is_local_label(const std::string& label) {
+	return label.length() > 0 && label[0] == '.';
+}
+
+int register_number(Register reg) {
+	if (is_xmm(reg)) return (int)reg - (int)Register::XMM0;
+	return (int)reg;
+}
+
+int condition_code(Condition condition) {
+	switch (condition)
+	{
+	case Condition::B: return 0x2;
+	case Condition::AE: return 0x3;
+	case Condition::E: return 0x4;
+	case Condition::NE: return 0x5;
+	case Condition::BE: return 0x6;
+	case Condition::A: return 0x7;
+	case Condition::P: return 0xA;
+	case Condition::NP: return 0xB;
+	case Condition::L: return 0xC;
+	case Condition::GE: return 0xD;
+	case Condition::LE: return 0xE;
+	case Condition::G: return 0xF;
+	default: throw std::runtime_error("no condition code to encode");
+	}
+}
+
+void push_bytes(Encoding& encoding, long long value, int count) {
+	for (int i = 0; i < count; i++) {
+		encoding.bytes.push_back((unsigned char)((value >> (i * 8)) & 0xff));
+	}
+}
+
+void push_label(Encoding& encoding, const std::string& label, bool short_label = false) {
+	encoding.label = label;
+	encoding.label_offset = encoding.bytes.size();
+	encoding.short_label = short_label;
+	push_bytes(encoding, 0, short_label ? 1 : 4);
+}
+
+// spl, bpl, sil and dil only exist with a rex prefix, without one the same numbers mean ah, ch, dh and bh
+bool needs_byte_rex(int reg, int size) {
+	return size == 1 && reg >= 4 && reg <= 7;
+}
+
+int base_number(const Operand& rm) {
+	return rm.is_register() || (rm.is_memory() && rm.label.length() == 0) ? register_number(rm.reg) : 0;
+}
+
+int index_number(const Operand& rm) {
+	return rm.is_memory() && rm.index != Register::NONE ? register_number(rm.index) : 4; // 4 in the sib index means none
+}
+
+// the r, x and b bits of a rex prefix, the high bits of the three register numbers
+int rex_bits(int reg, const Operand& rm) {
+	return ((reg & 8) ? 0x4 : 0) | ((index_number(rm) & 8) ? 0x2 : 0) | ((base_number(rm) & 8) ? 0x1 : 0);
+}
+
+// the modrm byte and whatever addresses memory after it
+void encode_modrm(Encoding& encoding, int reg, const Operand& rm) {
+	int base = base_number(rm);
+	bool indexed = rm.is_memory() && rm.index != Register::NONE;
+	int index = index_number(rm);
+	int reg_bits = (reg & 7) << 3;
+	if (rm.is_register()) {
+		encoding.bytes.push_back(0xC0 | reg_bits | (base & 7));
+		return;
+	}
+	if (!rm.is_memory()) {
+		throw std::runtime_error("expected a register or memory operand");
+	}
+	if (rm.label.length() > 0) {
+		// rip relative
+		encoding.bytes.push_back(0x05 | reg_bits);
+		push_label(encoding, rm.label);
+		encoding.label_addend = (int)rm.value;
+		return;
+	}
+
+	// rbp and r13 can't be encoded without a displacement, rsp and r12 need a sib byte
+	int mod = 2;
+	if (rm.value == 0 && (base & 7) != 5) mod = 0;
+	else if (fits_int8(rm.value)) mod = 1;
+	if (indexed || (base & 7) == 4) {
+		int scale_bits = rm.scale == 8 ? 3 : rm.scale == 4 ? 2 : rm.scale == 2 ? 1 : 0;
+		encoding.bytes.push_back((mod << 6) | reg_bits | 4);
+		encoding.bytes.push_back((scale_bits << 6) | ((index & 7) << 3) | (base & 7));
+	}
+	else {
+		encoding.bytes.push_back((mod << 6) | reg_bits | (base & 7));
+	}
+	if (mod == 1) push_bytes(encoding, rm.value, 1);
+	if (mod == 2) push_bytes(encoding, rm.value, 4);
+}
+
+// opcode with a modrm byte, reg is either a register number or the opcode extension
+void encode_rm(Encoding& encoding, std::vector<unsigned char> opcode, int reg, const Operand& rm, int size, bool reg_is_register = false) {
+	if (size == 2) encoding.bytes.push_back(0x66);
+
+	unsigned char rex = 0x40 | rex_bits(reg, rm);
+	if (size == 8) rex |= 0x8;
+	bool force_rex = (rm.is_register() && needs_byte_rex(base_number(rm), rm.size)) || (reg_is_register && needs_byte_rex(reg, size));
+	if (rex != 0x40 || force_rex) encoding.bytes.push_back(rex);
+
+	for (unsigned char byte : opcode) encoding.bytes.push_back(byte);
+	encode_modrm(encoding, reg, rm);
+}
+
+// the three byte vex prefix stands in for the sse prefix (pp: none, 66, f3, f2), the escape bytes (map: 0f,
+// 0f38, 0f3a) and rex. source is the extra register operand, long_vector picks ymm
+void encode_vex(Encoding& encoding, int pp, int map, unsigned char opcode, int reg, int source, const Operand& rm, bool long_vector, bool wide = false) {
+	encoding.bytes.push_back(0xC4);
+	encoding.bytes.push_back((unsigned char)(((~rex_bits(reg, rm) & 7) << 5) | map));
+	encoding.bytes.push_back((unsigned char)((wide ? 0x80 : 0) | ((~source & 15) << 3) | (long_vector ? 4 : 0) | pp));
+	encoding.bytes.push_back(opcode);
+	encode_modrm(encoding, reg, rm);
+}
+
+// packed sse, as the avx2 form when the registers are ymm ones. escape is 0x38 for the 0f38 map and 0x3a for 0f3a
+void encode_packed(Encoding& encoding, unsigned char prefix, unsigned char opcode, const Operand& reg, const Operand& rm, unsigned char escape = 0, bool reads_destination = true) {
+	if (reg.size == 32 || rm.size == 32) {
+		int pp = prefix == 0x66 ? 1 : prefix == 0xF3 ? 2 : prefix == 0xF2 ? 3 : 0;
+		encode_vex(encoding, pp, escape == 0x38 ? 2 : escape == 0x3A ? 3 : 1, opcode, register_number(reg.reg), reads_destination ? register_number(reg.reg) : 0, rm, true);
+		return;
+	}
+	if (prefix) encoding.bytes.push_back(prefix);
+	if (escape) encode_rm(encoding, { 0x0F, escape, opcode }, register_number(reg.reg), rm, 4);
+	else encode_rm(encoding, { 0x0F, opcode }, register_number(reg.reg), rm, 4);
+}
+
+// sse instructions put their mandatory prefix before the rex byte, wide sets rex.w for 64 bit integer operands
+void encode_sse(Encoding& encoding, unsigned char prefix, unsigned char opcode, int reg, const Operand& rm, bool wide = false) {
+	if (prefix) encoding.bytes.push_back(prefix);
+	encode_rm(encoding, { 0x0F, opcode }, reg, rm, wide ? 8 : 4);
+}
+
+unsigned char scalar_prefix(int size) {
+	return size == 4 ? 0xF3 : 0xF2;
+}
+
+// add, or, and, sub, xor and cmp share encodings, told apart by the extension
+void encode_arithmetic(Encoding& encoding, int extension, const Operand& a, const Operand& b) {
+	int size = a.size;
+	unsigned char base = extension << 3;
+	if (b.is_immediate()) {
+		if (size == 1) {
+			encode_rm(encoding, { 0x80 }, extension, a, size);
+			push_bytes(encoding, b.value, 1);
+		}
+		else if (fits_int8(b.value)) {
+			encode_rm(encoding, { 0x83 }, extension, a, size);
+			push_bytes(encoding, b.value, 1);
+		}
+		else {
+			encode_rm(encoding, { 0x81 }, extension, a, size);
+			push_bytes(encoding, b.value, size == 2 ? 2 : 4);
+		}
+	}
+	else if (b.is_register()) {
+		encode_rm(encoding, { (unsigned char)(base + (size == 1 ? 0 : 1)) }, register_number(b.reg), a, size, true);
+	}
+	else if (a.is_register() && b.is_memory()) {
+		encode_rm(encoding, { (unsigned char)(base + (size == 1 ? 2 : 3)) }, register_number(a.reg), b, size, true);
+	}
+	else {
+		throw std::runtime_error("can't encode memory to memory arithmetic");
+	}
+}
+
+void encode_mov(Encoding& encoding, const Operand& a, const Operand& b) {
+	int size = a.size;
+	if (a.is_register() && b.is_immediate()) {
+		int reg = register_number(a.reg);
+		if (size == 8 && fits_int32(b.value) && b.value < 0) {
+			encode_rm(encoding, { 0xC7 }, 0, a, size);
+			push_bytes(encoding, b.value, 4);
+			return;
+		}
+		if (size == 8 && b.value >= 0 && b.value <= UINT32_MAX) {
+			size = 4; // writing the low half zeroes the top
+		}
+		if (size == 2) encoding.bytes.push_back(0x66);
+		if (size == 8 || reg >= 8 || needs_byte_rex(reg, size)) {
+			encoding.bytes.push_back(0x40 | (size == 8 ? 0x8 : 0) | (reg >= 8 ? 0x1 : 0));
+		}
+		encoding.bytes.push_back((size == 1 ? 0xB0 : 0xB8) + (reg & 7));
+		push_bytes(encoding, b.value, size);
+		return;
+	}
+	if (a.is_memory() && b.is_immediate()) {
+		encode_rm(encoding, { (unsigned char)(size == 1 ? 0xC6 : 0xC7) }, 0, a, size);
+		push_bytes(encoding, b.value, size == 8 ? 4 : size);
+		return;
+	}
+	if (b.is_register()) {
+		encode_rm(encoding, { (unsigned char)(size == 1 ? 0x88 : 0x89) }, register_number(b.reg), a, size, true);
+		return;
+	}
+	if (a.is_register() && b.is_memory()) {
+		encode_rm(encoding, { (unsigned char)(size == 1 ? 0x8A : 0x8B) }, register_number(a.reg), b, size, true);
+		return;
+	}
+	throw std::runtime_error("can't encode memory to memory move");
+}
+
+// the recommended multi byte nops, each decodes as a single instruction
+void push_nops(Encoding& encoding, int count) {
+	static const std::vector<std::vector<unsigned char>> nops = {
+		{ 0x90 },
+		{ 0x66, 0x90 },
+		{ 0x0F, 0x1F, 0x00 },
+		{ 0x0F, 0x1F, 0x40, 0x00 },
+		{ 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+		{ 0x66, 0x0F, 0x1F, 0x44, 0x00, 0x00 },
+		{ 0x0F, 0x1F, 0x80, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 },
+		{ 0x66, 0x0F, 0x1F, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00 }
+	};
+	while (count > 0) {
+		int length = std::min(count, (int)nops.size());
+		encoding.bytes.insert(encoding.bytes.end(), nops[length - 1].begin(), nops[length - 1].end());
+		count -= length;
+	}
+}
+
+int label_padding(const Instruction& label, int address) {
+	if (label.operands.size() == 0) return 0;
+	int alignment = label.operands[0].value;
+	int padding = (alignment - address % alignment) % alignment;
+	return padding <= label.operands[1].value ? padding : 0;
+}
+
+// short selects the 8 bit displacement form of jumps
+Encoding encode_instruction(const Instruction& instruction, bool short_jump) {
+	Encoding encoding;
+	const std::vector<Operand>& operands = instruction.operands;
+
+	switch (instruction.opcode)
+	{
+	case Opcode::MOV:
+		encode_mov(encoding, operands[0], operands[1]);
+		break;
+	case Opcode::MOVZX:
+	case Opcode::MOVSX:
+	{
+		int source_size = operands[1].size;
+		if (instruction.opcode == Opcode::MOVSX && source_size == 4) {
+			encode_rm(encoding, { 0x63 }, register_number(operands[0].reg), operands[1], operands[0].size);
+			break;
+		}
+		unsigned char opcode = instruction.opcode == Opcode::MOVZX ? 0xB6 : 0xBE;
+		if (source_size == 2) opcode++;
+		encode_rm(encoding, { 0x0F, opcode }, register_number(operands[0].reg), operands[1], operands[0].size);
+		break;
+	}
+	case Opcode::LEA:
+		encode_rm(encoding, { 0x8D }, register_number(operands[0].reg), operands[1], operands[0].size);
+		break;
+	case Opcode::ADD:
+		encode_arithmetic(encoding, 0, operands[0], operands[1]);
+		break;
+	case Opcode::SUB:
+		encode_arithmetic(encoding, 5, operands[0], operands[1]);
+		break;
+	case Opcode::XOR:
+		encode_arithmetic(encoding, 6, operands[0], operands[1]);
+		break;
+	case Opcode::AND:
+		encode_arithmetic(encoding, 4, operands[0], operands[1]);
+		break;
+	case Opcode::SHL:
+	case Opcode::SHR:
+	case Opcode::SAR:
+	{
+		// shifts by a constant only
+		int extension = instruction.opcode == Opcode::SHL ? 4 : instruction.opcode == Opcode::SHR ? 5 : 7;
+		bool byte = operands[0].size == 1;
+		if (operands[1].value == 1) {
+			encode_rm(encoding, { (unsigned char)(byte ? 0xD0 : 0xD1) }, extension, operands[0], operands[0].size);
+		}
+		else {
+			encode_rm(encoding, { (unsigned char)(byte ? 0xC0 : 0xC1) }, extension, operands[0], operands[0].size);
+			push_bytes(encoding, operands[1].value, 1);
+		}
+		break;
+	}
+	case Opcode::CMP:
+		encode_arithmetic(encoding, 7, operands[0], operands[1]);
+		break;
+	case Opcode::TEST:
+		if (operands[1].is_immediate()) {
+			encode_rm(encoding, { (unsigned char)(operands[0].size == 1 ? 0xF6 : 0xF7) }, 0, operands[0], operands[0].size);
+			push_bytes(encoding, operands[1].value, operands[0].size == 1 ? 1 : 4);
+		}
+		else {
+			encode_rm(encoding, { (unsigned char)(operands[0].size == 1 ? 0x84 : 0x85) }, register_number(operands[1].reg), operands[0], operands[0].size, true);
+		}
+		break;
+	case Opcode::IMUL:
+	{
+		if (operands.size() == 1) {
+			// rdx:rax = rax * operand
+			encode_rm(encoding, { 0xF7 }, 5, operands[0], operands[0].size);
+			break;
+		}
+		Operand source = operands.size() == 3 ? operands[1] : operands[0];
+		Operand factor = operands.size() == 3 ? operands[2] : operands[1];
+		if (factor.is_immediate()) {
+			bool small = fits_int8(factor.value);
+			encode_rm(encoding, { (unsigned char)(small ? 0x6B : 0x69) }, register_number(operands[0].reg), source, operands[0].size);
+			push_bytes(encoding, factor.value, small ? 1 : 4);
+		}
+		else {
+			encode_rm(encoding, { 0x0F, 0xAF }, register_number(operands[0].reg), factor, operands[0].size);
+		}
+		break;
+	}
+	case Opcode::NEG:
+		encode_rm(encoding, { (unsigned char)(operands[0].size == 1 ? 0xF6 : 0xF7) }, 3, operands[0], operands[0].size);
+		break;
+	case Opcode::DIV:
+		encode_rm(encoding, { (unsigned char)(operands[0].size == 1 ? 0xF6 : 0xF7) }, 6, operands[0], operands[0].size);
+		break;
+	case Opcode::IDIV:
+		encode_rm(encoding, { (unsigned char)(operands[0].size == 1 ? 0xF6 : 0xF7) }, 7, operands[0], operands[0].size);
+		break;
+	case Opcode::CQO:
+		encoding.bytes.push_back(0x48);
+		encoding.bytes.push_back(0x99);
+		break;
+	case Opcode::SETCC:
+		encode_rm(encoding, { 0x0F, (unsigned char)(0x90 + condition_code(instruction.condition)) }, 0, operands[0], 1);
+		break;
+	case Opcode::JMP:
+	case Opcode::JCC:
+	case Opcode::CALL:
+		if (operands[0].type != Operand::Type::LABEL) {
+			if (instruction.opcode == Opcode::JCC) throw std::runtime_error("conditional jumps need a label");
+			encode_rm(encoding, { 0xFF }, instruction.opcode == Opcode::CALL ? 2 : 4, operands[0], 4);
+			break;
+		}
+		if (instruction.opcode == Opcode::CALL) {
+			encoding.bytes.push_back(0xE8);
+		}
+		else if (instruction.opcode == Opcode::JMP) {
+			encoding.bytes.push_back(short_jump ? 0xEB : 0xE9);
+		}
+		else if (short_jump) {
+			encoding.bytes.push_back(0x70 + condition_code(instruction.condition));
+		}
+		else {
+			encoding.bytes.push_back(0x0F);
+			encoding.bytes.push_back(0x80 + condition_code(instruction.condition));
+		}
+		push_label(encoding, operands[0].label, short_jump && instruction.opcode != Opcode::CALL);
+		break;
+	case Opcode::RET:
+		encoding.bytes.push_back(0xC3);
+		break;
+	case Opcode::LEAVE:
+		encoding.bytes.push_back(0xC9);
+		break;
+	case Opcode::PUSH:
+	case Opcode::POP:
+	{
+		int reg = register_number(operands[0].reg);
+		if (reg >= 8) encoding.bytes.push_back(0x41);
+		encoding.bytes.push_back((instruction.opcode == Opcode::PUSH ? 0x50 : 0x58) + (reg & 7));
+		break;
+	}
+	case Opcode::SYSCALL:
+		encoding.bytes.push_back(0x0F);
+		encoding.bytes.push_back(0x05);
+		break;
+	case Opcode::MOVSD:
+		if (operands[0].is_register()) {
+			encode_sse(encoding, scalar_prefix(operands[0].size), 0x10, register_number(operands[0].reg), operands[1]);
+		}
+		else {
+			encode_sse(encoding, scalar_prefix(operands[1].size), 0x11, register_number(operands[1].reg), operands[0]);
+		}
+		break;
+	case Opcode::ADDSD:
+	case Opcode::SUBSD:
+	case Opcode::MULSD:
+	case Opcode::DIVSD:
+	{
+		unsigned char opcode = instruction.opcode == Opcode::ADDSD ? 0x58 : instruction.opcode == Opcode::MULSD ? 0x59 : instruction.opcode == Opcode::SUBSD ? 0x5C : 0x5E;
+		encode_sse(encoding, scalar_prefix(operands[0].size), opcode, register_number(operands[0].reg), operands[1]);
+		break;
+	}
+	case Opcode::COMISD:
+		encode_sse(encoding, operands[0].size == 4 ? 0 : 0x66, 0x2F, register_number(operands[0].reg), operands[1]);
+		break;
+	case Opcode::CVTSI2SD:
+		encode_sse(encoding, scalar_prefix(operands[0].size), 0x2A, register_number(operands[0].reg), operands[1], operands[1].size == 8);
+		break;
+	case Opcode::CVTTSD2SI:
+		encode_sse(encoding, scalar_prefix(operands[1].size), 0x2C, register_number(operands[0].reg), operands[1], operands[0].size == 8);
+		break;
+	case Opcode::CVTSS2SD:
+		encode_sse(encoding, 0xF3, 0x5A, register_number(operands[0].reg), operands[1]);
+		break;
+	case Opcode::CVTSD2SS:
+		encode_sse(encoding, 0xF2, 0x5A, register_number(operands[0].reg), operands[1]);
+		break;
+	case Opcode::XORPS:
+		encode_sse(encoding, 0, 0x57, register_number(operands[0].reg), operands[1]);
+		break;
+	case Opcode::MOVAPS:
+		encode_sse(encoding, 0, 0x28, register_number(operands[0].reg), operands[1]);
+		break;
+	case Opcode::MOVQ:
+		if (is_xmm(operands[0].reg)) {
+			encode_sse(encoding, 0x66, 0x6E, register_number(operands[0].reg), operands[1], operands[1].size == 8);
+		}
+		else {
+			encode_sse(encoding, 0x66, 0x7E, register_number(operands[1].reg), operands[0], operands[0].size == 8);
+		}
+		break;
+	case Opcode::PINSRD:
+		encode_packed(encoding, 0x66, 0x22, operands[0], operands[1], 0x3A);
+		push_bytes(encoding, operands[2].value, 1);
+		break;
+	case Opcode::MOVUPS:
+		if (operands[0].is_register()) {
+			encode_packed(encoding, 0, 0x10, operands[0], operands[1], 0, false);
+		}
+		else {
+			encode_packed(encoding, 0, 0x11, operands[1], operands[0], 0, false);
+		}
+		break;
+	case Opcode::ADDPS: encode_packed(encoding, 0, 0x58, operands[0], operands[1]); break;
+	case Opcode::SUBPS: encode_packed(encoding, 0, 0x5C, operands[0], operands[1]); break;
+	case Opcode::MULPS: encode_packed(encoding, 0, 0x59, operands[0], operands[1]); break;
+	case Opcode::DIVPS: encode_packed(encoding, 0, 0x5E, operands[0], operands[1]); break;
+	case Opcode::ADDPD: encode_packed(encoding, 0x66, 0x58, operands[0], operands[1]); break;
+	case Opcode::SUBPD: encode_packed(encoding, 0x66, 0x5C, operands[0], operands[1]); break;
+	case Opcode::MULPD: encode_packed(encoding, 0x66, 0x59, operands[0], operands[1]); break;
+	case Opcode::DIVPD: encode_packed(encoding, 0x66, 0x5E, operands[0], operands[1]); break;
+	case Opcode::PADDD: encode_packed(encoding, 0x66, 0xFE, operands[0], operands[1]); break;
+	case Opcode::PADDQ: encode_packed(encoding, 0x66, 0xD4, operands[0], operands[1]); break;
+	case Opcode::PSUBD: encode_packed(encoding, 0x66, 0xFA, operands[0], operands[1]); break;
+	case Opcode::PSUBQ: encode_packed(encoding, 0x66, 0xFB, operands[0], operands[1]); break;
+	case Opcode::PMULLD: encode_packed(encoding, 0x66, 0x40, operands[0], operands[1], 0x38); break;
+	case Opcode::PMINSD: encode_packed(encoding, 0x66, 0x39, operands[0], operands[1], 0x38); break;
+	case Opcode::PMAXSD: encode_packed(encoding, 0x66, 0x3D, operands[0], operands[1], 0x38); break;
+	case Opcode::MINPS: encode_packed(encoding, 0, 0x5D, operands[0], operands[1]); break;
+	case Opcode::MAXPS: encode_packed(encoding, 0, 0x5F, operands[0], operands[1]); break;
+	case Opcode::PCMPEQD: encode_packed(encoding, 0x66, 0x76, operands[0], operands[1]); break;
+	case Opcode::PCMPGTD: encode_packed(encoding, 0x66, 0x66, operands[0], operands[1]); break;
+	case Opcode::CMPPS:
+		encode_packed(encoding, 0, 0xC2, operands[0], operands[1]);
+		push_bytes(encoding, operands[2].value, 1);
+		break;
+	case Opcode::PSHUFD:
+		encode_packed(encoding, 0x66, 0x70, operands[0], operands[1], 0, false);
+		push_bytes(encoding, operands[2].value, 1);
+		break;
+	case Opcode::VPBROADCASTD:
+	case Opcode::VPBROADCASTQ:
+		encode_vex(encoding, 1, 2, instruction.opcode == Opcode::VPBROADCASTD ? 0x58 : 0x59, register_number(operands[0].reg), 0, operands[1], operands[0].size == 32);
+		break;
+	case Opcode::VEXTRACTI128:
+		encode_vex(encoding, 1, 3, 0x39, register_number(operands[1].reg), 0, operands[0], true);
+		push_bytes(encoding, operands[2].value, 1);
+		break;
+	case Opcode::VINSERTI128:
+		encode_vex(encoding, 1, 3, 0x38, register_number(operands[0].reg), register_number(operands[0].reg), operands[1], true);
+		push_bytes(encoding, operands[2].value, 1);
+		break;
+	case Opcode::VZEROUPPER:
+		encoding.bytes = { 0xC5, 0xF8, 0x77 };
+		break;
+	default:
+		break; // labels, comments and nops take no space
+	}
+	return encoding;
+}
+
+// jumps start short and are only made long when their target is out of reach. that only ever grows the code,
+// so even with alignment padding moving around this settles after a few rounds. source_file is empty for
+// procedures the compiler wrote itself, their code is put down as having no line
+void assemble_procedure(Assembly& assembly, const std::vector<Instruction>& code, const std::string& source_file = "") {
+	std::vector<bool> long_jump(code.size(), false);
+	std::vector<Encoding> encodings(code.size());
+	std::vector<int> offsets(code.size());
+	std::map<std::string, int> labels;
+	int base = assembly.text.size();
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		labels.clear();
+		int offset = 0;
+		for (int i = 0; i < code.size(); i++) {
+			const Instruction& instruction = code[i];
+			offsets[i] = offset;
+			if (instruction.opcode == Opcode::LABEL) {
+				// the padding goes before the label
+				encodings[i] = Encoding();
+				push_nops(encodings[i], label_padding(instruction, base + offset));
+				offset += encodings[i].bytes.size();
+				labels[instruction.text] = offset;
+				continue;
+			}
+			bool short_jump = instruction.is_jump() && !long_jump[i] && is_local_label(instruction.operands[0].label);
+			encodings[i] = encode_instruction(instruction, short_jump);
+			offset += encodings[i].bytes.size();
+		}
+
+		for (int i = 0; i < code.size(); i++) {
+			if (!encodings[i].short_label) continue;
+			if (labels.count(encodings[i].label) == 0) {
+				throw std::runtime_error("jump to unknown label " + encodings[i].label);
+			}
+			int distance = labels[encodings[i].label] - (offsets[i] + (int)encodings[i].bytes.size());
+			if (!fits_int8(distance)) {
+				long_jump[i] = true;
+				changed = true;
+			}
+		}
+	}
+
+	std::string procedure_name;
+	int file = source_file_index(assembly, source_file);
+	int first_line = 0;
+	for (int i = 0; i < code.size(); i++) {
+		Encoding& encoding = encodings[i];
+		// instructions with no line of their own carry on the one before
+		int line = file == 0 ? 0 : code[i].line;
+		bool same_line = assembly.source_lines.size() > 0 && assembly.source_lines.back().file == file && assembly.source_lines.back().line == line;
+		if (encoding.bytes.size() > 0 && (line > 0 || file == 0) && !same_line) {
+			assembly.source_lines.push_back(SourceLine{ base + offsets[i], file, line });
+		}
+		if (first_line == 0) first_line = line;
+		if (code[i].opcode == Opcode::LABEL && !is_local_label(code[i].text)) {
+			assembly.symbols[code[i].text] = base + labels[code[i].text];
+			if (procedure_name.length() == 0) {
+				procedure_name = code[i].text;
+				assembly.symbol_order.push_back(procedure_name);
+			}
+		}
+		if (encoding.label_offset >= 0) {
+			int end = offsets[i] + encoding.bytes.size();
+			if (is_local_label(encoding.label)) {
+				if (labels.count(encoding.label) == 0) {
+					throw std::runtime_error("reference to unknown label " + encoding.label);
+				}
+				int distance = labels[encoding.label] + encoding.label_addend - end;
+				for (int b = 0; b < (encoding.short_label ? 1 : 4); b++) {
+					encoding.bytes[encoding.label_offset + b] = (unsigned char)((distance >> (b * 8)) & 0xff);
+				}
+			}
+			else {
+				assembly.relocations.push_back(Relocation{ base + offsets[i] + encoding.label_offset, base + end, encoding.label, encoding.label_addend });
+			}
+		}
+		assembly.text.insert(assembly.text.end(), encoding.bytes.begin(), encoding.bytes.end());
+	}
+	if (procedure_name.length() > 0) {
+		assembly.symbol_sizes[procedure_name] = assembly.text.size() - assembly.symbols[procedure_name];
+		if (file > 0) assembly.symbol_sources[procedure_name] = SourceLine{ assembly.symbols[procedure_name], file, first_line };
+	}
+}
+
+void patch_int32(std::vector<unsigned char>& bytes, int offset, long long value) {
+	for (int b = 0; b < 4; b++) {
+		bytes[offset + b] = (unsigned char)((value >> (b * 8)) & 0xff);
+	}
+}
+
+// little endian
+void write_bytes(std::vector<unsigned char>& out, unsigned long long value, int count) {
+	for (int i = 0; i < count; i++) {
+		out.push_back((unsigned char)((value >> (i * 8)) & 0xff));
+	}
+}
+
+// fills in calls and jumps between procedures, returns the relocations that point elsewhere
+std::vector<Relocation> resolve_procedure_relocations(Assembly& assembly) {
+	std::vector<Relocation> unresolved;
+	for (Relocation& relocation : assembly.relocations) {
+		if (assembly.symbols.count(relocation.symbol) == 0) {
+			unresolved.push_back(relocation);
+			continue;
+		}
+		patch_int32(assembly.text, relocation.offset, assembly.symbols[relocation.symbol] + relocation.addend - relocation.instruction_end);
+	}
+	return unresolved;
+}
@@ -0,0 +1,414 @@
+#pragma once
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+#include "Parsing.h"
+#include "Utils.h"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// COMPILATION CACHE
+// two things are kept on disk between runs, keyed by hashes of what they were made from. each top level
+// declaration's flattened tree, keyed by its text, saves tokenizing and parsing it. a procedure's generated code,
+// keyed by its tree after every optimization, the signatures of what it calls and the target, saves generating
+// it. the second key is taken after the whole program passes have run, so an edit that changes what gets folded
+// or hoisted into a procedure from another module still misses. bump cache_version whenever either format or
+// the code generator changes. a watching compiler also keeps every entry in memory, so a rebuild doesn't go to
+// the disk or decode anything for the declarations and procedures an edit didn't touch
+
+const int cache_version = 13;
+
+std::string cache_directory; // empty when nothing is kept on disk
+bool cache_in_memory = false; // also keep what was read or made, as trees and instructions rather than text
+
+void open_cache(const std::string& directory) {
+#ifdef _WIN32
+	_mkdir(directory.c_str());
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+	cache_directory = directory;
+}
+
+std::string cache_path(unsigned long long key, const std::string& extension) {
+	return string_format("%s/%016llx.%s", cache_directory.c_str(), key, extension.c_str());
+}
+
+bool cache_enabled() {
+	return cache_in_memory || cache_directory.length() > 0;
+}
+
+// everything is written as whitespace separated words, strings with their length in front so they can hold anything
+void write_text(std::ostream& out, const std::string& text) {
+	out << text.length() << ":" << text << " ";
+}
+
+std::string read_text(std::istream& in) {
+	int length = 0;
+	char colon = 0;
+	in >> length >> colon;
+	std::string text(length > 0 ? length : 0, '\0');
+	if (length > 0) in.read(&text[0], length);
+	return text;
+}
+
+bool write_node(std::ostream& out, SyntaxNode* node);
+
+bool write_block(std::ostream& out, Block* block) {
+	out << "block " << block->statements.size() << "\n";
+	for (SyntaxNode* statement : block->statements) {
+		out << statement->line << " ";
+		if (!write_node(out, statement)) return false;
+	}
+	return true;
+}
+
+// returns false for trees that can't be cached, ones with parse errors
+bool write_node(std::ostream& out, SyntaxNode* node) {
+	switch (node->type)
+	{
+	case SyntaxNode::Type::INTEGER_LITERAL:
+		out << "int " << ((IntLiteral*)node)->value << " ";
+		return true;
+	case SyntaxNode::Type::BOOLEAN_LITERAL:
+		out << "bool " << ((BooleanLiteral*)node)->value << " ";
+		return true;
+	case SyntaxNode::Type::FLOAT_LITERAL:
+	{
+		FloatLiteral* float_literal = (FloatLiteral*)node;
+		unsigned long long bits;
+		memcpy(&bits, &float_literal->value, 8);
+		out << "float " << bits << " " << float_literal->size << " ";
+		return true;
+	}
+	case SyntaxNode::Type::STRING_LITERAL:
+		out << "string ";
+		write_text(out, ((StringLiteral*)node)->value);
+		return true;
+	case SyntaxNode::Type::VARIABLE_CALL:
+		out << "variable ";
+		write_text(out, ((VariableCall*)node)->name);
+		return true;
+	case SyntaxNode::Type::BINARY_OPERATOR:
+	{
+		BinaryOperator* binary_operator = (BinaryOperator*)node;
+		out << "operator " << (int)binary_operator->operation << " ";
+		return write_node(out, binary_operator->left) && write_node(out, binary_operator->right);
+	}
+	case SyntaxNode::Type::PROCEDURE_CALL:
+	{
+		ProcedureCall* procedure_call = (ProcedureCall*)node;
+		out << "call ";
+		write_text(out, procedure_call->name);
+		out << procedure_call->inputs.size() << " ";
+		for (SyntaxNode* input : procedure_call->inputs) {
+			if (!write_node(out, input)) return false;
+		}
+		return true;
+	}
+	case SyntaxNode::Type::VARIABLE_DECLERATION:
+		out << "declare ";
+		write_text(out, ((VariableDecleration*)node)->name);
+		write_text(out, ((VariableDecleration*)node)->type_name);
+		out << "\n";
+		return true;
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		out << "assign ";
+		write_text(out, ((VariableAssignment*)node)->name);
+		if (!write_node(out, ((VariableAssignment*)node)->value)) return false;
+		out << "\n";
+		return true;
+	case SyntaxNode::Type::ARRAY_INDEX:
+		out << "element ";
+		write_text(out, ((ArrayIndex*)node)->name);
+		write_text(out, ((ArrayIndex*)node)->field);
+		out << ((ArrayIndex*)node)->checked << " ";
+		return write_node(out, ((ArrayIndex*)node)->index);
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+		out << "store ";
+		write_text(out, ((ElementAssignment*)node)->name);
+		write_text(out, ((ElementAssignment*)node)->field);
+		out << ((ElementAssignment*)node)->checked << " ";
+		if (!write_node(out, ((ElementAssignment*)node)->index) || !write_node(out, ((ElementAssignment*)node)->value)) return false;
+		out << "\n";
+		return true;
+	case SyntaxNode::Type::RETURN_STATEMENT:
+		out << "return ";
+		if (!write_node(out, ((ReturnStatement*)node)->expression)) return false;
+		out << "\n";
+		return true;
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		out << "while ";
+		return write_node(out, ((WhileStatement*)node)->condition) && write_block(out, ((WhileStatement*)node)->body);
+	case SyntaxNode::Type::IF_STATEMENT:
+		out << "if ";
+		return write_node(out, ((IfStatement*)node)->condition) && write_block(out, ((IfStatement*)node)->body);
+	case SyntaxNode::Type::BLOCK:
+		return write_block(out, (Block*)node);
+	case SyntaxNode::Type::PROCEDURE_DECLERATION:
+	{
+		Procedure* procedure = ((ProcedureDecleration*)node)->procedure;
+		out << "procedure ";
+		write_text(out, ((ProcedureDecleration*)node)->name);
+		out << procedure->inputs.size() << " ";
+		for (SyntaxNode* input : procedure->inputs) {
+			if (!write_node(out, input)) return false;
+		}
+		out << procedure->outputs.size() << " ";
+		for (SyntaxNode* output : procedure->outputs) {
+			if (!write_node(out, output)) return false;
+		}
+		return write_block(out, procedure->body);
+	}
+	case SyntaxNode::Type::STRUCT_DECLERATION:
+	{
+		StructDecleration* struct_decl = (StructDecleration*)node;
+		out << "struct ";
+		write_text(out, struct_decl->name);
+		out << struct_decl->soa << " " << struct_decl->fields.size() << " ";
+		for (SyntaxNode* field : struct_decl->fields) {
+			if (!write_node(out, field)) return false;
+		}
+		return true;
+	}
+	case SyntaxNode::Type::IMPORT_STATEMENT:
+		out << "import ";
+		write_text(out, ((ImportStatement*)node)->path);
+		out << "\n";
+		return true;
+	default:
+		return false;
+	}
+}
+
+Block* read_block(std::istream& in);
+
+SyntaxNode* read_node(std::istream& in) {
+	std::string kind;
+	in >> kind;
+	if (kind == "int") {
+		IntLiteral* int_literal = new IntLiteral();
+		in >> int_literal->value;
+		return int_literal;
+	}
+	if (kind == "bool") {
+		BooleanLiteral* boolean_literal = new BooleanLiteral();
+		in >> boolean_literal->value;
+		return boolean_literal;
+	}
+	if (kind == "float") {
+		FloatLiteral* float_literal = new FloatLiteral();
+		unsigned long long bits;
+		in >> bits >> float_literal->size;
+		memcpy(&float_literal->value, &bits, 8);
+		return float_literal;
+	}
+	if (kind == "string") {
+		StringLiteral* string_literal = new StringLiteral();
+		string_literal->value = read_text(in);
+		return string_literal;
+	}
+	if (kind == "variable") {
+		VariableCall* variable_call = new VariableCall();
+		variable_call->name = read_text(in);
+		return variable_call;
+	}
+	if (kind == "operator") {
+		BinaryOperator* binary_operator = new BinaryOperator();
+		int operation;
+		in >> operation;
+		binary_operator->operation = (BinaryOperator::Type)operation;
+		binary_operator->left = read_node(in);
+		binary_operator->right = read_node(in);
+		return binary_operator;
+	}
+	if (kind == "call") {
+		ProcedureCall* procedure_call = new ProcedureCall();
+		procedure_call->name = read_text(in);
+		int inputs = 0;
+		in >> inputs;
+		for (int i = 0; i < inputs; i++) {
+			procedure_call->inputs.push_back(read_node(in));
+		}
+		return procedure_call;
+	}
+	if (kind == "declare") {
+		VariableDecleration* decl = new VariableDecleration();
+		decl->name = read_text(in);
+		decl->type_name = read_text(in);
+		return decl;
+	}
+	if (kind == "assign") {
+		VariableAssignment* assignment = new VariableAssignment();
+		assignment->name = read_text(in);
+		assignment->value = read_node(in);
+		return assignment;
+	}
+	if (kind == "element") {
+		ArrayIndex* array_index = new ArrayIndex();
+		array_index->name = read_text(in);
+		array_index->field = read_text(in);
+		in >> array_index->checked;
+		array_index->index = read_node(in);
+		return array_index;
+	}
+	if (kind == "store") {
+		ElementAssignment* element_assignment = new ElementAssignment();
+		element_assignment->name = read_text(in);
+		element_assignment->field = read_text(in);
+		in >> element_assignment->checked;
+		element_assignment->index = read_node(in);
+		element_assignment->value = read_node(in);
+		return element_assignment;
+	}
+	if (kind == "return") {
+		ReturnStatement* return_statement = new ReturnStatement();
+		return_statement->expression = read_node(in);
+		return return_statement;
+	}
+	if (kind == "while") {
+		WhileStatement* while_statement = new WhileStatement();
+		while_statement->condition = read_node(in);
+		while_statement->body = read_block(in);
+		return while_statement;
+	}
+	if (kind == "if") {
+		IfStatement* if_statement = new IfStatement();
+		if_statement->condition = read_node(in);
+		if_statement->body = read_block(in);
+		return if_statement;
+	}
+	if (kind == "block") {
+		Block* block = new Block();
+		int statements = 0;
+		in >> statements;
+		for (int i = 0; i < statements; i++) {
+			int line = 0;
+			in >> line;
+			SyntaxNode* statement = read_node(in);
+			statement->line = line;
+			block->statements.push_back(statement);
+		}
+		return block;
+	}
+	if (kind == "procedure") {
+		ProcedureDecleration* procedure_decl = new ProcedureDecleration();
+		procedure_decl->name = read_text(in);
+		procedure_decl->procedure = new Procedure();
+		int count = 0;
+		in >> count;
+		for (int i = 0; i < count; i++) {
+			procedure_decl->procedure->inputs.push_back(read_node(in));
+		}
+		in >> count;
+		for (int i = 0; i < count; i++) {
+			procedure_decl->procedure->outputs.push_back(read_node(in));
+		}
+		procedure_decl->procedure->body = read_block(in);
+		return procedure_decl;
+	}
+	if (kind == "struct") {
+		StructDecleration* struct_decl = new StructDecleration();
+		struct_decl->name = read_text(in);
+		int count = 0;
+		in >> struct_decl->soa >> count;
+		for (int i = 0; i < count; i++) {
+			struct_decl->fields.push_back(read_node(in));
+		}
+		return struct_decl;
+	}
+	if (kind == "import") {
+		ImportStatement* import_statement = new ImportStatement();
+		import_statement->path = read_text(in);
+		return import_statement;
+	}
+	throw std::runtime_error("corrupt cache entry");
+}
+
+Block* read_block(std::istream& in) {
+	SyntaxNode* node = read_node(in);
+	if (node->type != SyntaxNode::Type::BLOCK) throw std::runtime_error("corrupt cache entry");
+	return (Block*)node;
+}
+
+unsigned long long declaration_cache_key(const std::string& text) {
+	return hash_text(string_format("declaration %d\n", cache_version) + text);
+}
+
+// the flattened statements of a declaration with this text, or nullptr
+Block* load_cached_declaration(const std::string& text) {
+	if (cache_directory.length() == 0) return nullptr;
+	std::ifstream in(cache_path(declaration_cache_key(text), "declaration"), std::ios::binary);
+	if (!in) return nullptr;
+	try {
+		return read_block(in);
+	}
+	catch (std::exception&) {
+		return nullptr;
+	}
+}
+
+void store_cached_declaration(const std::string& text, Block* declaration) {
+	if (cache_directory.length() == 0) return;
+	std::ostringstream out;
+	if (!write_block(out, declaration)) return;
+	std::ofstream file(cache_path(declaration_cache_key(text), "declaration"), std::ios::binary);
+	file << out.str();
+}
+
+void write_operand(std::ostream& out, const Operand& operand) {
+	out << (int)operand.type << " " << (int)operand.reg << " " << operand.value << " " << operand.size << " " << (int)operand.index << " " << operand.scale << " ";
+	write_text(out, operand.label);
+}
+
+Operand read_operand(std::istream& in) {
+	Operand operand;
+	int type, reg, index;
+	in >> type >> reg >> operand.value >> operand.size >> index >> operand.scale;
+	operand.type = (Operand::Type)type;
+	operand.reg = (Register)reg;
+	operand.index = (Register)index;
+	operand.label = read_text(in);
+	return operand;
+}
+
+void write_instructions(std::ostream& out, const std::vector<Instruction>& code) {
+	out << code.size() << "\n";
+	for (const Instruction& instruction : code) {
+		out << (int)instruction.opcode << " " << (int)instruction.condition << " " << instruction.line << " ";
+		write_text(out, instruction.text);
+		out << instruction.operands.size() << " ";
+		for (const Operand& operand : instruction.operands) {
+			write_operand(out, operand);
+		}
+		out << "\n";
+	}
+}
+
+std::vector<Instruction> read_instructions(std::istream& in) {
+	std::vector<Instruction> code;
+	int count = 0;
+	in >> count;
+	for (int i = 0; i < count && in; i++) {
+		Instruction instruction;
+		int opcode, condition, operands;
+		in >> opcode >> condition >> instruction.line;
+		instruction.opcode = (Opcode)opcode;
+		instruction.condition = (Condition)condition;
+		instruction.text = read_text(in);
+		in >> operands;
+		for (int j = 0; j < operands; j++) {
+			instruction.operands.push_back(read_operand(in));
+		}
+		code.push_back(instruction);
+	}
+	if (!in) throw std::runtime_error("corrupt cache entry");
+	return code;
+}
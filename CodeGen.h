@@ -1,306 +1,2286 @@
 #pragma once
 #include <fstream>
 #include <functional>
+#include <set>
+#include "Allocator.h"
+#include "Assembler.h"
+#include "Cache.h"
+#include "Elf.h"
+#include "Frame.h"
+#include "Instructions.h"
 #include "Parsing.h"
+#include "Peephole.h"
+#include "Profile.h"
+#include "RegisterAllocator.h"
+#include "Runtime.h"
+#include "Selection.h"
+#include "Stats.h"
+#include "Target.h"
+#include "Types.h"
 #include "Utils.h"
-#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <thread>
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
 typedef std::function<void(std::ofstream&)> writer;
 
+struct CompileOptions {
+	bool run = false;
+	bool object = false; // linux: write a relocatable object and link it with the system compiler
+	bool listing = false; // linux: also write the nasm listing
+	int threads = 0; // procedures generated at once, 0 is one per core
+	bool profile_generate = false; // count blocks, branches and calls and write them out when main returns
+	bool optimize = true; // value numbering, hoisting, range analysis, vectorization and the peephole pass, -O0 turns them off
+};
+
+const std::string bounds_message = "index out of range";
+bool uses_bounds_error = false; // some procedure checks an index
+
 void program_header(std::ofstream& out) {
 	out <<
 		"bits 64\n"
 		"default rel\n"
 		"segment .text\n"
-		"global main\n"
-		"extern ExitProcess\n"
-		"extern printf\n"
-		"extern _CRT_INIT\n";
+		"global main\n";
+	if (target.platform == Platform::WINDOWS) {
+		out <<
+			"extern ExitProcess\n"
+			"extern printf\n"
+			"extern _CRT_INIT\n";
+		if (uses_bounds_error) {
+			out << "extern exit\n";
+		}
+		if (uses_fflush) {
+			out << "extern fflush\n";
+		}
+		if (uses_allocators) {
+			out <<
+				"extern VirtualAlloc\n"
+				"extern VirtualFree\n";
+		}
+		if (profile_instrument) {
+			out <<
+				"extern fopen\n"
+				"extern fwrite\n"
+				"extern fclose\n";
+		}
+	}
+}
+
+// the operands of a db, printable runs quoted and anything else as numbers, each followed by a comma
+std::string data_bytes(const std::string& text) {
+	std::string bytes;
+	bool quoted = false;
+	for (char c : text) {
+		bool printable = c >= ' ' && c != '"' && c != 0x7f;
+		if (printable && !quoted) bytes += '"';
+		if (!printable && quoted) bytes += "\", ";
+		quoted = printable;
+		if (printable) bytes += c;
+		else bytes += string_format("0x%x, ", (unsigned char)c);
+	}
+	if (quoted) bytes += "\", ";
+	return bytes;
+}
+
+std::string newline_bytes() {
+	std::string bytes;
+	for (char c : target.newline) {
+		bytes += string_format(", 0x%x", c);
+	}
+	return bytes;
+}
+
+// float and double literals live in read only data, each distinct value once
+struct FloatConstant {
+	std::string label;
+	unsigned long long bits;
+	int size;
+};
+
+// everything generating one procedure produces. procedures are generated independently, possibly on different
+// threads, so their literals get unit local labels that are only renamed when the units are merged in order
+struct ProcedureUnit {
+	ProcedureDecleration* procedure_decl;
+	std::vector<Instruction> code;
+	std::vector<std::string> strings; // labelled local_string%d
+	std::vector<FloatConstant> float_constants; // labelled local_float%d
+	int peephole_removed = 0;
+	std::exception_ptr error;
+	unsigned long long cache_key = 0; // 0 when it can't be cached
+	bool from_cache = false;
+};
+
+thread_local ProcedureUnit* current_unit;
+
+int cached_units = 0; // procedures whose code came from the cache
+
+// the whole program's literals after merging, labelled string_id%d and float_id%d
+std::vector<std::string> strings;
+std::vector<FloatConstant> float_constants;
+
+Operand float_constant_operand(double value, int size) {
+	unsigned long long bits = 0;
+	if (size == 4) {
+		float single = (float)value;
+		unsigned int single_bits;
+		memcpy(&single_bits, &single, 4);
+		bits = single_bits;
+	}
+	else {
+		memcpy(&bits, &value, 8);
+	}
+	std::vector<FloatConstant>& constants = current_unit->float_constants;
+	for (FloatConstant& constant : constants) {
+		if (constant.bits == bits && constant.size == size) return label_memory_operand(constant.label, size);
+	}
+	FloatConstant constant{ string_format("local_float%d", (int)constants.size()), bits, size };
+	constants.push_back(constant);
+	return label_memory_operand(constant.label, size);
+}
+
+std::string static_array_label(const std::string& name) {
+	return "array_" + name;
 }
 
-std::vector<StringLiteral*> strings;
 void data_segment(std::ofstream& out) {
 	out <<
 		"segment .data\n";
-	out << "msg" << " db \"%d\", 0xd, 0xa, 0\n";
+	out << "msg" << " db \"%d\"" << newline_bytes() << ", 0\n";
+
+	for (int i = 0; i < strings.size(); i++) {
+		out << "string_id" << i << " db " << data_bytes(strings[i]) << "0\n";
+	}
+
+	if (profile_instrument) {
+		out << "profile_path db \"" << profile_file << "\", 0\n";
+		out << "profile_mode db \"wb\", 0\n";
+		out << "align 8\n";
+		out << "profile_counts dq " << profile_counter_count << string_format(", 0x%llx\n", profile_signature);
+		for (int i = 0; i < profile_counter_count; i++) {
+			out << profile_counter_label(i) << " dq 0\n";
+		}
+	}
+
+	if (uses_bounds_error) {
+		out << "bounds_message db \"" << bounds_message << "\"" << newline_bytes() << ", 0\n";
+	}
+
+	if (float_constants.size() > 0) {
+		out << (target.platform == Platform::WINDOWS ? "segment .rdata\n" : "segment .rodata\n");
+		for (FloatConstant& constant : float_constants) {
+			out << constant.label << (constant.size == 4 ? " dd " : " dq ") << string_format("0x%llx", constant.bits) << "\n";
+		}
+	}
+
+	if (static_arrays.size() > 0 || uses_allocator_cache || uses_output_buffer) {
+		out << "segment .bss\n";
+		for (auto& array : static_arrays) {
+			out << "alignb 32\n" << static_array_label(array.first) << " resb " << array_bytes(array.second) << "\n";
+		}
+		if (uses_allocator_cache) {
+			out << "alignb 8\n" << allocator_cache_label << " resq " << cached_size_limit / 16 << "\n";
+		}
+		if (uses_output_buffer) {
+			out << "alignb 16\n" << output_buffer_label << " resb " << output_buffer_size << "\n";
+			out << "alignb 8\n" << output_length_label << " resq 1\n" << output_registered_label << " resq 1\n";
+		}
+	}
+}
 
+// the same strings as data_segment, for the built in assembler
+DataSection build_data_section() {
+	DataSection data;
 	for (int i = 0; i < strings.size(); i++) {
-		out << "string_id" << i << " db \"" << strings[i]->value << "\", 0xd, 0xa, 0\n";
+		add_data(data, string_format("string_id%d", i), strings[i] + '\0');
+	}
+	if (profile_instrument) {
+		add_data(data, "profile_path", profile_file + '\0');
+		std::string header(16, '\0');
+		for (int i = 0; i < 8; i++) {
+			header[i] = (char)(((unsigned long long)profile_counter_count >> (i * 8)) & 0xff);
+			header[8 + i] = (char)((profile_signature >> (i * 8)) & 0xff);
+		}
+		add_data(data, "profile_counts", header);
+		for (int i = 0; i < profile_counter_count; i++) {
+			add_data(data, profile_counter_label(i), std::string(8, '\0'));
+		}
+	}
+	if (uses_bounds_error) {
+		add_data(data, "bounds_message", bounds_message + target.newline);
 	}
+	// aligned for the vector loops
+	for (auto& array : static_arrays) {
+		add_zeroed(data, static_array_label(array.first), array_bytes(array.second), 32);
+	}
+	if (uses_allocator_cache) {
+		add_zeroed(data, allocator_cache_label, cached_size_limit / 16 * 8, 8);
+	}
+	if (uses_output_buffer) {
+		add_zeroed(data, output_buffer_label, output_buffer_size, 16);
+		add_zeroed(data, output_length_label, 8, 8);
+		add_zeroed(data, output_registered_label, 8, 8);
+	}
+	return data;
 }
 
-void reserve_stack(std::ofstream& out, int bytes) {
-	out << 
-		"push rbp\n"
-		"mov rbp, rsp\n"
-		"sub rsp, " << bytes << "\n";
+DataSection build_constant_section() {
+	DataSection constants;
+	for (FloatConstant& constant : float_constants) {
+		std::string bytes;
+		for (int i = 0; i < constant.size; i++) {
+			bytes += (char)((constant.bits >> (i * 8)) & 0xff);
+		}
+		add_data(constants, constant.label, bytes);
+	}
+	return constants;
 }
 
-const char* registers[] = { "rax", "rbx", "rcx", "rdx", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
-const int num_registers = 12;
+void reserve_stack(std::vector<Instruction>& code, FrameLayout& frame) {
+	if (frame.frame_pointer) {
+		emit(code, Opcode::PUSH, register_operand(Register::RBP));
+		emit(code, Opcode::MOV, register_operand(Register::RBP), register_operand(Register::RSP));
+	}
+	int reserved = frame.reserved;
+	if (target.platform == Platform::WINDOWS && reserved > 4096) {
+		// windows only grows the stack a page at a time through its guard page, so a frame holding big arrays
+		// touches every page on the way down
+		emit(code, Opcode::MOV, rax_operand, immediate_operand(reserved / 4096));
+		emit_label(code, ".stack_probe");
+		emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(4096));
+		emit(code, Opcode::TEST, memory_operand(Register::RSP, 0), rax_operand);
+		emit(code, Opcode::SUB, rax_operand, immediate_operand(1));
+		emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".stack_probe"));
+		reserved %= 4096;
+	}
+	if (reserved > 0) {
+		emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(reserved));
+	}
+}
+
+// every intermediate result goes through the accumulator, floats and doubles through xmm0 which is also where
+// they are returned
+const Operand accumulator_operand = register_operand(Register::RBX);
+const Operand return_operand = register_operand(Register::RAX);
+
+Operand float_accumulator_operand(ValueType type) {
+	return register_operand(Register::XMM0, value_size(type));
+}
+
+// procedures defined in the program, calls to anything else go to the c runtime
+std::set<std::string> declared_procedures;
+
+// linux calls printf and flush through the runtime's buffered output, so the c runtime's printf is never the
+// one linked. what the program declares itself keeps its name
+std::string call_label(const std::string& name) {
+	if (declared_procedures.count(name) > 0) return name;
+	if (name == "flush") return "output_flush";
+	if (name == "printf" && target.platform == Platform::LINUX) return "output_printf";
+	return name;
+}
 
-int calculate_stack_size(Procedure* procedure);
-void declare_expression(std::ofstream& out, SyntaxNode* expression, std::map<std::string, std::string>& scope);
+void declare_expression(std::vector<Instruction>& code, SyntaxNode* expression, std::map<std::string, Operand>& scope);
 
-void declare_procedure_call(std::ofstream& out, ProcedureCall* procedure, std::map<std::string, std::string>& scope) {
-	out << "; procedure "<< procedure->name << " start " << "\n";
+// the procedure currently being generated, tail calls to it jump back to its entry instead of calling
+thread_local std::string current_procedure_name;
+thread_local std::vector<Operand> current_procedure_inputs;
+thread_local RegisterAllocation current_allocation;
+thread_local FrameLayout current_frame;
+thread_local ProcedureTypes* current_types;
+// rbx is callee saved under both conventions, so every procedure gives the accumulator back to its caller.
+// one that never ends up writing it has the push and pops taken out again by drop_unused_accumulator_save
+thread_local bool current_procedure_saves_accumulator = false;
+// it has 32 byte vectors, whose upper halves are cleared before a call or return so sse code in the callee or
+// caller doesn't wait on them
+thread_local bool current_procedure_wide = false;
 
+void save_registers(std::vector<Instruction>& code) {
+	for (int i = 0; i < current_allocation.saved_registers.size(); i++) {
+		emit(code, Opcode::MOV, current_allocation.saved_slots[i], register_operand(current_allocation.saved_registers[i]));
+	}
+}
+
+void restore_registers(std::vector<Instruction>& code) {
+	for (int i = 0; i < current_allocation.saved_registers.size(); i++) {
+		emit(code, Opcode::MOV, register_operand(current_allocation.saved_registers[i]), current_allocation.saved_slots[i]);
+	}
+}
+
+// everything before the ret, or before the jump of a tail call
+void leave_frame(std::vector<Instruction>& code) {
+	if (current_procedure_wide && !(is_vector(current_types->result) && value_size(current_types->result) == 32)) {
+		emit(code, Opcode::VZEROUPPER);
+	}
+	restore_registers(code);
+	if (current_frame.frame_pointer) {
+		emit(code, Opcode::LEAVE);
+	}
+	else if (current_frame.reserved > 0) {
+		emit(code, Opcode::ADD, register_operand(Register::RSP), immediate_operand(current_frame.reserved));
+	}
+	if (current_procedure_saves_accumulator) {
+		emit(code, Opcode::POP, accumulator_operand);
+	}
+	if (profile_instrument && current_procedure_name == "main") {
+		// rsp is back where it was on entry, the push keeps it aligned for the call
+		emit(code, Opcode::PUSH, return_operand);
+		emit(code, Opcode::CALL, label_operand("profile_write"));
+		emit(code, Opcode::POP, return_operand);
+	}
+}
+
+// the literal is stored byte for byte with a terminating zero
+Operand string_operand(const std::string& bytes) {
+	Operand operand = label_memory_operand(string_format("local_string%d", (int)current_unit->strings.size()));
+	current_unit->strings.push_back(bytes);
+	return operand;
+}
+
+// literals and variables become operands directly, strings are added to the data segment
+Operand get_operand(SyntaxNode* node, std::map<std::string, Operand>& scope) {
+	if (node->type == SyntaxNode::Type::VARIABLE_CALL) {
+		return scope[((VariableCall*)node)->name];
+	}
+	if (node->type == SyntaxNode::Type::INTEGER_LITERAL) {
+		return immediate_operand(((IntLiteral*)node)->value);
+	}
+	if (node->type == SyntaxNode::Type::BOOLEAN_LITERAL) {
+		return immediate_operand(((BooleanLiteral*)node)->value ? 1 : 0);
+	}
+	if (node->type == SyntaxNode::Type::FLOAT_LITERAL) {
+		return float_constant_operand(((FloatLiteral*)node)->value, ((FloatLiteral*)node)->size);
+	}
+	if (node->type == SyntaxNode::Type::STRING_LITERAL) {
+		return string_operand(((StringLiteral*)node)->value + target.newline);
+	}
+	return Operand();
+}
+
+ValueType type_of(SyntaxNode* expression) {
+	return expression_type(expression, current_types->variables);
+}
+
+// numbers the local labels, they only have to be unique within a procedure
+thread_local int ident_count = 0;
+
+// ARRAYS
+// a declared array is a block of the frame, a static one is array_<name> in the data segment and an input is a
+// pointer to either. an element is addressed from there with the index in a register, or folded into the
+// displacement when it's a literal. a checked index is compared with the length unsigned, which catches negative
+// ones too, and jumps to bounds_error which says so and exits with 1. a field of an array of structs is where
+// place_field says, an element's index is scaled by how far apart the elements are and multiplied out in rcx when
+// that isn't 1, 2, 4 or 8
+
+const std::string bounds_error_label = "bounds_error";
+
+// the address of the first element, for passing the array to a procedure
+void load_array_address(std::vector<Instruction>& code, Operand destination, const std::string& name, std::map<std::string, Operand>& scope) {
+	ArrayType* array = find_array(*current_types, name);
+	if (array->storage == ArrayType::Storage::STACK) {
+		emit(code, Opcode::LEA, destination, current_allocation.locations[name]);
+	}
+	else if (array->storage == ArrayType::Storage::STATIC) {
+		emit(code, Opcode::LEA, destination, label_memory_operand(static_array_label(name)));
+	}
+	else {
+		emit(code, Opcode::MOV, destination, scope[name]);
+	}
+}
+
+// the element as a memory operand of its size, uses rcx for an index that isn't in a register and rax for the
+// address of an input or static array. a vector load or store checks that count elements from the index are in it
+Operand element_operand(std::vector<Instruction>& code, const std::string& name, const std::string& field, SyntaxNode* index, bool checked, std::map<std::string, Operand>& scope, int count = 1) {
+	ArrayType* array = find_array(*current_types, name);
+	int size = value_size(element_type(*array, field));
+	FieldPlacement placement = place_field(*array, field);
+	Operand index_operand = get_operand(index, scope);
+	long long displacement = placement.start;
+	Register index_register = Register::NONE;
+	int scale = placement.stride;
+	if (index_operand.is_immediate()) {
+		if (index_operand.value >= 0 && index_operand.value + count <= array->length) {
+			displacement += index_operand.value * placement.stride;
+		}
+		else if (checked) {
+			emit(code, Opcode::JMP, label_operand(bounds_error_label));
+		}
+	}
+	else {
+		if (!index_operand.is_register()) {
+			emit(code, Opcode::MOV, register_operand(Register::RCX), index_operand);
+			index_operand = register_operand(Register::RCX);
+		}
+		if (checked) {
+			emit(code, Opcode::CMP, index_operand, immediate_operand(array->length - count + 1));
+			emit_condition(code, Opcode::JCC, Condition::AE, label_operand(bounds_error_label));
+		}
+		if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+			emit(code, Opcode::IMUL, register_operand(Register::RCX), index_operand, immediate_operand(scale));
+			index_operand = register_operand(Register::RCX);
+			scale = 1;
+		}
+		index_register = index_operand.reg;
+	}
+
+	Operand element;
+	if (array->storage == ArrayType::Storage::STACK) {
+		Operand location = current_allocation.locations[name];
+		element = memory_operand(location.reg, location.value + displacement, size);
+	}
+	else if (array->storage == ArrayType::Storage::STATIC && index_register == Register::NONE) {
+		element = label_memory_operand(static_array_label(name), size);
+		element.value = displacement;
+		return element;
+	}
+	else if (array->storage == ArrayType::Storage::STATIC) {
+		// rip relative addresses can't have an index
+		emit(code, Opcode::LEA, rax_operand, label_memory_operand(static_array_label(name)));
+		element = memory_operand(Register::RAX, displacement, size);
+	}
+	else {
+		Operand pointer = scope[name];
+		if (!pointer.is_register()) {
+			emit(code, Opcode::MOV, rax_operand, pointer);
+			pointer = rax_operand;
+		}
+		element = memory_operand(pointer.reg, displacement, size);
+	}
+	if (index_register != Register::NONE) {
+		element.index = index_register;
+		element.scale = scale;
+	}
+	return element;
+}
+
+// the element is addressed, and checked, before anything goes in the accumulator, which isn't kept across the
+// jump to bounds_error
+void declare_element_load(std::vector<Instruction>& code, Operand destination, ArrayIndex* array_index, std::map<std::string, Operand>& scope) {
+	ValueType type = element_type(*find_array(*current_types, array_index->name), array_index->field);
+	Operand element = element_operand(code, array_index->name, array_index->field, array_index->index, array_index->checked, scope);
+	if (is_floating(type)) {
+		Operand value = destination.is_register() ? destination : float_accumulator_operand(type);
+		emit_float_move(code, value, element);
+		if (value != destination) emit_float_move(code, destination, value);
+		return;
+	}
+	Operand value = destination.is_register() ? register_operand(destination.reg) : accumulator_operand;
+	if (value_size(type) == 8) {
+		emit(code, Opcode::MOV, value, element);
+	}
+	else if (type == ValueType::U32) {
+		emit(code, Opcode::MOV, register_operand(value.reg, 4), element); // zeroes the top half
+	}
+	else {
+		emit(code, is_unsigned(type) ? Opcode::MOVZX : Opcode::MOVSX, value, element);
+	}
+	if (value != destination) emit(code, Opcode::MOV, destination, value);
+}
+
+void declare_element_store(std::vector<Instruction>& code, ElementAssignment* element_assignment, std::map<std::string, Operand>& scope) {
+	ValueType type = element_type(*find_array(*current_types, element_assignment->name), element_assignment->field);
+	Operand element = element_operand(code, element_assignment->name, element_assignment->field, element_assignment->index, element_assignment->checked, scope);
+	Operand value = get_operand(element_assignment->value, scope);
+	if (is_floating(type)) {
+		if (!value.is_register()) {
+			emit_float_move(code, float_accumulator_operand(type), value);
+			value = float_accumulator_operand(type);
+		}
+		emit_float_move(code, element, value);
+		return;
+	}
+	if (value.is_memory() || (value.is_immediate() && !fits_int32(value.value))) {
+		emit(code, Opcode::MOV, accumulator_operand, value);
+		value = accumulator_operand;
+	}
+	if (value.is_register()) value.size = element.size;
+	emit(code, Opcode::MOV, element, value);
+}
+
+// declaring an array clears it, sixteen bytes at a time
+void clear_stack_array(std::vector<Instruction>& code, Operand location, const ArrayType& array) {
+	int bytes = array_bytes(array);
+	Operand zero = register_operand(Register::XMM0, 16);
+	emit(code, Opcode::XORPS, zero, zero);
+	if (bytes <= 128) {
+		for (int offset = 0; offset < bytes; offset += 16) {
+			emit(code, Opcode::MOVUPS, memory_operand(location.reg, location.value + offset, 16), zero);
+		}
+		return;
+	}
+	// rax counts up from minus the size to zero
+	std::string loop_label = string_format(".array_clear%d", ident_count++);
+	emit(code, Opcode::MOV, rax_operand, immediate_operand(-bytes));
+	emit_label(code, loop_label);
+	emit(code, Opcode::MOVUPS, indexed_memory_operand(location.reg, Register::RAX, 1, location.value + bytes, 16), zero);
+	emit(code, Opcode::ADD, rax_operand, immediate_operand(16));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(loop_label));
+}
+
+// prints why and exits with 1, out of line so a checked access is only a compare and a branch not taken. it goes
+// through printf and flushes, so whatever the program printed before comes out first
+void bounds_error_procedure(std::vector<Instruction>& code, bool c_runtime) {
+	Register first = target.argument_registers[0];
+	emit_label(code, bounds_error_label);
+	emit(code, Opcode::AND, register_operand(Register::RSP), immediate_operand(-16));
+	emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(32)); // the shadow space on windows
+	emit(code, Opcode::LEA, register_operand(first), label_memory_operand("bounds_message"));
+	emit(code, Opcode::XOR, register_operand(Register::RAX, 4), register_operand(Register::RAX, 4));
+	emit(code, Opcode::CALL, label_operand(call_label("printf")));
+	if (target.platform == Platform::LINUX) {
+		emit(code, Opcode::CALL, label_operand("output_flush"));
+	}
+	emit(code, Opcode::MOV, register_operand(first, 4), immediate_operand(1));
+	if (c_runtime) {
+		emit(code, Opcode::CALL, label_operand("exit"));
+		return;
+	}
+	emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(231)); // exit_group
+	emit(code, Opcode::SYSCALL);
+}
+
+// whether any of the code jumps to bounds_error
+bool jumps_to_bounds_error(std::vector<std::vector<Instruction>>& procedures) {
+	for (std::vector<Instruction>& code : procedures) {
+		for (Instruction& instruction : code) {
+			if (instruction.is_jump() && instruction.operands[0].label == bounds_error_label) return true;
+		}
+	}
+	return false;
+}
+
+// a tail call leaves the frame before the callee runs, so it can't be given one of the frame's arrays
+bool passes_stack_array(ProcedureCall* procedure) {
+	for (SyntaxNode* input : procedure->inputs) {
+		if (input->type != SyntaxNode::Type::VARIABLE_CALL) continue;
+		ArrayType* array = find_array(*current_types, ((VariableCall*)input)->name);
+		if (array && array->storage == ArrayType::Storage::STACK) return true;
+	}
+	return false;
+}
+
+// the types a call passes, c functions get floats promoted to doubles like any variadic call
+std::vector<ValueType> call_input_types(ProcedureCall* procedure) {
+	auto declared = procedure_types.find(procedure->name);
+	if (declared != procedure_types.end()) {
+		return declared->second.inputs;
+	}
+	std::vector<ValueType> types;
+	for (SyntaxNode* input : procedure->inputs) {
+		ValueType type = type_of(input);
+		types.push_back(type == ValueType::FLOAT ? ValueType::DOUBLE : type);
+	}
+	return types;
+}
+
+std::vector<Register> input_locations(const std::vector<ValueType>& types) {
+	std::vector<bool> floating;
+	for (ValueType type : types) {
+		floating.push_back(is_xmm_type(type));
+	}
+	return argument_locations(floating);
+}
+
+// returns how many inputs went in xmm registers
+int load_procedure_inputs(std::vector<Instruction>& code, ProcedureCall* procedure, std::map<std::string, Operand>& scope) {
+	std::vector<ValueType> types = call_input_types(procedure);
+	std::vector<Register> locations = input_locations(types);
+	int float_inputs = 0;
 	for (int i = 0; i < procedure->inputs.size(); i++) {
 		SyntaxNode* input = procedure->inputs[i];
-		std::string input_register = registers[i + 2]; // COULD SPILL OFF OFF REGISTERS IF TOO MANY PARAMS !!!
-		
-		if (input->type == SyntaxNode::Type::VARIABLE_CALL) {
-			VariableCall* var_call = (VariableCall*)input;
-			out << "mov " << input_register << ", " << scope[var_call->name] << "\n";
+		if (type_of(input) == ValueType::ARRAY) {
+			load_array_address(code, register_operand(locations[i]), ((VariableCall*)input)->name, scope);
+			continue;
 		}
-		if (input->type == SyntaxNode::Type::INTEGER_LITERAL) {
-			IntLiteral* int_literal = (IntLiteral*)input;
-			out << "mov " << input_register << ", " << int_literal->value << "\n";
+		// only a format ends the line, a string printed through %s doesn't
+		bool printed_string = input->type == SyntaxNode::Type::STRING_LITERAL && procedure->name == "printf" && i > 0;
+		Operand input_operand = printed_string ? string_operand(((StringLiteral*)input)->value) : get_operand(input, scope);
+
+		if (is_xmm_type(types[i])) {
+			Operand input_register = register_operand(locations[i], value_size(types[i]));
+			if (type_of(input) == ValueType::FLOAT && types[i] == ValueType::DOUBLE) {
+				emit(code, Opcode::CVTSS2SD, input_register, input_operand);
+			}
+			else {
+				emit_float_move(code, input_register, input_operand);
+			}
+			if (target.floats_by_position && declared_procedures.count(procedure->name) == 0) {
+				// variadic c functions on windows read floats from the integer register in the same position
+				emit(code, Opcode::MOVQ, register_operand(target.argument_registers[i]), input_register);
+			}
+			float_inputs++;
+			continue;
 		}
+
+		Operand input_register = register_operand(locations[i]);
 		if (input->type == SyntaxNode::Type::STRING_LITERAL) {
-			out << "lea " << input_register << ", " << "[string_id" << strings.size() << "]\n";
-			strings.push_back((StringLiteral*)input);
+			emit(code, Opcode::LEA, input_register, input_operand);
+		}
+		else if (input_operand.type != Operand::Type::NONE) {
+			emit(code, Opcode::MOV, input_register, input_operand);
 		}
-		out << "\n";
 	}
-	out << "call " << procedure->name << "\n";
+	return float_inputs;
 }
 
-void declare_expression(std::ofstream& out, SyntaxNode* expression, std::map<std::string, std::string>& scope) {
-	// all results go into rbx
+bool passes_wide_vector(ProcedureCall* procedure) {
+	for (ValueType type : call_input_types(procedure)) {
+		if (is_vector(type) && value_size(type) == 32) return true;
+	}
+	return false;
+}
+
+void declare_procedure_call(std::vector<Instruction>& code, ProcedureCall* procedure, std::map<std::string, Operand>& scope) {
+	emit_comment(code, "procedure " + procedure->name + " start");
+	int float_inputs = load_procedure_inputs(code, procedure, scope);
+	if (current_procedure_wide && !passes_wide_vector(procedure)) {
+		emit(code, Opcode::VZEROUPPER);
+	}
+	if (target.platform == Platform::LINUX && declared_procedures.count(procedure->name) == 0) {
+		// al holds how many vector registers a variadic c function gets
+		if (float_inputs > 0) {
+			emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(float_inputs));
+		}
+		else {
+			emit(code, Opcode::XOR, register_operand(Register::RAX, 4), register_operand(Register::RAX, 4));
+		}
+	}
+	emit(code, Opcode::CALL, label_operand(call_label(procedure->name)));
+}
+
+// from the register an input arrived in to where it is kept
+void move_input(std::vector<Instruction>& code, Operand location, Register input_register, ValueType type) {
+	if (is_xmm_type(type)) {
+		emit_float_move(code, location, register_operand(input_register, value_size(type)));
+	}
+	else {
+		emit(code, Opcode::MOV, location, register_operand(input_register));
+	}
+}
+
+// a call in tail position reuses the current frame rather than pushing a new one
+void declare_tail_call(std::vector<Instruction>& code, ProcedureCall* procedure, std::map<std::string, Operand>& scope) {
+	bool writes_profile = profile_instrument && current_procedure_name == "main";
+	if ((writes_profile || (current_procedure_wide && passes_wide_vector(procedure))) && procedure->name != current_procedure_name) {
+		// leaving would clear the vectors it's passed, or write the profile over the inputs before the callee
+		// has run, so this has to stay a call
+		declare_procedure_call(code, procedure, scope);
+		leave_frame(code);
+		emit(code, Opcode::RET);
+		return;
+	}
+
+	emit_comment(code, "tail call " + procedure->name);
+	load_procedure_inputs(code, procedure, scope);
+
+	if (procedure->name == current_procedure_name) {
+		// self recursion becomes a loop, all inputs are in registers so they can be overwritten in any order
+		std::vector<Register> locations = input_locations(current_types->inputs);
+		for (int i = 0; i < current_procedure_inputs.size(); i++) {
+			if (current_procedure_inputs[i].type == Operand::Type::NONE) continue; // never read
+			move_input(code, current_procedure_inputs[i], locations[i], current_types->inputs[i]);
+		}
+		emit(code, Opcode::JMP, label_operand(".tail_call_entry"));
+		return;
+	}
+
+	// the callee returns straight to our caller using our return address
+	leave_frame(code);
+	emit(code, Opcode::JMP, label_operand(call_label(procedure->name)));
+}
+
+bool is_simple_operand(SyntaxNode* node) {
+	return node->type == SyntaxNode::Type::INTEGER_LITERAL || node->type == SyntaxNode::Type::VARIABLE_CALL || node->type == SyntaxNode::Type::FLOAT_LITERAL ||
+		node->type == SyntaxNode::Type::BOOLEAN_LITERAL;
+}
+
+// arithmetic on flattened operands goes through instruction selection rather than the accumulator
+bool is_selectable(SyntaxNode* expression) {
+	if (expression->type != SyntaxNode::Type::BINARY_OPERATOR) return false;
+	BinaryOperator* binary_operator = (BinaryOperator*)expression;
+	return is_arithmetic_operator(binary_operator->operation) && is_simple_operand(binary_operator->left) && is_simple_operand(binary_operator->right) &&
+		is_integer(type_of(binary_operator));
+}
+
+void select_integer_arithmetic(std::vector<Instruction>& code, Operand destination, BinaryOperator* binary_operator, std::map<std::string, Operand>& scope) {
+	select_arithmetic(code, destination, binary_operator->operation, get_operand(binary_operator->left, scope), get_operand(binary_operator->right, scope),
+		type_of(binary_operator) == ValueType::U64);
+}
+
+// arithmetic can carry out of a narrow type and setcc only writes the low byte, so a value worked out in a
+// register is sign or zero extended from its type before anything keeps it
+void normalize_integer(std::vector<Instruction>& code, Operand destination, ValueType type) {
+	Operand whole = register_operand(destination.reg);
+	Operand part = register_operand(destination.reg, value_size(type));
+	switch (type)
+	{
+	case ValueType::I8:
+	case ValueType::I16:
+	case ValueType::I32:
+		emit(code, Opcode::MOVSX, whole, part);
+		break;
+	case ValueType::U8:
+	case ValueType::U16:
+	case ValueType::BOOL:
+		emit(code, Opcode::MOVZX, whole, part);
+		break;
+	case ValueType::U32:
+		emit(code, Opcode::MOV, part, part); // writing the low half zeroes the top
+		break;
+	default:
+		break;
+	}
+}
+
+// what an assignment or return computed, as the type it goes into. comparisons are bools whatever they go into
+void normalize_value(std::vector<Instruction>& code, Operand destination, SyntaxNode* value, ValueType type) {
+	if (value->type != SyntaxNode::Type::BINARY_OPERATOR) return;
+	normalize_integer(code, destination, is_comparison(((BinaryOperator*)value)->operation) ? ValueType::BOOL : type);
+}
+
+void declare_expression(std::vector<Instruction>& code, SyntaxNode* expression, std::map<std::string, Operand>& scope);
+void declare_float_expression(std::vector<Instruction>& code, SyntaxNode* expression, std::map<std::string, Operand>& scope);
+
+// int(), the sized integers, float() and double(), the result goes in the destination register. integers wrap
+// to a narrower type, and u64 values past the top of i64 convert to floats as if they were signed
+void declare_conversion(std::vector<Instruction>& code, ProcedureCall* conversion, Operand destination, std::map<std::string, Operand>& scope) {
+	SyntaxNode* input = conversion->inputs[0];
+	ValueType from = type_of(input);
+	ValueType to = type_from_name(conversion->name);
+
+	Operand source;
+	if (is_simple_operand(input)) {
+		source = get_operand(input, scope);
+	}
+	else if (is_floating(from)) {
+		declare_float_expression(code, input, scope);
+		source = float_accumulator_operand(from);
+	}
+	else {
+		declare_expression(code, input, scope);
+		source = accumulator_operand;
+	}
+	if (source.is_immediate()) {
+		emit(code, Opcode::MOV, rax_operand, source);
+		source = rax_operand;
+	}
+
+	if (!is_floating(to)) {
+		if (is_floating(from)) {
+			emit(code, Opcode::CVTTSD2SI, destination, source); // truncates like a c cast
+		}
+		else if (destination != source) {
+			emit(code, Opcode::MOV, destination, source);
+		}
+		if (from != to) normalize_integer(code, destination, to);
+		return;
+	}
+	destination.size = value_size(to);
+	if (!is_floating(from)) {
+		// cvtsi2sd only writes the low lane, clearing the register first breaks the dependency on its old value
+		emit(code, Opcode::XORPS, destination, destination);
+		emit(code, Opcode::CVTSI2SD, destination, source);
+	}
+	else if (from != to) {
+		emit(code, from == ValueType::FLOAT ? Opcode::CVTSS2SD : Opcode::CVTSD2SS, destination, source);
+	}
+	else if (destination != source) {
+		emit_float_move(code, destination, source);
+	}
+}
+
+// peek(x) loads the 8 bytes at x into the destination. poke(x, v) stores v there and gives v back when it's used
+// as a value
+void declare_memory_access(std::vector<Instruction>& code, ProcedureCall* access, Operand destination, std::map<std::string, Operand>& scope) {
+	Operand address = get_operand(access->inputs[0], scope);
+	if (!address.is_register()) {
+		emit(code, Opcode::MOV, rax_operand, address);
+		address = rax_operand;
+	}
+	if (access->name == "peek") {
+		emit(code, Opcode::MOV, destination, memory_operand(address.reg, 0));
+		return;
+	}
+	Operand value = get_operand(access->inputs[1], scope);
+	if (!value.is_register()) {
+		emit(code, Opcode::MOV, register_operand(Register::RCX), value);
+		value = register_operand(Register::RCX);
+	}
+	emit(code, Opcode::MOV, memory_operand(address.reg, 0), value);
+	if (destination.type != Operand::Type::NONE && destination != value) {
+		emit(code, Opcode::MOV, destination, value);
+	}
+}
+
+// VECTORS
+// v4 types are kept in xmm registers and v8 ones in ymm registers, which needs avx2 whatever -cpu says. a value
+// is worked out in the register of the variable it goes into, or xmm0 when that's in memory, with the target's
+// vector scratch for an operand that has to be loaded first. sse needs its memory operands aligned and the
+// frame isn't, so vectors in memory are only ever moved with movups
+
+Operand vector_operand(Register reg, ValueType type) {
+	return register_operand(reg, value_size(type));
+}
+
+// any integer or float lane value into eax, from wherever it is
+void load_lane_bits(std::vector<Instruction>& code, SyntaxNode* input, std::map<std::string, Operand>& scope) {
+	Operand eax = register_operand(Register::RAX, 4);
+	Operand source = get_operand(input, scope);
+	if (source.is_register() && is_xmm(source.reg)) {
+		emit(code, Opcode::MOVQ, eax, register_operand(source.reg, 16));
+		return;
+	}
+	if (source.is_register() || (source.is_memory() && source.size == 8)) {
+		source.size = 4;
+	}
+	emit(code, Opcode::MOV, eax, source);
+}
+
+// four lanes into an xmm register, movd clears the ones after the first
+void insert_lanes(std::vector<Instruction>& code, Register reg, std::vector<SyntaxNode*>& inputs, int first, std::map<std::string, Operand>& scope) {
+	Operand half = register_operand(reg, 16);
+	for (int i = 0; i < 4; i++) {
+		load_lane_bits(code, inputs[first + i], scope);
+		if (i == 0) {
+			emit(code, Opcode::MOVQ, half, register_operand(Register::RAX, 4));
+		}
+		else {
+			emit(code, Opcode::PINSRD, half, register_operand(Register::RAX, 4), immediate_operand(i));
+		}
+	}
+}
+
+// the lanes of a vector load or store as one memory operand, always checked
+Operand vector_element_operand(std::vector<Instruction>& code, ProcedureCall* procedure_call, ValueType type, std::map<std::string, Operand>& scope) {
+	const std::string& name = ((VariableCall*)procedure_call->inputs[0])->name;
+	Operand element = element_operand(code, name, "", procedure_call->inputs[1], true, scope, lane_count(type));
+	element.size = value_size(type);
+	return element;
+}
+
+Opcode vector_operator_opcode(BinaryOperator::Type operation, ValueType type) {
+	bool floating = is_floating(lane_type(type));
+	switch (operation)
+	{
+	case BinaryOperator::Type::ADD: return floating ? Opcode::ADDPS : Opcode::PADDD;
+	case BinaryOperator::Type::SUBTRACT: return floating ? Opcode::SUBPS : Opcode::PSUBD;
+	case BinaryOperator::Type::MULTIPLY: return floating ? Opcode::MULPS : Opcode::PMULLD;
+	case BinaryOperator::Type::DIVIDE: return Opcode::DIVPS;
+	case BinaryOperator::Type::EQUAL: return floating ? Opcode::CMPPS : Opcode::PCMPEQD;
+	case BinaryOperator::Type::LESS_THAN: return Opcode::CMPPS; // integers are swapped to a greater than
+	case BinaryOperator::Type::GREATER_THAN: return Opcode::PCMPGTD; // floats are swapped to a less than
+	default: return Opcode::NOP;
+	}
+}
+
+// destination = left op right lane by lane, the destination a register. with it also the right operand the
+// left one would overwrite it, so unless the order doesn't matter that's worked out in xmm0 instead
+void declare_vector_operation(std::vector<Instruction>& code, Operand destination, Opcode opcode, bool commutative, Operand left, Operand right, int predicate = -1) {
+	Operand scratch = register_operand(target.vector_scratch, destination.size);
+	Operand work = destination;
+	if (work == right && work != left) {
+		if (commutative) {
+			std::swap(left, right);
+		}
+		else {
+			work = register_operand(Register::XMM0, destination.size);
+		}
+	}
+	if (right.is_memory()) {
+		emit(code, Opcode::MOVUPS, scratch, right);
+		right = scratch;
+	}
+	if (work != left) emit(code, Opcode::MOVUPS, work, left);
+	if (predicate >= 0) {
+		emit(code, opcode, work, right, immediate_operand(predicate));
+	}
+	else {
+		emit(code, opcode, work, right);
+	}
+	if (work != destination) emit(code, Opcode::MOVUPS, destination, work);
+}
+
+void declare_vector_value(std::vector<Instruction>& code, Operand destination, SyntaxNode* value, std::map<std::string, Operand>& scope) {
+	ValueType type = type_of(value);
+	Operand work = destination.is_register() ? vector_operand(destination.reg, type) : vector_operand(Register::XMM0, type);
+
+	if (is_simple_operand(value)) {
+		Operand source = get_operand(value, scope);
+		if (source == destination) return;
+		if (source.is_memory() && destination.is_memory()) {
+			emit(code, Opcode::MOVUPS, work, source);
+			source = work;
+		}
+		emit(code, Opcode::MOVUPS, destination, source);
+		return;
+	}
+
+	if (value->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		BinaryOperator* binary_operator = (BinaryOperator*)value;
+		ValueType operands = type_of(binary_operator->left);
+		Operand left = get_operand(binary_operator->left, scope);
+		Operand right = get_operand(binary_operator->right, scope);
+		BinaryOperator::Type operation = binary_operator->operation;
+		bool floating = is_floating(lane_type(operands));
+		// there's only pcmpgtd for integers and the less than predicate of cmpps for floats
+		if ((floating && operation == BinaryOperator::Type::GREATER_THAN) || (!floating && operation == BinaryOperator::Type::LESS_THAN)) {
+			std::swap(left, right);
+			operation = floating ? BinaryOperator::Type::LESS_THAN : BinaryOperator::Type::GREATER_THAN;
+		}
+		bool commutative = operation == BinaryOperator::Type::ADD || operation == BinaryOperator::Type::MULTIPLY || operation == BinaryOperator::Type::EQUAL;
+		int predicate = !floating ? -1 : operation == BinaryOperator::Type::EQUAL ? 0 : operation == BinaryOperator::Type::LESS_THAN ? 1 : -1;
+		declare_vector_operation(code, work, vector_operator_opcode(operation, operands), commutative, left, right, predicate);
+		if (work != destination) emit(code, Opcode::MOVUPS, destination, work);
+		return;
+	}
+
+	if (value->type != SyntaxNode::Type::PROCEDURE_CALL) return;
+	ProcedureCall* procedure_call = (ProcedureCall*)value;
+	std::vector<SyntaxNode*>& inputs = procedure_call->inputs;
+	Operand work_half = register_operand(work.reg, 16);
+	Operand scratch_half = register_operand(target.vector_scratch, 16);
+	bool wide = work.size == 32;
+
+	if (!is_vector_builtin(procedure_call)) {
+		declare_procedure_call(code, procedure_call, scope);
+		emit(code, Opcode::MOVUPS, destination, vector_operand(Register::XMM0, type));
+		return;
+	}
+	if (is_vector(type_from_name(procedure_call->name))) {
+		if (inputs.size() == 2) {
+			emit(code, Opcode::MOVUPS, work, vector_element_operand(code, procedure_call, type, scope));
+		}
+		else if (inputs.size() == 1) {
+			load_lane_bits(code, inputs[0], scope);
+			emit(code, Opcode::MOVQ, work_half, register_operand(Register::RAX, 4));
+			if (wide) {
+				emit(code, Opcode::VPBROADCASTD, work, work_half);
+			}
+			else {
+				emit(code, Opcode::PSHUFD, work, work, immediate_operand(0));
+			}
+		}
+		else {
+			insert_lanes(code, work.reg, inputs, 0, scope);
+			if (wide) {
+				insert_lanes(code, target.vector_scratch, inputs, 4, scope);
+				emit(code, Opcode::VINSERTI128, work, scratch_half, immediate_operand(1));
+			}
+		}
+	}
+	else if (procedure_call->name == "shuffle") {
+		Operand source = get_operand(inputs[0], scope);
+		if (source.is_memory()) {
+			emit(code, Opcode::MOVUPS, work, source);
+			source = work;
+		}
+		int selection = 0;
+		for (int i = 0; i < 4; i++) {
+			selection |= (int)((IntLiteral*)inputs[i + 1])->value << (i * 2);
+		}
+		emit(code, Opcode::PSHUFD, work, source, immediate_operand(selection));
+	}
+	else if (procedure_call->name == "min" || procedure_call->name == "max") {
+		// minps and maxps give the second operand when either is nan, so they don't commute
+		bool minimum = procedure_call->name == "min";
+		Opcode opcode = is_floating(lane_type(type)) ? (minimum ? Opcode::MINPS : Opcode::MAXPS) : (minimum ? Opcode::PMINSD : Opcode::PMAXSD);
+		declare_vector_operation(code, work, opcode, false, get_operand(inputs[0], scope), get_operand(inputs[1], scope));
+	}
+	if (work != destination) emit(code, Opcode::MOVUPS, destination, work);
+}
 
-	if (expression->type == SyntaxNode::Type::INTEGER_LITERAL) {
-		IntLiteral* int_literal = (IntLiteral*)expression;
-		out << "mov " << registers[1] << "," << int_literal->value << "\n";
+// lane() and hadd(), into rbx for i32 lanes and xmm0 for float ones
+void declare_vector_scalar(std::vector<Instruction>& code, ProcedureCall* procedure_call, std::map<std::string, Operand>& scope) {
+	ValueType type = type_of(procedure_call->inputs[0]);
+	bool floating = is_floating(lane_type(type));
+	Operand source = get_operand(procedure_call->inputs[0], scope);
+	Operand result = register_operand(Register::XMM0, 16);
+	Operand scratch = register_operand(target.vector_scratch, 16);
+
+	if (procedure_call->name == "lane") {
+		int lane = ((IntLiteral*)procedure_call->inputs[1])->value;
+		if (source.is_memory()) {
+			// straight from the slot
+			Operand element = source;
+			element.value += lane * 4;
+			element.size = 4;
+			if (floating) {
+				emit(code, Opcode::MOVSD, register_operand(Register::XMM0, 4), element);
+			}
+			else {
+				emit(code, Opcode::MOVSX, accumulator_operand, element);
+			}
+			return;
+		}
+		if (lane >= 4) {
+			emit(code, Opcode::VEXTRACTI128, result, source, immediate_operand(1));
+			source = result;
+			lane -= 4;
+		}
+		source.size = 16;
+		if (lane > 0) {
+			emit(code, Opcode::PSHUFD, result, source, immediate_operand(lane));
+			source = result;
+		}
+		if (floating) {
+			if (source != result) emit(code, Opcode::MOVAPS, result, source);
+			return;
+		}
+		emit(code, Opcode::MOVQ, register_operand(Register::RBX, 4), source);
+		emit(code, Opcode::MOVSX, accumulator_operand, register_operand(Register::RBX, 4));
+		return;
+	}
+
+	// the halves of an 8 lane vector added together, then lanes two apart, then the last pair
+	Opcode add = floating ? Opcode::ADDPS : Opcode::PADDD;
+	if (source.is_memory()) {
+		Operand half = source;
+		half.size = 16;
+		emit(code, Opcode::MOVUPS, result, half);
+		if (value_size(type) == 32) {
+			half.value += 16;
+			emit(code, Opcode::MOVUPS, scratch, half);
+			emit(code, add, result, scratch);
+		}
+	}
+	else if (value_size(type) == 32) {
+		emit(code, Opcode::VEXTRACTI128, result, source, immediate_operand(1));
+		emit(code, add, result, register_operand(source.reg, 16));
+	}
+	else {
+		emit(code, Opcode::MOVUPS, result, source);
+	}
+	emit(code, Opcode::PSHUFD, scratch, result, immediate_operand(0x4e));
+	emit(code, add, result, scratch);
+	emit(code, Opcode::PSHUFD, scratch, result, immediate_operand(0xb1));
+	emit(code, add, result, scratch);
+	if (!floating) {
+		emit(code, Opcode::MOVQ, register_operand(Register::RBX, 4), result);
+		emit(code, Opcode::MOVSX, accumulator_operand, register_operand(Register::RBX, 4));
+	}
+}
+
+void declare_vector_store(std::vector<Instruction>& code, ProcedureCall* procedure_call, std::map<std::string, Operand>& scope) {
+	ValueType type = type_of(procedure_call->inputs[2]);
+	Operand value = get_operand(procedure_call->inputs[2], scope);
+	if (value.is_memory()) {
+		emit(code, Opcode::MOVUPS, vector_operand(Register::XMM0, type), value);
+		value = vector_operand(Register::XMM0, type);
+	}
+	emit(code, Opcode::MOVUPS, vector_element_operand(code, procedure_call, type, scope), value);
+}
+
+// floats and doubles are worked out in xmm0
+void declare_float_expression(std::vector<Instruction>& code, SyntaxNode* expression, std::map<std::string, Operand>& scope) {
+	Operand accumulator = float_accumulator_operand(type_of(expression));
+
+	if (is_simple_operand(expression)) {
+		emit_float_move(code, accumulator, get_operand(expression, scope));
+	}
+
+	if (expression->type == SyntaxNode::Type::PROCEDURE_CALL) {
+		ProcedureCall* proc_call = (ProcedureCall*)expression;
+		if (is_conversion(proc_call)) {
+			declare_conversion(code, proc_call, accumulator, scope);
+		}
+		else if (is_vector_builtin(proc_call)) {
+			declare_vector_scalar(code, proc_call, scope);
+		}
+		else {
+			declare_procedure_call(code, proc_call, scope); // returned in xmm0 already
+		}
+	}
+
+	if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		BinaryOperator* binary_operator = (BinaryOperator*)expression;
+		if (is_simple_operand(binary_operator->left) && is_simple_operand(binary_operator->right)) {
+			select_float_arithmetic(code, accumulator, binary_operator->operation, get_operand(binary_operator->left, scope), get_operand(binary_operator->right, scope));
+			return;
+		}
+		declare_float_expression(code, binary_operator->left, scope);
+		emit(code, float_opcode(binary_operator->operation), accumulator, get_operand(binary_operator->right, scope));
+	}
+}
+
+// comisd sets the flags the way an unsigned compare would, and when either side is nan it sets zf, pf and cf
+// together. a needs cf and zf both clear so it's false for nan already, which is why less than is worked out
+// as greater than the other way round, while equal also has to check that pf is clear
+void declare_float_comparison(std::vector<Instruction>& code, BinaryOperator* binary_operator, std::map<std::string, Operand>& scope) {
+	Operand accumulator = float_accumulator_operand(type_of(binary_operator->left));
+	Operand left = accumulator;
+	Operand right = get_operand(binary_operator->right, scope);
+	bool less_than = binary_operator->operation == BinaryOperator::Type::LESS_THAN;
+	if (is_simple_operand(binary_operator->left) && (less_than || get_operand(binary_operator->left, scope).is_register())) {
+		left = get_operand(binary_operator->left, scope);
+	}
+	else {
+		declare_float_expression(code, binary_operator->left, scope);
+	}
+
+	if (less_than && (right.is_register() || left != accumulator)) {
+		if (!right.is_register()) {
+			emit_float_move(code, accumulator, right);
+			right = accumulator;
+		}
+		emit(code, Opcode::XOR, register_operand(Register::RBX, 4), register_operand(Register::RBX, 4));
+		emit(code, Opcode::COMISD, right, left);
+		emit_condition(code, Opcode::SETCC, Condition::A, register_operand(Register::RBX, 1));
+		return;
+	}
+	if (!left.is_register()) {
+		emit_float_move(code, accumulator, left);
+		left = accumulator;
+	}
+
+	emit(code, Opcode::XOR, register_operand(Register::RBX, 4), register_operand(Register::RBX, 4));
+	emit(code, Opcode::COMISD, left, right);
+	if (binary_operator->operation == BinaryOperator::Type::GREATER_THAN) {
+		emit_condition(code, Opcode::SETCC, Condition::A, register_operand(Register::RBX, 1));
+		return;
 	}
-	if (expression->type == SyntaxNode::Type::VARIABLE_CALL) {
-		VariableCall* var_call = (VariableCall*)expression;
-		out << "mov " << registers[1] << "," << scope[var_call->name] << "\n";
+	// a less than worked out into the accumulator against memory has nowhere to swap into
+	Condition comparison = less_than ? Condition::B : Condition::E;
+	emit_condition(code, Opcode::SETCC, comparison, register_operand(Register::RBX, 1));
+	emit_condition(code, Opcode::SETCC, Condition::NP, register_operand(Register::RAX, 1));
+	emit(code, Opcode::AND, register_operand(Register::RBX, 1), register_operand(Register::RAX, 1));
+}
+
+void declare_float_assignment(std::vector<Instruction>& code, Operand destination, SyntaxNode* value, std::map<std::string, Operand>& scope) {
+	if (destination.is_register()) {
+		if (value->type == SyntaxNode::Type::BINARY_OPERATOR) {
+			BinaryOperator* binary_operator = (BinaryOperator*)value;
+			if (is_simple_operand(binary_operator->left) && is_simple_operand(binary_operator->right)) {
+				select_float_arithmetic(code, destination, binary_operator->operation, get_operand(binary_operator->left, scope), get_operand(binary_operator->right, scope));
+				return;
+			}
+		}
+		if (is_simple_operand(value)) {
+			Operand source = get_operand(value, scope);
+			if (source != destination) emit_float_move(code, destination, source);
+			return;
+		}
+		if (is_conversion(value)) {
+			declare_conversion(code, (ProcedureCall*)value, destination, scope);
+			return;
+		}
+	}
+	declare_float_expression(code, value, scope);
+	emit_float_move(code, destination, float_accumulator_operand(type_of(value)));
+}
+
+void declare_expression(std::vector<Instruction>& code, SyntaxNode* expression, std::map<std::string, Operand>& scope) {
+	// all results go into rbx
+
+	if (expression->type == SyntaxNode::Type::INTEGER_LITERAL || expression->type == SyntaxNode::Type::VARIABLE_CALL || expression->type == SyntaxNode::Type::BOOLEAN_LITERAL) {
+		emit(code, Opcode::MOV, accumulator_operand, get_operand(expression, scope));
 	}
 
 	if (expression->type == SyntaxNode::Type::PROCEDURE_CALL) {
 		ProcedureCall* proc_call = (ProcedureCall*)expression;
-		declare_procedure_call(out, proc_call, scope);
-		out << "mov " << registers[1] << ", " << registers[0] << "\n";
+		if (is_conversion(proc_call)) {
+			declare_conversion(code, proc_call, accumulator_operand, scope);
+			return;
+		}
+		if (is_vector_builtin(proc_call)) {
+			declare_vector_scalar(code, proc_call, scope);
+			return;
+		}
+		if (is_memory_access(proc_call)) {
+			declare_memory_access(code, proc_call, accumulator_operand, scope);
+			return;
+		}
+		declare_procedure_call(code, proc_call, scope);
+		emit(code, Opcode::MOV, accumulator_operand, return_operand);
 	}
 
 	if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
 		BinaryOperator* binary_operator = (BinaryOperator*)expression;
-		declare_expression(out, binary_operator->left, scope);
+		if (is_comparison(binary_operator->operation) && is_floating(type_of(binary_operator->left))) {
+			declare_float_comparison(code, binary_operator, scope);
+			return;
+		}
+		if (is_selectable(binary_operator)) {
+			select_integer_arithmetic(code, accumulator_operand, binary_operator, scope);
+			return;
+		}
+		declare_expression(code, binary_operator->left, scope);
 
-		std::string operation;
-		std::string comparison_operation;
+		Opcode operation = Opcode::NOP;
+		Condition comparison = Condition::NONE;
+		bool unsigned_compare = is_unsigned(combined_type(type_of(binary_operator->left), type_of(binary_operator->right)));
 
 		switch (binary_operator->operation)
 		{
 		case BinaryOperator::Type::ADD:
-			operation = "add";
+			operation = Opcode::ADD;
 			break;
 		case BinaryOperator::Type::MULTIPLY:
-			operation = "imul";
+			operation = Opcode::IMUL;
 			break;
 		case BinaryOperator::Type::SUBTRACT:
-			operation = "sub";
+			operation = Opcode::SUB;
 			break;
 		case BinaryOperator::Type::LESS_THAN:
-			operation = "cmp";
-			comparison_operation = "setl";
+			operation = Opcode::CMP;
+			comparison = unsigned_compare ? Condition::B : Condition::L;
 			break;
 		case BinaryOperator::Type::GREATER_THAN:
-			operation = "cmp";
-			comparison_operation = "setg";
+			operation = Opcode::CMP;
+			comparison = unsigned_compare ? Condition::A : Condition::G;
 			break;
 		case BinaryOperator::Type::EQUAL:
-			operation = "cmp";
-			comparison_operation = "sete";
+			operation = Opcode::CMP;
+			comparison = Condition::E;
 			break;
 
 		default:
 			break;
 		}
 
-		if (binary_operator->right->type == SyntaxNode::Type::INTEGER_LITERAL) {
-			IntLiteral* int_literal = (IntLiteral*)binary_operator->right;
-			out << operation << " " << registers[1] << ", " << int_literal->value << "\n";
-		}
-		if (binary_operator->right->type == SyntaxNode::Type::VARIABLE_CALL) {
-			VariableCall* var_call = (VariableCall*)binary_operator->right;
-			out << operation << " " << registers[1] << ", " << scope[var_call->name] << "\n";
+		if (binary_operator->right->type == SyntaxNode::Type::INTEGER_LITERAL || binary_operator->right->type == SyntaxNode::Type::VARIABLE_CALL ||
+			binary_operator->right->type == SyntaxNode::Type::BOOLEAN_LITERAL) {
+			Operand right = get_operand(binary_operator->right, scope);
+			if (right.is_immediate() && !fits_int32(right.value)) {
+				// only mov takes a 64 bit immediate, a big unsigned one would be sign extended from 32
+				emit(code, Opcode::MOV, register_operand(Register::RCX), right);
+				right = register_operand(Register::RCX);
+			}
+			emit(code, operation, accumulator_operand, right);
 		}
 		if (binary_operator->right->type == SyntaxNode::Type::PROCEDURE_CALL) {
 			// SHOULD NEVER HAPPEN NEED TO CHECK
-			declare_procedure_call(out, (ProcedureCall*)binary_operator->right, scope);
-			out << operation << " " << registers[1] << ", " << registers[0] << "\n";
+			declare_procedure_call(code, (ProcedureCall*)binary_operator->right, scope);
+			emit(code, operation, accumulator_operand, return_operand);
 		}
 
-		if (comparison_operation.length() > 0) {
-			out << comparison_operation << " " << "bl" << "\n";
+		if (comparison != Condition::NONE) {
+			emit_condition(code, Opcode::SETCC, comparison, register_operand(Register::RBX, 1));
 		}
 	}
 }
 
-int ident_count = 0;
+// if bodies that are laid out after the procedure's ret so the likely path falls straight through
+thread_local std::vector<Instruction> cold_code;
+
+// which ifs are rarely taken. the profile says when there is one: out of line a taken if costs two jumps and
+// in line a skipped one costs one, so it's worth it below a third. otherwise it's a guess, a body that returns
+// is an early exit or a recursion base case
+bool is_cold(IfStatement* if_statement) {
+	long long reached = profile_count(if_statement, 0);
+	if (reached >= 0) {
+		return profile_count(if_statement, 1) * 3 < reached;
+	}
+	std::vector<SyntaxNode*>& statements = if_statement->body->statements;
+	return statements.size() > 0 && statements.back()->type == SyntaxNode::Type::RETURN_STATEMENT;
+}
+
+void declare_condition_jump(std::vector<Instruction>& code, SyntaxNode* condition, Condition jump_when, const std::string& label, std::map<std::string, Operand>& scope) {
+	declare_expression(code, condition, scope);
+	emit(code, Opcode::CMP, register_operand(Register::RBX, 1), immediate_operand(1));
+	emit_condition(code, Opcode::JCC, jump_when, label_operand(label));
+}
+
+// VECTORIZATION
+// a counting loop whose body only loads elements at the counter, works them out with + - * or / and stores them
+// at the counter, or adds them into a variable, first runs as many iterations at once as a vector register has
+// lanes for as long as there are that many left. the loop as it was does what's left over. the vectors are kept
+// in xmm registers the allocator didn't hand out, with xmm0 as the scratch. float and double sums stay scalar,
+// adding each lane up separately changes how they round. when an access is still checked the vector part stops
+// short of the end of the shortest array and the scalar loop is what gets to the bad index
 
-void declare_block(std::ofstream& out, Block* block, std::map<std::string, std::string>& scope, int& stack_offset) {
-	out << "xor rbx, rbx\n";
+bool vectorize_enabled = true; // -O0 and instrumented builds leave every loop scalar
+
+struct VectorLoop {
+	std::string counter;
+	SyntaxNode* limit;
+	ValueType element = ValueType::NONE;
+	bool checked = false;
+	long long length = 0; // of the shortest array the body touches
+	std::vector<SyntaxNode*> body; // without the step
+	std::map<std::string, Register> vectors; // by vector_key, what's worked out in the body, the invariants and the sums
+	std::vector<std::pair<SyntaxNode*, Register>> invariants; // broadcast to every lane before the loop
+	std::vector<std::string> sums;
+	std::vector<Register> free_registers;
+};
+
+bool is_temporary(const std::string& name) {
+	return name.rfind("generated_ident_", 0) == 0;
+}
+
+bool is_vector_element(ValueType type) {
+	return type == ValueType::I32 || type == ValueType::U32 || type == ValueType::INT || type == ValueType::U64 || is_floating(type);
+}
+
+// pmulld is the only integer multiply, there's no 64 bit one before avx-512 and no integer divide at all
+Opcode vector_opcode(BinaryOperator::Type operation, ValueType element) {
+	bool wide = value_size(element) == 8;
+	if (is_floating(element)) {
+		switch (operation)
+		{
+		case BinaryOperator::Type::ADD: return wide ? Opcode::ADDPD : Opcode::ADDPS;
+		case BinaryOperator::Type::SUBTRACT: return wide ? Opcode::SUBPD : Opcode::SUBPS;
+		case BinaryOperator::Type::MULTIPLY: return wide ? Opcode::MULPD : Opcode::MULPS;
+		case BinaryOperator::Type::DIVIDE: return wide ? Opcode::DIVPD : Opcode::DIVPS;
+		default: return Opcode::NOP;
+		}
+	}
+	switch (operation)
+	{
+	case BinaryOperator::Type::ADD: return wide ? Opcode::PADDQ : Opcode::PADDD;
+	case BinaryOperator::Type::SUBTRACT: return wide ? Opcode::PSUBQ : Opcode::PSUBD;
+	case BinaryOperator::Type::MULTIPLY: return wide ? Opcode::NOP : Opcode::PMULLD;
+	default: return Opcode::NOP;
+	}
+}
+
+// variables by name, literals by value
+std::string vector_key(SyntaxNode* operand) {
+	switch (operand->type)
+	{
+	case SyntaxNode::Type::VARIABLE_CALL: return ((VariableCall*)operand)->name;
+	case SyntaxNode::Type::INTEGER_LITERAL: return string_format("#%lld", ((IntLiteral*)operand)->value);
+	case SyntaxNode::Type::FLOAT_LITERAL: return string_format("#%.17g", ((FloatLiteral*)operand)->value);
+	default: return "";
+	}
+}
+
+bool take_vector_register(VectorLoop& loop, const std::string& key) {
+	if (loop.free_registers.size() == 0) return false;
+	loop.vectors[key] = loop.free_registers.back();
+	loop.free_registers.pop_back();
+	return true;
+}
+
+// an element at exactly the counter, of the same type as every other one in the loop. a field of a struct of
+// arrays is next to the same field of the next element so it's as good as an array, in an array of structs it isn't
+bool is_vector_access(VectorLoop& loop, const std::string& name, const std::string& field, SyntaxNode* index, bool checked) {
+	ArrayType* array = find_array(*current_types, name);
+	if (!array || index->type != SyntaxNode::Type::VARIABLE_CALL || ((VariableCall*)index)->name != loop.counter) return false;
+	ValueType element = element_type(*array, field);
+	if (place_field(*array, field).stride != value_size(element)) return false;
+	if (loop.element == ValueType::NONE) loop.element = element;
+	if (element != loop.element) return false;
+	if (loop.length == 0 || array->length < loop.length) loop.length = array->length;
+	loop.checked = loop.checked || checked;
+	return true;
+}
+
+// something worked out earlier in the body, or a literal or variable the loop doesn't change, which is broadcast
+bool is_vector_operand(VectorLoop& loop, SyntaxNode* operand, std::set<std::string>& assigned) {
+	std::string key = vector_key(operand);
+	if (key.length() == 0) return false;
+	if (loop.vectors.count(key) > 0) return std::find(loop.sums.begin(), loop.sums.end(), key) == loop.sums.end();
+	if (operand->type == SyntaxNode::Type::VARIABLE_CALL) {
+		if (key == loop.counter || assigned.count(key) > 0 || current_types->variables[key] != loop.element) return false;
+	}
+	if (operand->type == SyntaxNode::Type::FLOAT_LITERAL && !is_floating(loop.element)) return false;
+	if (operand->type == SyntaxNode::Type::INTEGER_LITERAL && !is_floating(loop.element) && !fits_integer(((IntLiteral*)operand)->value, loop.element)) return false;
+	if (!take_vector_register(loop, key)) return false;
+	loop.invariants.push_back({ operand, loop.vectors[key] });
+	return true;
+}
+
+int count_operand_reads(SyntaxNode* expression, const std::string& name) {
+	if (expression->type == SyntaxNode::Type::VARIABLE_CALL) return ((VariableCall*)expression)->name == name ? 1 : 0;
+	if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		return count_operand_reads(((BinaryOperator*)expression)->left, name) + count_operand_reads(((BinaryOperator*)expression)->right, name);
+	}
+	if (expression->type == SyntaxNode::Type::ARRAY_INDEX) return count_operand_reads(((ArrayIndex*)expression)->index, name);
+	return 0;
+}
+
+// s = s + t where t was worked out in the body and s isn't read anywhere else in it
+bool is_vector_sum(VectorLoop& loop, VariableAssignment* assignment) {
+	BinaryOperator* sum = (BinaryOperator*)assignment->value;
+	if (sum->operation != BinaryOperator::Type::ADD || is_floating(loop.element) || current_types->variables[assignment->name] != loop.element ||
+		loop.vectors.count(assignment->name) > 0 || sum->left->type != SyntaxNode::Type::VARIABLE_CALL || ((VariableCall*)sum->left)->name != assignment->name ||
+		sum->right->type != SyntaxNode::Type::VARIABLE_CALL || loop.vectors.count(((VariableCall*)sum->right)->name) == 0) {
+		return false;
+	}
+	int reads = 0;
+	for (SyntaxNode* statement : loop.body) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) reads += count_operand_reads(((VariableAssignment*)statement)->value, assignment->name);
+		if (statement->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) reads += count_operand_reads(((ElementAssignment*)statement)->value, assignment->name);
+	}
+	if (reads != 1 || (loop.limit->type == SyntaxNode::Type::VARIABLE_CALL && ((VariableCall*)loop.limit)->name == assignment->name)) return false;
+	loop.sums.push_back(assignment->name);
+	return take_vector_register(loop, assignment->name);
+}
+
+bool analyse_vector_loop(WhileStatement* while_statement, VectorLoop& loop) {
+	if (!vectorize_enabled || cpu.vector_bytes == 0 || while_statement->condition->type != SyntaxNode::Type::BINARY_OPERATOR) return false;
+	BinaryOperator* condition = (BinaryOperator*)while_statement->condition;
+	if (condition->operation != BinaryOperator::Type::LESS_THAN || condition->left->type != SyntaxNode::Type::VARIABLE_CALL) return false;
+	loop.counter = ((VariableCall*)condition->left)->name;
+	loop.limit = condition->right;
+	if (current_types->variables[loop.counter] != ValueType::INT) return false;
+	if (!(loop.limit->type == SyntaxNode::Type::INTEGER_LITERAL && fits_int32(((IntLiteral*)loop.limit)->value)) &&
+		!(loop.limit->type == SyntaxNode::Type::VARIABLE_CALL && is_integer(current_types->variables[((VariableCall*)loop.limit)->name]))) {
+		return false;
+	}
+
+	// the last statement steps the counter by one, nothing else touches it
+	std::vector<SyntaxNode*>& statements = while_statement->body->statements;
+	if (statements.size() < 2 || statements.back()->type != SyntaxNode::Type::VARIABLE_ASSIGNMENT) return false;
+	VariableAssignment* step = (VariableAssignment*)statements.back();
+	if (step->name != loop.counter || step->value->type != SyntaxNode::Type::BINARY_OPERATOR) return false;
+	BinaryOperator* step_value = (BinaryOperator*)step->value;
+	if (step_value->operation != BinaryOperator::Type::ADD || vector_key(step_value->left) != loop.counter || vector_key(step_value->right) != "#1") return false;
+	loop.body.assign(statements.begin(), statements.end() - 1);
+
+	std::set<std::string> assigned;
+	for (SyntaxNode* statement : loop.body) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) assigned.insert(((VariableAssignment*)statement)->name);
+	}
+	if (assigned.count(loop.counter) > 0 || assigned.count(vector_key(loop.limit)) > 0) return false;
+
+	// windows keeps xmm6 and up for its caller
+	Register last = target.platform == Platform::WINDOWS ? Register::XMM5 : Register::XMM15;
+	for (Register reg = last; reg > Register::XMM0; reg = (Register)((int)reg - 1)) {
+		bool allocated = false;
+		for (auto& location : current_allocation.locations) {
+			if (location.second.is_register() && location.second.reg == reg) allocated = true;
+		}
+		if (!allocated) loop.free_registers.push_back(reg);
+	}
+
+	for (SyntaxNode* statement : loop.body) {
+		switch (statement->type)
+		{
+		case SyntaxNode::Type::VARIABLE_DECLERATION:
+			if (!is_temporary(((VariableDecleration*)statement)->name)) return false;
+			break;
+		case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+		{
+			ElementAssignment* element_assignment = (ElementAssignment*)statement;
+			if (!is_vector_access(loop, element_assignment->name, element_assignment->field, element_assignment->index, element_assignment->checked) ||
+				!is_vector_operand(loop, element_assignment->value, assigned)) {
+				return false;
+			}
+		}
+		break;
+		case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		{
+			VariableAssignment* assignment = (VariableAssignment*)statement;
+			if (assignment->value->type == SyntaxNode::Type::BINARY_OPERATOR && !is_temporary(assignment->name)) {
+				if (!is_vector_sum(loop, assignment)) return false;
+				break;
+			}
+			if (!is_temporary(assignment->name)) return false;
+			if (assignment->value->type == SyntaxNode::Type::ARRAY_INDEX) {
+				ArrayIndex* array_index = (ArrayIndex*)assignment->value;
+				if (!is_vector_access(loop, array_index->name, array_index->field, array_index->index, array_index->checked)) return false;
+			}
+			else if (assignment->value->type == SyntaxNode::Type::BINARY_OPERATOR) {
+				BinaryOperator* binary_operator = (BinaryOperator*)assignment->value;
+				if (loop.element == ValueType::NONE || vector_opcode(binary_operator->operation, loop.element) == Opcode::NOP ||
+					!is_vector_operand(loop, binary_operator->left, assigned) || !is_vector_operand(loop, binary_operator->right, assigned)) {
+					return false;
+				}
+			}
+			else {
+				return false;
+			}
+			if (current_types->variables[assignment->name] != loop.element || !take_vector_register(loop, assignment->name)) return false;
+		}
+		break;
+		default:
+			return false;
+		}
+	}
+	return is_vector_element(loop.element);
+}
+
+Operand vector_operand(VectorLoop& loop, SyntaxNode* operand) {
+	return register_operand(loop.vectors[vector_key(operand)], cpu.vector_bytes);
+}
+
+// jumps to the label when the next vector of iterations runs past the limit, or past the shortest array when an
+// access is checked. the back edge jumps to the body when it doesn't
+void vector_limit_jump(std::vector<Instruction>& code, VectorLoop& loop, bool back_edge, const std::string& body_label, const std::string& end_label,
+	std::map<std::string, Operand>& scope) {
+	emit(code, Opcode::MOV, rax_operand, scope[loop.counter]);
+	emit(code, Opcode::ADD, rax_operand, immediate_operand(cpu.vector_bytes / value_size(loop.element)));
+	if (loop.checked) {
+		emit(code, Opcode::CMP, rax_operand, immediate_operand(loop.length));
+		emit_condition(code, Opcode::JCC, Condition::G, label_operand(end_label));
+	}
+	emit(code, Opcode::CMP, rax_operand, get_operand(loop.limit, scope));
+	if (back_edge) {
+		emit_condition(code, Opcode::JCC, Condition::LE, label_operand(body_label));
+	}
+	else {
+		emit_condition(code, Opcode::JCC, Condition::G, label_operand(end_label));
+	}
+}
+
+void declare_vector_loop(std::vector<Instruction>& code, VectorLoop& loop, std::map<std::string, Operand>& scope) {
+	int vector_id = ident_count++;
+	std::string body_label = string_format(".vector_body%d", vector_id);
+	std::string end_label = string_format(".vector_end%d", vector_id);
+	int element_size = value_size(loop.element);
+	bool avx = cpu.vector_bytes == 32;
+	Operand scratch = register_operand(Register::XMM0, 16);
+
+	emit_comment(code, "vectorized loop");
+	for (auto& invariant : loop.invariants) {
+		Operand lane = scratch;
+		if (is_floating(loop.element)) {
+			Operand source;
+			if (invariant.first->type == SyntaxNode::Type::INTEGER_LITERAL) {
+				source = float_constant_operand((double)((IntLiteral*)invariant.first)->value, element_size);
+			}
+			else if (invariant.first->type == SyntaxNode::Type::FLOAT_LITERAL) {
+				source = float_constant_operand(((FloatLiteral*)invariant.first)->value, element_size);
+			}
+			else {
+				source = get_operand(invariant.first, scope);
+			}
+			if (source.is_register()) {
+				lane = register_operand(source.reg, 16);
+			}
+			else {
+				emit_float_move(code, register_operand(Register::XMM0, element_size), source);
+			}
+		}
+		else {
+			emit(code, Opcode::MOV, rax_operand, get_operand(invariant.first, scope));
+			emit(code, Opcode::MOVQ, scratch, register_operand(Register::RAX, element_size));
+		}
+		Operand vector = register_operand(invariant.second, cpu.vector_bytes);
+		if (avx) {
+			emit(code, element_size == 4 ? Opcode::VPBROADCASTD : Opcode::VPBROADCASTQ, vector, lane);
+		}
+		else {
+			emit(code, Opcode::PSHUFD, vector, lane, immediate_operand(element_size == 4 ? 0 : 0x44));
+		}
+	}
+	for (const std::string& sum : loop.sums) {
+		Operand vector = register_operand(loop.vectors[sum], cpu.vector_bytes);
+		emit(code, vector_opcode(BinaryOperator::Type::SUBTRACT, loop.element), vector, vector);
+	}
+	if (loop.checked) {
+		emit(code, Opcode::CMP, scope[loop.counter], immediate_operand(0));
+		emit_condition(code, Opcode::JCC, Condition::L, label_operand(end_label));
+	}
+	vector_limit_jump(code, loop, false, body_label, end_label, scope);
+
+	emit_label(code, body_label, cpu.loop_alignment, cpu.loop_max_padding);
+	for (SyntaxNode* statement : loop.body) {
+		if (statement->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+			ElementAssignment* element_assignment = (ElementAssignment*)statement;
+			Operand element = element_operand(code, element_assignment->name, element_assignment->field, element_assignment->index, false, scope);
+			element.size = cpu.vector_bytes;
+			emit(code, Opcode::MOVUPS, element, vector_operand(loop, element_assignment->value));
+		}
+		if (statement->type != SyntaxNode::Type::VARIABLE_ASSIGNMENT) continue;
+		VariableAssignment* assignment = (VariableAssignment*)statement;
+		Operand destination = register_operand(loop.vectors[assignment->name], cpu.vector_bytes);
+		if (assignment->value->type == SyntaxNode::Type::ARRAY_INDEX) {
+			ArrayIndex* array_index = (ArrayIndex*)assignment->value;
+			Operand element = element_operand(code, array_index->name, array_index->field, array_index->index, false, scope);
+			element.size = cpu.vector_bytes;
+			emit(code, Opcode::MOVUPS, destination, element);
+			continue;
+		}
+		BinaryOperator* binary_operator = (BinaryOperator*)assignment->value;
+		Operand left = vector_operand(loop, binary_operator->left);
+		Operand right = vector_operand(loop, binary_operator->right);
+		if (std::find(loop.sums.begin(), loop.sums.end(), assignment->name) != loop.sums.end()) {
+			left = destination;
+		}
+		else if (destination != left) {
+			emit(code, Opcode::MOVUPS, destination, left);
+		}
+		emit(code, vector_opcode(binary_operator->operation, loop.element), destination, right);
+	}
+	emit(code, Opcode::ADD, scope[loop.counter], immediate_operand(cpu.vector_bytes / element_size));
+	vector_limit_jump(code, loop, true, body_label, end_label, scope);
+	emit_label(code, end_label);
+
+	// the halves of each sum are added while the top half is still there, then the lanes of the bottom half
+	Opcode add = vector_opcode(BinaryOperator::Type::ADD, loop.element);
+	if (avx) {
+		for (const std::string& sum : loop.sums) {
+			emit(code, Opcode::VEXTRACTI128, scratch, register_operand(loop.vectors[sum], 32), immediate_operand(1));
+			emit(code, add, register_operand(loop.vectors[sum], 32), register_operand(Register::XMM0, 32));
+		}
+		emit(code, Opcode::VZEROUPPER);
+	}
+	for (const std::string& sum : loop.sums) {
+		Operand vector = register_operand(loop.vectors[sum], 16);
+		emit(code, Opcode::PSHUFD, scratch, vector, immediate_operand(0x4e));
+		emit(code, add, vector, scratch);
+		if (element_size == 4) {
+			emit(code, Opcode::PSHUFD, scratch, vector, immediate_operand(0xb1));
+			emit(code, add, vector, scratch);
+		}
+		Operand total = register_operand(Register::RCX);
+		emit(code, Opcode::MOVQ, register_operand(Register::RAX, element_size), vector);
+		emit(code, Opcode::MOV, total, scope[sum]);
+		emit(code, Opcode::ADD, total, rax_operand);
+		normalize_integer(code, total, loop.element);
+		emit(code, Opcode::MOV, scope[sum], total);
+	}
+}
+
+void declare_block(std::vector<Instruction>& code, Block* block, std::map<std::string, Operand>& scope) {
+	emit(code, Opcode::XOR, accumulator_operand, accumulator_operand);
 	for (SyntaxNode* statement : block->statements) {
+		if (statement->line > 0) emitting_line = statement->line;
+		if (statement_call(statement)) {
+			emit_profile_count(code, statement);
+		}
 		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
 			VariableDecleration* decl = (VariableDecleration*)statement;
-			stack_offset += 8;
-			scope[decl->name] = string_format("QWORD [rbp - %d]", stack_offset);
+			scope[decl->name] = current_allocation.locations[decl->name];
+			auto array = current_types->arrays.find(decl->name);
+			if (array != current_types->arrays.end() && scope[decl->name].is_memory()) {
+				clear_stack_array(code, scope[decl->name], array->second);
+			}
+		}
+		if (statement->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+			declare_element_store(code, (ElementAssignment*)statement, scope);
 		}
 		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
 			VariableAssignment* assignment = (VariableAssignment*)statement;
-			declare_expression(out, assignment->value, scope);
-			out << "mov " << scope[assignment->name] << "," << registers[1] << "\n"; // rbx is accumilator
+			Operand destination = scope[assignment->name];
+			ValueType type = current_types->variables[assignment->name];
+			if (assignment->value->type == SyntaxNode::Type::ARRAY_INDEX) {
+				declare_element_load(code, destination, (ArrayIndex*)assignment->value, scope);
+				continue;
+			}
+			if (is_vector(type)) {
+				declare_vector_value(code, destination, assignment->value, scope);
+				continue;
+			}
+			if (is_floating(type)) {
+				declare_float_assignment(code, destination, assignment->value, scope);
+				continue;
+			}
+			if (destination.is_register() && is_selectable(assignment->value)) {
+				select_integer_arithmetic(code, destination, (BinaryOperator*)assignment->value, scope);
+				normalize_value(code, destination, assignment->value, type);
+				continue;
+			}
+			if (destination.is_register() && is_memory_access(assignment->value)) {
+				declare_memory_access(code, (ProcedureCall*)assignment->value, destination, scope);
+				normalize_integer(code, destination, type);
+				continue;
+			}
+			declare_expression(code, assignment->value, scope);
+			normalize_value(code, accumulator_operand, assignment->value, type);
+			emit(code, Opcode::MOV, scope[assignment->name], accumulator_operand); // rbx is accumilator
 
 		}
-		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL) {
-			declare_procedure_call(out, (ProcedureCall*)statement, scope);
+		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL && is_vector_builtin(statement) && ((ProcedureCall*)statement)->name == "store") {
+			declare_vector_store(code, (ProcedureCall*)statement, scope);
+		}
+		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL && is_memory_access(statement)) {
+			declare_memory_access(code, (ProcedureCall*)statement, Operand(), scope);
+		}
+		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL && !is_intrinsic(statement)) {
+			declare_procedure_call(code, (ProcedureCall*)statement, scope);
 		}
 
 		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
 			WhileStatement* while_statment = (WhileStatement*)statement;
 			int while_id = ident_count++;
-			out << ".while_head"<<while_id<<":\n";
-			declare_expression(out, while_statment->condition, scope);
-			out << "cmp bl, 1\n";
-			out << "jne " << ".while_end"<<while_id<<"\n";
+			std::string body_label = string_format(".while_body%d", while_id);
+			std::string end_label = string_format(".while_end%d", while_id);
+
+			VectorLoop vector_loop;
+			if (analyse_vector_loop(while_statment, vector_loop)) {
+				declare_vector_loop(code, vector_loop, scope);
+			}
 
-			declare_block(out, while_statment->body, scope, stack_offset);
-			out << "jmp " << ".while_head"<<while_id<<"\n";
-			out << ".while_end"<<while_id<<":\n";
+			// rotated, the condition is checked once on the way in and then at the bottom, so an iteration takes one branch
+			emit_profile_count(code, while_statment);
+			declare_condition_jump(code, while_statment->condition, Condition::NE, end_label, scope);
+			emit_label(code, body_label, cpu.loop_alignment, cpu.loop_max_padding);
+			emit_profile_count(code, while_statment, 1);
+			declare_block(code, while_statment->body, scope);
+			if (while_statment->line > 0) emitting_line = while_statment->line;
+			declare_condition_jump(code, while_statment->condition, Condition::E, body_label, scope);
+			emit_label(code, end_label);
 		}
 		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
 			IfStatement* if_statement = (IfStatement*)statement;
 			int if_id = ident_count++;
-			declare_expression(out, if_statement->condition, scope);
-			out << "cmp bl, 1\n";
-			out << "jne " << ".if_end" << if_id << "\n";
-			declare_block(out, if_statement->body, scope, stack_offset);
-			out << ".if_end" << if_id << ":\n";
+			std::string end_label = string_format(".if_end%d", if_id);
+			emit_profile_count(code, if_statement);
+			if (is_cold(if_statement)) {
+				std::string body_label = string_format(".if_body%d", if_id);
+				declare_condition_jump(code, if_statement->condition, Condition::E, body_label, scope);
+				emit_label(code, end_label);
+
+				std::vector<Instruction> body;
+				emit_label(body, body_label);
+				emit_profile_count(body, if_statement, 1);
+				declare_block(body, if_statement->body, scope);
+				emit(body, Opcode::JMP, label_operand(end_label));
+				cold_code.insert(cold_code.end(), body.begin(), body.end());
+				continue;
+			}
+			declare_condition_jump(code, if_statement->condition, Condition::NE, end_label, scope);
+			emit_profile_count(code, if_statement, 1);
+			declare_block(code, if_statement->body, scope);
+			emit_label(code, end_label);
 		}
 		if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) {
 			ReturnStatement* return_statement = (ReturnStatement*)statement;
-			declare_expression(out, return_statement->expression, scope);
-			out << "mov rax, rbx\n";
-			out << "leave\n";
-			out << "ret\n";
+			if (return_statement->expression->type == SyntaxNode::Type::PROCEDURE_CALL && !is_intrinsic(return_statement->expression) &&
+				!passes_stack_array((ProcedureCall*)return_statement->expression)) {
+				declare_tail_call(code, (ProcedureCall*)return_statement->expression, scope);
+				continue;
+			}
+			if (is_vector(current_types->result)) {
+				declare_vector_value(code, float_accumulator_operand(current_types->result), return_statement->expression, scope);
+			}
+			else if (is_floating(current_types->result)) {
+				declare_float_expression(code, return_statement->expression, scope); // already in xmm0
+			}
+			else {
+				declare_expression(code, return_statement->expression, scope);
+				normalize_value(code, accumulator_operand, return_statement->expression, current_types->result);
+				emit(code, Opcode::MOV, return_operand, accumulator_operand);
+			}
+			leave_frame(code);
+			emit(code, Opcode::RET);
 		}
 	}
 }
 
-void declare_procedure(std::ofstream& out, ProcedureDecleration* procedure_decl, std::map<std::string, std::string> scope) {
-	out << procedure_decl->name << ":\n";
+// spill slots narrower than a register and the type each holds, code generation treats them like any other
+// operand and widen_narrow_slots fixes up how they're read and written once the procedure is generated
+thread_local std::vector<std::pair<Operand, ValueType>> narrow_slots;
 
-	int stack_size = calculate_stack_size(procedure_decl->procedure);
-	//std::cout << "stack size of " << procedure_decl->name << " is " << stack_size << std::endl;
-	reserve_stack(out, stack_size);
+void collect_narrow_slots() {
+	narrow_slots.clear();
+	for (auto& location : current_allocation.locations) {
+		auto type = current_types->variables.find(location.first);
+		if (!location.second.is_memory() || type == current_types->variables.end()) continue;
+		if (is_integer(type->second) && value_size(type->second) < 8) narrow_slots.push_back({ location.second, type->second });
+	}
+}
 
-	int stack_offset = 32;
+void emit_widening_load(std::vector<Instruction>& code, const Instruction& at, Register destination, const Operand& slot, ValueType type) {
+	if (type == ValueType::U32) {
+		emit(code, Opcode::MOV, register_operand(destination, 4), slot); // zeroes the top half
+	}
+	else {
+		emit(code, is_unsigned(type) ? Opcode::MOVZX : Opcode::MOVSX, register_operand(destination), slot);
+	}
+	code.back().line = at.line;
+}
 
-	if (procedure_decl->name == "main") {
-		out << "call    _CRT_INIT\n";
+// a load from a narrow slot becomes movsx or movzx by its type, and a store only writes the low part of the
+// register. anything else reads the slot through rax, or rcx when the instruction uses rax itself, which are
+// never allocated and never hold anything across an instruction that reads a variable
+void widen_narrow_slots(std::vector<Instruction>& code) {
+	if (narrow_slots.size() == 0) return;
+	std::vector<Instruction> widened;
+	for (Instruction& instruction : code) {
+		int operand = -1;
+		ValueType type = ValueType::NONE;
+		for (int i = 0; i < instruction.operands.size() && instruction.opcode != Opcode::LEA; i++) {
+			for (auto& slot : narrow_slots) {
+				if (instruction.operands[i] == slot.first) {
+					operand = i;
+					type = slot.second;
+				}
+			}
+		}
+		if (operand < 0) {
+			widened.push_back(instruction);
+			continue;
+		}
+		Operand slot = instruction.operands[operand];
+		if (instruction.opcode == Opcode::MOV && operand == 0) {
+			if (instruction.operands[1].is_register()) instruction.operands[1].size = slot.size;
+			widened.push_back(instruction);
+			continue;
+		}
+		if (instruction.opcode == Opcode::MOV && instruction.operands[0].is_register()) {
+			emit_widening_load(widened, instruction, instruction.operands[0].reg, slot, type);
+			continue;
+		}
+		bool read_only = instruction.operands.size() == 1 ? instruction.opcode == Opcode::IMUL || instruction.opcode == Opcode::DIV || instruction.opcode == Opcode::IDIV :
+			instruction.opcode == Opcode::CMP || instruction.opcode == Opcode::TEST;
+		if (operand == 0 && !read_only) {
+			throw std::runtime_error("narrow stack slot written by " + std::string(opcode_names[(int)instruction.opcode]));
+		}
+		Register scratch = reads_register(instruction, Register::RAX) || writes_register(instruction, Register::RAX) ? Register::RCX : Register::RAX;
+		emit_widening_load(widened, instruction, scratch, slot, type);
+		instruction.operands[operand] = register_operand(scratch);
+		widened.push_back(instruction);
 	}
+	code = widened;
+}
 
+void declare_procedure(std::vector<Instruction>& code, ProcedureDecleration* procedure_decl, std::map<std::string, Operand> scope) {
+	emitting_line = procedure_decl->line;
+	emit_label(code, procedure_decl->name, cpu.procedure_alignment, cpu.procedure_alignment);
+	cold_code.clear();
+	ident_count = 0;
 
 	Procedure* proc = procedure_decl->procedure;
-	std::map<std::string, std::string> sub_scope(scope);
+	current_types = &procedure_types.at(procedure_decl->name);
+	current_allocation = allocate_registers(proc, *current_types);
 
-	out << "; move the inputs to stack adresses" << "\n";
-	int register_offset = 2;
-	for (SyntaxNode* input : proc->inputs) {
-		VariableDecleration* decl = (VariableDecleration*)input;
-		stack_offset += 8;
-		std::string input_register = registers[register_offset];
-		register_offset++;
-		std::string mem_location = string_format("QWORD [rbp - %d]", stack_offset);
-		sub_scope[decl->name] = mem_location;
-		out << "mov " << mem_location << ", " << input_register << "\n";
+	current_procedure_saves_accumulator = true;
+	current_procedure_wide = is_vector(current_types->result) && value_size(current_types->result) == 32;
+	for (auto& variable : current_types->variables) {
+		if (is_vector(variable.second) && value_size(variable.second) == 32) current_procedure_wide = true;
+	}
+	// main calls _CRT_INIT on windows, which the body doesn't show
+	current_frame = layout_frame(proc, current_allocation, current_procedure_saves_accumulator, procedure_decl->name == "main");
+	collect_narrow_slots();
+	if (current_procedure_saves_accumulator) {
+		emit(code, Opcode::PUSH, accumulator_operand);
 	}
+	reserve_stack(code, current_frame);
+	save_registers(code);
 
-	declare_block(out, proc->body, sub_scope, stack_offset);
+	if (procedure_decl->name == "main" && target.platform == Platform::WINDOWS) {
+		emit(code, Opcode::CALL, label_operand("_CRT_INIT"));
+	}
 
-	out <<
-		"leave\n"
-		"ret\n";
-}
+	std::map<std::string, Operand> sub_scope(scope);
 
-int calculate_stack_size(Block* block) {
-	int stack_size = 0;
-	const int int_size = 8;
+	current_procedure_name = procedure_decl->name;
+	current_procedure_inputs.clear();
 
-	for (SyntaxNode* statement : block->statements) {
-		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
-			stack_size += 8; // assume int
+	emit_comment(code, "move the inputs to their allocated locations");
+	std::vector<Register> input_registers = input_locations(current_types->inputs);
+	for (int i = 0; i < proc->inputs.size(); i++) {
+		VariableDecleration* decl = (VariableDecleration*)proc->inputs[i];
+		Operand location = current_allocation.locations[decl->name];
+		sub_scope[decl->name] = location;
+		current_procedure_inputs.push_back(location);
+		if (location.type != Operand::Type::NONE) {
+			move_input(code, location, input_registers[i], current_types->inputs[i]);
 		}
-		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
-			WhileStatement* while_statement = (WhileStatement*)statement;
-			stack_size += calculate_stack_size(while_statement->body);
+	}
+	emit_profile_count(code, procedure_decl);
+	emit_label(code, ".tail_call_entry");
+
+	declare_block(code, proc->body, sub_scope);
+
+	leave_frame(code);
+	emit(code, Opcode::RET);
+	code.insert(code.end(), cold_code.begin(), cold_code.end());
+}
+
+// runs once the peephole has had its go at the accumulator. without anything left writing rbx the push and every
+// pop come out, and a frame takes the 8 bytes the push moved rsp by into its reservation so calls stay aligned
+void drop_unused_accumulator_save(std::vector<Instruction>& code, bool frame_pointer) {
+	int push = -1;
+	int reservation = -1;
+	bool entered = false;
+	std::vector<int> pops;
+	for (int i = 0; i < code.size(); i++) {
+		Instruction& instruction = code[i];
+		if (instruction.opcode == Opcode::LABEL && instruction.text == ".tail_call_entry") entered = true;
+		if (!entered && instruction.opcode == Opcode::SUB && instruction.operands[0].is_register(Register::RSP)) reservation = i;
+		if (instruction.opcode == Opcode::PUSH && instruction.operands[0] == accumulator_operand && push < 0) {
+			push = i;
+			continue;
 		}
-		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
-			IfStatement* if_statement = (IfStatement*)statement;
-			stack_size += calculate_stack_size(if_statement->body);
+		if (instruction.opcode == Opcode::POP && instruction.operands[0] == accumulator_operand) {
+			pops.push_back(i);
+			continue;
 		}
+		for (Operand& operand : instruction.operands) {
+			if (operand.uses(Register::RBX)) return;
+		}
+	}
+	if (push < 0) return;
+	if (frame_pointer) {
+		code[reservation].operands[1].value += 8;
 	}
-	return stack_size;
+	for (int i = pops.size() - 1; i >= 0; i--) {
+		code.erase(code.begin() + pops[i]);
+	}
+	code.erase(code.begin() + push);
 }
 
-int calculate_stack_size(Procedure* procedure) {
-	int stack_size = 0;
-	int int_size = 8;
+void collect_calls(SyntaxNode* node, std::set<std::string>& calls) {
+	switch (node->type)
+	{
+	case SyntaxNode::Type::PROCEDURE_CALL:
+		calls.insert(((ProcedureCall*)node)->name);
+		for (SyntaxNode* input : ((ProcedureCall*)node)->inputs) collect_calls(input, calls);
+		break;
+	case SyntaxNode::Type::BINARY_OPERATOR:
+		collect_calls(((BinaryOperator*)node)->left, calls);
+		collect_calls(((BinaryOperator*)node)->right, calls);
+		break;
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		collect_calls(((VariableAssignment*)node)->value, calls);
+		break;
+	case SyntaxNode::Type::RETURN_STATEMENT:
+		collect_calls(((ReturnStatement*)node)->expression, calls);
+		break;
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		collect_calls(((WhileStatement*)node)->condition, calls);
+		collect_calls(((WhileStatement*)node)->body, calls);
+		break;
+	case SyntaxNode::Type::IF_STATEMENT:
+		collect_calls(((IfStatement*)node)->condition, calls);
+		collect_calls(((IfStatement*)node)->body, calls);
+		break;
+	case SyntaxNode::Type::BLOCK:
+		for (SyntaxNode* statement : ((Block*)node)->statements) collect_calls(statement, calls);
+		break;
+	default:
+		break;
+	}
+}
 
-	stack_size += 32; // shadow space
+bool peephole_enabled = true;
 
-	
-	for (SyntaxNode* input : procedure->inputs) {
-		stack_size += 8; // assume int
+// the optimized, typed procedure, how each procedure it calls is passed to and returns, and what it's built for
+unsigned long long unit_cache_key(ProcedureDecleration* procedure_decl) {
+	std::ostringstream key;
+	key << "unit " << cache_version << " " << (int)target.platform << " " << cpu.name << " " << peephole_enabled << vectorize_enabled << " " << procedure_decl->line << "\n";
+	if (!write_node(key, procedure_decl)) return 0;
+	for (auto& array : static_arrays) {
+		key << "\nstatic " << array.first << " " << array_type_name(array.second);
+	}
+	// where a field is depends on every field of its struct
+	for (auto& structure : struct_types) {
+		key << "\nstruct " << structure.first << " " << structure.second.soa;
+		for (StructField& field : structure.second.fields) key << " " << field.name << " " << (int)field.type;
+	}
+	std::set<std::string> calls;
+	collect_calls(procedure_decl->procedure->body, calls);
+	for (const std::string& call : calls) {
+		key << "\ncallee " << call;
+		auto types = procedure_types.find(call);
+		if (types == procedure_types.end()) continue; // c runtime
+		key << " declared " << (int)types->second.result;
+		for (ValueType input : types->second.inputs) key << " " << (int)input;
+		for (ArrayType& array : types->second.input_arrays) key << " " << array.length << (int)array.element << array.structure;
+	}
+	unsigned long long hash = hash_text(key.str());
+	return hash == 0 ? 1 : hash;
+}
+
+bool load_cached_unit(ProcedureUnit& unit) {
+	if (cache_directory.length() == 0) return false;
+	std::ifstream in(cache_path(unit.cache_key, "unit"), std::ios::binary);
+	if (!in) return false;
+	try {
+		int count = 0;
+		in >> unit.peephole_removed >> count;
+		for (int i = 0; i < count; i++) {
+			unit.strings.push_back(read_text(in));
+		}
+		in >> count;
+		for (int i = 0; i < count; i++) {
+			FloatConstant constant;
+			constant.label = read_text(in);
+			in >> constant.bits >> constant.size;
+			unit.float_constants.push_back(constant);
+		}
+		unit.code = read_instructions(in);
 	}
-	stack_size += calculate_stack_size(procedure->body);
+	catch (std::exception&) {
+		unit.strings.clear();
+		unit.float_constants.clear();
+		return false;
+	}
+	return true;
+}
+
+void store_cached_unit(ProcedureUnit& unit) {
+	if (cache_directory.length() == 0) return;
+	std::ostringstream out;
+	out << unit.peephole_removed << " " << unit.strings.size() << "\n";
+	for (std::string& string : unit.strings) {
+		write_text(out, string);
+	}
+	out << unit.float_constants.size() << "\n";
+	for (FloatConstant& constant : unit.float_constants) {
+		write_text(out, constant.label);
+		out << constant.bits << " " << constant.size << "\n";
+	}
+	write_instructions(out, unit.code);
+	std::ofstream file(cache_path(unit.cache_key, "unit"), std::ios::binary);
+	file << out.str();
+}
 
-	const int stack_alignment_bytes = 16;
-	int stack_multiple = stack_size / stack_alignment_bytes;
-	int stack_remainder = stack_size % stack_alignment_bytes;
-	if (stack_remainder != 0) stack_multiple += 1;
+std::map<unsigned long long, ProcedureUnit> remembered_units; // when the cache is kept in memory
+
+bool load_remembered_unit(ProcedureUnit& unit) {
+	if (!cache_in_memory) return false;
+	auto found = remembered_units.find(unit.cache_key);
+	if (found == remembered_units.end()) return false;
+	unit.code = found->second.code;
+	unit.strings = found->second.strings;
+	unit.float_constants = found->second.float_constants;
+	unit.peephole_removed = found->second.peephole_removed;
+	return true;
+}
 
-	return (stack_multiple + 1) * 16;
+void generate_unit(ProcedureUnit& unit) {
+	current_unit = &unit;
+	try {
+		std::map<std::string, Operand> scope;
+		declare_procedure(unit.code, unit.procedure_decl, scope);
+		unit.peephole_removed = peephole_enabled ? peephole_optimize(unit.code) : 0;
+		drop_unused_accumulator_save(unit.code, current_frame.frame_pointer);
+		widen_narrow_slots(unit.code);
+	}
+	catch (...) {
+		unit.error = std::current_exception();
+	}
+	current_unit = nullptr;
+	emitting_line = 0;
 }
 
-void compile(Block* node, std::string& file_name, bool run) {
-	std::ofstream out(string_format("%s.asm", file_name));
+// procedures share nothing mutable while they're generated, so each thread takes the next one that's left
+void generate_units(std::vector<ProcedureUnit>& units, int threads) {
+	if (threads <= 0) threads = std::thread::hardware_concurrency();
+	if (threads > (int)units.size()) threads = units.size();
 
-	std::map<std::string, std::string> scope;
+	std::atomic<int> next_unit(0);
+	auto worker = [&]() {
+		for (int i = next_unit++; i < (int)units.size(); i = next_unit++) {
+			if (!units[i].from_cache) generate_unit(units[i]);
+		}
+	};
+	std::vector<std::thread> pool;
+	for (int i = 1; i < threads; i++) {
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (std::thread& thread : pool) {
+		thread.join();
+	}
+}
 
+// gives a unit's literals their program wide labels, equal literals from anywhere in the program share one
+void merge_literals(ProcedureUnit& unit, std::map<std::string, std::string>& string_labels, std::map<std::pair<unsigned long long, int>, std::string>& float_labels) {
+	std::map<std::string, std::string> renamed;
+	for (int i = 0; i < unit.strings.size(); i++) {
+		auto found = string_labels.find(unit.strings[i]);
+		if (found == string_labels.end()) {
+			found = string_labels.emplace(unit.strings[i], string_format("string_id%d", (int)strings.size())).first;
+			strings.push_back(unit.strings[i]);
+		}
+		renamed[string_format("local_string%d", i)] = found->second;
+	}
+	for (FloatConstant& constant : unit.float_constants) {
+		std::pair<unsigned long long, int> key(constant.bits, constant.size);
+		auto found = float_labels.find(key);
+		if (found == float_labels.end()) {
+			found = float_labels.emplace(key, string_format("float_id%d", (int)float_constants.size())).first;
+			float_constants.push_back(FloatConstant{ found->second, constant.bits, constant.size });
+		}
+		renamed[constant.label] = found->second;
+	}
+	if (renamed.size() == 0) return;
+
+	for (Instruction& instruction : unit.code) {
+		for (Operand& operand : instruction.operands) {
+			if (!operand.is_memory() || operand.label.length() == 0) continue;
+			auto found = renamed.find(operand.label);
+			if (found != renamed.end()) operand.label = found->second;
+		}
+	}
+}
+
+// labels that are called or jumped to but not defined in the code
+std::set<std::string> collect_external_calls(std::vector<std::vector<Instruction>>& procedures) {
+	std::set<std::string> defined;
+	std::set<std::string> called;
+	for (std::vector<Instruction>& code : procedures) {
+		for (Instruction& instruction : code) {
+			if (instruction.opcode == Opcode::LABEL) {
+				defined.insert(instruction.text);
+			}
+			if ((instruction.opcode == Opcode::CALL || instruction.opcode == Opcode::JMP) && instruction.operands[0].type == Operand::Type::LABEL) {
+				called.insert(instruction.operands[0].label);
+			}
+		}
+	}
+	std::set<std::string> external;
+	for (const std::string& name : called) {
+		if (!is_local_label(name) && defined.count(name) == 0) external.insert(name);
+	}
+	return external;
+}
+
+void write_listing(const std::string& file_name, std::vector<std::vector<Instruction>>& procedures) {
+	std::ofstream out(file_name);
 	program_header(out);
+	for (std::vector<Instruction>& code : procedures) {
+		print_instructions(out, code);
+	}
+	data_segment(out);
+}
+
+// windows goes through nasm and link, linux is assembled here and written as ELF
+void compile(Block* node, std::string& file_name, CompileOptions& options) {
+	PhaseStart phase = begin_phase();
+	check_types(node); // types the temporaries the optimizer added
+	end_phase("type check", phase);
+	profile_instrument = options.profile_generate;
+	peephole_enabled = options.optimize;
+	vectorize_enabled = options.optimize && !options.profile_generate;
+	profile_file = file_name + ".profile";
+
+	strings.clear();
+	float_constants.clear();
+	declared_procedures.clear();
 	for (SyntaxNode* statement : node->statements) {
 		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
-			ProcedureDecleration* procedure_decl = (ProcedureDecleration*)statement;
-			declare_procedure(out, procedure_decl, scope);
+			declared_procedures.insert(((ProcedureDecleration*)statement)->name);
 		}
 	}
-	data_segment(out);
 
-	out.close();
-	std::string compile_command = string_format("nasm -f win64 -o %s.obj %s.asm", file_name, file_name);
-	std::string link_command = string_format("link %s.obj /subsystem:console /out:%s.exe kernel32.lib legacy_stdio_definitions.lib msvcrt.lib", file_name, file_name);
+	std::vector<ProcedureUnit> units;
+	for (SyntaxNode* statement : node->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			ProcedureUnit unit;
+			unit.procedure_decl = (ProcedureDecleration*)statement;
+			units.push_back(unit);
+		}
+	}
+	// counters and profile weights aren't part of the key, so those builds always generate
+	bool cached = cache_enabled() && !profile_instrument && !has_profile();
+	phase = begin_phase();
+	if (cached) {
+		for (ProcedureUnit& unit : units) {
+			unit.cache_key = unit_cache_key(unit.procedure_decl);
+			if (unit.cache_key == 0) continue;
+			bool remembered = load_remembered_unit(unit);
+			unit.from_cache = remembered || load_cached_unit(unit);
+			if (unit.from_cache) cached_units++;
+			if (unit.from_cache && !remembered && cache_in_memory) remembered_units[unit.cache_key] = unit;
+		}
+	}
+	end_phase("unit cache", phase);
+	phase = begin_phase();
+	generate_units(units, options.threads);
+	end_phase("codegen", phase);
+	phase = begin_phase();
+	if (cached) {
+		for (ProcedureUnit& unit : units) {
+			if (unit.from_cache || unit.cache_key == 0 || unit.error) continue;
+			store_cached_unit(unit);
+			if (cache_in_memory) remembered_units[unit.cache_key] = unit;
+		}
+	}
+	end_phase("unit cache", phase);
+
+	// merged in program order so the output doesn't depend on which thread finished first
+	phase = begin_phase();
+	std::vector<std::vector<Instruction>> procedures;
+	std::vector<std::string> procedure_files; // empty for the ones the compiler adds
+	std::map<std::string, std::string> string_labels;
+	std::map<std::pair<unsigned long long, int>, std::string> float_labels;
+	for (ProcedureUnit& unit : units) {
+		if (unit.error) std::rethrow_exception(unit.error);
+		merge_literals(unit, string_labels, float_labels);
+		peephole_removed += unit.peephole_removed;
+		procedures.push_back(std::move(unit.code));
+		procedure_files.push_back(unit.procedure_decl->source_file);
+	}
+	if (profile_instrument) {
+		std::vector<Instruction> profile_write;
+		profile_write_procedure(profile_write);
+		procedures.push_back(profile_write);
+		procedure_files.push_back("");
+	}
+	uses_bounds_error = jumps_to_bounds_error(procedures);
+	if (uses_bounds_error) {
+		std::vector<Instruction> bounds_error;
+		bounds_error_procedure(bounds_error, target.platform == Platform::WINDOWS || options.object);
+		procedures.push_back(bounds_error);
+		procedure_files.push_back("");
+	}
+	// the allocators are ours on every platform
+	for (std::vector<Instruction>& code : allocator_procedures(collect_external_calls(procedures))) {
+		procedures.push_back(code);
+		procedure_files.push_back("");
+	}
+	for (std::vector<Instruction>& code : output_procedures(collect_external_calls(procedures), target.platform == Platform::WINDOWS || options.object)) {
+		procedures.push_back(code);
+		procedure_files.push_back("");
+	}
+	end_phase("merge", phase);
+	add_count("procedures", units.size());
+	for (std::vector<Instruction>& code : procedures) {
+		add_count("instructions", code.size());
+	}
+
+	if (target.platform == Platform::WINDOWS) {
+		phase = begin_phase();
+		write_listing(string_format("%s.asm", file_name.c_str()), procedures);
+		std::string compile_command = string_format("nasm -f win64 -o %s.obj %s.asm", file_name.c_str(), file_name.c_str());
+		std::string link_command = string_format("link %s.obj /subsystem:console /out:%s.exe kernel32.lib legacy_stdio_definitions.lib msvcrt.lib", file_name.c_str(), file_name.c_str());
 
-	system(compile_command.c_str());
-	system(link_command.c_str());
+		system(compile_command.c_str());
+		end_phase("assemble", phase);
+		phase = begin_phase();
+		system(link_command.c_str());
+		end_phase("link", phase);
 
-	if (run) {
-		system(string_format("%s.exe", file_name).c_str());
+		if (options.run) {
+			system(string_format("%s.exe", file_name.c_str()).c_str());
+		}
+		return;
 	}
 
+	phase = begin_phase();
+	if (options.listing) {
+		write_listing(string_format("%s.asm", file_name.c_str()), procedures);
+	}
+	if (!options.object) {
+		// no c runtime to link against, so bring our own
+		for (std::vector<Instruction>& code : runtime_procedures()) {
+			procedures.push_back(code);
+			procedure_files.push_back("");
+		}
+	}
 
-#if false
-	int start = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-	system("compiled.exe");
-	int end = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-	std::cout << "graph took " << (end - start) / 1e9 << " seconds" << std::endl;
+	Assembly assembly;
+	assembly.source_name = file_name + ".graph";
+	for (int i = 0; i < procedures.size(); i++) {
+		assemble_procedure(assembly, procedures[i], procedure_files[i]);
+	}
+	DataSection data = build_data_section();
+	DataSection constants = build_constant_section();
+	end_phase("assemble", phase);
+	add_count("code bytes", assembly.text.size());
 
-	start = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-	system("python C:/Users/Thewa/AppData/Local/Programs/Python/Python310/speed_test.py");
-	end = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-	std::cout << "python took " << (end - start) / 1e9 << " seconds" << std::endl;
+	phase = begin_phase();
+	std::string executable_name = file_name;
+	if (options.object) {
+		std::string object_name = string_format("%s.o", file_name.c_str());
+		write_elf_object(object_name, assembly, data, constants);
+		if (!options.run) {
+			end_phase("link", phase);
+			return;
+		}
+		system(string_format("cc -o %s %s", executable_name.c_str(), object_name.c_str()).c_str());
+	}
+	else {
+		write_elf_executable(executable_name, assembly, data, constants, "_start");
+#ifndef _WIN32
+		chmod(executable_name.c_str(), 0755);
 #endif
-}
\ No newline at end of file
+	}
+	end_phase("link", phase);
+
+	if (options.run) {
+		if (executable_name.find('/') == std::string::npos) executable_name = "./" + executable_name;
+		system(executable_name.c_str());
+	}
+}
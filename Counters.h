@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// HARDWARE COUNTERS
+// cycles and instructions retired around a piece of work, through perf_event_open on linux. the counters are
+// inherited, so a program started with system() is counted once it exits, along with the shell that started it.
+// where there are no counters, no permission to read them or it isn't linux, only the time is measured
+
+struct CounterReading {
+	double milliseconds = 0;
+	long long cycles = -1; // -1 when it couldn't be counted
+	long long instructions = -1;
+
+	double instructions_per_cycle() const {
+		return cycles > 0 && instructions >= 0 ? (double)instructions / cycles : -1;
+	}
+};
+
+struct HardwareCounters {
+	int cycles = -1;
+	int instructions = -1;
+	std::chrono::steady_clock::time_point start;
+};
+
+#ifdef __linux__
+int open_hardware_counter(unsigned long long config) {
+	perf_event_attr attributes;
+	memset(&attributes, 0, sizeof(attributes));
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = config;
+	attributes.disabled = 1;
+	attributes.inherit = 1;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	return (int)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+#endif
+
+HardwareCounters start_counters() {
+	HardwareCounters counters;
+#ifdef __linux__
+	counters.cycles = open_hardware_counter(PERF_COUNT_HW_CPU_CYCLES);
+	counters.instructions = open_hardware_counter(PERF_COUNT_HW_INSTRUCTIONS);
+	if (counters.cycles >= 0) ioctl(counters.cycles, PERF_EVENT_IOC_ENABLE, 0);
+	if (counters.instructions >= 0) ioctl(counters.instructions, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+	counters.start = std::chrono::steady_clock::now();
+	return counters;
+}
+
+CounterReading stop_counters(HardwareCounters& counters) {
+	CounterReading reading;
+	auto end = std::chrono::steady_clock::now();
+	reading.milliseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - counters.start).count() / 1e6;
+#ifdef __linux__
+	int descriptors[] = { counters.cycles, counters.instructions };
+	long long* values[] = { &reading.cycles, &reading.instructions };
+	for (int i = 0; i < 2; i++) {
+		if (descriptors[i] < 0) continue;
+		ioctl(descriptors[i], PERF_EVENT_IOC_DISABLE, 0);
+		long long value = 0;
+		if (read(descriptors[i], &value, sizeof(value)) == sizeof(value)) *values[i] = value;
+		close(descriptors[i]);
+	}
+#endif
+	return reading;
+}
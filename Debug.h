@@ -0,0 +1,233 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Assembler.h"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+// DEBUG INFORMATION
+// dwarf 4 for perf, gdb and addr2line. a line table maps each run of code back to the .graph file and line of
+// the statement it was generated from, and one compile unit lists every procedure with where it starts and
+// ends. addresses are written relative to the start of the text and listed as fixups, an executable adds where
+// the text was placed and an object turns them into relocations for the linker
+
+struct DebugFixup {
+	enum class Target { TEXT, ABBREV, LINE };
+	int offset; // of the field in its section
+	int size; // 8 for addresses, 4 for offsets into another debug section
+	Target target;
+	long long addend;
+};
+
+struct DebugSections {
+	std::vector<unsigned char> abbrev;
+	std::vector<unsigned char> info;
+	std::vector<unsigned char> line;
+	std::vector<DebugFixup> info_fixups;
+	std::vector<DebugFixup> line_fixups;
+};
+
+void write_uleb(std::vector<unsigned char>& out, unsigned long long value) {
+	do {
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+		out.push_back(value != 0 ? byte | 0x80 : byte);
+	} while (value != 0);
+}
+
+void write_sleb(std::vector<unsigned char>& out, long long value) {
+	while (true) {
+		unsigned char byte = value & 0x7f;
+		value >>= 7; // arithmetic, so the sign carries
+		bool done = (value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40));
+		out.push_back(done ? byte : byte | 0x80);
+		if (done) return;
+	}
+}
+
+void write_debug_string(std::vector<unsigned char>& out, const std::string& value) {
+	out.insert(out.end(), value.begin(), value.end());
+	out.push_back(0);
+}
+
+void write_fixup(std::vector<unsigned char>& out, std::vector<DebugFixup>& fixups, int size, DebugFixup::Target target, long long addend) {
+	fixups.push_back(DebugFixup{ (int)out.size(), size, target, addend });
+	write_bytes(out, addend, size);
+}
+
+std::string current_directory() {
+	char buffer[4096];
+#ifdef _WIN32
+	if (!_getcwd(buffer, sizeof(buffer))) return "";
+#else
+	if (!getcwd(buffer, sizeof(buffer))) return "";
+#endif
+	return buffer;
+}
+
+const int dw_lns_copy = 1;
+const int dw_lns_advance_pc = 2;
+const int dw_lns_advance_line = 3;
+const int dw_lns_set_file = 4;
+const int dw_lne_end_sequence = 1;
+const int dw_lne_set_address = 2;
+
+// no special opcodes, every row is advance, advance, copy. it's bigger but simple and nothing reads it often
+void build_line_table(DebugSections& debug, Assembly& assembly) {
+	std::vector<unsigned char>& out = debug.line;
+	out.clear();
+	write_bytes(out, 0, 4); // unit length
+	write_bytes(out, 4, 2); // version
+	int header_length_at = out.size();
+	write_bytes(out, 0, 4);
+	int header_start = out.size();
+	write_bytes(out, 1, 1); // minimum instruction length
+	write_bytes(out, 1, 1); // operations per instruction
+	write_bytes(out, 1, 1); // every row is a statement
+	write_bytes(out, (unsigned char)-5, 1); // line base
+	write_bytes(out, 14, 1); // line range
+	write_bytes(out, 13, 1); // opcode base
+	const unsigned char opcode_lengths[] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+	out.insert(out.end(), opcode_lengths, opcode_lengths + sizeof(opcode_lengths));
+	out.push_back(0); // no include directories, the files are relative to the compile directory
+	for (const std::string& file : assembly.source_files) {
+		write_debug_string(out, file);
+		write_uleb(out, 0); // directory
+		write_uleb(out, 0); // modification time
+		write_uleb(out, 0); // length
+	}
+	out.push_back(0);
+	patch_int32(out, header_length_at, out.size() - header_start);
+
+	out.push_back(0);
+	write_uleb(out, 9);
+	out.push_back(dw_lne_set_address);
+	write_fixup(out, debug.line_fixups, 8, DebugFixup::Target::TEXT, 0);
+
+	int address = 0;
+	int file = 1;
+	int line = 1;
+	for (SourceLine& source_line : assembly.source_lines) {
+		if (source_line.offset != address) {
+			out.push_back(dw_lns_advance_pc);
+			write_uleb(out, source_line.offset - address);
+			address = source_line.offset;
+		}
+		// code with no source keeps whichever file came before, line 0 is what says it has none
+		if (source_line.file > 0 && source_line.file != file) {
+			out.push_back(dw_lns_set_file);
+			write_uleb(out, source_line.file);
+			file = source_line.file;
+		}
+		if (source_line.line != line) {
+			out.push_back(dw_lns_advance_line);
+			write_sleb(out, source_line.line - line);
+			line = source_line.line;
+		}
+		out.push_back(dw_lns_copy);
+	}
+	if ((int)assembly.text.size() != address) {
+		out.push_back(dw_lns_advance_pc);
+		write_uleb(out, assembly.text.size() - address);
+	}
+	out.push_back(0);
+	write_uleb(out, 1);
+	out.push_back(dw_lne_end_sequence);
+	patch_int32(out, 0, out.size() - 4); // the length doesn't count itself
+}
+
+const int dw_tag_compile_unit = 0x11;
+const int dw_tag_subprogram = 0x2e;
+const int dw_at_name = 0x03;
+const int dw_at_stmt_list = 0x10;
+const int dw_at_low_pc = 0x11;
+const int dw_at_high_pc = 0x12;
+const int dw_at_language = 0x13;
+const int dw_at_comp_dir = 0x1b;
+const int dw_at_producer = 0x25;
+const int dw_at_decl_file = 0x3a;
+const int dw_at_decl_line = 0x3b;
+const int dw_at_external = 0x3f;
+const int dw_form_addr = 0x01;
+const int dw_form_data2 = 0x05;
+const int dw_form_data8 = 0x07;
+const int dw_form_string = 0x08;
+const int dw_form_udata = 0x0f;
+const int dw_form_sec_offset = 0x17;
+const int dw_form_flag_present = 0x19;
+const int dw_lang_c99 = 0x0c; // there's no code for this language, debuggers know what to do with c
+
+void write_abbreviation(std::vector<unsigned char>& out, int code, int tag, bool children, const std::vector<std::pair<int, int>>& attributes) {
+	write_uleb(out, code);
+	write_uleb(out, tag);
+	out.push_back(children ? 1 : 0);
+	for (auto& attribute : attributes) {
+		write_uleb(out, attribute.first);
+		write_uleb(out, attribute.second);
+	}
+	out.push_back(0);
+	out.push_back(0);
+}
+
+DebugSections build_debug_sections(Assembly& assembly) {
+	DebugSections debug;
+	build_line_table(debug, assembly);
+
+	const int compile_unit_code = 1;
+	const int subprogram_code = 2;
+	write_abbreviation(debug.abbrev, compile_unit_code, dw_tag_compile_unit, true, {
+		{ dw_at_producer, dw_form_string }, { dw_at_language, dw_form_data2 }, { dw_at_name, dw_form_string },
+		{ dw_at_comp_dir, dw_form_string }, { dw_at_low_pc, dw_form_addr }, { dw_at_high_pc, dw_form_data8 },
+		{ dw_at_stmt_list, dw_form_sec_offset } });
+	write_abbreviation(debug.abbrev, subprogram_code, dw_tag_subprogram, false, {
+		{ dw_at_name, dw_form_string }, { dw_at_external, dw_form_flag_present }, { dw_at_low_pc, dw_form_addr },
+		{ dw_at_high_pc, dw_form_data8 }, { dw_at_decl_file, dw_form_udata }, { dw_at_decl_line, dw_form_udata } });
+	debug.abbrev.push_back(0);
+
+	std::vector<unsigned char>& out = debug.info;
+	write_bytes(out, 0, 4); // unit length
+	write_bytes(out, 4, 2); // version
+	write_fixup(out, debug.info_fixups, 4, DebugFixup::Target::ABBREV, 0);
+	write_bytes(out, 8, 1); // address size
+
+	write_uleb(out, compile_unit_code);
+	write_debug_string(out, "graph compiler");
+	write_bytes(out, dw_lang_c99, 2);
+	write_debug_string(out, assembly.source_name);
+	write_debug_string(out, current_directory());
+	write_fixup(out, debug.info_fixups, 8, DebugFixup::Target::TEXT, 0);
+	write_bytes(out, assembly.text.size(), 8); // high pc is the length
+	write_fixup(out, debug.info_fixups, 4, DebugFixup::Target::LINE, 0);
+
+	for (const std::string& name : assembly.symbol_order) {
+		auto source = assembly.symbol_sources.find(name);
+		if (source == assembly.symbol_sources.end()) continue;
+		write_uleb(out, subprogram_code);
+		write_debug_string(out, name);
+		write_fixup(out, debug.info_fixups, 8, DebugFixup::Target::TEXT, source->second.offset);
+		write_bytes(out, assembly.symbol_sizes[name], 8);
+		write_uleb(out, source->second.file);
+		write_uleb(out, source->second.line);
+	}
+	out.push_back(0); // end of the compile unit's children
+	patch_int32(out, 0, out.size() - 4);
+	return debug;
+}
+
+// an executable has nothing left to link, the text addresses are filled in where it was placed
+void place_debug_sections(DebugSections& debug, unsigned long long text_address) {
+	std::vector<unsigned char>* sections[] = { &debug.info, &debug.line };
+	std::vector<DebugFixup>* fixups[] = { &debug.info_fixups, &debug.line_fixups };
+	for (int i = 0; i < 2; i++) {
+		for (DebugFixup& fixup : *fixups[i]) {
+			if (fixup.target != DebugFixup::Target::TEXT) continue;
+			unsigned long long value = text_address + fixup.addend;
+			for (int b = 0; b < fixup.size; b++) {
+				(*sections[i])[fixup.offset + b] = (unsigned char)((value >> (b * 8)) & 0xff);
+			}
+		}
+	}
+}
@@ -0,0 +1,312 @@
+#pragma once
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Assembler.h"
+#include "Debug.h"
+
+// ELF64 OUTPUT
+// either a static executable with the text and data already placed and every address filled in, or a
+// relocatable object that the system linker can combine with the c runtime. float constants go in read only
+// data, which in an executable just follows the text. both carry a symbol for every procedure, with its size,
+// and the debug information that maps the code back to the source
+
+struct DataSection {
+	std::vector<unsigned char> bytes;
+	std::map<std::string, int> labels;
+	int bss_size = 0; // zeroed space after the bytes, only in executables
+};
+
+void add_data(DataSection& data, const std::string& label, const std::string& contents) {
+	while (data.bytes.size() % 8 != 0) data.bytes.push_back(0);
+	data.labels[label] = data.bytes.size();
+	data.bytes.insert(data.bytes.end(), contents.begin(), contents.end());
+}
+
+// space that starts out zeroed, after all the bytes so an executable doesn't have to store it
+void add_zeroed(DataSection& data, const std::string& label, int size, int alignment) {
+	int offset = data.bytes.size() + data.bss_size;
+	offset += (alignment - offset % alignment) % alignment;
+	data.labels[label] = offset;
+	data.bss_size = offset + size - data.bytes.size();
+}
+
+// the Elf64 structs are written field by field with write_bytes so the output doesn't depend on the host's padding
+void pad_to(std::vector<unsigned char>& out, int alignment) {
+	while (out.size() % alignment != 0) out.push_back(0);
+}
+
+const int elf_header_size = 64;
+const int program_header_size = 56;
+const int section_header_size = 64;
+
+void write_elf_header(std::vector<unsigned char>& out, int file_type, unsigned long long entry, int program_header_count, unsigned long long section_header_offset, int section_count, int section_names_index) {
+	const unsigned char identity[] = { 0x7f, 'E', 'L', 'F', 2 /* 64 bit */, 1 /* little endian */, 1 /* version */, 0 /* system v */ };
+	out.insert(out.end(), identity, identity + sizeof(identity));
+	write_bytes(out, 0, 8);
+	write_bytes(out, file_type, 2);
+	write_bytes(out, 62, 2); // x86-64
+	write_bytes(out, 1, 4);
+	write_bytes(out, entry, 8);
+	write_bytes(out, program_header_count > 0 ? elf_header_size : 0, 8);
+	write_bytes(out, section_header_offset, 8);
+	write_bytes(out, 0, 4); // flags
+	write_bytes(out, elf_header_size, 2);
+	write_bytes(out, program_header_count > 0 ? program_header_size : 0, 2);
+	write_bytes(out, program_header_count, 2);
+	write_bytes(out, section_count > 0 ? section_header_size : 0, 2);
+	write_bytes(out, section_count, 2);
+	write_bytes(out, section_names_index, 2);
+}
+
+void write_program_header(std::vector<unsigned char>& out, int flags, unsigned long long offset, unsigned long long address, unsigned long long file_size, unsigned long long memory_size) {
+	write_bytes(out, 1, 4); // loadable
+	write_bytes(out, flags, 4);
+	write_bytes(out, offset, 8);
+	write_bytes(out, address, 8);
+	write_bytes(out, address, 8);
+	write_bytes(out, file_size, 8);
+	write_bytes(out, memory_size, 8);
+	write_bytes(out, 0x1000, 8);
+}
+
+void write_file(const std::string& file_name, std::vector<unsigned char>& bytes) {
+	std::ofstream out(file_name, std::ios::binary);
+	out.write((const char*)bytes.data(), bytes.size());
+}
+
+struct SectionHeader {
+	int name = 0;
+	int type = 0;
+	unsigned long long flags = 0;
+	unsigned long long offset = 0;
+	unsigned long long size = 0;
+	int link = 0;
+	int info = 0;
+	unsigned long long alignment = 0;
+	unsigned long long entry_size = 0;
+	unsigned long long address = 0; // only for sections an executable loads
+};
+
+int add_string(std::vector<unsigned char>& table, const std::string& value) {
+	int index = table.size();
+	table.insert(table.end(), value.begin(), value.end());
+	table.push_back(0);
+	return index;
+}
+
+void write_symbol(std::vector<unsigned char>& out, int name, int info, int section, unsigned long long value, unsigned long long size) {
+	write_bytes(out, name, 4);
+	write_bytes(out, info, 1);
+	write_bytes(out, 0, 1);
+	write_bytes(out, section, 2);
+	write_bytes(out, value, 8);
+	write_bytes(out, size, 8);
+}
+
+// the section headers go at the end, once everything they describe has been placed
+void write_section_headers(std::vector<unsigned char>& out, std::vector<SectionHeader>& sections) {
+	pad_to(out, 8);
+	// the elf header went out before we knew where they would start
+	unsigned long long section_header_offset = out.size();
+	for (int i = 0; i < 8; i++) {
+		out[40 + i] = (unsigned char)((section_header_offset >> (i * 8)) & 0xff);
+	}
+	for (SectionHeader& section : sections) {
+		write_bytes(out, section.name, 4);
+		write_bytes(out, section.type, 4);
+		write_bytes(out, section.flags, 8);
+		write_bytes(out, section.address, 8);
+		write_bytes(out, section.offset, 8);
+		write_bytes(out, section.size, 8);
+		write_bytes(out, section.link, 4);
+		write_bytes(out, section.info, 4);
+		write_bytes(out, section.alignment, 8);
+		write_bytes(out, section.entry_size, 8);
+	}
+}
+
+const unsigned long long executable_base = 0x400000;
+const int page_size = 0x1000;
+
+// two segments, the headers, text and constants readable and executable, the data writable. the symbols and
+// debug information come after them and aren't loaded
+void write_elf_executable(const std::string& file_name, Assembly& assembly, DataSection& data, DataSection& constants, const std::string& entry) {
+	std::vector<Relocation> relocations = resolve_procedure_relocations(assembly);
+
+	const int text_offset = elf_header_size + 2 * program_header_size;
+	unsigned long long text_address = executable_base + text_offset;
+	int constants_offset = text_offset + assembly.text.size();
+	constants_offset += (16 - constants_offset % 16) % 16;
+	unsigned long long constants_address = executable_base + constants_offset;
+	int data_offset = constants_offset + constants.bytes.size();
+	data_offset += (page_size - data_offset % page_size) % page_size;
+	unsigned long long data_address = executable_base + data_offset;
+
+	for (Relocation& relocation : relocations) {
+		long long target;
+		if (data.labels.count(relocation.symbol) > 0) {
+			target = data_address + data.labels[relocation.symbol];
+		}
+		else if (constants.labels.count(relocation.symbol) > 0) {
+			target = constants_address + constants.labels[relocation.symbol];
+		}
+		else {
+			throw std::runtime_error("unresolved symbol " + relocation.symbol + ", link against it with -object");
+		}
+		patch_int32(assembly.text, relocation.offset, target + relocation.addend - (long long)(text_address + relocation.instruction_end));
+	}
+	if (assembly.symbols.count(entry) == 0) {
+		throw std::runtime_error("no entry point " + entry);
+	}
+
+	enum { NULL_SECTION, TEXT, CONSTANTS, DATA, SYMBOLS, STRINGS, DEBUG_ABBREV, DEBUG_INFO, DEBUG_LINE, SECTION_NAMES, SECTION_COUNT };
+	const int symbol_size = 24;
+
+	std::vector<unsigned char> strings;
+	std::vector<unsigned char> symbols;
+	strings.push_back(0);
+	write_symbol(symbols, 0, 0, 0, 0, 0);
+	for (const std::string& name : assembly.symbol_order) {
+		write_symbol(symbols, add_string(strings, name), 0x12 /* global function */, TEXT, text_address + assembly.symbols[name], assembly.symbol_sizes[name]);
+	}
+	DebugSections debug = build_debug_sections(assembly);
+	place_debug_sections(debug, text_address);
+
+	std::vector<unsigned char> section_names;
+	section_names.push_back(0);
+	std::vector<SectionHeader> sections(SECTION_COUNT);
+	sections[NULL_SECTION] = SectionHeader{};
+	sections[TEXT] = SectionHeader{ add_string(section_names, ".text"), 1, 0x6 /* alloc execute */, (unsigned long long)text_offset, assembly.text.size(), 0, 0, 16, 0, text_address };
+	sections[CONSTANTS] = SectionHeader{ add_string(section_names, ".rodata"), 1, 0x2 /* alloc */, (unsigned long long)constants_offset, constants.bytes.size(), 0, 0, 16, 0, constants_address };
+	sections[DATA] = SectionHeader{ add_string(section_names, ".data"), 1, 0x3 /* write alloc */, (unsigned long long)data_offset, data.bytes.size(), 0, 0, 8, 0, data_address };
+	sections[SYMBOLS] = SectionHeader{ add_string(section_names, ".symtab"), 2, 0, 0, symbols.size(), STRINGS, 1 /* first global */, 8, symbol_size };
+	sections[STRINGS] = SectionHeader{ add_string(section_names, ".strtab"), 3, 0, 0, strings.size(), 0, 0, 1, 0 };
+	sections[DEBUG_ABBREV] = SectionHeader{ add_string(section_names, ".debug_abbrev"), 1, 0, 0, debug.abbrev.size(), 0, 0, 1, 0 };
+	sections[DEBUG_INFO] = SectionHeader{ add_string(section_names, ".debug_info"), 1, 0, 0, debug.info.size(), 0, 0, 1, 0 };
+	sections[DEBUG_LINE] = SectionHeader{ add_string(section_names, ".debug_line"), 1, 0, 0, debug.line.size(), 0, 0, 1, 0 };
+	sections[SECTION_NAMES] = SectionHeader{ add_string(section_names, ".shstrtab"), 3, 0, 0, section_names.size(), 0, 0, 1, 0 };
+
+	std::vector<unsigned char> out;
+	write_elf_header(out, 2 /* executable */, text_address + assembly.symbols[entry], 2, 0, SECTION_COUNT, SECTION_NAMES);
+	int text_end = constants_offset + constants.bytes.size();
+	write_program_header(out, 5 /* read execute */, 0, executable_base, text_end, text_end);
+	write_program_header(out, 6 /* read write */, data_offset, data_address, data.bytes.size(), data.bytes.size() + data.bss_size);
+	out.insert(out.end(), assembly.text.begin(), assembly.text.end());
+	pad_to(out, 16);
+	out.insert(out.end(), constants.bytes.begin(), constants.bytes.end());
+	pad_to(out, page_size);
+	out.insert(out.end(), data.bytes.begin(), data.bytes.end());
+	std::vector<unsigned char>* unloaded[] = { &symbols, &strings, &debug.abbrev, &debug.info, &debug.line, &section_names };
+	for (int i = 0; i < 6; i++) {
+		pad_to(out, 8);
+		sections[SYMBOLS + i].offset = out.size();
+		out.insert(out.end(), unloaded[i]->begin(), unloaded[i]->end());
+	}
+	write_section_headers(out, sections);
+	write_file(file_name, out);
+}
+
+// procedures are global symbols, anything called but not defined becomes an undefined symbol for the linker
+void write_elf_object(const std::string& file_name, Assembly& assembly, DataSection& data, DataSection& constants) {
+	std::vector<Relocation> relocations = resolve_procedure_relocations(assembly);
+	data.bytes.resize(data.bytes.size() + data.bss_size); // an object has no bss, the zeroes are written out
+	data.bss_size = 0;
+
+	enum {
+		NULL_SECTION, TEXT, DATA, CONSTANTS, SYMBOLS, STRINGS, TEXT_RELOCATIONS, DEBUG_ABBREV, DEBUG_INFO, DEBUG_INFO_RELOCATIONS,
+		DEBUG_LINE, DEBUG_LINE_RELOCATIONS, STACK_NOTE, SECTION_NAMES, SECTION_COUNT
+	};
+	const int symbol_size = 24;
+
+	std::vector<unsigned char> strings;
+	std::vector<unsigned char> symbols;
+	strings.push_back(0);
+	write_symbol(symbols, 0, 0, 0, 0, 0);
+	write_symbol(symbols, 0, 3 /* local section */, TEXT, 0, 0);
+	write_symbol(symbols, 0, 3, DATA, 0, 0);
+	write_symbol(symbols, 0, 3, CONSTANTS, 0, 0);
+	write_symbol(symbols, 0, 3, DEBUG_ABBREV, 0, 0);
+	write_symbol(symbols, 0, 3, DEBUG_LINE, 0, 0);
+	const int text_symbol = 1;
+	const int data_symbol = 2;
+	const int constants_symbol = 3;
+	const int first_global = 6;
+	const int debug_symbols[] = { text_symbol, 4, 5 }; // by DebugFixup::Target
+
+	std::map<std::string, int> symbol_indices;
+	for (const std::string& name : assembly.symbol_order) {
+		symbol_indices[name] = symbols.size() / symbol_size;
+		write_symbol(symbols, add_string(strings, name), 0x12 /* global function */, TEXT, assembly.symbols[name], assembly.symbol_sizes[name]);
+	}
+
+	std::vector<unsigned char> relocation_entries;
+	for (Relocation& relocation : relocations) {
+		int to_end = relocation.instruction_end - relocation.offset - relocation.addend;
+		if (data.labels.count(relocation.symbol) > 0) {
+			write_bytes(relocation_entries, relocation.offset, 8);
+			write_bytes(relocation_entries, ((unsigned long long)data_symbol << 32) | 2 /* pc32 */, 8);
+			write_bytes(relocation_entries, (long long)data.labels[relocation.symbol] - to_end, 8);
+			continue;
+		}
+		if (constants.labels.count(relocation.symbol) > 0) {
+			write_bytes(relocation_entries, relocation.offset, 8);
+			write_bytes(relocation_entries, ((unsigned long long)constants_symbol << 32) | 2 /* pc32 */, 8);
+			write_bytes(relocation_entries, (long long)constants.labels[relocation.symbol] - to_end, 8);
+			continue;
+		}
+		if (symbol_indices.count(relocation.symbol) == 0) {
+			symbol_indices[relocation.symbol] = symbols.size() / symbol_size;
+			write_symbol(symbols, add_string(strings, relocation.symbol), 0x10 /* global, no type */, 0, 0, 0);
+		}
+		write_bytes(relocation_entries, relocation.offset, 8);
+		write_bytes(relocation_entries, ((unsigned long long)symbol_indices[relocation.symbol] << 32) | 4 /* plt32 */, 8);
+		write_bytes(relocation_entries, -(long long)to_end, 8);
+	}
+
+	// the linker puts our debug sections after those of the c runtime, so offsets between them are relocated too
+	DebugSections debug = build_debug_sections(assembly);
+	std::vector<unsigned char> debug_relocations[2];
+	std::vector<DebugFixup>* fixups[] = { &debug.info_fixups, &debug.line_fixups };
+	for (int i = 0; i < 2; i++) {
+		for (DebugFixup& fixup : *fixups[i]) {
+			write_bytes(debug_relocations[i], fixup.offset, 8);
+			write_bytes(debug_relocations[i], ((unsigned long long)debug_symbols[(int)fixup.target] << 32) | (fixup.size == 8 ? 1 /* 64 */ : 10 /* 32 */), 8);
+			write_bytes(debug_relocations[i], fixup.addend, 8);
+		}
+	}
+
+	std::vector<unsigned char> section_names;
+	section_names.push_back(0);
+	std::vector<SectionHeader> sections(SECTION_COUNT);
+	sections[NULL_SECTION] = SectionHeader{};
+	sections[TEXT] = SectionHeader{ add_string(section_names, ".text"), 1, 0x6 /* alloc execute */, 0, assembly.text.size(), 0, 0, 16, 0 };
+	sections[DATA] = SectionHeader{ add_string(section_names, ".data"), 1, 0x3 /* write alloc */, 0, data.bytes.size(), 0, 0, 32, 0 };
+	sections[CONSTANTS] = SectionHeader{ add_string(section_names, ".rodata"), 1, 0x2 /* alloc */, 0, constants.bytes.size(), 0, 0, 8, 0 };
+	sections[SYMBOLS] = SectionHeader{ add_string(section_names, ".symtab"), 2, 0, 0, symbols.size(), STRINGS, first_global, 8, symbol_size };
+	sections[STRINGS] = SectionHeader{ add_string(section_names, ".strtab"), 3, 0, 0, strings.size(), 0, 0, 1, 0 };
+	sections[TEXT_RELOCATIONS] = SectionHeader{ add_string(section_names, ".rela.text"), 4, 0x40 /* info link */, 0, relocation_entries.size(), SYMBOLS, TEXT, 8, 24 };
+	sections[DEBUG_ABBREV] = SectionHeader{ add_string(section_names, ".debug_abbrev"), 1, 0, 0, debug.abbrev.size(), 0, 0, 1, 0 };
+	sections[DEBUG_INFO] = SectionHeader{ add_string(section_names, ".debug_info"), 1, 0, 0, debug.info.size(), 0, 0, 1, 0 };
+	sections[DEBUG_INFO_RELOCATIONS] = SectionHeader{ add_string(section_names, ".rela.debug_info"), 4, 0x40, 0, debug_relocations[0].size(), SYMBOLS, DEBUG_INFO, 8, 24 };
+	sections[DEBUG_LINE] = SectionHeader{ add_string(section_names, ".debug_line"), 1, 0, 0, debug.line.size(), 0, 0, 1, 0 };
+	sections[DEBUG_LINE_RELOCATIONS] = SectionHeader{ add_string(section_names, ".rela.debug_line"), 4, 0x40, 0, debug_relocations[1].size(), SYMBOLS, DEBUG_LINE, 8, 24 };
+	sections[STACK_NOTE] = SectionHeader{ add_string(section_names, ".note.GNU-stack"), 1, 0, 0, 0, 0, 0, 1, 0 };
+	sections[SECTION_NAMES] = SectionHeader{ add_string(section_names, ".shstrtab"), 3, 0, 0, section_names.size(), 0, 0, 1, 0 };
+
+	std::vector<unsigned char> out;
+	write_elf_header(out, 1 /* relocatable */, 0, 0, 0, SECTION_COUNT, SECTION_NAMES);
+	std::vector<std::vector<unsigned char>*> contents = {
+		nullptr, &assembly.text, &data.bytes, &constants.bytes, &symbols, &strings, &relocation_entries, &debug.abbrev, &debug.info,
+		&debug_relocations[0], &debug.line, &debug_relocations[1], nullptr, &section_names
+	};
+	for (int i = 1; i < SECTION_COUNT; i++) {
+		pad_to(out, 16);
+		sections[i].offset = out.size();
+		if (contents[i]) out.insert(out.end(), contents[i]->begin(), contents[i]->end());
+	}
+	write_section_headers(out, sections);
+	write_file(file_name, out);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include "Instructions.h"
+#include "Parsing.h"
+#include "RegisterAllocator.h"
+#include "Target.h"
+#include "Types.h"
+
+// FRAME LAYOUT
+// decides what a procedure's stack frame looks like once its registers are allocated. a procedure that calls
+// nothing is a leaf: it keeps its slots relative to rsp instead of setting up rbp, needs no shadow space and on
+// linux fits small frames in the red zone without moving rsp at all. everything else gets rbp, its slots, and
+// the shadow space at the bottom where the callee expects it, rounded so calls see rsp 16 byte aligned
+
+struct FrameLayout {
+	bool frame_pointer = true; // push rbp / mov rbp, rsp and leave
+	int reserved = 0; // bytes rsp is moved down by after the pushes
+};
+
+// a call in tail position leaves the frame before it jumps, so it doesn't stop a procedure being a leaf
+bool makes_calls(SyntaxNode* node) {
+	switch (node->type)
+	{
+	case SyntaxNode::Type::PROCEDURE_CALL:
+	{
+		if (!is_intrinsic(node)) return true;
+		for (SyntaxNode* input : ((ProcedureCall*)node)->inputs) {
+			if (makes_calls(input)) return true;
+		}
+		return false;
+	}
+	case SyntaxNode::Type::BINARY_OPERATOR:
+		return makes_calls(((BinaryOperator*)node)->left) || makes_calls(((BinaryOperator*)node)->right);
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		return makes_calls(((VariableAssignment*)node)->value);
+	case SyntaxNode::Type::RETURN_STATEMENT:
+	{
+		SyntaxNode* expression = ((ReturnStatement*)node)->expression;
+		if (expression->type == SyntaxNode::Type::PROCEDURE_CALL && !is_intrinsic(expression)) {
+			for (SyntaxNode* input : ((ProcedureCall*)expression)->inputs) {
+				if (makes_calls(input)) return true;
+			}
+			return false;
+		}
+		return makes_calls(expression);
+	}
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		return makes_calls(((WhileStatement*)node)->condition) || makes_calls(((WhileStatement*)node)->body);
+	case SyntaxNode::Type::IF_STATEMENT:
+		return makes_calls(((IfStatement*)node)->condition) || makes_calls(((IfStatement*)node)->body);
+	case SyntaxNode::Type::BLOCK:
+		for (SyntaxNode* statement : ((Block*)node)->statements) {
+			if (makes_calls(statement)) return true;
+		}
+		return false;
+	default:
+		return false;
+	}
+}
+
+void rebase_slot(Operand& slot, int displacement) {
+	if (slot.is_memory() && slot.reg == Register::RBP) {
+		slot.reg = Register::RSP;
+		slot.value += displacement;
+	}
+}
+
+// a saved rbx is pushed before rbp. a leaf's slots are relative to rsp after the push, so they stay where they
+// are whether or not the push is later dropped
+FrameLayout layout_frame(Procedure* procedure, RegisterAllocation& allocation, bool saves_accumulator, bool needs_frame) {
+	FrameLayout frame;
+	if (needs_frame || makes_calls(procedure->body)) {
+		// the return address and every push but rbp's leave rsp 8 off, the reservation makes that up
+		int pushed = saves_accumulator ? 8 : 0;
+		int needed = allocation.stack_size + target.shadow_space + pushed;
+		frame.reserved = (needed + 15) / 16 * 16 - pushed;
+		return frame;
+	}
+
+	// the slots go straight below the return address, a leaf makes no calls so rsp needn't be aligned
+	frame.frame_pointer = false;
+	int displacement = 0;
+	if (allocation.stack_size > target.red_zone) {
+		frame.reserved = allocation.stack_size;
+		displacement = frame.reserved;
+	}
+	for (auto& location : allocation.locations) {
+		rebase_slot(location.second, displacement);
+	}
+	for (Operand& slot : allocation.saved_slots) {
+		rebase_slot(slot, displacement);
+	}
+	return frame;
+}
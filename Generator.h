@@ -0,0 +1,84 @@
+#pragma once
+#include <string>
+#include "Utils.h"
+
+// SYNTHETIC PROGRAMS
+// made up programs for measuring how the compiler scales with its input. every procedure has the same shape,
+// set by the settings, and calls the one before it so main reaches all of them and none are stripped. the
+// arithmetic only reads inputs and variables, so nothing but main's one call can be folded at compile time
+
+struct GeneratorSettings {
+	long long size = 0; // bytes of source to stop after, when procedures isn't given
+	int procedures = 0;
+	int statements = 4; // assignments at the start of each block
+	int depth = 2; // whiles and ifs nested inside each other
+	int expression = 4; // operators in each expression
+	int strings = 1; // printf calls with their own string literal in each procedure
+};
+
+// operators only, the language has no precedence or parentheses so anything goes
+std::string generated_expression(const GeneratorSettings& settings, int seed) {
+	const char* operands[] = { "a", "b", "x", "3", "y", "7" };
+	const char* operators[] = { " + ", " - ", " * " };
+	std::string expression = operands[seed % 6];
+	for (int i = 0; i < settings.expression; i++) {
+		expression += operators[(seed + i) % 3];
+		expression += operands[(seed + i * 5 + 1) % 6];
+	}
+	return expression;
+}
+
+// even depths are loops, odd depths are ifs
+void generate_block(std::string& text, const GeneratorSettings& settings, int depth, const std::string& indent, int& seed) {
+	for (int i = 0; i < settings.statements; i++) {
+		text += indent + "x = " + generated_expression(settings, seed++) + ";\n";
+	}
+	if (depth <= 0) {
+		return;
+	}
+	std::string inner = indent + "  ";
+	if (depth % 2 == 0) {
+		std::string counter = string_format("n%d", depth);
+		text += indent + counter + ": int;\n";
+		text += indent + counter + " = 0;\n";
+		text += indent + "while (" + counter + " < 4) {\n";
+		generate_block(text, settings, depth - 1, inner, seed);
+		text += inner + counter + " = " + counter + " + 1;\n";
+		text += indent + "}\n";
+	}
+	else {
+		text += indent + "if (x < a) {\n";
+		generate_block(text, settings, depth - 1, inner, seed);
+		text += indent + "}\n";
+	}
+}
+
+void generate_procedure(std::string& text, const GeneratorSettings& settings, int index) {
+	int seed = index;
+	text += string_format("p%d :: (a: int, b: int){\n", index);
+	text += "  x: int;\n  x = a;\n  y: int;\n  y = b;\n";
+	generate_block(text, settings, settings.depth, "  ", seed);
+	for (int i = 0; i < settings.strings; i++) {
+		text += string_format("  printf(\"p%d says %d %%d\", x);\n", index, i);
+	}
+	if (index > 0) {
+		text += string_format("  x = x + p%d(y, x);\n", index - 1);
+	}
+	text += "  <- x;\n}\n";
+}
+
+std::string generate_program(const GeneratorSettings& settings) {
+	std::string text = "// generated\n";
+	std::string main_text;
+	int procedures = 0;
+	while (true) {
+		main_text = string_format("main :: (){\n  printf(\"%%d\", p%d(1, 2));\n  <- 0;\n}\n", procedures);
+		generate_procedure(text, settings, procedures);
+		procedures++;
+		if (settings.procedures > 0 ? procedures >= settings.procedures : text.size() + main_text.size() >= settings.size) {
+			break;
+		}
+	}
+	main_text = string_format("main :: (){\n  printf(\"%%d\", p%d(1, 2));\n  <- 0;\n}\n", procedures - 1);
+	return text + main_text;
+}
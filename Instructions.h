@@ -0,0 +1,433 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+// MACHINE INSTRUCTIONS
+// code generation builds a list of these per procedure, so passes can rewrite it before it is printed as nasm
+
+// numbered the way the hardware encodes them
+enum class Register {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+	XMM0, XMM1, XMM2, XMM3, XMM4, XMM5, XMM6, XMM7,
+	XMM8, XMM9, XMM10, XMM11, XMM12, XMM13, XMM14, XMM15,
+	NONE
+};
+
+bool is_xmm(Register reg) {
+	return reg >= Register::XMM0 && reg <= Register::XMM15;
+}
+
+const char* register_names_64[] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+const char* register_names_32[] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+const char* register_names_16[] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w" };
+const char* register_names_8[] = { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b" };
+const char* register_names_xmm[] = { "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14", "xmm15" };
+const char* register_names_ymm[] = { "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7", "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15" };
+
+enum class Condition {
+	NONE,
+	E, NE,
+	L, GE,
+	LE, G,
+	B, AE,
+	BE, A,
+	P, NP
+};
+
+const char* condition_names[] = { "", "e", "ne", "l", "ge", "le", "g", "b", "ae", "be", "a", "p", "np" };
+
+Condition invert_condition(Condition condition) {
+	switch (condition)
+	{
+	case Condition::E: return Condition::NE;
+	case Condition::NE: return Condition::E;
+	case Condition::L: return Condition::GE;
+	case Condition::GE: return Condition::L;
+	case Condition::LE: return Condition::G;
+	case Condition::G: return Condition::LE;
+	case Condition::B: return Condition::AE;
+	case Condition::AE: return Condition::B;
+	case Condition::BE: return Condition::A;
+	case Condition::A: return Condition::BE;
+	case Condition::P: return Condition::NP;
+	case Condition::NP: return Condition::P;
+	default: return Condition::NONE;
+	}
+}
+
+struct Operand {
+	enum class Type {
+		NONE,
+		REGISTER,
+		IMMEDIATE,
+		MEMORY, // [base + index * scale + displacement], or [label] relative to rip when base is NONE
+		LABEL
+	};
+
+	Type type = Type::NONE;
+	Register reg = Register::NONE;
+	long long value = 0;
+	std::string label;
+	int size = 8;
+	Register index = Register::NONE;
+	int scale = 1;
+
+	bool operator == (const Operand& other) const {
+		return type == other.type && reg == other.reg && value == other.value && label == other.label && size == other.size &&
+			index == other.index && scale == other.scale;
+	}
+	bool operator != (const Operand& other) const {
+		return !(*this == other);
+	}
+
+	bool is_register() const { return type == Type::REGISTER; }
+	bool is_register(Register r) const { return type == Type::REGISTER && reg == r; }
+	bool is_memory() const { return type == Type::MEMORY; }
+	bool is_immediate() const { return type == Type::IMMEDIATE; }
+
+	// whether reading this operand reads the register, as a value or as an address
+	bool uses(Register r) const { return ((type == Type::REGISTER || type == Type::MEMORY) && reg == r) || (type == Type::MEMORY && index == r); }
+};
+
+Operand register_operand(Register reg, int size = 8) {
+	Operand operand;
+	operand.type = Operand::Type::REGISTER;
+	operand.reg = reg;
+	operand.size = size;
+	return operand;
+}
+
+Operand immediate_operand(long long value) {
+	Operand operand;
+	operand.type = Operand::Type::IMMEDIATE;
+	operand.value = value;
+	return operand;
+}
+
+Operand memory_operand(Register base, long long displacement, int size = 8) {
+	Operand operand;
+	operand.type = Operand::Type::MEMORY;
+	operand.reg = base;
+	operand.value = displacement;
+	operand.size = size;
+	return operand;
+}
+
+Operand indexed_memory_operand(Register base, Register index, int scale, long long displacement, int size = 8) {
+	Operand operand = memory_operand(base, displacement, size);
+	operand.index = index;
+	operand.scale = scale;
+	return operand;
+}
+
+Operand label_memory_operand(const std::string& label, int size = 8) {
+	Operand operand;
+	operand.type = Operand::Type::MEMORY;
+	operand.label = label;
+	operand.size = size;
+	return operand;
+}
+
+Operand label_operand(const std::string& label) {
+	Operand operand;
+	operand.type = Operand::Type::LABEL;
+	operand.label = label;
+	return operand;
+}
+
+enum class Opcode {
+	MOV,
+	MOVZX,
+	MOVSX,
+	LEA,
+	ADD,
+	SUB,
+	IMUL,
+	XOR,
+	AND,
+	SHL,
+	SHR, // logical
+	SAR, // arithmetic
+	NEG,
+	DIV,
+	IDIV,
+	CQO, // sign extends rax into rdx
+	CMP,
+	TEST,
+	SETCC,
+	JMP,
+	JCC,
+	CALL,
+	RET,
+	LEAVE,
+	PUSH,
+	POP,
+	SYSCALL,
+
+	// scalar floating point, the operand size picks single (4) or double (8) precision
+	MOVSD,
+	ADDSD,
+	SUBSD,
+	MULSD,
+	DIVSD,
+	COMISD,
+	CVTSI2SD,
+	CVTTSD2SI, // truncates
+	CVTSS2SD,
+	CVTSD2SS,
+	XORPS,
+	MOVAPS, // whole register copy, movsd between registers only writes the low lane and waits on the rest
+	MOVQ, // between general and xmm registers, movd when the general one is 32 bit
+	PINSRD, // dst, 32 bit general register, which lane. the other lanes are kept
+
+	// packed, on all of an xmm register (size 16) or with avx2 a ymm one (size 32). the 32 byte forms are
+	// printed and encoded as their three operand v forms with the destination as the first source
+	MOVUPS,
+	ADDPS,
+	SUBPS,
+	MULPS,
+	DIVPS,
+	ADDPD,
+	SUBPD,
+	MULPD,
+	DIVPD,
+	PADDD,
+	PADDQ,
+	PSUBD,
+	PSUBQ,
+	PMULLD,
+	PMINSD,
+	PMAXSD,
+	MINPS,
+	MAXPS,
+	PCMPEQD, // every bit of a lane set where the comparison holds
+	PCMPGTD,
+	CMPPS, // dst, src, predicate: 0 is equal, 1 is less than
+	PSHUFD, // dst, src, lane selection
+	VPBROADCASTD, // avx2 only, the low lane of an xmm register to every lane
+	VPBROADCASTQ,
+	VEXTRACTI128, // dst, src, which half
+	VINSERTI128, // dst, xmm src, which half of dst it replaces. the other half is kept
+	VZEROUPPER, // after avx code so the sse code after it doesn't wait on the upper halves
+
+	// not real instructions
+	LABEL,
+	COMMENT,
+	NOP // removed by a pass, skipped when printing
+};
+
+const char* opcode_names[] = { "mov", "movzx", "movsx", "lea", "add", "sub", "imul", "xor", "and", "shl", "shr", "sar", "neg", "div", "idiv", "cqo", "cmp", "test", "set", "jmp", "j", "call", "ret", "leave", "push", "pop", "syscall",
+	"movsd", "addsd", "subsd", "mulsd", "divsd", "comisd", "cvtsi2sd", "cvttsd2si", "cvtss2sd", "cvtsd2ss", "xorps", "movaps", "movq", "pinsrd",
+	"movups", "addps", "subps", "mulps", "divps", "addpd", "subpd", "mulpd", "divpd", "paddd", "paddq", "psubd", "psubq", "pmulld", "pminsd",
+	"pmaxsd", "minps", "maxps", "pcmpeqd", "pcmpgtd", "cmpps", "pshufd", "vpbroadcastd", "vpbroadcastq", "vextracti128", "vinserti128",
+	"vzeroupper", "", "", "" };
+
+// the source line of the statement being generated, every instruction made on this thread is stamped with it
+thread_local int emitting_line = 0;
+
+struct Instruction {
+	Opcode opcode;
+	Condition condition = Condition::NONE;
+	std::vector<Operand> operands;
+	std::string text; // label name or comment
+	int line = emitting_line; // 0 when it doesn't come from a statement
+
+	bool is_jump() const { return opcode == Opcode::JMP || opcode == Opcode::JCC; }
+	bool ends_block() const { return opcode == Opcode::JMP || opcode == Opcode::RET; }
+};
+
+bool is_scalar_float(Opcode opcode) {
+	return opcode >= Opcode::MOVSD && opcode <= Opcode::CVTTSD2SI;
+}
+
+bool is_packed(Opcode opcode) {
+	return opcode >= Opcode::MOVUPS && opcode <= Opcode::PSHUFD;
+}
+
+// the operand of a movq that isn't an xmm register
+const Operand& general_operand(const Instruction& instruction) {
+	return is_xmm(instruction.operands[0].reg) ? instruction.operands[1] : instruction.operands[0];
+}
+
+// a packed instruction working on ymm registers
+bool is_wide_vector(const Instruction& instruction) {
+	return is_packed(instruction.opcode) && instruction.operands.size() > 0 && instruction.operands[0].size == 32;
+}
+
+// the precision an instruction works in, from its xmm operand
+int scalar_size(const Instruction& instruction) {
+	const Operand& first = instruction.operands[0];
+	if (first.is_register() && is_xmm(first.reg)) return first.size;
+	return instruction.operands[1].size;
+}
+
+void emit(std::vector<Instruction>& code, Opcode opcode) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	code.push_back(instruction);
+}
+
+void emit(std::vector<Instruction>& code, Opcode opcode, Operand a) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	instruction.operands.push_back(a);
+	code.push_back(instruction);
+}
+
+void emit(std::vector<Instruction>& code, Opcode opcode, Operand a, Operand b) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	instruction.operands.push_back(a);
+	instruction.operands.push_back(b);
+	code.push_back(instruction);
+}
+
+void emit(std::vector<Instruction>& code, Opcode opcode, Operand a, Operand b, Operand c) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	instruction.operands = { a, b, c };
+	code.push_back(instruction);
+}
+
+void emit_condition(std::vector<Instruction>& code, Opcode opcode, Condition condition, Operand a) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	instruction.condition = condition;
+	instruction.operands.push_back(a);
+	code.push_back(instruction);
+}
+
+// an aligned label is padded with nops up to the alignment, unless that would take more than max_padding bytes
+void emit_label(std::vector<Instruction>& code, const std::string& name, int alignment = 0, int max_padding = 0) {
+	Instruction instruction;
+	instruction.opcode = Opcode::LABEL;
+	instruction.text = name;
+	if (alignment > 1) {
+		instruction.operands.push_back(immediate_operand(alignment));
+		instruction.operands.push_back(immediate_operand(max_padding));
+	}
+	code.push_back(instruction);
+}
+
+void emit_comment(std::vector<Instruction>& code, const std::string& text) {
+	Instruction instruction;
+	instruction.opcode = Opcode::COMMENT;
+	instruction.text = text;
+	code.push_back(instruction);
+}
+
+const char* register_name(Register reg, int size) {
+	if (is_xmm(reg)) return (size == 32 ? register_names_ymm : register_names_xmm)[(int)reg - (int)Register::XMM0];
+	switch (size)
+	{
+	case 1: return register_names_8[(int)reg];
+	case 2: return register_names_16[(int)reg];
+	case 4: return register_names_32[(int)reg];
+	default: return register_names_64[(int)reg];
+	}
+}
+
+const char* size_name(int size) {
+	switch (size)
+	{
+	case 1: return "BYTE";
+	case 2: return "WORD";
+	case 4: return "DWORD";
+	case 16: return "OWORD";
+	case 32: return "YWORD";
+	default: return "QWORD";
+	}
+}
+
+// lea takes an address so its memory operand has no size
+void print_operand(std::ostream& out, const Operand& operand, bool sized = true) {
+	switch (operand.type)
+	{
+	case Operand::Type::REGISTER:
+		out << register_name(operand.reg, operand.size);
+		break;
+	case Operand::Type::IMMEDIATE:
+		out << operand.value;
+		break;
+	case Operand::Type::LABEL:
+		out << operand.label;
+		break;
+	case Operand::Type::MEMORY:
+		if (sized) {
+			out << size_name(operand.size) << " ";
+		}
+		out << "[";
+		if (operand.label.length() > 0) {
+			out << operand.label;
+		}
+		else {
+			out << register_name(operand.reg, 8);
+		}
+		if (operand.index != Register::NONE) {
+			out << " + " << register_name(operand.index, 8);
+			if (operand.scale > 1) out << "*" << operand.scale;
+		}
+		if (operand.value > 0) out << " + " << operand.value;
+		if (operand.value < 0) out << " - " << -operand.value;
+		out << "]";
+		break;
+	default:
+		break;
+	}
+}
+
+void print_instruction(std::ostream& out, const Instruction& instruction) {
+	switch (instruction.opcode)
+	{
+	case Opcode::LABEL:
+		if (instruction.operands.size() > 0) {
+			out << "align " << instruction.operands[0].value << "\n"; // nasm has no limit on the padding
+		}
+		out << instruction.text << ":\n";
+		return;
+	case Opcode::COMMENT:
+		out << "; " << instruction.text << "\n";
+		return;
+	case Opcode::NOP:
+		return;
+	default:
+		break;
+	}
+
+	std::string name = opcode_names[(int)instruction.opcode];
+	if (is_scalar_float(instruction.opcode) && scalar_size(instruction) == 4) {
+		name.replace(name.rfind("sd"), 2, "ss");
+	}
+	if (instruction.opcode == Opcode::MOVQ && general_operand(instruction).size == 4) {
+		name = "movd";
+	}
+	std::vector<Operand> operands = instruction.operands;
+	if (is_wide_vector(instruction)) {
+		name = "v" + name;
+		// moves and shuffles only have the one source
+		if (instruction.opcode != Opcode::MOVUPS && instruction.opcode != Opcode::PSHUFD) operands.insert(operands.begin(), operands[0]);
+	}
+	if (instruction.opcode == Opcode::VINSERTI128) {
+		operands.insert(operands.begin(), operands[0]);
+	}
+	out << name;
+	if (instruction.opcode == Opcode::MOVSX && instruction.operands[1].size == 4) {
+		out << "d"; // nasm spells the 32 bit source form movsxd
+	}
+	if (instruction.opcode == Opcode::SETCC || instruction.opcode == Opcode::JCC) {
+		out << condition_names[(int)instruction.condition];
+	}
+	for (int i = 0; i < operands.size(); i++) {
+		out << (i == 0 ? " " : ", ");
+		print_operand(out, operands[i], instruction.opcode != Opcode::LEA);
+	}
+	out << "\n";
+}
+
+void print_instructions(std::ostream& out, const std::vector<Instruction>& code) {
+	for (const Instruction& instruction : code) {
+		print_instruction(out, instruction);
+	}
+}
@@ -0,0 +1,845 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "Parsing.h"
+#include "Types.h"
+
+SyntaxNode* evaluate_block(Block* block);
+SyntaxNode* evaluate_node(SyntaxNode* node);
+
+std::map<std::string, Procedure*> procedures;
+std::map<std::string, SyntaxNode*> variables;
+
+// the elements of the current call's arrays, an array passed in is the caller's own vector so stores reach it.
+// static arrays are shared by every call
+typedef std::vector<SyntaxNode*> ArrayValues;
+std::map<std::string, ArrayValues*> arrays;
+std::map<std::string, ArrayValues> static_array_values;
+
+// set once a return statement runs, blocks stop evaluating until the procedure call clears it
+bool returning = false;
+
+// how many more nodes may be evaluated before giving up, negative means no limit
+long long evaluation_budget = -1;
+
+// the types of the procedure being evaluated, null when it wasn't checked. values are wrapped to the type of
+// the variable they're assigned to and the procedure they're returned from, like the compiled code does
+ProcedureTypes* interpreting_types = nullptr;
+
+BooleanLiteral* boolean_value(bool value) {
+	static BooleanLiteral* true_literal = nullptr;
+	static BooleanLiteral* false_literal = nullptr;
+	BooleanLiteral*& literal = value ? true_literal : false_literal;
+	if (!literal) {
+		literal = new BooleanLiteral();
+		literal->value = value;
+	}
+	return literal;
+}
+
+SyntaxNode* integer_value(long long value) {
+	IntLiteral* int_literal = new IntLiteral();
+	int_literal->value = value;
+	return int_literal;
+}
+
+SyntaxNode* as_type(SyntaxNode* value, ValueType type) {
+	if (!value || !is_integer(type)) return value;
+	if (value->type == SyntaxNode::Type::BOOLEAN_LITERAL) {
+		return type == ValueType::BOOL ? value : integer_value(((BooleanLiteral*)value)->value ? 1 : 0);
+	}
+	if (value->type != SyntaxNode::Type::INTEGER_LITERAL) return value;
+	long long integer = ((IntLiteral*)value)->value;
+	if (type == ValueType::BOOL) return boolean_value(integer != 0);
+	long long wrapped = wrap_integer(integer, type);
+	return wrapped == integer ? value : integer_value(wrapped);
+}
+
+SyntaxNode* zero_value(ValueType type) {
+	if (type == ValueType::BOOL) return boolean_value(false);
+	if (!is_floating(type)) return integer_value(0);
+	FloatLiteral* float_literal = new FloatLiteral();
+	float_literal->value = 0;
+	float_literal->size = value_size(type);
+	return float_literal;
+}
+
+// every element starts at zero, like the compiled code clears them. an array of structs has each element's fields
+// one after the other whatever its layout, which only changes where the compiled code puts them
+ArrayValues zeroed_elements(const ArrayType& array) {
+	if (array.structure.length() == 0) return ArrayValues(array.length, zero_value(array.element));
+	ArrayValues values;
+	for (int i = 0; i < array.length; i++) {
+		for (StructField& field : struct_types[array.structure].fields) values.push_back(zero_value(field.type));
+	}
+	return values;
+}
+
+ArrayValues* new_array(const ArrayType& array) {
+	return new ArrayValues(zeroed_elements(array));
+}
+
+ArrayValues* find_array_values(const std::string& name) {
+	auto local = arrays.find(name);
+	if (local != arrays.end()) return local->second;
+	if (variables.count(name) > 0) return nullptr;
+	auto global = static_array_values.find(name);
+	return global == static_array_values.end() ? nullptr : &global->second;
+}
+
+void reset_static_arrays() {
+	static_array_values.clear();
+	for (auto& array : static_arrays) {
+		static_array_values[array.first] = zeroed_elements(array.second);
+	}
+}
+
+ArrayType* interpreted_array(const std::string& name) {
+	return interpreting_types ? find_array(*interpreting_types, name) : nullptr;
+}
+
+// the element the index picks out, or its field, the compiled code exits with the same message
+SyntaxNode*& element_value(const std::string& name, const std::string& field, SyntaxNode* index) {
+	ArrayValues* values = find_array_values(name);
+	SyntaxNode* position = as_type(evaluate_node(index), ValueType::INT);
+	if (!values || !position || position->type != SyntaxNode::Type::INTEGER_LITERAL) {
+		throw std::runtime_error("no array " + name);
+	}
+	long long fields = 1;
+	long long slot = 0;
+	ArrayType* array = interpreted_array(name);
+	if (field.length() > 0 && array && array->structure.length() > 0) {
+		std::vector<StructField>& struct_fields = struct_types[array->structure].fields;
+		fields = struct_fields.size();
+		while (slot < fields && struct_fields[slot].name != field) slot++;
+	}
+	long long i = ((IntLiteral*)position)->value;
+	if (i < 0 || i >= (long long)values->size() / fields) {
+		throw std::runtime_error("index out of range");
+	}
+	return (*values)[i * fields + slot];
+}
+
+ValueType element_type(const std::string& name, const std::string& field) {
+	ArrayType* array = interpreted_array(name);
+	return array ? element_type(*array, field) : ValueType::NONE;
+}
+
+ValueType interpreted_type(SyntaxNode* expression) {
+	return interpreting_types ? expression_type(expression, interpreting_types->variables) : ValueType::INT;
+}
+
+// int(), the sized integers, float() and double() on an evaluated value
+SyntaxNode* evaluate_conversion(ProcedureCall* conversion) {
+	SyntaxNode* value = conversion->inputs.size() == 1 ? evaluate_node(conversion->inputs[0]) : nullptr;
+	ValueType to = type_from_name(conversion->name);
+	if (!value) return nullptr;
+	if (value->type == SyntaxNode::Type::FLOAT_LITERAL) {
+		double number = ((FloatLiteral*)value)->value;
+		if (is_integer(to)) return as_type(integer_value((long long)number), to);
+		FloatLiteral* float_literal = new FloatLiteral();
+		float_literal->value = to == ValueType::FLOAT ? (float)number : number;
+		float_literal->size = value_size(to);
+		return float_literal;
+	}
+	value = as_type(value, ValueType::INT);
+	if (value->type != SyntaxNode::Type::INTEGER_LITERAL) return nullptr;
+	if (is_integer(to)) return as_type(value, to);
+	FloatLiteral* float_literal = new FloatLiteral();
+	float_literal->value = (double)((IntLiteral*)value)->value;
+	if (to == ValueType::FLOAT) float_literal->value = (float)float_literal->value;
+	float_literal->size = value_size(to);
+	return float_literal;
+}
+
+// VECTORS
+// lane by lane the way the instructions work: i32 lanes wrap, float lanes are rounded to single precision after
+// every operation and a comparison gives -1 in the lanes where it holds. hadd adds the lanes up in the same order
+// the compiled code does, since with floats the order changes the result
+
+VectorValue* new_vector(ValueType type) {
+	VectorValue* vector = new VectorValue();
+	vector->lanes.assign(lane_count(type), 0);
+	vector->floating = is_floating(lane_type(type));
+	return vector;
+}
+
+double wrap_lane(const VectorValue* vector, double value) {
+	return vector->floating ? (double)(float)value : (double)wrap_integer((long long)value, ValueType::I32);
+}
+
+double scalar_lane(const VectorValue* vector, SyntaxNode* value) {
+	if (value->type == SyntaxNode::Type::FLOAT_LITERAL) return wrap_lane(vector, ((FloatLiteral*)value)->value);
+	value = as_type(value, ValueType::INT);
+	if (value->type != SyntaxNode::Type::INTEGER_LITERAL) throw std::runtime_error("not a lane value");
+	return wrap_lane(vector, (double)((IntLiteral*)value)->value);
+}
+
+SyntaxNode* lane_node(const VectorValue* vector, double lane) {
+	if (!vector->floating) return integer_value((long long)lane);
+	FloatLiteral* float_literal = new FloatLiteral();
+	float_literal->value = lane;
+	float_literal->size = 4;
+	return float_literal;
+}
+
+// the first element a vector load or store covers, every one of them has to be in range
+long long vector_start(ArrayValues*& values, const std::string& name, SyntaxNode* index, int lanes) {
+	values = find_array_values(name);
+	SyntaxNode* position = as_type(evaluate_node(index), ValueType::INT);
+	if (!values || !position || position->type != SyntaxNode::Type::INTEGER_LITERAL) {
+		throw std::runtime_error("no array " + name);
+	}
+	long long start = ((IntLiteral*)position)->value;
+	if (start < 0 || start + lanes > (long long)values->size()) {
+		throw std::runtime_error("index out of range");
+	}
+	return start;
+}
+
+SyntaxNode* evaluate_vector_operator(BinaryOperator::Type operation, VectorValue* left, VectorValue* right) {
+	VectorValue* result = new VectorValue();
+	result->floating = left->floating && !is_comparison(operation);
+	for (int i = 0; i < left->lanes.size() && i < right->lanes.size(); i++) {
+		double a = left->lanes[i];
+		double b = right->lanes[i];
+		double lane = 0;
+		switch (operation)
+		{
+		case BinaryOperator::Type::ADD: lane = wrap_lane(left, a + b); break;
+		case BinaryOperator::Type::SUBTRACT: lane = wrap_lane(left, a - b); break;
+		case BinaryOperator::Type::MULTIPLY: lane = left->floating ? wrap_lane(left, a * b) : wrap_lane(left, (double)wrap_integer((long long)a * (long long)b, ValueType::I32)); break;
+		case BinaryOperator::Type::DIVIDE: lane = wrap_lane(left, a / b); break;
+		case BinaryOperator::Type::LESS_THAN: lane = a < b ? -1 : 0; break;
+		case BinaryOperator::Type::GREATER_THAN: lane = a > b ? -1 : 0; break;
+		case BinaryOperator::Type::EQUAL: lane = a == b ? -1 : 0; break;
+		default: return nullptr;
+		}
+		result->lanes.push_back(lane);
+	}
+	return result;
+}
+
+// the constructors and the builtins Types.h lists
+SyntaxNode* evaluate_vector_call(ProcedureCall* procedure_call) {
+	const std::string& name = procedure_call->name;
+	std::vector<SyntaxNode*>& inputs = procedure_call->inputs;
+	ValueType constructed = type_from_name(name);
+	if (is_vector(constructed)) {
+		VectorValue* vector = new_vector(constructed);
+		int lanes = vector->lanes.size();
+		ArrayValues* values = nullptr;
+		if (inputs.size() == 2 && inputs[0]->type == SyntaxNode::Type::VARIABLE_CALL && find_array_values(((VariableCall*)inputs[0])->name)) {
+			long long start = vector_start(values, ((VariableCall*)inputs[0])->name, inputs[1], lanes);
+			for (int i = 0; i < lanes; i++) vector->lanes[i] = scalar_lane(vector, (*values)[start + i]);
+			return vector;
+		}
+		SyntaxNode* splat = inputs.size() == 1 ? evaluate_node(inputs[0]) : nullptr;
+		for (int i = 0; i < lanes; i++) {
+			SyntaxNode* value = splat ? splat : evaluate_node(inputs[i]);
+			if (!value) return nullptr;
+			vector->lanes[i] = scalar_lane(vector, value);
+		}
+		return vector;
+	}
+
+	if (name == "store") {
+		VectorValue* vector = (VectorValue*)evaluate_node(inputs[2]);
+		if (!vector || vector->type != SyntaxNode::Type::VECTOR_VALUE) return nullptr;
+		ArrayValues* values = nullptr;
+		long long start = vector_start(values, ((VariableCall*)inputs[0])->name, inputs[1], vector->lanes.size());
+		for (int i = 0; i < vector->lanes.size(); i++) (*values)[start + i] = lane_node(vector, vector->lanes[i]);
+		return nullptr;
+	}
+
+	VectorValue* vector = (VectorValue*)evaluate_node(inputs[0]);
+	if (!vector || vector->type != SyntaxNode::Type::VECTOR_VALUE) return nullptr;
+	if (name == "lane") {
+		return lane_node(vector, vector->lanes[((IntLiteral*)inputs[1])->value]);
+	}
+	if (name == "shuffle") {
+		VectorValue* result = new VectorValue(*vector);
+		for (int half = 0; half < vector->lanes.size(); half += 4) {
+			for (int i = 0; i < 4; i++) result->lanes[half + i] = vector->lanes[half + ((IntLiteral*)inputs[i + 1])->value];
+		}
+		return result;
+	}
+	if (name == "hadd") {
+		// the top half onto the bottom, then lanes two apart, then the last pair
+		std::vector<double> lanes = vector->lanes;
+		if (lanes.size() == 8) {
+			for (int i = 0; i < 4; i++) lanes[i] = wrap_lane(vector, lanes[i + 4] + lanes[i]);
+		}
+		double even = wrap_lane(vector, lanes[0] + lanes[2]);
+		double odd = wrap_lane(vector, lanes[1] + lanes[3]);
+		return lane_node(vector, wrap_lane(vector, even + odd));
+	}
+	VectorValue* other = (VectorValue*)evaluate_node(inputs[1]);
+	if (!other || other->type != SyntaxNode::Type::VECTOR_VALUE) return nullptr;
+	VectorValue* result = new VectorValue(*vector);
+	for (int i = 0; i < result->lanes.size(); i++) {
+		double a = vector->lanes[i];
+		double b = other->lanes[i];
+		result->lanes[i] = name == "min" ? (a < b ? a : b) : (a > b ? a : b);
+	}
+	return result;
+}
+
+// MEMORY
+// the memory builtins on the interpreter's own heap, with the same rounding as the runtime. handles are the
+// addresses of the structs below and blocks are real addresses, so peek and poke read and write them directly
+
+struct InterpretedArena {
+	std::vector<std::pair<char*, long long>> chunks; // where each starts and how big it is, the current one last
+	char* cursor;
+	char* limit;
+	long long chunk_bytes;
+};
+
+struct InterpretedPool {
+	long long block;
+	char* free_list = nullptr;
+	char* cursor = nullptr;
+	char* limit = nullptr;
+};
+
+InterpretedPool* interpreted_size_classes[cached_size_limit / 16] = {};
+
+long long round_up(long long value, long long multiple) {
+	return (value + multiple - 1) & -multiple;
+}
+
+void add_arena_chunk(InterpretedArena* arena, long long bytes) {
+	char* chunk = (char*)calloc(bytes, 1);
+	if (!chunk) throw std::runtime_error("out of memory");
+	arena->chunks.push_back({ chunk, bytes });
+	arena->cursor = chunk;
+	arena->limit = chunk + bytes;
+}
+
+InterpretedPool* new_pool(long long size) {
+	InterpretedPool* pool = new InterpretedPool();
+	pool->block = std::max(round_up(size, 16), 16LL);
+	return pool;
+}
+
+char* pool_alloc(InterpretedPool* pool) {
+	if (pool->free_list) {
+		char* block = pool->free_list;
+		pool->free_list = *(char**)block;
+		return block;
+	}
+	if (pool->cursor + pool->block > pool->limit) {
+		long long slab_bytes = round_up(pool->block << 8, 4096);
+		pool->cursor = (char*)calloc(slab_bytes, 1);
+		if (!pool->cursor) throw std::runtime_error("out of memory");
+		pool->limit = pool->cursor + slab_bytes;
+	}
+	char* block = pool->cursor;
+	pool->cursor += pool->block;
+	return block;
+}
+
+void pool_free(InterpretedPool* pool, char* block) {
+	*(char**)block = pool->free_list;
+	pool->free_list = block;
+}
+
+// 1 for up to 16 bytes to 32 for up to 512
+InterpretedPool*& size_class_pool(long long bytes) {
+	long long size_class = (std::max(bytes, 1LL) + 15) >> 4;
+	InterpretedPool*& pool = interpreted_size_classes[size_class - 1];
+	if (!pool) pool = new_pool(size_class * 16);
+	return pool;
+}
+
+long long memory_input(ProcedureCall* procedure_call, int i) {
+	SyntaxNode* value = as_type(evaluate_node(procedure_call->inputs[i]), ValueType::INT);
+	if (!value || value->type != SyntaxNode::Type::INTEGER_LITERAL) throw std::runtime_error(procedure_call->name + "() needs int inputs");
+	return ((IntLiteral*)value)->value;
+}
+
+SyntaxNode* evaluate_memory_call(ProcedureCall* procedure_call) {
+	const std::string& name = procedure_call->name;
+	long long first = memory_input(procedure_call, 0);
+	long long second = procedure_call->inputs.size() > 1 ? memory_input(procedure_call, 1) : 0;
+	if (name == "peek") {
+		return integer_value(*(long long*)first);
+	}
+	if (name == "poke") {
+		*(long long*)first = second;
+		return integer_value(second);
+	}
+	if (name == "arena") {
+		InterpretedArena* arena = new InterpretedArena();
+		arena->chunk_bytes = round_up(std::max(first, 4096LL), 4096);
+		add_arena_chunk(arena, arena->chunk_bytes);
+		return integer_value((long long)arena);
+	}
+	if (name == "arena_alloc") {
+		InterpretedArena* arena = (InterpretedArena*)first;
+		long long size = round_up(second, 16);
+		if (arena->cursor + size > arena->limit) {
+			add_arena_chunk(arena, std::max(round_up(size, 4096), arena->chunk_bytes));
+		}
+		char* block = arena->cursor;
+		arena->cursor += size;
+		return integer_value((long long)block);
+	}
+	if (name == "arena_mark") {
+		return integer_value((long long)((InterpretedArena*)first)->cursor);
+	}
+	if (name == "arena_reset") {
+		InterpretedArena* arena = (InterpretedArena*)first;
+		char* mark = (char*)second;
+		while (arena->chunks.size() > 1 && !(mark > arena->chunks.back().first && mark <= arena->chunks.back().first + arena->chunks.back().second)) {
+			free(arena->chunks.back().first);
+			arena->chunks.pop_back();
+		}
+		arena->cursor = mark;
+		arena->limit = arena->chunks.back().first + arena->chunks.back().second;
+		return integer_value(0);
+	}
+	if (name == "pool") {
+		return integer_value((long long)new_pool(first));
+	}
+	if (name == "pool_alloc") {
+		return integer_value((long long)pool_alloc((InterpretedPool*)first));
+	}
+	if (name == "pool_free") {
+		pool_free((InterpretedPool*)first, (char*)second);
+		return integer_value(0);
+	}
+	if (name == "cached_alloc") {
+		if (first > cached_size_limit) return integer_value((long long)calloc(first, 1));
+		return integer_value((long long)pool_alloc(size_class_pool(first)));
+	}
+	if (name == "cached_free") {
+		if (second > cached_size_limit) free((char*)first);
+		else pool_free(size_class_pool(second), (char*)first);
+		return integer_value(0);
+	}
+	return nullptr;
+}
+
+// OUTPUT
+// print and printf append to a buffer of the same size as the runtime's, written to stdout when it fills, when
+// the thread ends and on flush(). integers and strings are formatted here, without going through a stream
+
+struct OutputBuffer {
+	std::string text;
+
+	~OutputBuffer() {
+		std::cout.write(text.data(), text.size());
+		std::cout.flush();
+	}
+};
+
+thread_local OutputBuffer output_buffer;
+
+void flush_output() {
+	std::cout.write(output_buffer.text.data(), output_buffer.text.size());
+	std::cout.flush();
+	output_buffer.text.clear();
+}
+
+void output_written() {
+	if (output_buffer.text.size() >= output_buffer_size) flush_output();
+}
+
+// digits are built backwards from the end, the magnitude is unsigned so the lowest value has one too
+void append_integer(std::string& out, long long value) {
+	char digits[24];
+	char* start = digits + sizeof(digits);
+	unsigned long long magnitude = value < 0 ? 0ull - (unsigned long long)value : value;
+	do {
+		*--start = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (value < 0) *--start = '-';
+	out.append(start, digits + sizeof(digits) - start);
+}
+
+// what print shows for a value, anything but an integer or a string is printed the way the node prints itself
+void append_value(std::string& out, SyntaxNode* value) {
+	if (value->type == SyntaxNode::Type::INTEGER_LITERAL) {
+		append_integer(out, ((IntLiteral*)value)->value);
+		return;
+	}
+	if (value->type == SyntaxNode::Type::STRING_LITERAL) {
+		out += ((StringLiteral*)value)->value;
+		return;
+	}
+	std::ostringstream printed;
+	std::streambuf* console = std::cout.rdbuf(printed.rdbuf());
+	value->print();
+	std::cout.rdbuf(console);
+	out += printed.str();
+}
+
+SyntaxNode* evaluate_node(SyntaxNode* node) {
+	if (evaluation_budget >= 0 && evaluation_budget-- == 0) {
+		throw std::runtime_error("evaluation budget exhausted");
+	}
+
+	switch (node->type)
+	{
+	case SyntaxNode::Type::INTEGER_LITERAL:
+	case SyntaxNode::Type::FLOAT_LITERAL:
+	case SyntaxNode::Type::STRING_LITERAL:
+	case SyntaxNode::Type::BOOLEAN_LITERAL:
+		return node;
+
+	case SyntaxNode::Type::BLOCK:
+	{
+		return evaluate_block((Block*)node);
+	}
+	break;
+
+	case SyntaxNode::Type::WHILE_STATEMENT:
+	{
+		WhileStatement* while_statement = (WhileStatement*)node;
+		while (true) {
+			SyntaxNode* condition_eval = evaluate_node(while_statement->condition);
+			if (!condition_eval || condition_eval->type != SyntaxNode::Type::BOOLEAN_LITERAL) {
+				std::cout << "while statement condition is not a boolean expression" << std::endl;
+				return nullptr;
+			}
+			BooleanLiteral* boolean_condition = (BooleanLiteral*)condition_eval;
+			if (!boolean_condition->value) {
+				break;
+			}
+
+			SyntaxNode* result = evaluate_block(while_statement->body);
+			if (returning) {
+				return result;
+			}
+		}
+	}
+	break;
+
+	case SyntaxNode::Type::IF_STATEMENT:
+	{
+		IfStatement* if_statement = (IfStatement*)node;
+		SyntaxNode* condition_eval = evaluate_node(if_statement->condition);
+		if (!condition_eval || condition_eval->type != SyntaxNode::Type::BOOLEAN_LITERAL) {
+			std::cout << "if statement condition is not a boolean expression" << std::endl;
+			return nullptr;
+		}
+		BooleanLiteral* boolean_condition = (BooleanLiteral*)condition_eval;
+		if (boolean_condition->value) {
+			return evaluate_block(if_statement->body);
+		}
+	}
+	break;
+
+	case SyntaxNode::Type::VARIABLE_CALL:
+	{
+		VariableCall* var_call = (VariableCall*)node;
+		return variables[var_call->name];
+	}
+	break;
+
+	case SyntaxNode::Type::VARIABLE_DECLERATION:
+	{
+		VariableDecleration* var_decl = (VariableDecleration*)node;
+		ArrayType* array = interpreting_types ? find_array(*interpreting_types, var_decl->name) : nullptr;
+		if (array && array->storage == ArrayType::Storage::STACK) {
+			arrays[var_decl->name] = new_array(*array);
+			break;
+		}
+		variables[var_decl->name] = nullptr;
+	}
+	break;
+
+	case SyntaxNode::Type::ARRAY_INDEX:
+	{
+		ArrayIndex* array_index = (ArrayIndex*)node;
+		return element_value(array_index->name, array_index->field, array_index->index);
+	}
+	break;
+
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+	{
+		ElementAssignment* element_assignment = (ElementAssignment*)node;
+		SyntaxNode*& element = element_value(element_assignment->name, element_assignment->field, element_assignment->index);
+		element = as_type(evaluate_node(element_assignment->value), element_type(element_assignment->name, element_assignment->field));
+	}
+	break;
+
+	case SyntaxNode::Type::PROCEDURE_DECLERATION:
+	{
+		ProcedureDecleration* proc_decl = (ProcedureDecleration*)node;
+		procedures[proc_decl->name] = proc_decl->procedure;
+	}
+	break;
+
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+	{
+		VariableAssignment* var_assign = (VariableAssignment*)node;
+		SyntaxNode* value = evaluate_node(var_assign->value);
+		if (interpreting_types) {
+			auto type = interpreting_types->variables.find(var_assign->name);
+			if (type != interpreting_types->variables.end()) value = as_type(value, type->second);
+		}
+		variables[var_assign->name] = value;
+	}
+	break;
+
+	case SyntaxNode::Type::PROCEDURE_CALL:
+	{
+		ProcedureCall* procedure_call = (ProcedureCall*)node;
+		if (procedure_call->name == "print") {
+			for (auto input : procedure_call->inputs) {
+				append_value(output_buffer.text, evaluate_node(input));
+			}
+			output_buffer.text += '\n';
+			output_written();
+			return nullptr;
+		}
+		// prints the same as the runtime's printf, ints are 32 bits there so %d shows the low half
+		if (procedure_call->name == "printf" && procedure_call->inputs.size() > 0) {
+			SyntaxNode* format = evaluate_node(procedure_call->inputs[0]);
+			if (!format || format->type != SyntaxNode::Type::STRING_LITERAL) return nullptr;
+			const std::string& text = ((StringLiteral*)format)->value;
+			std::string output; // the inputs can print too, theirs comes first
+			int next_input = 1;
+			for (int i = 0; i < text.size(); i++) {
+				if (text[i] != '%' || i + 1 == text.size()) {
+					output += text[i];
+					continue;
+				}
+				char conversion = text[++i];
+				if (conversion == '%') {
+					output += '%';
+					continue;
+				}
+				SyntaxNode* value = next_input < procedure_call->inputs.size() ? evaluate_node(procedure_call->inputs[next_input++]) : nullptr;
+				if (!value) continue;
+				if (conversion == 'd' || conversion == 'c') value = as_type(value, ValueType::INT); // bools print as 0 or 1
+				if (conversion == 'd' && value->type == SyntaxNode::Type::INTEGER_LITERAL) append_integer(output, (int)((IntLiteral*)value)->value);
+				if (conversion == 'c' && value->type == SyntaxNode::Type::INTEGER_LITERAL) output += (char)((IntLiteral*)value)->value;
+				if (conversion == 'f' && value->type == SyntaxNode::Type::FLOAT_LITERAL) output += std::to_string(((FloatLiteral*)value)->value);
+				if (conversion == 's' && value->type == SyntaxNode::Type::STRING_LITERAL) output += ((StringLiteral*)value)->value;
+			}
+			output_buffer.text += output;
+			output_buffer.text += '\n';
+			output_written();
+			return nullptr;
+		}
+		if (is_flush_builtin(procedure_call->name)) {
+			flush_output();
+			return integer_value(0);
+		}
+		if (is_conversion(procedure_call->name)) {
+			return evaluate_conversion(procedure_call);
+		}
+		if (is_vector_builtin(procedure_call->name)) {
+			return evaluate_vector_call(procedure_call);
+		}
+		if (is_memory_builtin(procedure_call->name)) {
+			return evaluate_memory_call(procedure_call);
+		}
+		if (procedure_call->name == "time_nano_seconds") {
+			long long time = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+			IntLiteral* int_literal = new IntLiteral();
+			int_literal->value = time;
+			return int_literal;
+		}
+		else {
+			Procedure* procedure = procedures[procedure_call->name];
+
+			if (!procedure) {
+				std::cout << "we dont have this procedure!";
+				return nullptr;
+			}
+			
+			// inputs are evaluated in the callers frame before any of them are bound
+			std::vector<SyntaxNode*> input_values;
+			std::vector<ArrayValues*> input_arrays;
+			for (SyntaxNode* input : procedure_call->inputs) {
+				ArrayValues* array = input->type == SyntaxNode::Type::VARIABLE_CALL ? find_array_values(((VariableCall*)input)->name) : nullptr;
+				input_arrays.push_back(array);
+				input_values.push_back(array ? nullptr : evaluate_node(input));
+			}
+
+			// each call gets its own variables so recursion doesnt clobber the caller
+			std::map<std::string, SyntaxNode*> caller_variables;
+			std::map<std::string, ArrayValues*> caller_arrays;
+			caller_variables.swap(variables);
+			caller_arrays.swap(arrays);
+			for (int i = 0; i < procedure->inputs.size() && i < input_values.size(); i++) {
+				VariableDecleration* input_decl = (VariableDecleration*)procedure->inputs[i];
+				if (input_arrays[i]) arrays[input_decl->name] = input_arrays[i];
+				else variables[input_decl->name] = input_values[i];
+			}
+			ProcedureTypes* caller_types = interpreting_types;
+			auto types = procedure_types.find(procedure_call->name);
+			interpreting_types = types == procedure_types.end() ? nullptr : &types->second;
+
+			SyntaxNode* result = evaluate_node(procedure->body);
+			if (interpreting_types) result = as_type(result, interpreting_types->result);
+			returning = false;
+			variables.swap(caller_variables);
+			arrays.swap(caller_arrays);
+			interpreting_types = caller_types;
+			return result;
+		}
+	}
+	break;
+
+	case SyntaxNode::Type::BINARY_OPERATOR:
+	{
+		BinaryOperator* binary_operator = (BinaryOperator*)node;
+		
+		SyntaxNode* left = evaluate_node(binary_operator->left);
+		SyntaxNode* right = evaluate_node(binary_operator->right);
+		if (!left || !right) {
+			return nullptr;
+		}
+
+		if (left->type == SyntaxNode::Type::VECTOR_VALUE && right->type == SyntaxNode::Type::VECTOR_VALUE) {
+			return evaluate_vector_operator(binary_operator->operation, (VectorValue*)left, (VectorValue*)right);
+		}
+
+		if (left->type == SyntaxNode::Type::BOOLEAN_LITERAL && right->type == SyntaxNode::Type::BOOLEAN_LITERAL && binary_operator->operation == BinaryOperator::Type::EQUAL) {
+			return boolean_value(((BooleanLiteral*)left)->value == ((BooleanLiteral*)right)->value);
+		}
+
+		if (left->type == SyntaxNode::Type::INTEGER_LITERAL && right->type == SyntaxNode::Type::INTEGER_LITERAL) {
+			
+			IntLiteral* left_int = (IntLiteral*)left;
+			IntLiteral* right_int = (IntLiteral*)right;
+
+			// u64 values past the top of i64 are negative here, they compare and divide as the unsigned bits
+			if (interpreted_type(binary_operator) == ValueType::U64 || (is_comparison(binary_operator->operation) &&
+				combined_type(interpreted_type(binary_operator->left), interpreted_type(binary_operator->right)) == ValueType::U64)) {
+				unsigned long long left_bits = left_int->value;
+				unsigned long long right_bits = right_int->value;
+				switch (binary_operator->operation)
+				{
+				case BinaryOperator::Type::LESS_THAN:
+					return boolean_value(left_bits < right_bits);
+				case BinaryOperator::Type::GREATER_THAN:
+					return boolean_value(left_bits > right_bits);
+				case BinaryOperator::Type::DIVIDE:
+					if (right_bits == 0) throw std::runtime_error("division by zero");
+					return integer_value((long long)(left_bits / right_bits));
+				case BinaryOperator::Type::MODULO:
+					if (right_bits == 0) throw std::runtime_error("division by zero");
+					return integer_value((long long)(left_bits % right_bits));
+				default:
+					break;
+				}
+			}
+
+
+			// comparisons share two literals, nothing changes a value once it's made
+			switch (binary_operator->operation)
+			{
+			case BinaryOperator::Type::LESS_THAN:
+				return boolean_value(left_int->value < right_int->value);
+			case BinaryOperator::Type::GREATER_THAN:
+				return boolean_value(left_int->value > right_int->value);
+			case BinaryOperator::Type::EQUAL:
+				return boolean_value(left_int->value == right_int->value);
+			default:
+				break;
+			}
+
+			IntLiteral* int_literal = new IntLiteral();
+			switch (binary_operator->operation)
+			{
+			case BinaryOperator::Type::ADD:
+				int_literal->value = left_int->value + right_int->value;
+				break;
+			case BinaryOperator::Type::MULTIPLY:
+				int_literal->value = left_int->value * right_int->value;
+				break;
+			case BinaryOperator::Type::SUBTRACT:
+				int_literal->value = left_int->value - right_int->value;
+				break;
+			case BinaryOperator::Type::DIVIDE:
+				if (right_int->value == 0) throw std::runtime_error("division by zero");
+				int_literal->value = left_int->value / right_int->value;
+				break;
+			case BinaryOperator::Type::MODULO:
+				if (right_int->value == 0) throw std::runtime_error("division by zero");
+				int_literal->value = left_int->value % right_int->value;
+				break;
+			default:
+				break;
+			}
+			return int_literal;
+		}
+
+		// floats and doubles, a float result is rounded to single precision like the ss instructions round it
+		if (left->type == SyntaxNode::Type::FLOAT_LITERAL && right->type == SyntaxNode::Type::FLOAT_LITERAL) {
+			double left_value = ((FloatLiteral*)left)->value;
+			double right_value = ((FloatLiteral*)right)->value;
+			switch (binary_operator->operation)
+			{
+			case BinaryOperator::Type::LESS_THAN:
+				return boolean_value(left_value < right_value);
+			case BinaryOperator::Type::GREATER_THAN:
+				return boolean_value(left_value > right_value);
+			case BinaryOperator::Type::EQUAL:
+				return boolean_value(left_value == right_value);
+			default:
+				break;
+			}
+			FloatLiteral* float_literal = new FloatLiteral();
+			float_literal->size = ((FloatLiteral*)left)->size == 4 && ((FloatLiteral*)right)->size == 4 ? 4 : 8;
+			if (interpreted_type(binary_operator) == ValueType::FLOAT) float_literal->size = 4;
+			switch (binary_operator->operation)
+			{
+			case BinaryOperator::Type::ADD:
+				float_literal->value = left_value + right_value;
+				break;
+			case BinaryOperator::Type::MULTIPLY:
+				float_literal->value = left_value * right_value;
+				break;
+			case BinaryOperator::Type::SUBTRACT:
+				float_literal->value = left_value - right_value;
+				break;
+			case BinaryOperator::Type::DIVIDE:
+				float_literal->value = left_value / right_value;
+				break;
+			default:
+				return nullptr;
+			}
+			if (float_literal->size == 4) float_literal->value = (float)float_literal->value;
+			return float_literal;
+		}
+	}
+	break;
+
+	default:
+		break;
+	}
+	return nullptr;
+}
+
+SyntaxNode* evaluate_block(Block* block) {
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) {
+			ReturnStatement* return_statement = (ReturnStatement*)statement;
+			SyntaxNode* result = evaluate_node(return_statement->expression);
+			returning = true;
+			return result;
+		}
+		else {
+			SyntaxNode* result = evaluate_node(statement);
+			if (returning) {
+				return result;
+			}
+		}
+	}
+	return nullptr;
+}
@@ -7,9 +7,23 @@
 #include "Parsing.h"
 #include <map>
 #include <chrono>
+#include <cmath>
 #include <memory>
 #include <stdexcept>
+#include <thread>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+#include <algorithm>
 #include "CodeGen.h"
+#include "Counters.h"
+#include "Generator.h"
+#include "Interpreter.h"
+#include "Optimizer.h"
+#include "Types.h"
 
 std::string get_file_contents_as_text(const std::string filename) {
 	std::ifstream file_stream(filename);
@@ -102,50 +116,65 @@ void comp() {
 struct Tokenizer {
 	std::vector<Token>* tokens;
 	std::string program_text;
+	std::vector<int> line_starts; // where each line of program_text starts
 	int index = 0;
 
 	/// skips punctuation
+	/// past the end everything is the closing brace tokenize adds, so a file that stops part way through a block
+	/// (one that's still being typed) ends the block instead of running off the tokens
 	Token* next_token() {
-		if (index >= tokens->size())return nullptr;
-		while (true) {
+		while (index < tokens->size()) {
 			Token* token = &(*tokens)[index];
 			index += 1;
 			if (is_whitespace(*token))continue;
 			return token;
 		}
+		return &tokens->back();
 	}
 	Token* peek_next_token() {
-		if (index >= tokens->size()) {
-			return nullptr;
-		}
 		int temp_index = index;
-		while (true) {
+		while (temp_index < tokens->size()) {
 			Token* token = &(*tokens)[temp_index];
 			temp_index += 1;
 			if (is_whitespace(*token))continue;
 			return token;
 		}
+		return &tokens->back();
 	}
 	std::string get_identifier_name(Token& identifier) {
 		return program_text.substr(identifier.start_index, identifier.end_index - identifier.start_index);
 	}
+	void set_text(const std::string& text, std::vector<Token>& text_tokens) {
+		program_text = text;
+		tokens = &text_tokens;
+		index = 0;
+		line_starts = { 0 };
+		for (int i = 0; i < text.size(); i++) {
+			if (text[i] == '\n') line_starts.push_back(i + 1);
+		}
+	}
+	/// counting from 1
+	int line_of(Token& token) {
+		return (int)(std::upper_bound(line_starts.begin(), line_starts.end(), token.start_index) - line_starts.begin());
+	}
 };
 
 Tokenizer tokenizer;
 SyntaxNode* parse_statement();
 std::vector<SyntaxNode*> parse_arguments(bool use_expression = true);
+SyntaxNode* parse_expression(int priority = -9999);
 
 IntLiteral* integer_node(Token& integer_token) {
 	IntLiteral* integer_node = new IntLiteral();
 	std::string token_value = tokenizer.get_identifier_name(integer_token);
-	integer_node->value = std::stoi(token_value);
+	integer_node->value = std::stoll(token_value);
 	return integer_node;
 }
 
 SyntaxNode* float_node(Token& integer_token, Token& fractional_token) {
 	std::string float_string = tokenizer.get_identifier_name(integer_token) + "." + tokenizer.get_identifier_name(fractional_token);
 	FloatLiteral* float_node = new FloatLiteral();
-	float_node->value = std::stof(float_string);
+	float_node->value = std::stod(float_string);
 	return float_node;
 }
 
@@ -156,6 +185,20 @@ SyntaxNode* string_node(Token& string_token) {
 	return string_node;
 }
 
+// .field after an element, false when the dot has no name after it
+bool parse_field(std::string& field) {
+	if (tokenizer.peek_next_token()->type != TokenType::DOT) {
+		return true;
+	}
+	tokenizer.next_token();
+	Token* name = tokenizer.next_token();
+	if (name->type != TokenType::IDENTIFIER) {
+		return false;
+	}
+	field = tokenizer.get_identifier_name(*name);
+	return true;
+}
+
 SyntaxNode* parse_subexpression() {
 	Token* token = tokenizer.next_token();
 
@@ -170,6 +213,29 @@ SyntaxNode* parse_subexpression() {
 			proc_call->inputs = parse_arguments();
 			return proc_call;
 		}
+		else if (next_token->type == TokenType::OPEN_BRACKET) {
+			ArrayIndex* array_index = new ArrayIndex();
+			array_index->name = tokenizer.get_identifier_name(*token);
+			tokenizer.next_token();
+			array_index->index = parse_expression();
+			if (tokenizer.next_token()->type != TokenType::CLOSE_BRACKET) {
+				return new ParseError("no closing bracket");
+			}
+			if (!parse_field(array_index->field)) {
+				return new ParseError("no field name after the dot");
+			}
+			return array_index;
+		}
+		else if (next_token->type == TokenType::DOT) {
+			// p.x is the only element of a struct that isn't an array
+			ArrayIndex* array_index = new ArrayIndex();
+			array_index->name = tokenizer.get_identifier_name(*token);
+			array_index->index = new IntLiteral();
+			if (!parse_field(array_index->field)) {
+				return new ParseError("no field name after the dot");
+			}
+			return array_index;
+		}
 		else {
 			VariableCall* var_call = new VariableCall();
 			var_call->name = tokenizer.get_identifier_name(*token);
@@ -216,11 +282,11 @@ SyntaxNode* parse_subexpression() {
 	return new ParseError("couldn't parse subexpression");
 }
 
-SyntaxNode* parse_expression(int priority = -9999) {
+SyntaxNode* parse_expression(int priority) {
 	Token* next_token = tokenizer.peek_next_token();
 
 	// check for termination tokens
-	if(next_token->type == TokenType::SEMI_COLON || next_token->type == TokenType::COMMA || next_token->type == TokenType::CLOSE_PARENTHESIS) {
+	if(next_token->type == TokenType::SEMI_COLON || next_token->type == TokenType::COMMA || next_token->type == TokenType::CLOSE_PARENTHESIS || next_token->type == TokenType::CLOSE_BRACE || next_token->type == TokenType::CLOSE_BRACKET) {
 		return new ParseError("expression with no value");
 	}
 
@@ -228,7 +294,7 @@ SyntaxNode* parse_expression(int priority = -9999) {
 	next_token = tokenizer.peek_next_token();
 
 	// check for termination tokens
-	if (next_token->type == TokenType::SEMI_COLON || next_token->type == TokenType::COMMA || next_token->type == TokenType::CLOSE_PARENTHESIS) {
+	if (next_token->type == TokenType::SEMI_COLON || next_token->type == TokenType::COMMA || next_token->type == TokenType::CLOSE_PARENTHESIS || next_token->type == TokenType::CLOSE_BRACE || next_token->type == TokenType::CLOSE_BRACKET) {
 		return sub_expression;
 	}
 
@@ -249,6 +315,9 @@ SyntaxNode* parse_expression(int priority = -9999) {
 	if (next_token->type == TokenType::FORWARD_SLASH) {
 		binary_operator->operation = BinaryOperator::Type::DIVIDE;
 	}
+	if (next_token->type == TokenType::PERCENT) {
+		binary_operator->operation = BinaryOperator::Type::MODULO;
+	}
 	if (next_token->type == TokenType::LESS_THAN) {
 		binary_operator->operation = BinaryOperator::Type::LESS_THAN;
 	}
@@ -309,6 +378,10 @@ std::vector<SyntaxNode*> parse_arguments(bool use_expression) {
 		if (next_token->type == TokenType::CLOSE_PARENTHESIS) {
 			break;
 		}
+		else if (next_token->type == TokenType::CLOSE_BRACE) {
+			arguments.push_back(new ParseError("no closing parenthesis"));
+			break;
+		}
 		else if (next_token->type != TokenType::COMMA) {
 			arguments.push_back(new ParseError("no comma")); // if its not a closed parenthesis
 		}
@@ -327,15 +400,55 @@ Procedure* parse_procedure() {
 
 	// parse input
 	procedure->inputs = parse_arguments(false);
-	tokenizer.next_token(); // could change 
-	// eventually parse return type in here
+
+	// optional return type, (inputs) -> double {
+	if (tokenizer.peek_next_token()->type == TokenType::FORWARD_ARROW) {
+		tokenizer.next_token();
+		VariableDecleration* output = new VariableDecleration();
+		output->type_name = tokenizer.get_identifier_name(*tokenizer.next_token());
+		procedure->outputs.push_back(output);
+	}
+	tokenizer.next_token(); // {
 	procedure->body = parse_block();
 	return procedure;
 }
 
+SyntaxNode* parse_statement_from(Token* start_token);
+
+// after Name :: struct, an optional soa then the fields as declarations in braces
+SyntaxNode* parse_struct(const std::string& name) {
+	StructDecleration* struct_decleration = new StructDecleration();
+	struct_decleration->name = name;
+	Token* token = tokenizer.next_token();
+	if (token->type == TokenType::IDENTIFIER) {
+		std::string layout = tokenizer.get_identifier_name(*token);
+		if (layout != "soa" && layout != "aos") {
+			return new ParseError("struct layout isn't soa or aos");
+		}
+		struct_decleration->soa = layout == "soa";
+		token = tokenizer.next_token();
+	}
+	if (token->type != TokenType::OPEN_BRACE) {
+		return new ParseError("struct has no fields");
+	}
+	for (SyntaxNode* field : parse_block()->statements) {
+		if (field->type != SyntaxNode::Type::VARIABLE_DECLERATION && field->type != SyntaxNode::Type::PARSE_ERROR) {
+			return new ParseError("a struct can only declare fields");
+		}
+		struct_decleration->fields.push_back(field);
+	}
+	return struct_decleration;
+}
+
+// statements remember the line they start on, counted from the start of their declaration's text
 SyntaxNode* parse_statement() {
 	Token* start_token = tokenizer.next_token();
+	SyntaxNode* statement = parse_statement_from(start_token);
+	if (statement) statement->line = tokenizer.line_of(*start_token);
+	return statement;
+}
 
+SyntaxNode* parse_statement_from(Token* start_token) {
 	if (start_token->type == TokenType::BACK_ARROW) {
 		// parse return statement
 		ReturnStatement* return_statement = new ReturnStatement();
@@ -374,6 +487,12 @@ SyntaxNode* parse_statement() {
 	std::string identifier = tokenizer.get_identifier_name(*start_token);
 
 	Token* token = tokenizer.next_token();
+	if (identifier == "import" && token->type == TokenType::STRING_LITERAL) {
+		ImportStatement* import_statement = new ImportStatement();
+		std::string quoted = tokenizer.get_identifier_name(*token);
+		import_statement->path = quoted.substr(1, quoted.length() - 2);
+		return import_statement;
+	}
 	if (token->type == TokenType::COLON) {
 		token = tokenizer.next_token();
 
@@ -383,7 +502,27 @@ SyntaxNode* parse_statement() {
 			variable_decleration->type_name = tokenizer.get_identifier_name(*token);
 			return variable_decleration;
 		}
+		else if (token->type == TokenType::OPEN_BRACKET) {
+			// a: [16]i32; the length has to be a literal
+			Token* length = tokenizer.next_token();
+			if (length->type != TokenType::INTEGER_LITERAL || tokenizer.next_token()->type != TokenType::CLOSE_BRACKET) {
+				return new ParseError("array length isn't an integer");
+			}
+			Token* element_type = tokenizer.next_token();
+			if (element_type->type != TokenType::IDENTIFIER) {
+				return new ParseError("array has no element type");
+			}
+			VariableDecleration* variable_decleration = new VariableDecleration();
+			variable_decleration->name = identifier;
+			variable_decleration->type_name = "[" + tokenizer.get_identifier_name(*length) + "]" + tokenizer.get_identifier_name(*element_type);
+			return variable_decleration;
+		}
 		else if (token->type == TokenType::COLON) {
+			Token* next_token = tokenizer.peek_next_token();
+			if (next_token->type == TokenType::IDENTIFIER && tokenizer.get_identifier_name(*next_token) == "struct") {
+				tokenizer.next_token();
+				return parse_struct(identifier);
+			}
 			ProcedureDecleration* procedure_decleration = new ProcedureDecleration();
 			// constant decleration for now we just assume its a function
 			procedure_decleration->name = identifier;
@@ -397,201 +536,38 @@ SyntaxNode* parse_statement() {
 		variable_assignment->value = parse_expression();
 		return variable_assignment;
 	}
-	else if (token->type == TokenType::OPEN_PARENTHESIS) {
-		ProcedureCall* procedure_call = new ProcedureCall();
-		procedure_call->name = identifier;
-		procedure_call->inputs = parse_arguments();
-		return procedure_call;
-	}
-	return nullptr;
-}
-
-
-SyntaxNode* evaluate_block(Block* block);
-
-std::map<std::string, Procedure*> procedures;
-std::map<std::string, SyntaxNode*> variables;
-
-SyntaxNode* evaluate_node(SyntaxNode* node) {
-	switch (node->type)
-	{
-	case SyntaxNode::Type::INTEGER_LITERAL:
-	case SyntaxNode::Type::FLOAT_LITERAL:
-	case SyntaxNode::Type::STRING_LITERAL:
-	case SyntaxNode::Type::BOOLEAN_LITERAL:
-		return node;
-
-	case SyntaxNode::Type::BLOCK:
-	{
-		return evaluate_block((Block*)node);
-	}
-	break;
-
-	case SyntaxNode::Type::WHILE_STATEMENT:
-	{
-		WhileStatement* while_statement = (WhileStatement*)node;
-		while (true) {
-			SyntaxNode* condition_eval = evaluate_node(while_statement->condition);
-			if (condition_eval->type != SyntaxNode::Type::BOOLEAN_LITERAL) {
-				std::cout << "while statement condition is not a boolean expression" << std::endl;
-				return nullptr;
-			}
-			BooleanLiteral* boolean_condition = (BooleanLiteral*)condition_eval;
-			if (!boolean_condition->value) {
-				break;
-			}
-
-			evaluate_block(while_statement->body);
-		}
-	}
-	break;
-
-	case SyntaxNode::Type::IF_STATEMENT:
-	{
-		IfStatement* if_statement = (IfStatement*)node;
-		SyntaxNode* condition_eval = evaluate_node(if_statement->condition);
-		if (condition_eval->type != SyntaxNode::Type::BOOLEAN_LITERAL) {
-			std::cout << "if statement condition is not a boolean expression" << std::endl;
-			return nullptr;
-		}
-		BooleanLiteral* boolean_condition = (BooleanLiteral*)condition_eval;
-		if (boolean_condition->value) {
-			evaluate_block(if_statement->body);
-		}
-	}
-	break;
-
-	case SyntaxNode::Type::VARIABLE_CALL:
-	{
-		VariableCall* var_call = (VariableCall*)node;
-		return variables[var_call->name];
-	}
-	break;
-
-	case SyntaxNode::Type::VARIABLE_DECLERATION:
-	{
-		VariableDecleration* var_decl = (VariableDecleration*)node;
-		variables[var_decl->name] = nullptr;
-	}
-	break;
-
-	case SyntaxNode::Type::PROCEDURE_DECLERATION:
-	{
-		ProcedureDecleration* proc_decl = (ProcedureDecleration*)node;
-		procedures[proc_decl->name] = proc_decl->procedure;
-	}
-	break;
-
-	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
-	{
-		VariableAssignment* var_assign = (VariableAssignment*)node;
-		variables[var_assign->name] = evaluate_node(var_assign->value);
-	}
-	break;
-
-	case SyntaxNode::Type::PROCEDURE_CALL:
-	{
-		ProcedureCall* procedure_call = (ProcedureCall*)node;
-		if (procedure_call->name == "print") {
-			for (auto input : procedure_call->inputs) {
-				SyntaxNode* evaluated = evaluate_node(input);
-				evaluated->print();
+	else if (token->type == TokenType::OPEN_BRACKET || token->type == TokenType::DOT) {
+		ElementAssignment* element_assignment = new ElementAssignment();
+		element_assignment->name = identifier;
+		if (token->type == TokenType::DOT) {
+			// p.x = value; the dot was already taken, the field name is next
+			element_assignment->index = new IntLiteral();
+			Token* field = tokenizer.next_token();
+			if (field->type != TokenType::IDENTIFIER) {
+				return new ParseError("no field name after the dot");
 			}
-			std::cout << std::endl;
-			return nullptr;
-		}
-		if (procedure_call->name == "time_nano_seconds") {
-			int time = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-			IntLiteral* int_literal = new IntLiteral();
-			int_literal->value = time;
-			return int_literal;
+			element_assignment->field = tokenizer.get_identifier_name(*field);
 		}
 		else {
-			Procedure* procedure = procedures[procedure_call->name];
-
-			if (!procedure) {
-				std::cout << "we dont have this procedure!";
-				return nullptr;
+			element_assignment->index = parse_expression();
+			if (tokenizer.next_token()->type != TokenType::CLOSE_BRACKET) {
+				return new ParseError("no closing bracket");
 			}
-			
-			// adding variables 
-			for (int i = 0; i < procedure->inputs.size(); i++) {
-				VariableDecleration* input_decl = (VariableDecleration*)procedure->inputs[i];
-				SyntaxNode* input_value = procedure_call->inputs[i];
-				variables[input_decl->name] = evaluate_node(input_value);
+			if (!parse_field(element_assignment->field)) {
+				return new ParseError("no field name after the dot");
 			}
-
-			SyntaxNode* result = evaluate_node(procedure->body);
-			return result;
 		}
-	}
-	break;
-
-	case SyntaxNode::Type::BINARY_OPERATOR:
-	{
-		BinaryOperator* binary_operator = (BinaryOperator*)node;
-		
-		SyntaxNode* left = evaluate_node(binary_operator->left);
-		SyntaxNode* right = evaluate_node(binary_operator->right);
-
-		if (left->type == SyntaxNode::Type::INTEGER_LITERAL && right->type == SyntaxNode::Type::INTEGER_LITERAL) {
-			
-			IntLiteral* left_int = (IntLiteral*)left;
-			IntLiteral* right_int = (IntLiteral*)right;
-
-
-			BooleanLiteral* bool_literal = new BooleanLiteral();
-			IntLiteral* int_literal = new IntLiteral();
-
-			switch (binary_operator->operation)
-			{
-			case BinaryOperator::Type::ADD:
-				int_literal->value = left_int->value + right_int->value;
-				break;
-			case BinaryOperator::Type::MULTIPLY:
-				int_literal->value = left_int->value * right_int->value;
-				break;
-			case BinaryOperator::Type::SUBTRACT:
-				int_literal->value = left_int->value - right_int->value;
-				break;
-			case BinaryOperator::Type::DIVIDE:
-				int_literal->value = left_int->value / right_int->value;
-				break;
-
-			// BOOLEAN
-			case BinaryOperator::Type::LESS_THAN:
-				bool_literal->value = left_int->value < right_int->value;
-				return bool_literal;
-			case BinaryOperator::Type::GREATER_THAN:
-				bool_literal->value = left_int->value > right_int->value;
-				return bool_literal;
-			case BinaryOperator::Type::EQUAL:
-				bool_literal->value = left_int->value == right_int->value;
-				return bool_literal;
-			default:
-				break;
-			}
-			return int_literal;
+		if (tokenizer.next_token()->type != TokenType::EQUALS) {
+			return new ParseError("element isn't assigned");
 		}
-		
-	}
-	break;
-
-	default:
-		break;
+		element_assignment->value = parse_expression();
+		return element_assignment;
 	}
-	return nullptr;
-}
-
-SyntaxNode* evaluate_block(Block* block) {
-	for (SyntaxNode* statement : block->statements) {
-		if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) {
-			ReturnStatement* return_statement = (ReturnStatement*)statement;
-			return evaluate_node(return_statement->expression);
-		}
-		else {
-			evaluate_node(statement);
-		}
+	else if (token->type == TokenType::OPEN_PARENTHESIS) {
+		ProcedureCall* procedure_call = new ProcedureCall();
+		procedure_call->name = identifier;
+		procedure_call->inputs = parse_arguments();
+		return procedure_call;
 	}
 	return nullptr;
 }
@@ -607,7 +583,7 @@ SyntaxNode* generate_link(SyntaxNode* expression, std::vector<SyntaxNode*>& gene
 	// make into var assign and usage
 	VariableDecleration* decl = new VariableDecleration();
 	decl->name = get_generated_name();
-	decl->type_name = "int";
+	decl->type_name = ""; // the type checker gives it the type of the expression
 	generated_statements.push_back(decl);
 
 	VariableAssignment* assignment = new VariableAssignment();
@@ -628,7 +604,8 @@ SyntaxNode* flatten_expression(SyntaxNode* expression, std::vector<SyntaxNode*>&
 		for (int i = 0; i < procedure_call->inputs.size(); i++) {
 			SyntaxNode* input_expression = procedure_call->inputs[i];
 			input_expression = flatten_expression(input_expression, generated_statements);
-			if (!is_literal(input_expression)) {
+			// variables are passed as they are, an array can't be copied into a temporary
+			if (!is_literal(input_expression) && input_expression->type != SyntaxNode::Type::VARIABLE_CALL) {
 				input_expression = generate_link(input_expression, generated_statements);
 			}
 			procedure_call->inputs[i] = input_expression;
@@ -647,6 +624,24 @@ SyntaxNode* flatten_expression(SyntaxNode* expression, std::vector<SyntaxNode*>&
 			return generate_link(binary_operator, generated_statements);
 		}
 	}
+
+	// the index ends up a literal or a variable, so the element is one memory operand
+	if (expression->type == SyntaxNode::Type::ARRAY_INDEX) {
+		ArrayIndex* array_index = (ArrayIndex*)expression;
+		array_index->index = flatten_expression(array_index->index, generated_statements);
+		if (!top_level) {
+			return generate_link(array_index, generated_statements);
+		}
+	}
+	return expression;
+}
+
+// a load is only ever the whole value of an assignment
+SyntaxNode* flatten_value(SyntaxNode* expression, std::vector<SyntaxNode*>& generated_statements) {
+	expression = flatten_expression(expression, generated_statements, true);
+	if (expression->type == SyntaxNode::Type::ARRAY_INDEX) {
+		return generate_link(expression, generated_statements);
+	}
 	return expression;
 }
 
@@ -655,6 +650,7 @@ void flatten(Block* block) {
 	for (int i = 0; i < block->statements.size(); i++) {
 
 		SyntaxNode* statement = block->statements[i];
+		int generated_from = modified_statements.size();
 		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
 			VariableAssignment* assignment = (VariableAssignment*)statement;
 
@@ -662,7 +658,7 @@ void flatten(Block* block) {
 		}
 		if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) {
 			ReturnStatement* return_statement = (ReturnStatement*)statement;
-			return_statement->expression = flatten_expression(return_statement->expression, modified_statements, true);
+			return_statement->expression = flatten_value(return_statement->expression, modified_statements);
 		}
 		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
 			ProcedureDecleration* proc_decl = (ProcedureDecleration*)statement;
@@ -670,34 +666,31 @@ void flatten(Block* block) {
 		}
 		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
 			WhileStatement* while_statement = (WhileStatement*)statement;
-			while_statement->condition = flatten_expression(while_statement->condition, modified_statements, true);
+			while_statement->condition = flatten_value(while_statement->condition, modified_statements);
 			flatten(while_statement->body);
 		}
 		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
 			IfStatement* if_statement = (IfStatement*)statement;
-			if_statement->condition = flatten_expression(if_statement->condition, modified_statements, true);
+			if_statement->condition = flatten_value(if_statement->condition, modified_statements);
 			flatten(if_statement->body);
 		}
+		if (statement->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+			ElementAssignment* element_assignment = (ElementAssignment*)statement;
+			element_assignment->index = flatten_expression(element_assignment->index, modified_statements);
+			element_assignment->value = flatten_expression(element_assignment->value, modified_statements);
+		}
 		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL) {
 			flatten_expression(statement, modified_statements, true);
 		}
+		for (int j = generated_from; j < modified_statements.size(); j++) {
+			modified_statements[j]->line = statement->line;
+		}
 		modified_statements.push_back(statement);
 	}
 	block->statements = modified_statements;
 }
 
-int main(int argc, char** argv) {
-	char* program_file = argv[1];
-	
-	bool run = false;
-	if (argc > 2) {
-		std::string run_arg = argv[2];
-		if (run_arg == "-run") {
-			run = true;
-		}
-	}
-
-	std::string program_text = get_file_contents_as_text(program_file);
+std::vector<Token> tokenize(const std::string& program_text) {
 	std::vector<Token> tokens;
 
 	int text_index = 0;
@@ -795,22 +788,1068 @@ int main(int argc, char** argv) {
 
 	Token end_brace;
 	end_brace.type = TokenType::CLOSE_BRACE;
+	end_brace.start_index = program_text.size();
+	end_brace.end_index = program_text.size();
 	tokens.push_back(end_brace);
+	return tokens;
+}
 
-	
+// MODULES
+// a program is its main file and every file it imports, each split into its top level declarations and those
+// parsed on their own (or taken from the cache), then their procedures put in one program, imported modules
+// first. an edit to one procedure only reparses that procedure
+
+int cached_declarations = 0;
+int parsed_declarations = 0;
+std::set<std::string> loaded_modules;
+std::map<std::string, std::string> procedure_modules; // which file declared each procedure
+
+std::string directory_of(const std::string& path) {
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// cuts a module after each semi colon or closing brace outside of any braces, skipping strings and comments
+// the way the tokenizer does. the comments and blank lines in front of a declaration go with it
+std::vector<std::string> split_declarations(const std::string& program_text) {
+	std::vector<std::string> declarations;
+	int start = 0;
+	int depth = 0;
+	int index = 0;
+	while (index < program_text.size()) {
+		char text_char = program_text[index];
+		if (text_char == '"') {
+			size_t end = program_text.find('"', index + 1);
+			if (end != std::string::npos) {
+				index = (int)end + 1;
+				continue;
+			}
+		}
+		if (text_char == '/' && index + 1 < program_text.size() && program_text[index + 1] == '/') {
+			size_t end = program_text.find('\n', index + 2);
+			index = end == std::string::npos ? (int)program_text.size() : (int)end + 1;
+			continue;
+		}
+		index++;
+		if (text_char == '{') depth++;
+		if (text_char == '}') depth--;
+		if (depth <= 0 && (text_char == ';' || text_char == '}')) {
+			declarations.push_back(program_text.substr(start, index - start));
+			start = index;
+			depth = 0;
+		}
+	}
+	if (program_text.find_first_not_of(" \t\r\n", start) != std::string::npos) {
+		declarations.push_back(program_text.substr(start));
+	}
+	return declarations;
+}
+
+// untouched by the passes, each build gets a copy to optimize
+std::map<std::string, Block*> remembered_declarations;
+
+Block* remembered_declaration(const std::string& program_text) {
+	if (!cache_in_memory) return nullptr;
+	auto found = remembered_declarations.find(program_text);
+	if (found == remembered_declarations.end()) return nullptr;
+	std::map<std::string, std::string> renamed;
+	return clone_block(found->second, renamed);
+}
+
+void remember_declaration(const std::string& program_text, Block* declaration) {
+	if (!cache_in_memory) return;
+	std::map<std::string, std::string> renamed;
+	remembered_declarations[program_text] = clone_block(declaration, renamed);
+}
+
+// tokenizes, parses and flattens one top level declaration
+Block* parse_declaration(const std::string& program_text) {
+	PhaseStart phase = begin_phase();
+	Block* declaration = remembered_declaration(program_text);
+	if (declaration) {
+		cached_declarations++;
+		end_phase("declaration cache", phase);
+		return declaration;
+	}
+	declaration = load_cached_declaration(program_text);
+	if (declaration) {
+		cached_declarations++;
+		remember_declaration(program_text, declaration);
+		end_phase("declaration cache", phase);
+		return declaration;
+	}
+	end_phase("declaration cache", phase);
+
+	phase = begin_phase();
+	std::vector<Token> tokens = tokenize(program_text);
 	// print_tokens(std::cout, tokens, program_text);
 	// std::cout << "\n";
+	end_phase("lex", phase);
+	add_count("tokens", tokens.size());
+
+	phase = begin_phase();
+	tokenizer.set_text(program_text, tokens);
+	generated_name_counter = 0; // temporaries only have to be unique within a procedure
+	declaration = parse_block();
+	end_phase("parse", phase);
+
+	phase = begin_phase();
+	flatten(declaration);
+	end_phase("flatten", phase);
+	parsed_declarations++;
+
+	phase = begin_phase();
+	store_cached_declaration(program_text, declaration);
+	remember_declaration(program_text, declaration);
+	end_phase("declaration cache", phase);
+	return declaration;
+}
+
+// declarations are parsed and cached with lines counted from their own text, this moves them to where it is in the file
+void shift_lines(SyntaxNode* node, int lines) {
+	if (node->line > 0) node->line += lines;
+	switch (node->type)
+	{
+	case SyntaxNode::Type::BLOCK:
+		for (SyntaxNode* statement : ((Block*)node)->statements) shift_lines(statement, lines);
+		break;
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		shift_lines(((WhileStatement*)node)->body, lines);
+		break;
+	case SyntaxNode::Type::IF_STATEMENT:
+		shift_lines(((IfStatement*)node)->body, lines);
+		break;
+	case SyntaxNode::Type::PROCEDURE_DECLERATION:
+		if (((ProcedureDecleration*)node)->procedure) shift_lines(((ProcedureDecleration*)node)->procedure->body, lines);
+		break;
+	default:
+		break;
+	}
+}
+
+Block* parse_module(const std::string& program_text) {
+	Block* module = new Block();
+	PhaseStart phase = begin_phase();
+	std::vector<std::string> declarations = split_declarations(program_text);
+	end_phase("split", phase);
+	int lines_before = 0;
+	for (const std::string& text : declarations) {
+		Block* declaration = parse_declaration(text);
+		for (SyntaxNode* statement : declaration->statements) {
+			shift_lines(statement, lines_before);
+			module->statements.push_back(statement);
+		}
+		lines_before += (int)std::count(text.begin(), text.end(), '\n');
+	}
+	return module;
+}
+
+void collect_parse_errors(SyntaxNode* node, std::vector<std::string>& errors) {
+	switch (node->type)
+	{
+	case SyntaxNode::Type::PARSE_ERROR:
+		errors.push_back(((ParseError*)node)->error);
+		break;
+	case SyntaxNode::Type::BINARY_OPERATOR:
+		collect_parse_errors(((BinaryOperator*)node)->left, errors);
+		collect_parse_errors(((BinaryOperator*)node)->right, errors);
+		break;
+	case SyntaxNode::Type::PROCEDURE_CALL:
+		for (SyntaxNode* input : ((ProcedureCall*)node)->inputs) collect_parse_errors(input, errors);
+		break;
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		collect_parse_errors(((VariableAssignment*)node)->value, errors);
+		break;
+	case SyntaxNode::Type::ARRAY_INDEX:
+		collect_parse_errors(((ArrayIndex*)node)->index, errors);
+		break;
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+		collect_parse_errors(((ElementAssignment*)node)->index, errors);
+		collect_parse_errors(((ElementAssignment*)node)->value, errors);
+		break;
+	case SyntaxNode::Type::STRUCT_DECLERATION:
+		for (SyntaxNode* field : ((StructDecleration*)node)->fields) collect_parse_errors(field, errors);
+		break;
+	case SyntaxNode::Type::RETURN_STATEMENT:
+		collect_parse_errors(((ReturnStatement*)node)->expression, errors);
+		break;
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		collect_parse_errors(((WhileStatement*)node)->condition, errors);
+		collect_parse_errors(((WhileStatement*)node)->body, errors);
+		break;
+	case SyntaxNode::Type::IF_STATEMENT:
+		collect_parse_errors(((IfStatement*)node)->condition, errors);
+		collect_parse_errors(((IfStatement*)node)->body, errors);
+		break;
+	case SyntaxNode::Type::BLOCK:
+		for (SyntaxNode* statement : ((Block*)node)->statements) collect_parse_errors(statement, errors);
+		break;
+	case SyntaxNode::Type::PROCEDURE_DECLERATION:
+	{
+		Procedure* procedure = ((ProcedureDecleration*)node)->procedure;
+		if (!procedure) {
+			errors.push_back("procedure with no inputs");
+			break;
+		}
+		for (SyntaxNode* input : procedure->inputs) collect_parse_errors(input, errors);
+		collect_parse_errors(procedure->body, errors);
+		break;
+	}
+	default:
+		break;
+	}
+}
 
-	tokenizer.program_text = program_text;
-	tokenizer.tokens = &tokens;
-	tokenizer.index = 0;
-	Block* block = parse_block();
+void load_module(const std::string& path, Block* program, std::vector<std::string>& errors) {
+	if (!loaded_modules.insert(path).second) {
+		return;
+	}
+	std::ifstream file(path);
+	if (!file) {
+		errors.push_back("can't open " + path);
+		return;
+	}
+	PhaseStart phase = begin_phase();
+	std::string program_text = get_file_contents_as_text(path);
+	end_phase("read", phase);
+	Block* module = parse_module(program_text);
+	std::vector<std::string> parse_errors;
+	collect_parse_errors(module, parse_errors);
+	for (const std::string& parse_error : parse_errors) {
+		errors.push_back("parse error in " + path + ": " + parse_error);
+	}
+	if (parse_errors.size() > 0) {
+		return;
+	}
+	for (SyntaxNode* statement : module->statements) {
+		if (statement->type == SyntaxNode::Type::IMPORT_STATEMENT) {
+			load_module(directory_of(path) + ((ImportStatement*)statement)->path, program, errors);
+		}
+	}
+	for (SyntaxNode* statement : module->statements) {
+		if (statement->type == SyntaxNode::Type::IMPORT_STATEMENT) {
+			continue;
+		}
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			std::string name = ((ProcedureDecleration*)statement)->name;
+			((ProcedureDecleration*)statement)->source_file = path;
+			auto declared = procedure_modules.find(name);
+			if (declared != procedure_modules.end()) {
+				errors.push_back(name + " is declared in both " + declared->second + " and " + path);
+				continue;
+			}
+			procedure_modules[name] = path;
+		}
+		program->statements.push_back(statement);
+	}
+}
+
+// BUILDING
+// one build runs the whole pipeline over the program as it is on disk. watching keeps the compiler running and
+// builds again whenever a file it loaded changes, with the cache kept in memory so only the declarations that
+// were edited get parsed and only the procedures whose optimized trees changed get generated again, then
+// everything is assembled and linked
+
+struct BuildRequest {
+	std::string program_file;
+	CompileOptions options;
+	std::set<std::string> roots = { "main" };
+	bool report = false;
+	bool profile_use = false;
+	bool use_cache = true;
+	bool watch = false;
+	bool stats = false;
+	std::string stats_json; // where to write the stats as json, empty for nowhere
+};
+
+// every node of the tree, and how many of the variables are temporaries flattening made up
+void count_nodes(SyntaxNode* node, long long& nodes, long long& temporaries) {
+	nodes++;
+	switch (node->type)
+	{
+	case SyntaxNode::Type::VARIABLE_DECLERATION:
+		if (((VariableDecleration*)node)->name.rfind("generated_ident_", 0) == 0) temporaries++;
+		break;
+	case SyntaxNode::Type::BINARY_OPERATOR:
+		count_nodes(((BinaryOperator*)node)->left, nodes, temporaries);
+		count_nodes(((BinaryOperator*)node)->right, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::PROCEDURE_CALL:
+		for (SyntaxNode* input : ((ProcedureCall*)node)->inputs) count_nodes(input, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		count_nodes(((VariableAssignment*)node)->value, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::ARRAY_INDEX:
+		count_nodes(((ArrayIndex*)node)->index, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+		count_nodes(((ElementAssignment*)node)->index, nodes, temporaries);
+		count_nodes(((ElementAssignment*)node)->value, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::RETURN_STATEMENT:
+		count_nodes(((ReturnStatement*)node)->expression, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		count_nodes(((WhileStatement*)node)->condition, nodes, temporaries);
+		count_nodes(((WhileStatement*)node)->body, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::IF_STATEMENT:
+		count_nodes(((IfStatement*)node)->condition, nodes, temporaries);
+		count_nodes(((IfStatement*)node)->body, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::BLOCK:
+		for (SyntaxNode* statement : ((Block*)node)->statements) count_nodes(statement, nodes, temporaries);
+		break;
+	case SyntaxNode::Type::PROCEDURE_DECLERATION:
+	{
+		Procedure* procedure = ((ProcedureDecleration*)node)->procedure;
+		for (SyntaxNode* input : procedure->inputs) count_nodes(input, nodes, temporaries);
+		for (SyntaxNode* output : procedure->outputs) count_nodes(output, nodes, temporaries);
+		count_nodes(procedure->body, nodes, temporaries);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// a procedure comes out of the optimizer the same as long as it and everything it can call are unchanged, so
+// a watching compiler keeps a copy of what each one came out as, keyed by the trees they were loaded as. purity
+// is still worked out over the whole program first, it's cheap and what the reused procedures call needs it
+std::map<unsigned long long, ProcedureDecleration*> remembered_optimizations;
+
+std::map<std::string, unsigned long long> optimization_keys(Block* program) {
+	std::map<std::string, unsigned long long> loaded;
+	std::map<std::string, std::set<std::string>> calls;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type != SyntaxNode::Type::PROCEDURE_DECLERATION) continue;
+		ProcedureDecleration* procedure_decl = (ProcedureDecleration*)statement;
+		std::ostringstream tree;
+		if (!write_node(tree, procedure_decl)) continue;
+		loaded[procedure_decl->name] = hash_text(tree.str());
+		collect_calls(procedure_decl->procedure->body, calls[procedure_decl->name]);
+	}
+
+	std::map<std::string, unsigned long long> keys;
+	for (auto& entry : loaded) {
+		std::set<std::string> reachable;
+		std::vector<std::string> pending = { entry.first };
+		while (pending.size() > 0) {
+			std::string name = pending.back();
+			pending.pop_back();
+			if (!reachable.insert(name).second) continue;
+			for (const std::string& call : calls[name]) pending.push_back(call);
+		}
+		std::string key = string_format("optimized %d %s", cache_version, entry.first.c_str());
+		// range analysis goes by the lengths of the static arrays
+		for (auto& array : static_arrays) {
+			key += " static " + array.first + " " + array_type_name(array.second);
+		}
+		bool complete = true;
+		for (const std::string& name : reachable) {
+			auto found = loaded.find(name);
+			if (found == loaded.end()) {
+				// the c runtime is the same every time, a procedure that couldn't be written out isn't
+				if (procedure_modules.count(name) > 0) complete = false;
+				continue;
+			}
+			key += string_format(" %s %016llx", name.c_str(), found->second);
+		}
+		if (complete) keys[entry.first] = hash_text(key);
+	}
+	return keys;
+}
+
+// puts a copy of each remembered procedure in the program, returns a block of the ones that still need optimizing
+Block* reuse_optimized_procedures(Block* program, std::map<std::string, unsigned long long>& keys) {
+	keys = optimization_keys(program);
+	Block* changed = new Block();
+	for (SyntaxNode*& statement : program->statements) {
+		if (statement->type != SyntaxNode::Type::PROCEDURE_DECLERATION) continue;
+		ProcedureDecleration* procedure_decl = (ProcedureDecleration*)statement;
+		auto key = keys.find(procedure_decl->name);
+		auto remembered = key == keys.end() ? remembered_optimizations.end() : remembered_optimizations.find(key->second);
+		if (remembered == remembered_optimizations.end()) {
+			changed->statements.push_back(statement);
+			continue;
+		}
+		std::map<std::string, std::string> renamed;
+		statement = clone_node(remembered->second, renamed);
+		((ProcedureDecleration*)statement)->source_file = procedure_decl->source_file;
+		procedures[procedure_decl->name] = ((ProcedureDecleration*)statement)->procedure; // for folding calls to it
+	}
+	return changed;
+}
+
+void remember_optimized_procedures(Block* changed, std::map<std::string, unsigned long long>& keys) {
+	for (SyntaxNode* statement : changed->statements) {
+		ProcedureDecleration* procedure_decl = (ProcedureDecleration*)statement;
+		auto key = keys.find(procedure_decl->name);
+		if (key == keys.end()) continue;
+		std::map<std::string, std::string> renamed;
+		remembered_optimizations[key->second] = (ProcedureDecleration*)clone_node(procedure_decl, renamed);
+	}
+}
+
+int build(BuildRequest& request) {
+	CompileOptions& options = request.options;
+	loaded_modules.clear();
+	procedure_modules.clear();
+	cached_declarations = 0;
+	parsed_declarations = 0;
+	cached_units = 0;
+	folded_calls = 0;
+	merged_calls = 0;
+	peephole_removed = 0;
+	reset_stats();
+
+	Block* block = new Block();
+	std::vector<std::string> load_errors;
+	load_module(request.program_file, block, load_errors);
+	for (const std::string& load_error : load_errors) {
+		std::cout << load_error << std::endl;
+	}
+	if (load_errors.size() > 0) {
+		return 1;
+	}
 	//evaluate_block(block);
-	flatten(block);
-	// run program
-	//evaluate_block(procedures["main"]->body);
-	std::string filename = program_file;
+	if (collect_stats) {
+		long long nodes = 0;
+		long long temporaries = 0;
+		count_nodes(block, nodes, temporaries);
+		add_count("declarations", cached_declarations + parsed_declarations);
+		add_count("declarations cached", cached_declarations);
+		add_count("nodes", nodes);
+		add_count("temporaries", temporaries);
+	}
+
+	PhaseStart phase = begin_phase();
+	std::vector<std::string> type_errors = check_types(block);
+	end_phase("type check", phase);
+	for (const std::string& type_error : type_errors) {
+		std::cout << type_error << std::endl;
+	}
+	if (type_errors.size() > 0) {
+		return 1;
+	}
+
+	// an object is linked against code the compiler never sees, so any procedure in it might be called
+	std::set<std::string> roots = request.roots;
+	std::set<std::string> declared;
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type != SyntaxNode::Type::PROCEDURE_DECLERATION) continue;
+		declared.insert(((ProcedureDecleration*)statement)->name);
+		if (options.object) roots.insert(((ProcedureDecleration*)statement)->name);
+	}
+	bool missing_exports = false;
+	for (const std::string& root : request.roots) {
+		if (root == "main" || declared.count(root) > 0) continue;
+		std::cout << "exported procedure " << root << " isn't declared" << std::endl;
+		missing_exports = true;
+	}
+	if (missing_exports) {
+		return 1;
+	}
+
+	phase = begin_phase();
+	Stripped stripped = remove_unreachable_procedures(block, roots);
+	end_phase("reachability", phase);
+	phase = begin_phase();
+	int pure_count = analyse_purity(block);
+	end_phase("purity", phase);
+	Block* changed = block;
+	std::map<std::string, unsigned long long> keys;
+	if (cache_in_memory) {
+		phase = begin_phase();
+		changed = reuse_optimized_procedures(block, keys);
+		end_phase("reuse optimized", phase);
+	}
+	int value_numbering_removed = 0;
+	int hoisted_calls = 0;
+	int unchecked_accesses = 0;
+	if (options.optimize) {
+		phase = begin_phase();
+		value_numbering_removed = value_numbering(changed);
+		end_phase("value numbering", phase);
+		// copies of loop invariant inputs have been propagated by now, and the hoisted calls get merged on the second run
+		phase = begin_phase();
+		hoisted_calls = hoist_loop_invariant_calls(changed);
+		end_phase("hoisting", phase);
+		phase = begin_phase();
+		value_numbering_removed += value_numbering(changed);
+		end_phase("value numbering", phase);
+		phase = begin_phase();
+		unchecked_accesses = remove_bounds_checks(changed);
+		end_phase("bounds checks", phase);
+	}
+	if (cache_in_memory) {
+		phase = begin_phase();
+		remember_optimized_procedures(changed, keys);
+		end_phase("reuse optimized", phase);
+	}
+	add_count("unreachable procedures", stripped.procedures);
+	add_count("pure procedures", pure_count);
+	add_count("hoisted calls", hoisted_calls);
+	add_count("folded calls", folded_calls);
+	add_count("merged calls", merged_calls);
+	add_count("value numbering removed", value_numbering_removed);
+	add_count("bounds checks removed", unchecked_accesses);
+	if (request.report) {
+		std::cout << "removed " << stripped.procedures << " unreachable procedures, " << stripped.statements << " statements" << std::endl;
+		std::cout << "purity analysis found " << pure_count << " pure procedures" << std::endl;
+		std::cout << "hoisted " << hoisted_calls << " pure calls out of loops" << std::endl;
+		std::cout << "folded " << folded_calls << " pure calls with constant inputs" << std::endl;
+		std::cout << "merged " << merged_calls << " duplicate pure calls" << std::endl;
+		std::cout << "value numbering removed " << value_numbering_removed << " instructions" << std::endl;
+		std::cout << "range analysis removed " << unchecked_accesses << " bounds checks" << std::endl;
+	}
+
+	std::string filename = request.program_file;
 	const std::string extension = ".graph";
 	filename = filename.substr(0, filename.size() - extension.size());
-	compile(block, filename, run);
-}
\ No newline at end of file
+
+	// counters are numbered the same way for both builds, before the profile changes anything
+	phase = begin_phase();
+	if (options.profile_generate || request.profile_use) {
+		number_profile_points(block);
+	}
+	if (request.profile_use) {
+		std::string problem = load_profile(filename + ".profile");
+		if (problem.length() > 0) {
+			std::cout << problem << ", compiling without it" << std::endl;
+		}
+		else {
+			int inlined = inline_hot_calls(block);
+			int unrolled = unroll_hot_loops(block);
+			if (request.report) {
+				std::cout << "profile inlined " << inlined << " hot calls and unrolled " << unrolled << " hot loops" << std::endl;
+			}
+			add_count("inlined calls", inlined);
+			add_count("unrolled loops", unrolled);
+		}
+	}
+	if (options.profile_generate || request.profile_use) {
+		end_phase("profile", phase);
+	}
+
+	// run program
+	//evaluate_block(procedures["main"]->body);
+	compile(block, filename, options);
+	add_count("procedures cached", cached_units);
+	add_count("peephole removed", peephole_removed);
+	if (request.report) {
+		std::cout << "peephole removed " << peephole_removed << " instructions" << std::endl;
+		if (cache_enabled()) {
+			std::cout << "cache had " << cached_declarations << " of " << cached_declarations + parsed_declarations << " declarations and " << cached_units << " of " << block->statements.size() << " procedures" << std::endl;
+		}
+	}
+	if (request.stats) {
+		print_stats(std::cout);
+	}
+	if (request.stats_json.length() > 0) {
+		write_stats_json(request.stats_json);
+	}
+	return 0;
+}
+
+// when each loaded file was last written, -1 for ones that couldn't be opened
+std::map<std::string, long long> module_times() {
+	std::map<std::string, long long> times;
+	for (const std::string& path : loaded_modules) {
+		struct stat file_status;
+		if (stat(path.c_str(), &file_status) != 0) {
+			times[path] = -1;
+			continue;
+		}
+#ifdef _WIN32
+		times[path] = (long long)file_status.st_mtime;
+#else
+		times[path] = (long long)file_status.st_mtim.tv_sec * 1000000000LL + file_status.st_mtim.tv_nsec; // two saves in one second still count
+#endif
+	}
+	return times;
+}
+
+int build_reporting_errors(BuildRequest& request) {
+	try {
+		return build(request);
+	}
+	catch (std::exception& error) {
+		std::cout << error.what() << std::endl;
+		return 1;
+	}
+}
+
+void watch(BuildRequest& request) {
+	cache_in_memory = true;
+	build_reporting_errors(request);
+	std::map<std::string, long long> times = module_times();
+	std::cout << "watching " << times.size() << " files" << std::endl;
+	while (true) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		std::map<std::string, long long> changed = module_times();
+		if (changed == times) {
+			continue;
+		}
+		auto start = std::chrono::steady_clock::now();
+		int result = build_reporting_errors(request);
+		auto end = std::chrono::steady_clock::now();
+		// files an import was added or removed for come and go from the list
+		times = module_times();
+		long long milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+		std::cout << (result == 0 ? "rebuilt" : "build failed") << " in " << milliseconds << " ms" << std::endl;
+	}
+}
+
+// THROUGHPUT
+// -bench builds generated programs from 1KB up to -size bytes, each about three times bigger than the last, and
+// prints how many megabytes of source each phase gets through a second at every size. a phase that is linear in
+// its input keeps the same rate once the fixed costs stop mattering, one whose rate keeps falling is worse than
+// linear and gets flagged. nothing is cached, every size is built from scratch
+
+std::string byte_count_name(long long bytes) {
+	if (bytes >= 1000000) return string_format("%.3gM", bytes / 1e6);
+	if (bytes >= 1000) return string_format("%.3gK", bytes / 1e3);
+	return string_format("%lld", bytes);
+}
+
+void write_throughput_json(const std::string& path, const std::vector<long long>& sizes, const std::vector<std::pair<std::string, std::vector<double>>>& rates) {
+	std::ofstream out(path);
+	out << "{\n  \"sizes\": [";
+	for (int i = 0; i < sizes.size(); i++) {
+		out << (i > 0 ? ", " : "") << sizes[i];
+	}
+	out << "],\n  \"megabytes_per_second\": {";
+	for (int i = 0; i < rates.size(); i++) {
+		out << string_format("%s\n    \"%s\": [", i > 0 ? "," : "", rates[i].first.c_str());
+		for (int j = 0; j < rates[i].second.size(); j++) {
+			out << (j > 0 ? ", " : "") << string_format("%.3f", rates[i].second[j]);
+		}
+		out << "]";
+	}
+	out << "\n  }\n}\n";
+}
+
+int run_throughput_benchmark(BuildRequest& request, GeneratorSettings settings) {
+	long long largest = settings.size > 0 ? settings.size : 100000000;
+	std::vector<long long> sizes;
+	for (int step = 0; 1000 * std::pow(10.0, step / 2.0) < largest; step++) {
+		sizes.push_back((long long)(1000 * std::pow(10.0, step / 2.0)));
+	}
+	sizes.push_back(largest);
+
+	std::string json_file = request.stats_json;
+	request.stats_json = "";
+	request.program_file = "throughput.graph";
+	request.options.run = false;
+	cache_directory = "";
+	cache_in_memory = false;
+	collect_stats = true;
+	// phases in the order they first ran, with a rate for each size, 0 where a phase didn't run
+	std::vector<std::pair<std::string, std::vector<double>>> rates;
+	auto rate_of = [&](const std::string& name) -> std::vector<double>& {
+		for (auto& phase : rates) {
+			if (phase.first == name) return phase.second;
+		}
+		rates.push_back({ name, std::vector<double>(sizes.size(), 0) });
+		return rates.back().second;
+	};
+	for (int i = 0; i < sizes.size(); i++) {
+		settings.size = sizes[i];
+		settings.procedures = 0;
+		std::string text = generate_program(settings);
+		std::ofstream(request.program_file, std::ios::binary) << text;
+		double megabytes = text.size() / 1e6;
+
+		auto start = std::chrono::steady_clock::now();
+		int result = build_reporting_errors(request);
+		auto end = std::chrono::steady_clock::now();
+		if (result != 0) {
+			std::cout << "build of " << byte_count_name(text.size()) << " failed" << std::endl;
+			break;
+		}
+		double seconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() / 1e9;
+		for (PhaseStats& phase : phase_stats) {
+			if (phase.nanoseconds > 0) rate_of(phase.name)[i] = megabytes / (phase.nanoseconds / 1e9);
+		}
+		rate_of("total")[i] = megabytes / seconds;
+		std::cout << string_format("built %s in %.3f s, peak rss %lld kb", byte_count_name(text.size()).c_str(), seconds, peak_rss_kilobytes()) << std::endl;
+	}
+	std::remove("throughput.graph");
+	std::remove("throughput.asm");
+	std::remove("throughput.o");
+	std::remove("throughput.obj");
+	std::remove("throughput");
+	std::remove("throughput.exe");
+
+	std::cout << std::endl << string_format("%-20s", "MB/s");
+	for (long long size : sizes) {
+		std::cout << string_format(" %9s", byte_count_name(size).c_str());
+	}
+	std::cout << "   scaling" << std::endl;
+	for (auto& phase : rates) {
+		std::cout << string_format("%-20s", phase.first.c_str());
+		double best = 0;
+		for (double rate : phase.second) {
+			std::cout << string_format(" %9.2f", rate);
+			if (rate > best) best = rate;
+		}
+		// the largest input against the best any size managed, small sizes are all fixed cost so only the best counts
+		double last = phase.second.back();
+		double scaling = best > 0 ? last / best : 0;
+		std::cout << string_format("   %7.2f%s", scaling, last > 0 && scaling < 0.5 ? " nonlinear" : "") << std::endl;
+	}
+	if (json_file.length() > 0) {
+		write_throughput_json(json_file, sizes, rates);
+	}
+	return 0;
+}
+
+// INTERPRETING
+// -interpret runs the program through the tree walking evaluator instead of compiling it, straight from the
+// parsed and type checked tree so it measures the interpreter on its own
+
+int interpret(const std::string& program_file) {
+	Block* block = new Block();
+	std::vector<std::string> errors;
+	load_module(program_file, block, errors);
+	if (errors.size() == 0) {
+		errors = check_types(block);
+	}
+	for (const std::string& error : errors) {
+		std::cout << error << std::endl;
+	}
+	if (errors.size() > 0) {
+		return 1;
+	}
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			procedures[((ProcedureDecleration*)statement)->name] = ((ProcedureDecleration*)statement)->procedure;
+		}
+	}
+	if (!procedures["main"]) {
+		std::cout << "no main procedure" << std::endl;
+		return 1;
+	}
+	interpreting_types = &procedure_types["main"];
+	reset_static_arrays();
+	SyntaxNode* result = nullptr;
+	try {
+		result = evaluate_block(procedures["main"]->body);
+	}
+	catch (std::runtime_error& error) {
+		flush_output();
+		std::cout << error.what() << std::endl;
+		return 1;
+	}
+	flush_output();
+	return result && result->type == SyntaxNode::Type::INTEGER_LITERAL ? (int)((IntLiteral*)result)->value : 0;
+}
+
+// RUNTIME BENCHMARKS
+// -bench-runtime runs every kernel in a directory through the interpreter, the native code at -O0, with the
+// default optimizations and with a profile, and the c version next to it built by the system compiler. each runs
+// in its own process, so what the interpreter leaks doesn't slow down starting the next one. the compiled ones
+// run -runs times and the best is printed, with instructions per cycle where the counters can be read. the
+// interpreter is slow enough to run once, and everything else has to print what it printed. baseline.txt in the
+// same directory holds the times to beat, a kernel more than -tolerance percent slower than its baseline fails
+// the run, and -write-baseline records them instead. the c times are only there to compare against
+
+const char* runtime_backends[] = { "interpreter", "O0", "O1", "pgo", "c" };
+
+// sorted, so the table comes out the same every time
+std::vector<std::string> files_with_extension(const std::string& directory, const std::string& extension) {
+	std::vector<std::string> names;
+#ifdef _WIN32
+	_finddata_t found;
+	intptr_t search = _findfirst((directory + "/*" + extension).c_str(), &found);
+	if (search != -1) {
+		do names.push_back(found.name); while (_findnext(search, &found) == 0);
+		_findclose(search);
+	}
+#else
+	DIR* listing = opendir(directory.c_str());
+	if (listing) {
+		while (dirent* entry = readdir(listing)) {
+			std::string name = entry->d_name;
+			if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0) names.push_back(name);
+		}
+		closedir(listing);
+	}
+#endif
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+std::string read_file(const std::string& path) {
+	std::ifstream in(path, std::ios::binary);
+	std::stringstream text;
+	text << in.rdbuf();
+	return text.str();
+}
+
+// "kernel backend" to milliseconds
+std::map<std::string, double> read_baseline(const std::string& path) {
+	std::map<std::string, double> baseline;
+	std::ifstream in(path);
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream words(line);
+		std::string kernel, backend;
+		double milliseconds;
+		if (line.length() == 0 || line[0] == '#') continue;
+		if (words >> kernel >> backend >> milliseconds) baseline[kernel + " " + backend] = milliseconds;
+	}
+	return baseline;
+}
+
+CounterReading run_command(const std::string& command, const std::string& output_file, std::string& output) {
+	HardwareCounters counters = start_counters();
+	system((command + " > " + output_file).c_str());
+	CounterReading reading = stop_counters(counters);
+	output = read_file(output_file);
+	std::remove(output_file.c_str());
+	return reading;
+}
+
+std::string local_command(const std::string& path) {
+	return path.find_first_of("/\\") == std::string::npos ? "./" + path : path;
+}
+
+// builds the kernel for a backend and returns what runs it, or an empty string when it couldn't be built
+std::string kernel_command(BuildRequest& settings, const std::string& compiler, const std::string& path, const std::string& backend) {
+	std::string base = path.substr(0, path.size() - std::string(".graph").size());
+	if (backend == "interpreter") {
+		return string_format("%s -interpret %s", compiler.c_str(), path.c_str());
+	}
+	if (backend == "c") {
+		std::string command = string_format("cc -O2 -o %s_c %s.c", base.c_str(), base.c_str());
+		return system(command.c_str()) == 0 ? local_command(base + "_c") : "";
+	}
+	BuildRequest request;
+	request.program_file = path;
+	request.options = settings.options;
+	request.options.run = false;
+	request.options.object = false;
+	request.options.optimize = backend != "O0";
+	if (backend == "pgo") {
+		// a training run writes the profile the second build reads
+		request.options.profile_generate = true;
+		if (build_reporting_errors(request) != 0) return "";
+		std::string ignored;
+		run_command(local_command(base), base + ".out", ignored);
+		request.options.profile_generate = false;
+		request.profile_use = true;
+	}
+	return build_reporting_errors(request) == 0 ? local_command(base) : "";
+}
+
+void remove_kernel_outputs(const std::string& path) {
+	std::string base = path.substr(0, path.size() - std::string(".graph").size());
+	for (const char* extension : { "", ".exe", ".asm", ".obj", ".profile", "_c", "_c.exe" }) {
+		std::remove((base + extension).c_str());
+	}
+}
+
+int run_runtime_benchmark(BuildRequest& settings, const std::string& compiler, const std::string& directory, int runs, double tolerance, bool write_baseline) {
+	cache_directory = "";
+	cache_in_memory = false;
+	collect_stats = false;
+	std::string baseline_file = directory + "/baseline.txt";
+	std::map<std::string, double> baseline = read_baseline(baseline_file);
+	std::vector<std::pair<std::string, double>> measured;
+	bool failed = false;
+
+	std::cout << string_format("%-14s %-12s %10s %7s %10s %10s", "kernel", "backend", "ms", "ipc", "speedup", "baseline") << std::endl;
+	for (const std::string& name : files_with_extension(directory, ".graph")) {
+		std::string path = directory + "/" + name;
+		std::string kernel = name.substr(0, name.size() - std::string(".graph").size());
+		std::string expected;
+		double interpreted = 0;
+		for (const char* backend : runtime_backends) {
+			bool interpreter = std::string(backend) == "interpreter";
+			std::string command = kernel_command(settings, compiler, path, backend);
+			std::vector<CounterReading> readings;
+			std::string output;
+			for (int run = 0; command.length() > 0 && run < (interpreter ? 1 : runs); run++) {
+				readings.push_back(run_command(command, path + ".out", output));
+			}
+			remove_kernel_outputs(path);
+			if (interpreter) expected = output;
+			if (readings.size() == 0) {
+				std::cout << string_format("%-14s %-12s %10s", kernel.c_str(), backend, "-") << std::endl;
+				if (std::string(backend) != "c") failed = true;
+				continue;
+			}
+
+			CounterReading best = readings[0];
+			for (CounterReading& reading : readings) {
+				if (reading.milliseconds < best.milliseconds) best = reading;
+			}
+			if (interpreter) interpreted = best.milliseconds;
+			std::string key = kernel + " " + backend;
+			measured.push_back({ key, best.milliseconds });
+			std::string ipc = best.instructions_per_cycle() < 0 ? "-" : string_format("%.2f", best.instructions_per_cycle());
+			auto expected_time = baseline.find(key);
+			std::string previous = expected_time == baseline.end() ? "-" : string_format("%.3f", expected_time->second);
+			std::string verdict;
+			if (output != expected) {
+				verdict = " wrong output";
+				failed = true;
+			}
+			else if (!write_baseline && std::string(backend) != "c" && expected_time != baseline.end() && best.milliseconds > expected_time->second * (1 + tolerance / 100)) {
+				verdict = " slower";
+				failed = true;
+			}
+			std::cout << string_format("%-14s %-12s %10.3f %7s %9.1fx %10s%s", kernel.c_str(), backend, best.milliseconds, ipc.c_str(), interpreted / best.milliseconds, previous.c_str(), verdict.c_str()) << std::endl;
+		}
+	}
+
+	if (write_baseline) {
+		std::ofstream out(baseline_file);
+		out << "# kernel backend milliseconds, written by -bench-runtime -write-baseline\n";
+		for (auto& entry : measured) {
+			out << entry.first << " " << string_format("%.3f", entry.second) << "\n";
+		}
+		return 0;
+	}
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+	BuildRequest request;
+	CompileOptions& options = request.options;
+	GeneratorSettings generator;
+	std::string generate_file;
+	bool bench = false;
+	std::string kernel_directory;
+	int runs = 3;
+	double tolerance = 25;
+	bool write_baseline = false;
+	bool interpret_program = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg[0] != '-' && request.program_file.length() == 0) {
+			request.program_file = arg;
+		}
+		if (arg == "-generate" && i + 1 < argc) {
+			generate_file = argv[++i];
+		}
+		if (arg == "-bench") {
+			bench = true;
+		}
+		if (arg == "-bench-runtime" && i + 1 < argc) {
+			kernel_directory = argv[++i];
+		}
+		if (arg == "-runs" && i + 1 < argc) {
+			runs = std::stoi(argv[++i]);
+		}
+		if (arg == "-tolerance" && i + 1 < argc) {
+			tolerance = std::stod(argv[++i]);
+		}
+		if (arg == "-interpret") {
+			interpret_program = true;
+		}
+		if (arg == "-write-baseline") {
+			write_baseline = true;
+		}
+		if (arg == "-size" && i + 1 < argc) {
+			generator.size = std::stoll(argv[++i]);
+		}
+		if (arg == "-procedures" && i + 1 < argc) {
+			generator.procedures = std::stoi(argv[++i]);
+		}
+		if (arg == "-statements" && i + 1 < argc) {
+			generator.statements = std::stoi(argv[++i]);
+		}
+		if (arg == "-depth" && i + 1 < argc) {
+			generator.depth = std::stoi(argv[++i]);
+		}
+		if (arg == "-expression" && i + 1 < argc) {
+			generator.expression = std::stoi(argv[++i]);
+		}
+		if (arg == "-strings" && i + 1 < argc) {
+			generator.strings = std::stoi(argv[++i]);
+		}
+		if (arg == "-run") {
+			options.run = true;
+		}
+		if (arg == "-report") {
+			request.report = true;
+		}
+		if (arg == "-object") {
+			options.object = true;
+		}
+		if (arg == "-asm") {
+			options.listing = true;
+		}
+		if (arg == "-O0") {
+			options.optimize = false;
+		}
+		if (arg == "-no-cache") {
+			request.use_cache = false;
+		}
+		if (arg == "-watch") {
+			request.watch = true;
+		}
+		if (arg == "-stats") {
+			request.stats = true;
+		}
+		if (arg == "-stats-json" && i + 1 < argc) {
+			request.stats_json = argv[++i];
+		}
+		if (arg == "-profile-generate") {
+			options.profile_generate = true;
+		}
+		if (arg == "-profile-use") {
+			request.profile_use = true;
+		}
+		if (arg == "-export" && i + 1 < argc) {
+			request.roots.insert(argv[++i]);
+		}
+		if (arg == "-threads" && i + 1 < argc) {
+			options.threads = std::stoi(argv[++i]);
+		}
+		if (arg == "-cpu" && i + 1 < argc) {
+			std::string name = argv[++i];
+			if (!select_cpu(name)) {
+				std::cout << "unknown cpu " << name << ", using " << cpu.name << std::endl;
+			}
+		}
+		if (arg == "-target" && i + 1 < argc) {
+			std::string platform = argv[++i];
+			if (platform == "windows") target = windows_target();
+			if (platform == "linux") target = linux_target();
+		}
+	}
+
+	if (generate_file.length() > 0) {
+		if (generator.size == 0 && generator.procedures == 0) generator.size = 1000000;
+		std::ofstream(generate_file, std::ios::binary) << generate_program(generator);
+		return 0;
+	}
+	if (bench) {
+		return run_throughput_benchmark(request, generator);
+	}
+	if (kernel_directory.length() > 0) {
+		return run_runtime_benchmark(request, argv[0], kernel_directory, runs, tolerance, write_baseline);
+	}
+	if (request.program_file.length() == 0) {
+		std::cout << "usage: graph program.graph [options]" << std::endl;
+		return 1;
+	}
+
+	if (interpret_program) {
+		return interpret(request.program_file);
+	}
+
+	collect_stats = request.stats || request.stats_json.length() > 0;
+	if (request.use_cache) {
+		open_cache(directory_of(request.program_file) + ".graph_cache");
+	}
+	if (request.watch) {
+		watch(request);
+	}
+	return build_reporting_errors(request);
+}
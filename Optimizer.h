@@ -0,0 +1,1037 @@
+#pragma once
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "Interpreter.h"
+#include "Parsing.h"
+#include "Profile.h"
+#include "Types.h"
+#include "Utils.h"
+
+// passes that run over the flattened tree before code generation
+
+// PURITY
+// a procedure is pure when it only touches its own variables and only calls other pure procedures,
+// calls to it can be moved, merged or evaluated at compile time. printf, print and anything else we
+// don't have the body of are assumed to have side effects. arrays it declares are its own, static arrays and
+// ones passed in aren't, writing an element of either is seen by others
+std::set<std::string> pure_procedures;
+// pure procedures that also can't fail or run forever: they don't divide, index arrays, loop or recurse, so a
+// call to one can be made where the program might not have made it
+std::set<std::string> infallible_procedures;
+
+void collect_declared_variables(Block* block, std::set<std::string>& declared) {
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
+			declared.insert(((VariableDecleration*)statement)->name);
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			collect_declared_variables(((WhileStatement*)statement)->body, declared);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			collect_declared_variables(((IfStatement*)statement)->body, declared);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			collect_declared_variables((Block*)statement, declared);
+		}
+	}
+}
+
+void collect_assigned_variables(Block* block, std::set<std::string>& assigned) {
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
+			assigned.insert(((VariableAssignment*)statement)->name);
+		}
+		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
+			assigned.insert(((VariableDecleration*)statement)->name);
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			collect_assigned_variables(((WhileStatement*)statement)->body, assigned);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			collect_assigned_variables(((IfStatement*)statement)->body, assigned);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			collect_assigned_variables((Block*)statement, assigned);
+		}
+	}
+}
+
+struct Effects {
+	bool touches_globals = false;
+	bool may_fail = false;
+	std::set<std::string> calls;
+};
+
+void collect_effects(SyntaxNode* node, std::set<std::string>& locals, Effects& effects) {
+	switch (node->type)
+	{
+	case SyntaxNode::Type::VARIABLE_CALL:
+		if (locals.count(((VariableCall*)node)->name) == 0) {
+			effects.touches_globals = true;
+		}
+		break;
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+	{
+		VariableAssignment* assignment = (VariableAssignment*)node;
+		if (locals.count(assignment->name) == 0) {
+			effects.touches_globals = true;
+		}
+		collect_effects(assignment->value, locals, effects);
+	}
+	break;
+	case SyntaxNode::Type::ARRAY_INDEX:
+		effects.may_fail = true;
+		if (locals.count(((ArrayIndex*)node)->name) == 0) {
+			effects.touches_globals = true;
+		}
+		collect_effects(((ArrayIndex*)node)->index, locals, effects);
+		break;
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+	{
+		ElementAssignment* element_assignment = (ElementAssignment*)node;
+		effects.may_fail = true;
+		if (locals.count(element_assignment->name) == 0) {
+			effects.touches_globals = true;
+		}
+		collect_effects(element_assignment->index, locals, effects);
+		collect_effects(element_assignment->value, locals, effects);
+	}
+	break;
+	case SyntaxNode::Type::BINARY_OPERATOR:
+	{
+		BinaryOperator* binary_operator = (BinaryOperator*)node;
+		if (binary_operator->operation == BinaryOperator::Type::DIVIDE || binary_operator->operation == BinaryOperator::Type::MODULO) {
+			effects.may_fail = true;
+		}
+		collect_effects(binary_operator->left, locals, effects);
+		collect_effects(binary_operator->right, locals, effects);
+	}
+	break;
+	case SyntaxNode::Type::PROCEDURE_CALL:
+	{
+		ProcedureCall* procedure_call = (ProcedureCall*)node;
+		effects.calls.insert(procedure_call->name);
+		for (SyntaxNode* input : procedure_call->inputs) {
+			collect_effects(input, locals, effects);
+		}
+	}
+	break;
+	case SyntaxNode::Type::RETURN_STATEMENT:
+		collect_effects(((ReturnStatement*)node)->expression, locals, effects);
+		break;
+	case SyntaxNode::Type::WHILE_STATEMENT:
+		effects.may_fail = true;
+		collect_effects(((WhileStatement*)node)->condition, locals, effects);
+		collect_effects(((WhileStatement*)node)->body, locals, effects);
+		break;
+	case SyntaxNode::Type::IF_STATEMENT:
+		collect_effects(((IfStatement*)node)->condition, locals, effects);
+		collect_effects(((IfStatement*)node)->body, locals, effects);
+		break;
+	case SyntaxNode::Type::BLOCK:
+		for (SyntaxNode* statement : ((Block*)node)->statements) {
+			collect_effects(statement, locals, effects);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+// returns how many procedures are pure
+int analyse_purity(Block* program) {
+	std::map<std::string, Effects> procedure_effects;
+
+	pure_procedures.clear();
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type != SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			continue;
+		}
+		ProcedureDecleration* procedure_decl = (ProcedureDecleration*)statement;
+		Procedure* procedure = procedure_decl->procedure;
+
+		std::set<std::string> locals;
+		bool shares_array = false;
+		for (SyntaxNode* input : procedure->inputs) {
+			locals.insert(((VariableDecleration*)input)->name);
+			shares_array = shares_array || is_array_type_name(((VariableDecleration*)input)->type_name);
+		}
+		collect_declared_variables(procedure->body, locals);
+
+		Effects& effects = procedure_effects[procedure_decl->name];
+		effects.touches_globals = shares_array;
+		collect_effects(procedure->body, locals, effects);
+		if (!effects.touches_globals) {
+			pure_procedures.insert(procedure_decl->name);
+		}
+	}
+
+	// start optimistic so recursive procedures can be pure, then remove anything calling an impure procedure
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto& entry : procedure_effects) {
+			if (pure_procedures.count(entry.first) == 0) {
+				continue;
+			}
+			for (const std::string& call : entry.second.calls) {
+				if (pure_procedures.count(call) == 0) {
+					pure_procedures.erase(entry.first);
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// start empty so recursion never gets in, a procedure joins once everything it calls has
+	infallible_procedures.clear();
+	changed = true;
+	while (changed) {
+		changed = false;
+		for (auto& entry : procedure_effects) {
+			if (pure_procedures.count(entry.first) == 0 || infallible_procedures.count(entry.first) > 0 || entry.second.may_fail) {
+				continue;
+			}
+			bool calls_infallible = true;
+			for (const std::string& call : entry.second.calls) {
+				calls_infallible = calls_infallible && infallible_procedures.count(call) > 0;
+			}
+			if (calls_infallible) {
+				infallible_procedures.insert(entry.first);
+				changed = true;
+			}
+		}
+	}
+
+	// the evaluator needs the bodies to fold calls
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			ProcedureDecleration* procedure_decl = (ProcedureDecleration*)statement;
+			procedures[procedure_decl->name] = procedure_decl->procedure;
+		}
+	}
+	return pure_procedures.size();
+}
+
+bool is_pure_call(SyntaxNode* expression) {
+	return expression->type == SyntaxNode::Type::PROCEDURE_CALL && pure_procedures.count(((ProcedureCall*)expression)->name) > 0;
+}
+
+// LOOP INVARIANT CALLS
+// a pure call whose inputs don't change inside a loop gives the same result every iteration,
+// so it is computed once into a new variable before the loop. a loop can run no times, and a call that could
+// fail or never return mustn't be made when the loop wouldn't have made it, so unless the callee is infallible
+// the hoisted call goes in an if on the loop's condition, and only when nothing earlier in the body can return
+// before the call is reached. that if doesn't move out of an enclosing loop
+int hoisted_name_counter = 0;
+
+bool is_loop_invariant(SyntaxNode* input, std::set<std::string>& assigned) {
+	if (is_literal(input)) {
+		return true;
+	}
+	return input->type == SyntaxNode::Type::VARIABLE_CALL && assigned.count(((VariableCall*)input)->name) == 0;
+}
+
+// evaluating it once more just before the loop does nothing the loop's own first check wouldn't
+bool is_repeatable(SyntaxNode* condition) {
+	if (condition->type == SyntaxNode::Type::PROCEDURE_CALL) {
+		return is_pure_call(condition);
+	}
+	if (condition->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		return is_repeatable(((BinaryOperator*)condition)->left) && is_repeatable(((BinaryOperator*)condition)->right);
+	}
+	return true;
+}
+
+// whether running the statement can return from the procedure, and so leave the loop it's in early
+bool can_return(SyntaxNode* statement) {
+	std::vector<SyntaxNode*>* statements = nullptr;
+	if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) return true;
+	if (statement->type == SyntaxNode::Type::IF_STATEMENT) statements = &((IfStatement*)statement)->body->statements;
+	if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) statements = &((WhileStatement*)statement)->body->statements;
+	if (statement->type == SyntaxNode::Type::BLOCK) statements = &((Block*)statement)->statements;
+	if (!statements) return false;
+	for (SyntaxNode* inner : *statements) {
+		if (can_return(inner)) return true;
+	}
+	return false;
+}
+
+int hoist_from_block(Block* block) {
+	int hoisted = 0;
+	std::vector<SyntaxNode*> hoisted_statements;
+
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			hoisted += hoist_from_block(((IfStatement*)statement)->body);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			hoisted += hoist_from_block((Block*)statement);
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			WhileStatement* while_statement = (WhileStatement*)statement;
+
+			// inner loops first so their invariants can keep moving outwards
+			hoisted += hoist_from_block(while_statement->body);
+
+			std::set<std::string> assigned;
+			collect_assigned_variables(while_statement->body, assigned);
+			bool guardable = is_repeatable(while_statement->condition);
+			Block* guarded = new Block();
+			bool returned = false; // a statement before this one may return, so the loop needn't reach it
+
+			for (SyntaxNode* body_statement : while_statement->body->statements) {
+				bool reached = !returned;
+				returned = returned || can_return(body_statement);
+				if (body_statement->type != SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
+					continue;
+				}
+				VariableAssignment* assignment = (VariableAssignment*)body_statement;
+				if (!is_pure_call(assignment->value)) {
+					continue;
+				}
+				bool invariant = true;
+				for (SyntaxNode* input : ((ProcedureCall*)assignment->value)->inputs) {
+					invariant = invariant && is_loop_invariant(input, assigned);
+				}
+				bool infallible = infallible_procedures.count(((ProcedureCall*)assignment->value)->name) > 0;
+				if (!invariant || (!infallible && (!guardable || !reached))) {
+					continue;
+				}
+
+				VariableDecleration* decl = new VariableDecleration();
+				decl->name = string_format("hoisted_ident_%d", hoisted_name_counter++);
+				decl->type_name = ""; // typed when the checker runs again before code generation
+				decl->line = assignment->line;
+				hoisted_statements.push_back(decl);
+
+				VariableAssignment* hoisted_assignment = new VariableAssignment();
+				hoisted_assignment->name = decl->name;
+				hoisted_assignment->value = assignment->value;
+				hoisted_assignment->line = assignment->line;
+				if (infallible) {
+					hoisted_statements.push_back(hoisted_assignment);
+				}
+				else {
+					guarded->statements.push_back(hoisted_assignment);
+				}
+
+				VariableCall* var_call = new VariableCall();
+				var_call->name = decl->name;
+				assignment->value = var_call;
+				hoisted++;
+			}
+			if (guarded->statements.size() > 0) {
+				std::map<std::string, std::string> renamed;
+				IfStatement* guard = new IfStatement();
+				guard->condition = clone_node(while_statement->condition, renamed);
+				guard->body = guarded;
+				guard->line = while_statement->line;
+				hoisted_statements.push_back(guard);
+			}
+		}
+		hoisted_statements.push_back(statement);
+	}
+	block->statements = hoisted_statements;
+	return hoisted;
+}
+
+int hoist_loop_invariant_calls(Block* program) {
+	int hoisted = 0;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			hoisted_name_counter = 0; // names only have to be unique within a procedure
+			hoisted += hoist_from_block(((ProcedureDecleration*)statement)->procedure->body);
+		}
+	}
+	return hoisted;
+}
+
+// VALUE NUMBERING
+// every variable is given the number of the value it currently holds, two computations with the same
+// operation on the same numbered operands produce the same value, so the second one can just read the
+// variable that already holds it
+struct ValueTable {
+	std::map<std::string, int> variable_values;
+	std::map<std::string, int> expression_values;
+	std::map<int, std::vector<std::string>> holders;
+	std::map<int, long long> constants;
+	std::map<std::string, ValueType>* types = nullptr; // the procedure's, as of the last type check
+};
+
+int value_count = 0;
+int new_value() {
+	return value_count++;
+}
+
+int get_variable_value(ValueTable& table, const std::string& name) {
+	auto found = table.variable_values.find(name);
+	if (found != table.variable_values.end()) {
+		return found->second;
+	}
+	int value = new_value();
+	table.variable_values[name] = value;
+	table.holders[value].push_back(name);
+	return value;
+}
+
+// values are numbered without their types, and the same literal or arithmetic on it is a different value in an
+// i8 than in an int, so a variable only stands in for one of the same type. variables added since the types were
+// checked don't have one yet, they hold the result of a call like what they replaced
+bool same_type(ValueTable& table, const std::string& first, const std::string& second) {
+	if (!table.types) return true;
+	auto first_type = table.types->find(first);
+	auto second_type = table.types->find(second);
+	return first_type == table.types->end() || second_type == table.types->end() || first_type->second == second_type->second;
+}
+
+// the first variable that still holds the value and can be used as the named one, or an empty string
+std::string get_holder(ValueTable& table, int value, const std::string& name) {
+	for (std::string& holder : table.holders[value]) {
+		if (table.variable_values[holder] == value && same_type(table, holder, name)) {
+			return holder;
+		}
+	}
+	return "";
+}
+
+void set_variable_value(ValueTable& table, const std::string& name, int value) {
+	table.variable_values[name] = value;
+	table.holders[value].push_back(name);
+}
+
+int get_operand_value(ValueTable& table, SyntaxNode* operand) {
+	switch (operand->type)
+	{
+	case SyntaxNode::Type::VARIABLE_CALL:
+		return get_variable_value(table, ((VariableCall*)operand)->name);
+	case SyntaxNode::Type::INTEGER_LITERAL:
+	{
+		IntLiteral* int_literal = (IntLiteral*)operand;
+		std::string key = string_format("int %lld", int_literal->value);
+		if (table.expression_values.count(key) == 0) {
+			int value = new_value();
+			table.expression_values[key] = value;
+			table.constants[value] = int_literal->value;
+		}
+		return table.expression_values[key];
+	}
+	case SyntaxNode::Type::BOOLEAN_LITERAL:
+	{
+		std::string key = string_format("bool %d", ((BooleanLiteral*)operand)->value);
+		if (table.expression_values.count(key) == 0) {
+			table.expression_values[key] = new_value();
+		}
+		return table.expression_values[key];
+	}
+	default:
+		return new_value();
+	}
+}
+
+// replaces a variable read with the oldest variable holding the same value
+SyntaxNode* propagate_operand(ValueTable& table, SyntaxNode* operand) {
+	if (operand->type != SyntaxNode::Type::VARIABLE_CALL) {
+		return operand;
+	}
+	VariableCall* var_call = (VariableCall*)operand;
+	std::string holder = get_holder(table, get_variable_value(table, var_call->name), var_call->name);
+	if (holder.length() > 0 && holder != var_call->name) {
+		VariableCall* replacement = new VariableCall();
+		replacement->name = holder;
+		return replacement;
+	}
+	return operand;
+}
+
+void propagate_operands(ValueTable& table, SyntaxNode* expression) {
+	if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		BinaryOperator* binary_operator = (BinaryOperator*)expression;
+		binary_operator->left = propagate_operand(table, binary_operator->left);
+		binary_operator->right = propagate_operand(table, binary_operator->right);
+	}
+	if (expression->type == SyntaxNode::Type::PROCEDURE_CALL) {
+		ProcedureCall* procedure_call = (ProcedureCall*)expression;
+		for (int i = 0; i < procedure_call->inputs.size(); i++) {
+			procedure_call->inputs[i] = propagate_operand(table, procedure_call->inputs[i]);
+		}
+	}
+	if (expression->type == SyntaxNode::Type::ARRAY_INDEX) {
+		ArrayIndex* array_index = (ArrayIndex*)expression;
+		array_index->index = propagate_operand(table, array_index->index);
+	}
+	if (expression->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+		ElementAssignment* element_assignment = (ElementAssignment*)expression;
+		element_assignment->index = propagate_operand(table, element_assignment->index);
+		element_assignment->value = propagate_operand(table, element_assignment->value);
+	}
+}
+
+bool is_commutative(BinaryOperator::Type operation) {
+	return operation == BinaryOperator::Type::ADD || operation == BinaryOperator::Type::MULTIPLY || operation == BinaryOperator::Type::EQUAL;
+}
+
+std::string expression_key(ValueTable& table, BinaryOperator* binary_operator) {
+	int left = get_operand_value(table, binary_operator->left);
+	int right = get_operand_value(table, binary_operator->right);
+	if (is_commutative(binary_operator->operation) && right < left) {
+		std::swap(left, right);
+	}
+	return string_format("op %d %d %d", (int)binary_operator->operation, left, right);
+}
+
+std::string call_key(ValueTable& table, ProcedureCall* procedure_call) {
+	std::string key = "call " + procedure_call->name;
+	for (SyntaxNode* input : procedure_call->inputs) {
+		key += string_format(" %d", get_operand_value(table, input));
+	}
+	return key;
+}
+
+int folded_calls = 0;
+int merged_calls = 0;
+
+// runs a pure call through the evaluator when every input is a known constant
+IntLiteral* fold_call(ValueTable& table, ProcedureCall* procedure_call) {
+	if (!is_integer(procedure_types[procedure_call->name].result)) {
+		return nullptr; // the interpreter only works in integers
+	}
+	ProcedureCall* constant_call = new ProcedureCall();
+	constant_call->name = procedure_call->name;
+	for (SyntaxNode* input : procedure_call->inputs) {
+		auto constant = table.constants.find(get_operand_value(table, input));
+		if (constant == table.constants.end()) {
+			return nullptr;
+		}
+		IntLiteral* int_literal = new IntLiteral();
+		int_literal->value = constant->second;
+		constant_call->inputs.push_back(int_literal);
+	}
+
+	std::map<std::string, SyntaxNode*> saved_variables = variables;
+	std::map<std::string, ArrayValues*> saved_arrays = arrays;
+	SyntaxNode* result = nullptr;
+	evaluation_budget = 100000; // pure doesn't mean it terminates
+	try {
+		result = evaluate_node(constant_call);
+	}
+	catch (std::runtime_error&) {
+		result = nullptr;
+	}
+	evaluation_budget = -1;
+	returning = false;
+	variables = saved_variables;
+	arrays = saved_arrays;
+
+	// only fold what can be an immediate operand
+	if (!result || result->type != SyntaxNode::Type::INTEGER_LITERAL) {
+		return nullptr;
+	}
+	long long value = ((IntLiteral*)result)->value;
+	if (value < INT32_MIN || value > INT32_MAX) {
+		return nullptr;
+	}
+	IntLiteral* folded = new IntLiteral();
+	folded->value = value;
+	return folded;
+}
+
+// anything assigned inside a block that may or may not run (or runs many times) holds an unknown value afterwards
+void kill_assigned_variables(ValueTable& table, Block* block) {
+	std::set<std::string> assigned;
+	collect_assigned_variables(block, assigned);
+	for (const std::string& name : assigned) {
+		set_variable_value(table, name, new_value());
+	}
+}
+
+int number_block(Block* block, ValueTable& table) {
+	int removed = 0;
+
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
+			VariableDecleration* decl = (VariableDecleration*)statement;
+			set_variable_value(table, decl->name, new_value());
+		}
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
+			VariableAssignment* assignment = (VariableAssignment*)statement;
+			int value = -1;
+
+			if (assignment->value->type == SyntaxNode::Type::BINARY_OPERATOR) {
+				BinaryOperator* binary_operator = (BinaryOperator*)assignment->value;
+				propagate_operands(table, binary_operator);
+				std::string key = expression_key(table, binary_operator);
+
+				auto found = table.expression_values.find(key);
+				if (found != table.expression_values.end()) {
+					value = found->second;
+					std::string holder = get_holder(table, value, assignment->name);
+					if (holder.length() > 0) {
+						VariableCall* var_call = new VariableCall();
+						var_call->name = holder;
+						assignment->value = var_call;
+						removed++;
+					}
+				}
+				else {
+					value = new_value();
+					table.expression_values[key] = value;
+				}
+			}
+			else if (assignment->value->type == SyntaxNode::Type::PROCEDURE_CALL) {
+				ProcedureCall* procedure_call = (ProcedureCall*)assignment->value;
+				propagate_operands(table, procedure_call);
+				value = new_value();
+
+				if (is_pure_call(procedure_call)) {
+					IntLiteral* folded = fold_call(table, procedure_call);
+					std::string key = call_key(table, procedure_call);
+					auto found = table.expression_values.find(key);
+
+					if (folded) {
+						assignment->value = folded;
+						value = get_operand_value(table, folded);
+						folded_calls++;
+						removed++;
+					}
+					else if (found != table.expression_values.end() && get_holder(table, found->second, assignment->name).length() > 0) {
+						value = found->second;
+						VariableCall* var_call = new VariableCall();
+						var_call->name = get_holder(table, value, assignment->name);
+						assignment->value = var_call;
+						merged_calls++;
+						removed++;
+					}
+					else {
+						table.expression_values[key] = value;
+					}
+				}
+			}
+			else if (assignment->value->type == SyntaxNode::Type::ARRAY_INDEX) {
+				// elements aren't numbered, any store could have changed what a load reads
+				propagate_operands(table, assignment->value);
+				value = new_value();
+			}
+			else {
+				assignment->value = propagate_operand(table, assignment->value);
+				value = get_operand_value(table, assignment->value);
+			}
+			set_variable_value(table, assignment->name, value);
+		}
+		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL || statement->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+			propagate_operands(table, statement);
+		}
+		if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) {
+			ReturnStatement* return_statement = (ReturnStatement*)statement;
+			return_statement->expression = propagate_operand(table, return_statement->expression);
+			propagate_operands(table, return_statement->expression);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			IfStatement* if_statement = (IfStatement*)statement;
+			propagate_operands(table, if_statement->condition);
+
+			// the body is dominated by everything before it
+			ValueTable body_table = table;
+			removed += number_block(if_statement->body, body_table);
+
+			// values from before the if survive the join unless the body changed them
+			kill_assigned_variables(table, if_statement->body);
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			WhileStatement* while_statement = (WhileStatement*)statement;
+
+			// the loop head is reached from before the loop and from the end of the body
+			kill_assigned_variables(table, while_statement->body);
+			propagate_operands(table, while_statement->condition);
+
+			ValueTable body_table = table;
+			removed += number_block(while_statement->body, body_table);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			ValueTable body_table = table;
+			removed += number_block((Block*)statement, body_table);
+			kill_assigned_variables(table, (Block*)statement);
+		}
+	}
+	return removed;
+}
+
+void count_reads(SyntaxNode* expression, std::map<std::string, int>& reads) {
+	if (expression->type == SyntaxNode::Type::VARIABLE_CALL) {
+		reads[((VariableCall*)expression)->name]++;
+	}
+	if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		BinaryOperator* binary_operator = (BinaryOperator*)expression;
+		count_reads(binary_operator->left, reads);
+		count_reads(binary_operator->right, reads);
+	}
+	if (expression->type == SyntaxNode::Type::PROCEDURE_CALL) {
+		for (SyntaxNode* input : ((ProcedureCall*)expression)->inputs) {
+			count_reads(input, reads);
+		}
+	}
+	if (expression->type == SyntaxNode::Type::ARRAY_INDEX) {
+		reads[((ArrayIndex*)expression)->name]++;
+		count_reads(((ArrayIndex*)expression)->index, reads);
+	}
+	if (expression->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+		// the store stays whether or not anything reads the array, so the array does too
+		ElementAssignment* element_assignment = (ElementAssignment*)expression;
+		reads[element_assignment->name]++;
+		count_reads(element_assignment->index, reads);
+		count_reads(element_assignment->value, reads);
+	}
+}
+
+void count_reads(Block* block, std::map<std::string, int>& reads) {
+	for (SyntaxNode* statement : block->statements) {
+		switch (statement->type)
+		{
+		case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+			count_reads(((VariableAssignment*)statement)->value, reads);
+			break;
+		case SyntaxNode::Type::PROCEDURE_CALL:
+		case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+			count_reads(statement, reads);
+			break;
+		case SyntaxNode::Type::RETURN_STATEMENT:
+			count_reads(((ReturnStatement*)statement)->expression, reads);
+			break;
+		case SyntaxNode::Type::IF_STATEMENT:
+			count_reads(((IfStatement*)statement)->condition, reads);
+			count_reads(((IfStatement*)statement)->body, reads);
+			break;
+		case SyntaxNode::Type::WHILE_STATEMENT:
+			count_reads(((WhileStatement*)statement)->condition, reads);
+			count_reads(((WhileStatement*)statement)->body, reads);
+			break;
+		case SyntaxNode::Type::BLOCK:
+			count_reads((Block*)statement, reads);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// a load that could be out of range still has to stop the program
+bool has_side_effects(SyntaxNode* expression) {
+	if (expression->type == SyntaxNode::Type::ARRAY_INDEX) return ((ArrayIndex*)expression)->checked;
+	return expression->type == SyntaxNode::Type::PROCEDURE_CALL && !is_pure_call(expression);
+}
+
+// removes assignments to variables nobody reads, and their declerations once nothing assigns them
+int remove_dead_assignments(Block* block, std::map<std::string, int>& reads) {
+	int removed = 0;
+	std::vector<SyntaxNode*> live_statements;
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
+			VariableAssignment* assignment = (VariableAssignment*)statement;
+			if (reads[assignment->name] == 0 && !has_side_effects(assignment->value)) {
+				removed++;
+				continue;
+			}
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			removed += remove_dead_assignments(((WhileStatement*)statement)->body, reads);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			removed += remove_dead_assignments(((IfStatement*)statement)->body, reads);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			removed += remove_dead_assignments((Block*)statement, reads);
+		}
+		live_statements.push_back(statement);
+	}
+	block->statements = live_statements;
+	return removed;
+}
+
+void collect_assignment_targets(Block* block, std::set<std::string>& targets) {
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
+			targets.insert(((VariableAssignment*)statement)->name);
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			collect_assignment_targets(((WhileStatement*)statement)->body, targets);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			collect_assignment_targets(((IfStatement*)statement)->body, targets);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			collect_assignment_targets((Block*)statement, targets);
+		}
+	}
+}
+
+void remove_unused_declerations(Block* block, std::set<std::string>& used) {
+	std::vector<SyntaxNode*> live_statements;
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
+			if (used.count(((VariableDecleration*)statement)->name) == 0) {
+				continue;
+			}
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			remove_unused_declerations(((WhileStatement*)statement)->body, used);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			remove_unused_declerations(((IfStatement*)statement)->body, used);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			remove_unused_declerations((Block*)statement, used);
+		}
+		live_statements.push_back(statement);
+	}
+	block->statements = live_statements;
+}
+
+int remove_dead_code(Procedure* procedure) {
+	int removed = 0;
+	while (true) {
+		std::map<std::string, int> reads;
+		count_reads(procedure->body, reads);
+		int removed_now = remove_dead_assignments(procedure->body, reads);
+		removed += removed_now;
+		if (removed_now == 0) {
+			break;
+		}
+	}
+
+	std::set<std::string> used;
+	std::map<std::string, int> reads;
+	count_reads(procedure->body, reads);
+	for (auto& entry : reads) {
+		used.insert(entry.first);
+	}
+	collect_assignment_targets(procedure->body, used);
+	remove_unused_declerations(procedure->body, used);
+	return removed;
+}
+
+// returns how many instructions were removed
+int value_numbering(Block* program) {
+	int removed = 0;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type != SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			continue;
+		}
+		Procedure* procedure = ((ProcedureDecleration*)statement)->procedure;
+
+		ValueTable table;
+		auto types = procedure_types.find(((ProcedureDecleration*)statement)->name);
+		if (types != procedure_types.end()) table.types = &types->second.variables;
+		for (SyntaxNode* input : procedure->inputs) {
+			set_variable_value(table, ((VariableDecleration*)input)->name, new_value());
+		}
+		removed += number_block(procedure->body, table);
+		removed += remove_dead_code(procedure);
+	}
+	return removed;
+}
+
+// BOUNDS CHECKS
+// a loop counting an int up from a literal that isn't negative, for as long as it's below a limit known before the
+// loop, and only ever changing it with a step up at the top level of its body, has the counter in range in
+// everything before the step. an access at exactly the counter there can't be out of range when the limit is no
+// more than the array's length, so it isn't checked
+
+// the literal the nearest statement before index assigns the variable, null when it's anything else
+IntLiteral* literal_before(Block* block, int index, const std::string& name) {
+	for (int i = index - 1; i >= 0; i--) {
+		SyntaxNode* statement = block->statements[i];
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT && ((VariableAssignment*)statement)->name == name) {
+			SyntaxNode* value = ((VariableAssignment*)statement)->value;
+			return value->type == SyntaxNode::Type::INTEGER_LITERAL ? (IntLiteral*)value : nullptr;
+		}
+		Block single;
+		single.statements.push_back(statement);
+		std::set<std::string> assigned;
+		collect_assigned_variables(&single, assigned);
+		if (assigned.count(name) > 0) return nullptr;
+	}
+	return nullptr;
+}
+
+bool is_counter_step(SyntaxNode* statement, const std::string& counter) {
+	if (statement->type != SyntaxNode::Type::VARIABLE_ASSIGNMENT || ((VariableAssignment*)statement)->name != counter) return false;
+	SyntaxNode* value = ((VariableAssignment*)statement)->value;
+	if (value->type != SyntaxNode::Type::BINARY_OPERATOR) return false;
+	BinaryOperator* step = (BinaryOperator*)value;
+	return step->operation == BinaryOperator::Type::ADD && step->left->type == SyntaxNode::Type::VARIABLE_CALL &&
+		((VariableCall*)step->left)->name == counter && step->right->type == SyntaxNode::Type::INTEGER_LITERAL && ((IntLiteral*)step->right)->value > 0;
+}
+
+bool indexes_with(SyntaxNode* index, const std::string& counter) {
+	return index->type == SyntaxNode::Type::VARIABLE_CALL && ((VariableCall*)index)->name == counter;
+}
+
+int uncheck_accesses(Block* block, const std::string& counter, long long limit, ProcedureTypes& types) {
+	int removed = 0;
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT && ((VariableAssignment*)statement)->value->type == SyntaxNode::Type::ARRAY_INDEX) {
+			ArrayIndex* array_index = (ArrayIndex*)((VariableAssignment*)statement)->value;
+			ArrayType* array = find_array(types, array_index->name);
+			if (array_index->checked && array && indexes_with(array_index->index, counter) && limit <= array->length) {
+				array_index->checked = false;
+				removed++;
+			}
+		}
+		if (statement->type == SyntaxNode::Type::ELEMENT_ASSIGNMENT) {
+			ElementAssignment* element_assignment = (ElementAssignment*)statement;
+			ArrayType* array = find_array(types, element_assignment->name);
+			if (element_assignment->checked && array && indexes_with(element_assignment->index, counter) && limit <= array->length) {
+				element_assignment->checked = false;
+				removed++;
+			}
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			removed += uncheck_accesses(((WhileStatement*)statement)->body, counter, limit, types);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			removed += uncheck_accesses(((IfStatement*)statement)->body, counter, limit, types);
+		}
+	}
+	return removed;
+}
+
+int remove_loop_bounds_checks(Block* block, WhileStatement* loop, int index, ProcedureTypes& types) {
+	if (loop->condition->type != SyntaxNode::Type::BINARY_OPERATOR) return 0;
+	BinaryOperator* condition = (BinaryOperator*)loop->condition;
+	if (condition->operation != BinaryOperator::Type::LESS_THAN || condition->left->type != SyntaxNode::Type::VARIABLE_CALL) return 0;
+	std::string counter = ((VariableCall*)condition->left)->name;
+	auto counter_type = types.variables.find(counter);
+	if (counter_type == types.variables.end() || counter_type->second != ValueType::INT) return 0;
+
+	std::set<std::string> assigned;
+	collect_assigned_variables(loop->body, assigned);
+	IntLiteral* start = literal_before(block, index, counter);
+	if (!start || start->value < 0) return 0;
+	long long limit = 0;
+	if (condition->right->type == SyntaxNode::Type::INTEGER_LITERAL) {
+		limit = ((IntLiteral*)condition->right)->value;
+	}
+	else if (condition->right->type == SyntaxNode::Type::VARIABLE_CALL && assigned.count(((VariableCall*)condition->right)->name) == 0) {
+		IntLiteral* known = literal_before(block, index, ((VariableCall*)condition->right)->name);
+		if (!known) return 0;
+		limit = known->value;
+	}
+	else {
+		return 0;
+	}
+
+	// the step has to be the only assignment to the counter anywhere in the body
+	int step = -1;
+	for (int i = 0; i < loop->body->statements.size(); i++) {
+		if (is_counter_step(loop->body->statements[i], counter)) {
+			if (step >= 0) return 0;
+			step = i;
+		}
+	}
+	if (step < 0) return 0;
+	Block before_step;
+	Block after_step;
+	for (int i = 0; i < loop->body->statements.size(); i++) {
+		if (i < step) before_step.statements.push_back(loop->body->statements[i]);
+		if (i > step) after_step.statements.push_back(loop->body->statements[i]);
+	}
+	std::set<std::string> assigned_elsewhere;
+	collect_assigned_variables(&before_step, assigned_elsewhere);
+	collect_assigned_variables(&after_step, assigned_elsewhere);
+	if (assigned_elsewhere.count(counter) > 0) return 0;
+	return uncheck_accesses(&before_step, counter, limit, types);
+}
+
+int remove_block_bounds_checks(Block* block, ProcedureTypes& types) {
+	int removed = 0;
+	for (int i = 0; i < block->statements.size(); i++) {
+		SyntaxNode* statement = block->statements[i];
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			removed += remove_loop_bounds_checks(block, (WhileStatement*)statement, i, types);
+			removed += remove_block_bounds_checks(((WhileStatement*)statement)->body, types);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			removed += remove_block_bounds_checks(((IfStatement*)statement)->body, types);
+		}
+	}
+	return removed;
+}
+
+// returns how many accesses were left unchecked
+int remove_bounds_checks(Block* program) {
+	int removed = 0;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type != SyntaxNode::Type::PROCEDURE_DECLERATION) continue;
+		auto types = procedure_types.find(((ProcedureDecleration*)statement)->name);
+		if (types == procedure_types.end()) continue;
+		removed += remove_block_bounds_checks(((ProcedureDecleration*)statement)->procedure->body, types->second);
+	}
+	return removed;
+}
+
+// REACHABILITY
+// only procedures main or an exported procedure can end up calling are generated, the rest of a library the
+// program was written against is dropped before anything else looks at it. an object build makes every
+// procedure a root, since whatever it's linked with can call any of them
+int count_statements(Block* block) {
+	int count = 0;
+	for (SyntaxNode* statement : block->statements) {
+		count++;
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) count += count_statements(((WhileStatement*)statement)->body);
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) count += count_statements(((IfStatement*)statement)->body);
+		if (statement->type == SyntaxNode::Type::BLOCK) count += count_statements((Block*)statement);
+	}
+	return count;
+}
+
+struct Stripped {
+	int procedures = 0;
+	int statements = 0;
+};
+
+// roots that aren't declared are ignored, without any that are nothing is removed
+Stripped remove_unreachable_procedures(Block* program, const std::set<std::string>& roots) {
+	std::map<std::string, ProcedureDecleration*> declared;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			declared[((ProcedureDecleration*)statement)->name] = (ProcedureDecleration*)statement;
+		}
+	}
+
+	std::set<std::string> reachable;
+	std::vector<std::string> pending;
+	for (const std::string& root : roots) {
+		if (declared.count(root) > 0) pending.push_back(root);
+	}
+	Stripped stripped;
+	if (pending.size() == 0) {
+		return stripped;
+	}
+	while (pending.size() > 0) {
+		std::string name = pending.back();
+		pending.pop_back();
+		if (!reachable.insert(name).second) continue;
+
+		std::set<std::string> locals;
+		Effects effects;
+		collect_effects(declared[name]->procedure->body, locals, effects);
+		for (const std::string& call : effects.calls) {
+			if (declared.count(call) > 0 && reachable.count(call) == 0) pending.push_back(call);
+		}
+	}
+
+	std::vector<SyntaxNode*> kept;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION && reachable.count(((ProcedureDecleration*)statement)->name) == 0) {
+			stripped.procedures++;
+			stripped.statements += count_statements(((ProcedureDecleration*)statement)->procedure->body);
+			continue;
+		}
+		kept.push_back(statement);
+	}
+	program->statements = kept;
+	return stripped;
+}
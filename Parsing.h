@@ -26,10 +26,18 @@ struct SyntaxNode {
 		PROCEDURE,
 
 		WHILE_STATEMENT,
-		IF_STATEMENT
+		IF_STATEMENT,
+		IMPORT_STATEMENT,
+
+		ARRAY_INDEX,
+		ELEMENT_ASSIGNMENT,
+		STRUCT_DECLERATION,
+
+		VECTOR_VALUE // only made by the interpreter, nothing parses to one
 	};
 
 	SyntaxNode::Type type;
+	int line = 0; // where a statement starts in its file, 0 for ones the compiler made up
 	virtual void print() {
 	}
 };
@@ -53,7 +61,7 @@ struct Block : SyntaxNode {
 struct IntLiteral : SyntaxNode {
 
 	IntLiteral() { type = Type::INTEGER_LITERAL; }
-	int value;
+	long long value = 0;
 
 	void print() {
 		std::cout << value;
@@ -82,13 +90,27 @@ struct ParseError : SyntaxNode {
 
 struct FloatLiteral : SyntaxNode {
 	FloatLiteral() { type = Type::FLOAT_LITERAL; }
-	float value;
+	double value;
+	int size = 8; // 4 when the type checker finds it is used as a float
 
 	void print() {
 		std::cout << value;
 	}
 };
 
+// the lanes of a v4i32, v8i32, v4f32 or v8f32 as the interpreter works them out, i32s are exact in a double
+struct VectorValue : SyntaxNode {
+	VectorValue() { type = Type::VECTOR_VALUE; }
+	std::vector<double> lanes;
+	bool floating = false;
+
+	void print() {
+		for (int i = 0; i < lanes.size(); i++) {
+			std::cout << (i == 0 ? "" : " ") << lanes[i];
+		}
+	}
+};
+
 struct StringLiteral : SyntaxNode {
 	StringLiteral() { type = Type::STRING_LITERAL; }
 	std::string value;
@@ -137,6 +159,12 @@ struct IfStatement : SyntaxNode {
 	Block* body;
 };
 
+// import "path.graph"; at the top of a module, the path is relative to the importing module
+struct ImportStatement : SyntaxNode {
+	ImportStatement() { type = Type::IMPORT_STATEMENT; }
+	std::string path;
+};
+
 struct ProcedureCall : SyntaxNode {
 	ProcedureCall() { type = Type::PROCEDURE_CALL; }
 	std::string name;
@@ -166,6 +194,7 @@ struct ProcedureDecleration : SyntaxNode {
 	ProcedureDecleration() { type = Type::PROCEDURE_DECLERATION; }
 	std::string name;
 	Procedure* procedure;
+	std::string source_file; // the module it was loaded from
 
 	void print() {
 		std::cout << "PROC_DECL(" << name << ",";
@@ -185,6 +214,34 @@ struct VariableAssignment : SyntaxNode {
 	}
 };
 
+// name[index] read as a value, or name[index].field of an array of structs. checked is cleared once the index
+// is proven to be in range
+struct ArrayIndex : SyntaxNode {
+	ArrayIndex() { type = Type::ARRAY_INDEX; }
+	std::string name;
+	SyntaxNode* index;
+	std::string field; // empty for an array of numbers
+	bool checked = true;
+};
+
+// name[index] = value; or name[index].field = value;
+struct ElementAssignment : SyntaxNode {
+	ElementAssignment() { type = Type::ELEMENT_ASSIGNMENT; }
+	std::string name;
+	SyntaxNode* index;
+	std::string field;
+	SyntaxNode* value;
+	bool checked = true;
+};
+
+// Name :: struct { field: type; ... }, or struct soa for arrays of it to keep each field in its own run
+struct StructDecleration : SyntaxNode {
+	StructDecleration() { type = Type::STRUCT_DECLERATION; }
+	std::string name;
+	std::vector<SyntaxNode*> fields; // VariableDeclerations
+	bool soa = false;
+};
+
 struct BinaryOperator : SyntaxNode {
 	BinaryOperator() { type = SyntaxNode::Type::BINARY_OPERATOR; }
 	enum class Type {
@@ -194,6 +251,7 @@ struct BinaryOperator : SyntaxNode {
 		SUBTRACT,
 		MULTIPLY,
 		DIVIDE,
+		MODULO,
 
 		// comparison
 		LESS_THAN,
@@ -223,6 +281,9 @@ struct BinaryOperator : SyntaxNode {
 		case BinaryOperator::Type::DIVIDE:
 			std::cout << "/";
 			break;
+		case BinaryOperator::Type::MODULO:
+			std::cout << "%";
+			break;
 		case BinaryOperator::Type::LESS_THAN:
 			std::cout << "<";
 			break;
@@ -246,7 +307,8 @@ bool is_expression(SyntaxNode* node) {
 	if (
 		node->type == SyntaxNode::Type::BINARY_OPERATOR ||
 		node->type == SyntaxNode::Type::PROCEDURE_CALL  ||
-		node->type == SyntaxNode::Type::VARIABLE_CALL
+		node->type == SyntaxNode::Type::VARIABLE_CALL   ||
+		node->type == SyntaxNode::Type::ARRAY_INDEX
 		) {
 		return true;
 	}
@@ -0,0 +1,434 @@
+#pragma once
+#include <vector>
+#include "Instructions.h"
+
+// PEEPHOLE OPTIMIZATION
+// small patterns over neighbouring instructions, repeated until nothing matches.
+// code generation keeps every intermediate value in the rbx accumulator and never lets it live across a label,
+// jump or call, which is what lets most of these patterns prove the accumulator is dead
+
+const Register accumulator = Register::RBX;
+
+bool is_arithmetic(Opcode opcode) {
+	return opcode == Opcode::ADD || opcode == Opcode::SUB || opcode == Opcode::IMUL || opcode == Opcode::XOR || opcode == Opcode::AND ||
+		opcode == Opcode::SHL || opcode == Opcode::SHR || opcode == Opcode::SAR;
+}
+
+bool writes_flags(Opcode opcode) {
+	return is_arithmetic(opcode) || opcode == Opcode::NEG || opcode == Opcode::DIV || opcode == Opcode::IDIV || opcode == Opcode::CMP || opcode == Opcode::TEST ||
+		opcode == Opcode::COMISD;
+}
+
+bool reads_flags(Opcode opcode) {
+	return opcode == Opcode::JCC || opcode == Opcode::SETCC;
+}
+
+bool is_zeroing(const Instruction& instruction) {
+	return instruction.opcode == Opcode::XOR && instruction.operands[0].is_register() && instruction.operands[1] == instruction.operands[0];
+}
+
+bool reads_register(const Instruction& instruction, Register reg) {
+	switch (instruction.opcode)
+	{
+	case Opcode::MOV:
+	case Opcode::MOVZX:
+	case Opcode::MOVSX:
+	case Opcode::LEA:
+		return instruction.operands[1].uses(reg) || (instruction.operands[0].is_memory() && instruction.operands[0].uses(reg));
+	case Opcode::DIV:
+	case Opcode::IDIV:
+		return reg == Register::RAX || reg == Register::RDX || instruction.operands[0].uses(reg);
+	case Opcode::CQO:
+		return reg == Register::RAX;
+	case Opcode::SYSCALL:
+		return true;
+	case Opcode::XOR:
+		if (is_zeroing(instruction)) return false;
+		return instruction.operands[0].uses(reg) || instruction.operands[1].uses(reg);
+	case Opcode::ADD:
+	case Opcode::SUB:
+	case Opcode::IMUL:
+		if (instruction.operands.size() == 1 && reg == Register::RAX) return true;
+		// fall through
+	case Opcode::AND:
+	case Opcode::SHL:
+	case Opcode::SHR:
+	case Opcode::SAR:
+	case Opcode::NEG:
+	case Opcode::CMP:
+	case Opcode::TEST:
+	case Opcode::PUSH:
+	case Opcode::SETCC: // only writes the low byte
+	case Opcode::MOVSD: // the sse moves only write the low lane
+	case Opcode::ADDSD:
+	case Opcode::SUBSD:
+	case Opcode::MULSD:
+	case Opcode::DIVSD:
+	case Opcode::COMISD:
+	case Opcode::CVTSI2SD:
+	case Opcode::CVTTSD2SI:
+	case Opcode::CVTSS2SD:
+	case Opcode::CVTSD2SS:
+	case Opcode::XORPS:
+	case Opcode::MOVAPS:
+	case Opcode::MOVQ:
+	case Opcode::PINSRD:
+	case Opcode::MOVUPS: // packed, the general registers they read are the ones addressing memory
+	case Opcode::ADDPS:
+	case Opcode::SUBPS:
+	case Opcode::MULPS:
+	case Opcode::DIVPS:
+	case Opcode::ADDPD:
+	case Opcode::SUBPD:
+	case Opcode::MULPD:
+	case Opcode::DIVPD:
+	case Opcode::PADDD:
+	case Opcode::PADDQ:
+	case Opcode::PSUBD:
+	case Opcode::PSUBQ:
+	case Opcode::PMULLD:
+	case Opcode::PMINSD:
+	case Opcode::PMAXSD:
+	case Opcode::MINPS:
+	case Opcode::MAXPS:
+	case Opcode::PCMPEQD:
+	case Opcode::PCMPGTD:
+	case Opcode::CMPPS:
+	case Opcode::PSHUFD:
+	case Opcode::VPBROADCASTD:
+	case Opcode::VPBROADCASTQ:
+	case Opcode::VEXTRACTI128:
+	case Opcode::VINSERTI128:
+		for (const Operand& operand : instruction.operands) {
+			if (operand.uses(reg)) return true;
+		}
+		return false;
+	case Opcode::POP:
+		return instruction.operands[0].is_memory() && instruction.operands[0].reg == reg;
+	case Opcode::RET:
+		return reg == Register::RAX;
+	default:
+		return false;
+	}
+}
+
+bool writes_register(const Instruction& instruction, Register reg) {
+	switch (instruction.opcode)
+	{
+	case Opcode::MOV:
+	case Opcode::MOVZX:
+	case Opcode::MOVSX:
+	case Opcode::LEA:
+	case Opcode::ADD:
+	case Opcode::SUB:
+	case Opcode::XOR:
+	case Opcode::AND:
+	case Opcode::SHL:
+	case Opcode::SHR:
+	case Opcode::SAR:
+	case Opcode::NEG:
+	case Opcode::SETCC:
+	case Opcode::POP:
+	case Opcode::MOVSD:
+	case Opcode::ADDSD:
+	case Opcode::SUBSD:
+	case Opcode::MULSD:
+	case Opcode::DIVSD:
+	case Opcode::CVTSI2SD:
+	case Opcode::CVTTSD2SI:
+	case Opcode::CVTSS2SD:
+	case Opcode::CVTSD2SS:
+	case Opcode::XORPS:
+	case Opcode::MOVAPS:
+	case Opcode::MOVQ:
+	case Opcode::PINSRD:
+	case Opcode::MOVUPS:
+	case Opcode::ADDPS:
+	case Opcode::SUBPS:
+	case Opcode::MULPS:
+	case Opcode::DIVPS:
+	case Opcode::ADDPD:
+	case Opcode::SUBPD:
+	case Opcode::MULPD:
+	case Opcode::DIVPD:
+	case Opcode::PADDD:
+	case Opcode::PADDQ:
+	case Opcode::PSUBD:
+	case Opcode::PSUBQ:
+	case Opcode::PMULLD:
+	case Opcode::PMINSD:
+	case Opcode::PMAXSD:
+	case Opcode::MINPS:
+	case Opcode::MAXPS:
+	case Opcode::PCMPEQD:
+	case Opcode::PCMPGTD:
+	case Opcode::CMPPS:
+	case Opcode::PSHUFD:
+	case Opcode::VPBROADCASTD:
+	case Opcode::VPBROADCASTQ:
+	case Opcode::VEXTRACTI128:
+	case Opcode::VINSERTI128:
+		return instruction.operands[0].is_register(reg);
+	case Opcode::IMUL:
+		if (instruction.operands.size() == 1) return reg == Register::RAX || reg == Register::RDX;
+		return instruction.operands[0].is_register(reg);
+	case Opcode::DIV:
+	case Opcode::IDIV:
+		return reg == Register::RAX || reg == Register::RDX;
+	case Opcode::CQO:
+		return reg == Register::RDX;
+	case Opcode::SYSCALL:
+		return reg == Register::RAX || reg == Register::RCX || reg == Register::R11;
+	default:
+		return false;
+	}
+}
+
+bool is_control_flow(const Instruction& instruction) {
+	return instruction.opcode == Opcode::LABEL || instruction.opcode == Opcode::JMP || instruction.opcode == Opcode::JCC ||
+		instruction.opcode == Opcode::CALL || instruction.opcode == Opcode::RET;
+}
+
+bool is_skipped(const Instruction& instruction) {
+	return instruction.opcode == Opcode::NOP || instruction.opcode == Opcode::COMMENT;
+}
+
+// index of the next instruction that does something, or code.size()
+int next_instruction(std::vector<Instruction>& code, int index) {
+	index++;
+	while (index < code.size() && is_skipped(code[index])) index++;
+	return index;
+}
+
+bool register_dead_after(std::vector<Instruction>& code, int index, Register reg) {
+	for (int i = next_instruction(code, index); i < code.size(); i = next_instruction(code, i)) {
+		if (reads_register(code[i], reg)) return false;
+		if (writes_register(code[i], reg) && code[i].opcode != Opcode::SETCC) return true;
+		if (is_control_flow(code[i])) return reg == accumulator;
+	}
+	return reg == accumulator;
+}
+
+bool flags_dead_after(std::vector<Instruction>& code, int index) {
+	for (int i = next_instruction(code, index); i < code.size(); i = next_instruction(code, i)) {
+		if (reads_flags(code[i].opcode)) return false;
+		if (writes_flags(code[i].opcode) || is_control_flow(code[i])) return true;
+	}
+	return true;
+}
+
+bool fits_immediate(const Operand& operand) {
+	return !operand.is_immediate() || (operand.value >= INT32_MIN && operand.value <= INT32_MAX);
+}
+
+// setcc bl / cmp bl, 1 / jne target  ->  j(!cc) target
+bool fuse_branch(std::vector<Instruction>& code, int i) {
+	int j = next_instruction(code, i);
+	int k = next_instruction(code, j);
+	if (k >= code.size()) return false;
+	Instruction& set = code[i];
+	Instruction& compare = code[j];
+	Instruction& jump = code[k];
+
+	if (set.opcode != Opcode::SETCC || !set.operands[0].is_register(accumulator)) return false;
+	if (compare.opcode != Opcode::CMP || !compare.operands[0].is_register(accumulator) || compare.operands[1] != immediate_operand(1)) return false;
+	if (jump.opcode != Opcode::JCC || (jump.condition != Condition::NE && jump.condition != Condition::E)) return false;
+	if (!register_dead_after(code, k, accumulator)) return false;
+
+	jump.condition = jump.condition == Condition::NE ? invert_condition(set.condition) : set.condition;
+	set.opcode = Opcode::NOP;
+	compare.opcode = Opcode::NOP;
+	return true;
+}
+
+// sete bl / setnp al / and bl, al / cmp bl, 1 / jne target  ->  jne target / jp target
+// a float equal, which is false when either side is nan and so leaves the parity flag set
+bool fuse_ordered_branch(std::vector<Instruction>& code, int i) {
+	int j = next_instruction(code, i);
+	int k = next_instruction(code, j);
+	int l = next_instruction(code, k);
+	int m = next_instruction(code, l);
+	if (m >= code.size()) return false;
+	Instruction& equal = code[i];
+	Instruction& ordered = code[j];
+	Instruction& combine = code[k];
+	Instruction& compare = code[l];
+	Instruction& jump = code[m];
+
+	if (equal.opcode != Opcode::SETCC || equal.condition != Condition::E || !equal.operands[0].is_register(accumulator)) return false;
+	if (ordered.opcode != Opcode::SETCC || ordered.condition != Condition::NP || !ordered.operands[0].is_register(Register::RAX)) return false;
+	if (combine.opcode != Opcode::AND || !combine.operands[0].is_register(accumulator) || !combine.operands[1].is_register(Register::RAX)) return false;
+	if (compare.opcode != Opcode::CMP || !compare.operands[0].is_register(accumulator) || compare.operands[1] != immediate_operand(1)) return false;
+	if (jump.opcode != Opcode::JCC || jump.condition != Condition::NE) return false;
+	if (!register_dead_after(code, m, accumulator)) return false;
+
+	compare = jump;
+	jump.condition = Condition::P;
+	equal.opcode = Opcode::NOP;
+	ordered.opcode = Opcode::NOP;
+	combine.opcode = Opcode::NOP;
+	return true;
+}
+
+// mov rbx, x / op rbx, y ... / mov target, rbx  ->  mov target, x / op target, y ...
+bool retarget_accumulator(std::vector<Instruction>& code, int i) {
+	Instruction& load = code[i];
+	if (load.opcode != Opcode::MOV || !load.operands[0].is_register(accumulator)) return false;
+	Operand source = load.operands[1];
+
+	std::vector<int> operations;
+	int j = next_instruction(code, i);
+	while (j < code.size() && is_arithmetic(code[j].opcode) && code[j].operands.size() == 2 && code[j].operands[0].is_register(accumulator) && !code[j].operands[1].uses(accumulator)) {
+		operations.push_back(j);
+		j = next_instruction(code, j);
+	}
+	if (j >= code.size()) return false;
+	Instruction& store = code[j];
+
+	if (store.opcode == Opcode::CMP && operations.size() == 0 && store.operands[0].is_register(accumulator)) {
+		// compare the source directly
+		Operand other = store.operands[1];
+		if (source.is_immediate() || (source.is_memory() && other.is_memory()) || other.uses(accumulator)) return false;
+		if (!register_dead_after(code, j, accumulator)) return false;
+		store.operands[0] = source;
+		load.opcode = Opcode::NOP;
+		return true;
+	}
+
+	if (store.opcode == Opcode::TEST && operations.size() == 0 && store.operands[0].is_register(accumulator) && store.operands[1].is_register(accumulator)) {
+		if (!source.is_register() || !register_dead_after(code, j, accumulator)) return false;
+		store.operands = { source, source };
+		load.opcode = Opcode::NOP;
+		return true;
+	}
+
+	if (store.opcode != Opcode::MOV || !store.operands[1].is_register(accumulator) || store.operands[0].uses(accumulator)) return false;
+	Operand target = store.operands[0];
+	if (!register_dead_after(code, j, accumulator)) return false;
+
+	if (target.is_memory()) {
+		// memory to memory moves don't exist, and only a plain copy can go straight to memory
+		if (operations.size() > 0 || source.is_memory() || !fits_immediate(source)) return false;
+	}
+	for (int operation : operations) {
+		if (code[operation].operands[1].uses(target.reg)) return false;
+	}
+
+	load.operands[0] = target;
+	for (int operation : operations) {
+		code[operation].operands[0] = target;
+	}
+	store.opcode = Opcode::NOP;
+	return true;
+}
+
+bool optimize_instruction(std::vector<Instruction>& code, int i) {
+	Instruction& instruction = code[i];
+	int next = next_instruction(code, i);
+
+	switch (instruction.opcode)
+	{
+	case Opcode::MOV:
+		// mov r, r, a 32 bit one zeroes the top half so it isn't a no op
+		if (instruction.operands[0] == instruction.operands[1] && instruction.operands[0].size != 4) {
+			instruction.opcode = Opcode::NOP;
+			return true;
+		}
+		// mov a, b / mov b, a
+		if (next < code.size() && code[next].opcode == Opcode::MOV &&
+			code[next].operands[0] == instruction.operands[1] && code[next].operands[1] == instruction.operands[0]) {
+			code[next].opcode = Opcode::NOP;
+			return true;
+		}
+		// nothing reads the accumulator before it is written again
+		if (instruction.operands[0].is_register(accumulator) && register_dead_after(code, i, accumulator)) {
+			instruction.opcode = Opcode::NOP;
+			return true;
+		}
+		if (retarget_accumulator(code, i)) {
+			return true;
+		}
+		// mov r, 0  ->  xor r32, r32
+		if (instruction.operands[0].is_register() && instruction.operands[1] == immediate_operand(0) && flags_dead_after(code, i)) {
+			Operand reg = register_operand(instruction.operands[0].reg, 4);
+			instruction.opcode = Opcode::XOR;
+			instruction.operands = { reg, reg };
+			return true;
+		}
+		break;
+	case Opcode::XOR:
+		if (is_zeroing(instruction) && instruction.operands[0].reg == accumulator && register_dead_after(code, i, accumulator) && flags_dead_after(code, i)) {
+			instruction.opcode = Opcode::NOP;
+			return true;
+		}
+		break;
+	case Opcode::CMP:
+		// cmp r, 0  ->  test r, r
+		if (instruction.operands[0].is_register() && instruction.operands[1] == immediate_operand(0)) {
+			instruction.opcode = Opcode::TEST;
+			instruction.operands[1] = instruction.operands[0];
+			return true;
+		}
+		break;
+	case Opcode::SETCC:
+		if (fuse_branch(code, i) || fuse_ordered_branch(code, i)) {
+			return true;
+		}
+		break;
+	case Opcode::JCC:
+		// jcc a / jmp b / a:  ->  j(!cc) b / a:
+		if (next < code.size() && code[next].opcode == Opcode::JMP) {
+			int after = next_instruction(code, next);
+			if (after < code.size() && code[after].opcode == Opcode::LABEL && code[after].text == instruction.operands[0].label) {
+				instruction.condition = invert_condition(instruction.condition);
+				instruction.operands[0] = code[next].operands[0];
+				code[next].opcode = Opcode::NOP;
+				return true;
+			}
+		}
+		[[fallthrough]];
+	case Opcode::JMP:
+		for (int j = next; j < code.size() && code[j].opcode == Opcode::LABEL; j = next_instruction(code, j)) {
+			if (code[j].text == instruction.operands[0].label) {
+				instruction.opcode = Opcode::NOP;
+				return true;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	// nothing after a jump or return runs until the next label
+	if (instruction.ends_block() && next < code.size() && code[next].opcode != Opcode::LABEL) {
+		code[next].opcode = Opcode::NOP;
+		return true;
+	}
+	return false;
+}
+
+int peephole_removed = 0;
+
+// returns how many instructions were removed
+int peephole_optimize(std::vector<Instruction>& code) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i = 0; i < code.size(); i++) {
+			if (is_skipped(code[i])) continue;
+			changed = optimize_instruction(code, i) || changed;
+		}
+	}
+
+	int removed = 0;
+	std::vector<Instruction> optimized;
+	for (Instruction& instruction : code) {
+		if (instruction.opcode == Opcode::NOP) {
+			removed++;
+			continue;
+		}
+		optimized.push_back(instruction);
+	}
+	code = optimized;
+	return removed;
+}
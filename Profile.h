@@ -0,0 +1,566 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+#include "Parsing.h"
+#include "Target.h"
+#include "Types.h"
+#include "Utils.h"
+
+// PROFILE GUIDED OPTIMIZATION
+// -profile-generate builds a program that counts how often each procedure is entered, each if is reached and
+// taken, each while is reached and goes round, and each call is made, and writes the counts to <program>.profile
+// when main returns. -profile-use reads them back: rarely taken ifs move out of line, the least used variables
+// are spilled first, small procedures are inlined where they're called a lot and hot loops are unrolled once.
+// the counters are numbered walking the optimized tree, so a profile only fits the program it was made from
+
+// counters each kind of node gets: ifs count reached then taken, whiles reached then iterations
+std::map<SyntaxNode*, int> profile_points;
+int profile_counter_count = 0;
+unsigned long long profile_signature = 0; // hash of the numbering, written into the profile to check it fits
+
+bool profile_instrument = false;
+std::string profile_file; // where the instrumented program writes its counts
+std::vector<long long> profile_counts; // empty unless a profile was loaded
+std::map<Block*, long long> profile_block_counts; // how many times each counted block ran
+std::map<SyntaxNode*, SyntaxNode*> profile_copy_of; // ifs and whiles copied after numbering go by the original's counts
+long long profile_hottest = 0;
+
+// the call a statement makes, conversions and vector builtins aren't calls
+ProcedureCall* statement_call(SyntaxNode* statement) {
+	SyntaxNode* call = statement;
+	if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) call = ((VariableAssignment*)statement)->value;
+	if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) call = ((ReturnStatement*)statement)->expression;
+	if (call->type != SyntaxNode::Type::PROCEDURE_CALL || is_intrinsic(call)) return nullptr;
+	return (ProcedureCall*)call;
+}
+
+void add_profile_point(SyntaxNode* node, int counters, const std::string& kind) {
+	profile_points[node] = profile_counter_count;
+	profile_counter_count += counters;
+	profile_signature = hash_text(kind + ";", profile_signature);
+}
+
+void number_block_points(Block* block) {
+	for (SyntaxNode* statement : block->statements) {
+		ProcedureCall* call = statement_call(statement);
+		if (call) {
+			add_profile_point(statement, 1, "call " + call->name);
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			add_profile_point(statement, 2, "if");
+			number_block_points(((IfStatement*)statement)->body);
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			add_profile_point(statement, 2, "while");
+			number_block_points(((WhileStatement*)statement)->body);
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			number_block_points((Block*)statement);
+		}
+	}
+}
+
+void number_profile_points(Block* program) {
+	profile_points.clear();
+	profile_counter_count = 0;
+	profile_signature = hash_text("");
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			ProcedureDecleration* decl = (ProcedureDecleration*)statement;
+			add_profile_point(decl, 1, "procedure " + decl->name);
+			number_block_points(decl->procedure->body);
+		}
+	}
+}
+
+std::string profile_counter_label(int counter) {
+	return string_format("profile_count%d", counter);
+}
+
+// instrumented builds count the node's counter here, the counters are in the data segment after a two qword
+// header labelled profile_counts
+void emit_profile_count(std::vector<Instruction>& code, SyntaxNode* node, int counter = 0) {
+	if (!profile_instrument) return;
+	auto point = profile_points.find(node);
+	if (point == profile_points.end()) return;
+	emit(code, Opcode::ADD, label_memory_operand(profile_counter_label(point->second + counter)), immediate_operand(1));
+}
+
+// called by main on its way out with rsp as it was on entry, keeps rax. linux writes the file with system calls
+// so it works with or without the c runtime, windows goes through the c runtime
+void profile_write_procedure(std::vector<Instruction>& code) {
+	int header_and_counters = profile_counter_count + 2;
+	emit_label(code, "profile_write");
+	if (target.platform == Platform::WINDOWS) {
+		emit(code, Opcode::PUSH, register_operand(Register::RBP));
+		emit(code, Opcode::MOV, register_operand(Register::RBP), register_operand(Register::RSP));
+		emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(48));
+		emit(code, Opcode::LEA, register_operand(Register::RCX), label_memory_operand("profile_path"));
+		emit(code, Opcode::LEA, register_operand(Register::RDX), label_memory_operand("profile_mode"));
+		emit(code, Opcode::CALL, label_operand("fopen"));
+		emit(code, Opcode::TEST, register_operand(Register::RAX), register_operand(Register::RAX));
+		emit_condition(code, Opcode::JCC, Condition::E, label_operand(".done"));
+		emit(code, Opcode::MOV, memory_operand(Register::RBP, -8), register_operand(Register::RAX));
+		emit(code, Opcode::LEA, register_operand(Register::RCX), label_memory_operand("profile_counts"));
+		emit(code, Opcode::MOV, register_operand(Register::RDX, 4), immediate_operand(8));
+		emit(code, Opcode::MOV, register_operand(Register::R8, 4), immediate_operand(header_and_counters));
+		emit(code, Opcode::MOV, register_operand(Register::R9), register_operand(Register::RAX));
+		emit(code, Opcode::CALL, label_operand("fwrite"));
+		emit(code, Opcode::MOV, register_operand(Register::RCX), memory_operand(Register::RBP, -8));
+		emit(code, Opcode::CALL, label_operand("fclose"));
+		emit_label(code, ".done");
+		emit(code, Opcode::LEAVE);
+		emit(code, Opcode::RET);
+		return;
+	}
+
+	// open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), the descriptor stays in rdi for write and close
+	emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(2));
+	emit(code, Opcode::LEA, register_operand(Register::RDI), label_memory_operand("profile_path"));
+	emit(code, Opcode::MOV, register_operand(Register::RSI, 4), immediate_operand(0x241));
+	emit(code, Opcode::MOV, register_operand(Register::RDX, 4), immediate_operand(0644));
+	emit(code, Opcode::SYSCALL);
+	emit(code, Opcode::TEST, register_operand(Register::RAX), register_operand(Register::RAX));
+	emit_condition(code, Opcode::JCC, Condition::L, label_operand(".done"));
+	emit(code, Opcode::MOV, register_operand(Register::RDI), register_operand(Register::RAX));
+	emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(1));
+	emit(code, Opcode::LEA, register_operand(Register::RSI), label_memory_operand("profile_counts"));
+	emit(code, Opcode::MOV, register_operand(Register::RDX, 4), immediate_operand(header_and_counters * 8));
+	emit(code, Opcode::SYSCALL);
+	emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(3));
+	emit(code, Opcode::SYSCALL);
+	emit_label(code, ".done");
+	emit(code, Opcode::RET);
+}
+
+// returns what's wrong with the profile, or an empty string once it's loaded
+std::string load_profile(const std::string& file_name) {
+	std::ifstream in(file_name, std::ios::binary);
+	if (!in) {
+		return "no profile at " + file_name;
+	}
+	std::vector<long long> values;
+	long long value;
+	while (in.read((char*)&value, sizeof(value))) {
+		values.push_back(value);
+	}
+	if (values.size() < 2 || values[0] != profile_counter_count || (unsigned long long)values[1] != profile_signature || values.size() != profile_counter_count + 2) {
+		return file_name + " was made from a different program";
+	}
+
+	profile_counts.assign(values.begin() + 2, values.end());
+	profile_block_counts.clear();
+	profile_hottest = 0;
+	for (long long count : profile_counts) {
+		profile_hottest = std::max(profile_hottest, count);
+	}
+	for (auto& point : profile_points) {
+		SyntaxNode* node = point.first;
+		if (node->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			profile_block_counts[((ProcedureDecleration*)node)->procedure->body] = profile_counts[point.second];
+		}
+		if (node->type == SyntaxNode::Type::IF_STATEMENT) {
+			profile_block_counts[((IfStatement*)node)->body] = profile_counts[point.second + 1];
+		}
+		if (node->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			profile_block_counts[((WhileStatement*)node)->body] = profile_counts[point.second + 1];
+		}
+	}
+	return "";
+}
+
+bool has_profile() {
+	return profile_counts.size() > 0;
+}
+
+// -1 when the node wasn't counted, either there's no profile or the node was made after numbering
+long long profile_count(SyntaxNode* node, int counter = 0) {
+	if (!has_profile()) return -1;
+	auto copy = profile_copy_of.find(node);
+	if (copy != profile_copy_of.end()) node = copy->second;
+	auto point = profile_points.find(node);
+	if (point == profile_points.end()) return -1;
+	return profile_counts[point->second + counter];
+}
+
+long long profile_block_count(Block* block) {
+	auto count = profile_block_counts.find(block);
+	return count == profile_block_counts.end() ? -1 : count->second;
+}
+
+// anything within 2% of the busiest counter in the program
+bool is_hot(long long count) {
+	return count > 0 && count * 50 >= profile_hottest;
+}
+
+SyntaxNode* clone_node(SyntaxNode* node, std::map<std::string, std::string>& renamed);
+
+std::string rename_variable(const std::string& name, std::map<std::string, std::string>& renamed) {
+	auto found = renamed.find(name);
+	return found == renamed.end() ? name : found->second;
+}
+
+Block* clone_block(Block* block, std::map<std::string, std::string>& renamed) {
+	Block* copy = new Block();
+	for (SyntaxNode* statement : block->statements) {
+		SyntaxNode* statement_copy = clone_node(statement, renamed);
+		statement_copy->line = statement->line;
+		copy->statements.push_back(statement_copy);
+	}
+	long long count = profile_block_count(block);
+	if (count >= 0) profile_block_counts[copy] = count;
+	return copy;
+}
+
+// only nodes that were numbered are worth following back to
+void record_copy(SyntaxNode* copy, SyntaxNode* original) {
+	auto earlier = profile_copy_of.find(original);
+	if (earlier != profile_copy_of.end()) {
+		profile_copy_of[copy] = earlier->second;
+		return;
+	}
+	if (profile_points.count(original) > 0) profile_copy_of[copy] = original;
+}
+
+// a deep copy of a flattened statement or expression, with the variables in renamed given their new names
+SyntaxNode* clone_node(SyntaxNode* node, std::map<std::string, std::string>& renamed) {
+	switch (node->type)
+	{
+	case SyntaxNode::Type::INTEGER_LITERAL:
+	{
+		IntLiteral* copy = new IntLiteral();
+		copy->value = ((IntLiteral*)node)->value;
+		return copy;
+	}
+	case SyntaxNode::Type::BOOLEAN_LITERAL:
+	{
+		BooleanLiteral* copy = new BooleanLiteral();
+		copy->value = ((BooleanLiteral*)node)->value;
+		return copy;
+	}
+	case SyntaxNode::Type::FLOAT_LITERAL:
+	{
+		FloatLiteral* copy = new FloatLiteral();
+		copy->value = ((FloatLiteral*)node)->value;
+		copy->size = ((FloatLiteral*)node)->size;
+		return copy;
+	}
+	case SyntaxNode::Type::STRING_LITERAL:
+	{
+		StringLiteral* copy = new StringLiteral();
+		copy->value = ((StringLiteral*)node)->value;
+		return copy;
+	}
+	case SyntaxNode::Type::VARIABLE_CALL:
+	{
+		VariableCall* copy = new VariableCall();
+		copy->name = rename_variable(((VariableCall*)node)->name, renamed);
+		return copy;
+	}
+	case SyntaxNode::Type::BINARY_OPERATOR:
+	{
+		BinaryOperator* binary_operator = (BinaryOperator*)node;
+		BinaryOperator* copy = new BinaryOperator();
+		copy->operation = binary_operator->operation;
+		copy->left = clone_node(binary_operator->left, renamed);
+		copy->right = clone_node(binary_operator->right, renamed);
+		return copy;
+	}
+	case SyntaxNode::Type::PROCEDURE_CALL:
+	{
+		ProcedureCall* procedure_call = (ProcedureCall*)node;
+		ProcedureCall* copy = new ProcedureCall();
+		copy->name = procedure_call->name;
+		for (SyntaxNode* input : procedure_call->inputs) {
+			copy->inputs.push_back(clone_node(input, renamed));
+		}
+		return copy;
+	}
+	case SyntaxNode::Type::VARIABLE_DECLERATION:
+	{
+		VariableDecleration* copy = new VariableDecleration();
+		copy->name = rename_variable(((VariableDecleration*)node)->name, renamed);
+		copy->type_name = ((VariableDecleration*)node)->type_name;
+		return copy;
+	}
+	case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+	{
+		VariableAssignment* copy = new VariableAssignment();
+		copy->name = rename_variable(((VariableAssignment*)node)->name, renamed);
+		copy->value = clone_node(((VariableAssignment*)node)->value, renamed);
+		return copy;
+	}
+	case SyntaxNode::Type::ARRAY_INDEX:
+	{
+		ArrayIndex* copy = new ArrayIndex();
+		copy->name = rename_variable(((ArrayIndex*)node)->name, renamed);
+		copy->index = clone_node(((ArrayIndex*)node)->index, renamed);
+		copy->field = ((ArrayIndex*)node)->field;
+		copy->checked = ((ArrayIndex*)node)->checked;
+		return copy;
+	}
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+	{
+		ElementAssignment* copy = new ElementAssignment();
+		copy->name = rename_variable(((ElementAssignment*)node)->name, renamed);
+		copy->index = clone_node(((ElementAssignment*)node)->index, renamed);
+		copy->field = ((ElementAssignment*)node)->field;
+		copy->value = clone_node(((ElementAssignment*)node)->value, renamed);
+		copy->checked = ((ElementAssignment*)node)->checked;
+		return copy;
+	}
+	case SyntaxNode::Type::RETURN_STATEMENT:
+	{
+		ReturnStatement* copy = new ReturnStatement();
+		copy->expression = clone_node(((ReturnStatement*)node)->expression, renamed);
+		return copy;
+	}
+	case SyntaxNode::Type::IF_STATEMENT:
+	{
+		IfStatement* copy = new IfStatement();
+		copy->condition = clone_node(((IfStatement*)node)->condition, renamed);
+		copy->body = clone_block(((IfStatement*)node)->body, renamed);
+		record_copy(copy, node);
+		return copy;
+	}
+	case SyntaxNode::Type::WHILE_STATEMENT:
+	{
+		WhileStatement* copy = new WhileStatement();
+		copy->condition = clone_node(((WhileStatement*)node)->condition, renamed);
+		copy->body = clone_block(((WhileStatement*)node)->body, renamed);
+		record_copy(copy, node);
+		return copy;
+	}
+	case SyntaxNode::Type::BLOCK:
+		return clone_block((Block*)node, renamed);
+	case SyntaxNode::Type::PROCEDURE_DECLERATION:
+	{
+		Procedure* procedure = ((ProcedureDecleration*)node)->procedure;
+		ProcedureDecleration* copy = new ProcedureDecleration();
+		copy->name = ((ProcedureDecleration*)node)->name;
+		copy->line = node->line;
+		copy->source_file = ((ProcedureDecleration*)node)->source_file;
+		copy->procedure = new Procedure();
+		for (SyntaxNode* input : procedure->inputs) {
+			copy->procedure->inputs.push_back(clone_node(input, renamed));
+		}
+		for (SyntaxNode* output : procedure->outputs) {
+			copy->procedure->outputs.push_back(clone_node(output, renamed));
+		}
+		copy->procedure->body = clone_block(procedure->body, renamed);
+		return copy;
+	}
+	default:
+		return node;
+	}
+}
+
+// INLINING
+// a procedure whose body is a short straight line ending in its only return is copied into hot call sites
+// `x = f(a, b)`, its inputs and variables renamed so they can't clash with the caller's. ones that touch arrays
+// are left alone, an array input can't be copied into a variable
+
+bool uses_arrays(Block* block) {
+	for (SyntaxNode* statement : block->statements) {
+		switch (statement->type)
+		{
+		case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+			return true;
+		case SyntaxNode::Type::VARIABLE_DECLERATION:
+			if (is_array_type_name(((VariableDecleration*)statement)->type_name)) return true;
+			break;
+		case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+			if (((VariableAssignment*)statement)->value->type == SyntaxNode::Type::ARRAY_INDEX) return true;
+			break;
+		case SyntaxNode::Type::WHILE_STATEMENT:
+			if (uses_arrays(((WhileStatement*)statement)->body)) return true;
+			break;
+		case SyntaxNode::Type::IF_STATEMENT:
+			if (uses_arrays(((IfStatement*)statement)->body)) return true;
+			break;
+		case SyntaxNode::Type::BLOCK:
+			if (uses_arrays((Block*)statement)) return true;
+			break;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+const int inline_statement_limit = 12;
+int inlined_copies = 0;
+
+bool is_inlinable(ProcedureDecleration* procedure_decl) {
+	std::vector<SyntaxNode*>& statements = procedure_decl->procedure->body->statements;
+	if (procedure_decl->name == "main" || statements.size() == 0 || statements.size() > inline_statement_limit) return false;
+	for (SyntaxNode* input : procedure_decl->procedure->inputs) {
+		if (is_array_type_name(((VariableDecleration*)input)->type_name)) return false;
+	}
+	if (uses_arrays(procedure_decl->procedure->body)) return false;
+	for (int i = 0; i < statements.size(); i++) {
+		SyntaxNode::Type type = statements[i]->type;
+		bool last = i == statements.size() - 1;
+		if (last != (type == SyntaxNode::Type::RETURN_STATEMENT)) return false;
+		if (type != SyntaxNode::Type::VARIABLE_DECLERATION && type != SyntaxNode::Type::VARIABLE_ASSIGNMENT &&
+			type != SyntaxNode::Type::PROCEDURE_CALL && type != SyntaxNode::Type::RETURN_STATEMENT) return false;
+	}
+	return true;
+}
+
+void inline_call(VariableAssignment* assignment, ProcedureDecleration* callee, std::vector<SyntaxNode*>& statements) {
+	ProcedureCall* call = (ProcedureCall*)assignment->value;
+	Procedure* procedure = callee->procedure;
+	std::string prefix = string_format("inlined%d_", inlined_copies++);
+	std::map<std::string, std::string> renamed;
+	for (SyntaxNode* input : procedure->inputs) {
+		std::string name = ((VariableDecleration*)input)->name;
+		renamed[name] = prefix + name;
+	}
+	for (SyntaxNode* statement : procedure->body->statements) {
+		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
+			std::string name = ((VariableDecleration*)statement)->name;
+			renamed[name] = prefix + name;
+		}
+	}
+
+	int first = statements.size();
+	for (int i = 0; i < procedure->inputs.size(); i++) {
+		statements.push_back(clone_node(procedure->inputs[i], renamed));
+		VariableAssignment* input_assignment = new VariableAssignment();
+		input_assignment->name = renamed[((VariableDecleration*)procedure->inputs[i])->name];
+		input_assignment->value = call->inputs[i];
+		statements.push_back(input_assignment);
+	}
+	std::vector<SyntaxNode*>& body = procedure->body->statements;
+	for (int i = 0; i < body.size() - 1; i++) {
+		statements.push_back(clone_node(body[i], renamed));
+	}
+	VariableAssignment* result = new VariableAssignment();
+	result->name = assignment->name;
+	result->value = clone_node(((ReturnStatement*)body.back())->expression, renamed);
+	statements.push_back(result);
+	// the callee's lines could be in another file, so the copy is put down to the call
+	for (int i = first; i < statements.size(); i++) {
+		statements[i]->line = assignment->line;
+	}
+}
+
+int inline_block(Block* block, ProcedureDecleration* caller, std::map<std::string, ProcedureDecleration*>& procedures) {
+	int inlined = 0;
+	std::vector<SyntaxNode*> statements;
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) inlined += inline_block(((IfStatement*)statement)->body, caller, procedures);
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) inlined += inline_block(((WhileStatement*)statement)->body, caller, procedures);
+		if (statement->type == SyntaxNode::Type::BLOCK) inlined += inline_block((Block*)statement, caller, procedures);
+
+		ProcedureCall* call = statement_call(statement);
+		if (call && statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT && is_hot(profile_count(statement))) {
+			auto callee = procedures.find(call->name);
+			if (callee != procedures.end() && callee->second != caller && call->inputs.size() == callee->second->procedure->inputs.size() && is_inlinable(callee->second)) {
+				inline_call((VariableAssignment*)statement, callee->second, statements);
+				inlined++;
+				continue;
+			}
+		}
+		statements.push_back(statement);
+	}
+	block->statements = statements;
+	return inlined;
+}
+
+// returns how many calls were inlined
+int inline_hot_calls(Block* program) {
+	std::map<std::string, ProcedureDecleration*> procedures;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			procedures[((ProcedureDecleration*)statement)->name] = (ProcedureDecleration*)statement;
+		}
+	}
+	// callees are copied as they were before anything was inlined into them
+	std::map<std::string, ProcedureDecleration*> originals;
+	for (auto& procedure : procedures) {
+		if (!is_inlinable(procedure.second)) continue;
+		std::map<std::string, std::string> unchanged;
+		ProcedureDecleration* original = new ProcedureDecleration();
+		original->name = procedure.first;
+		original->procedure = new Procedure();
+		original->procedure->inputs = procedure.second->procedure->inputs;
+		original->procedure->outputs = procedure.second->procedure->outputs;
+		original->procedure->body = clone_block(procedure.second->procedure->body, unchanged);
+		originals[procedure.first] = original;
+	}
+
+	int inlined = 0;
+	for (auto& procedure : procedures) {
+		inlined += inline_block(procedure.second->procedure->body, procedure.second, originals);
+	}
+	return inlined;
+}
+
+// UNROLLING
+// a hot loop that goes round many times per visit has its body repeated once behind the condition,
+// while (c) { B } becomes while (c) { B if (c) { B } }, which halves the back edges taken. loops over arrays
+// are left for the vectorizer, and the copy would hide the induction variable that removes their bounds checks
+
+const int unroll_statement_limit = 16;
+const int unroll_minimum_trips = 8;
+
+bool has_call(SyntaxNode* expression) {
+	if (expression->type == SyntaxNode::Type::PROCEDURE_CALL) return true;
+	if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
+		return has_call(((BinaryOperator*)expression)->left) || has_call(((BinaryOperator*)expression)->right);
+	}
+	return false;
+}
+
+bool is_unrollable(WhileStatement* while_statement) {
+	std::vector<SyntaxNode*>& statements = while_statement->body->statements;
+	if (has_call(while_statement->condition) || statements.size() > unroll_statement_limit || uses_arrays(while_statement->body)) return false;
+	for (SyntaxNode* statement : statements) {
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) return false;
+	}
+	return true;
+}
+
+int unroll_block(Block* block) {
+	int unrolled = 0;
+	for (SyntaxNode* statement : block->statements) {
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) unrolled += unroll_block(((IfStatement*)statement)->body);
+		if (statement->type == SyntaxNode::Type::BLOCK) unrolled += unroll_block((Block*)statement);
+		if (statement->type != SyntaxNode::Type::WHILE_STATEMENT) continue;
+
+		WhileStatement* while_statement = (WhileStatement*)statement;
+		unrolled += unroll_block(while_statement->body);
+		long long reached = profile_count(while_statement, 0);
+		long long iterations = profile_count(while_statement, 1);
+		if (!is_hot(iterations) || iterations < reached * unroll_minimum_trips || !is_unrollable(while_statement)) continue;
+
+		std::map<std::string, std::string> unchanged;
+		IfStatement* repeat = new IfStatement();
+		repeat->line = while_statement->line;
+		repeat->condition = clone_node(while_statement->condition, unchanged);
+		repeat->body = clone_block(while_statement->body, unchanged);
+		while_statement->body->statements.push_back(repeat);
+		// each copy runs about half the iterations, which is what the spill weights go by
+		profile_block_counts[while_statement->body] = iterations / 2;
+		profile_block_counts[repeat->body] = iterations / 2;
+		unrolled++;
+	}
+	return unrolled;
+}
+
+// returns how many loops were unrolled
+int unroll_hot_loops(Block* program) {
+	int unrolled = 0;
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			unrolled += unroll_block(((ProcedureDecleration*)statement)->procedure->body);
+		}
+	}
+	return unrolled;
+}
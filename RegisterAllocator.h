@@ -0,0 +1,422 @@
+#pragma once
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+#include "Parsing.h"
+#include "Profile.h"
+#include "Target.h"
+#include "Types.h"
+
+// LINEAR SCAN REGISTER ALLOCATION
+// every statement of the flattened procedure gets a position, a variable is live from the first to the last
+// position it is mentioned at. loops stretch that range over the whole loop since the value can flow around
+// the back edge, unless the variable is always set at the top of the loop body before anything reads it.
+// arrays a procedure declares get a block of the frame rather than a register, one passed in is a pointer
+// allocated like any other variable
+
+struct Occurrence {
+	int position;
+	bool is_definition;
+	Block* block;
+};
+
+struct Loop {
+	int start;
+	int end;
+	Block* body;
+};
+
+struct LiveInterval {
+	std::string name;
+	int start;
+	int end;
+	bool crosses_call = false;
+	ValueType type = ValueType::INT;
+	long long weight = 0; // how many times it's read or written when the program ran, with a profile
+	Operand location;
+};
+
+struct Liveness {
+	int position = 0;
+	std::map<std::string, std::vector<Occurrence>> occurrences;
+	std::vector<int> calls;
+	std::vector<Loop> loops;
+};
+
+struct RegisterAllocation {
+	std::map<std::string, Operand> locations;
+	std::vector<Register> saved_registers; // callee saved registers we use, stored in the frame on entry
+	std::vector<Operand> saved_slots;
+	int stack_size = 0; // bytes of slots for spills and saved registers, measured down from rbp
+};
+
+struct StackSlot {
+	int end; // the slot is at rbp - end
+	ValueType type;
+	int size;
+	int free_after; // position its last occupant dies at
+};
+
+// the registers handed out come from the target, the accumulators, return and argument registers are used by
+// the code generator directly. floats and doubles get xmm registers, or a stack slot if they live across a call
+bool is_callee_saved(Register reg) {
+	return std::find(target.callee_saved_registers.begin(), target.callee_saved_registers.end(), reg) != target.callee_saved_registers.end();
+}
+
+void add_occurrence(Liveness& liveness, const std::string& name, bool is_definition, Block* block) {
+	liveness.occurrences[name].push_back(Occurrence{ liveness.position, is_definition, block });
+}
+
+void add_reads(Liveness& liveness, SyntaxNode* expression, Block* block) {
+	switch (expression->type)
+	{
+	case SyntaxNode::Type::VARIABLE_CALL:
+		add_occurrence(liveness, ((VariableCall*)expression)->name, false, block);
+		break;
+	case SyntaxNode::Type::BINARY_OPERATOR:
+		add_reads(liveness, ((BinaryOperator*)expression)->left, block);
+		add_reads(liveness, ((BinaryOperator*)expression)->right, block);
+		break;
+	case SyntaxNode::Type::PROCEDURE_CALL:
+		for (SyntaxNode* input : ((ProcedureCall*)expression)->inputs) {
+			add_reads(liveness, input, block);
+		}
+		break;
+	case SyntaxNode::Type::ARRAY_INDEX:
+		add_occurrence(liveness, ((ArrayIndex*)expression)->name, false, block);
+		add_reads(liveness, ((ArrayIndex*)expression)->index, block);
+		break;
+	case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+		add_occurrence(liveness, ((ElementAssignment*)expression)->name, false, block);
+		add_reads(liveness, ((ElementAssignment*)expression)->index, block);
+		add_reads(liveness, ((ElementAssignment*)expression)->value, block);
+		break;
+	default:
+		break;
+	}
+}
+
+void number_statements(Liveness& liveness, Block* block) {
+	for (SyntaxNode* statement : block->statements) {
+		liveness.position++;
+
+		switch (statement->type)
+		{
+		case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+		{
+			VariableAssignment* assignment = (VariableAssignment*)statement;
+			add_reads(liveness, assignment->value, block);
+			add_occurrence(liveness, assignment->name, true, block);
+			if (assignment->value->type == SyntaxNode::Type::PROCEDURE_CALL && !is_intrinsic(assignment->value)) {
+				liveness.calls.push_back(liveness.position);
+			}
+		}
+		break;
+		case SyntaxNode::Type::PROCEDURE_CALL:
+			add_reads(liveness, statement, block);
+			if (!is_intrinsic(statement)) liveness.calls.push_back(liveness.position);
+			break;
+		case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+			add_reads(liveness, statement, block);
+			break;
+		case SyntaxNode::Type::RETURN_STATEMENT:
+			// a returned call is a tail call, so nothing is live across it
+			add_reads(liveness, ((ReturnStatement*)statement)->expression, block);
+			break;
+		case SyntaxNode::Type::IF_STATEMENT:
+			add_reads(liveness, ((IfStatement*)statement)->condition, block);
+			number_statements(liveness, ((IfStatement*)statement)->body);
+			break;
+		case SyntaxNode::Type::WHILE_STATEMENT:
+		{
+			WhileStatement* while_statement = (WhileStatement*)statement;
+			Loop loop;
+			loop.start = liveness.position;
+			loop.body = while_statement->body;
+			add_reads(liveness, while_statement->condition, block);
+			number_statements(liveness, while_statement->body);
+			liveness.position++;
+			loop.end = liveness.position;
+			liveness.loops.push_back(loop);
+		}
+		break;
+		case SyntaxNode::Type::BLOCK:
+			number_statements(liveness, (Block*)statement);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// a variable only used within one iteration of a loop doesn't need to live around the back edge
+bool is_iteration_local(std::vector<Occurrence>& occurrences, Liveness& liveness) {
+	Loop* innermost = nullptr;
+	for (Loop& loop : liveness.loops) {
+		bool contains_all = true;
+		for (Occurrence& occurrence : occurrences) {
+			contains_all = contains_all && occurrence.position > loop.start && occurrence.position < loop.end;
+		}
+		if (contains_all && (!innermost || loop.end - loop.start < innermost->end - innermost->start)) {
+			innermost = &loop;
+		}
+	}
+	if (!innermost) {
+		return false;
+	}
+
+	Occurrence* first = &occurrences[0];
+	for (Occurrence& occurrence : occurrences) {
+		if (occurrence.position < first->position || (occurrence.position == first->position && !occurrence.is_definition)) {
+			first = &occurrence;
+		}
+	}
+	return first->is_definition && first->block == innermost->body;
+}
+
+std::vector<LiveInterval> build_live_intervals(Procedure* procedure) {
+	Liveness liveness;
+	for (SyntaxNode* input : procedure->inputs) {
+		add_occurrence(liveness, ((VariableDecleration*)input)->name, true, procedure->body);
+	}
+	number_statements(liveness, procedure->body);
+
+	std::vector<LiveInterval> intervals;
+	std::vector<bool> iteration_local;
+	for (auto& entry : liveness.occurrences) {
+		LiveInterval interval;
+		interval.name = entry.first;
+		interval.start = entry.second[0].position;
+		interval.end = entry.second[0].position;
+		for (Occurrence& occurrence : entry.second) {
+			interval.start = std::min(interval.start, occurrence.position);
+			interval.end = std::max(interval.end, occurrence.position);
+			long long count = profile_block_count(occurrence.block);
+			interval.weight += count < 0 ? 1 : count;
+		}
+		intervals.push_back(interval);
+		iteration_local.push_back(is_iteration_local(entry.second, liveness));
+	}
+
+	// stretch over loops until nothing changes, nested loops can widen each other. an iteration local variable
+	// skips the loops around it but still spans any loop inside them it's used in, as that loop's back edge
+	// comes round to its reads again
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int i = 0; i < intervals.size(); i++) {
+			LiveInterval& interval = intervals[i];
+			for (Loop& loop : liveness.loops) {
+				bool overlaps = interval.start <= loop.end && interval.end >= loop.start;
+				bool surrounds = loop.start < interval.start && interval.end < loop.end;
+				if (iteration_local[i] && surrounds) {
+					continue;
+				}
+				if (overlaps && (interval.start > loop.start || interval.end < loop.end)) {
+					interval.start = std::min(interval.start, loop.start);
+					interval.end = std::max(interval.end, loop.end);
+					changed = true;
+				}
+			}
+		}
+	}
+
+	for (LiveInterval& interval : intervals) {
+		for (int call : liveness.calls) {
+			if (interval.start < call && call < interval.end) {
+				interval.crosses_call = true;
+			}
+		}
+	}
+	return intervals;
+}
+
+int count_max_call_inputs(Block* block) {
+	int max_inputs = 0;
+	for (SyntaxNode* statement : block->statements) {
+		SyntaxNode* call = nullptr;
+		if (statement->type == SyntaxNode::Type::PROCEDURE_CALL) {
+			call = statement;
+		}
+		if (statement->type == SyntaxNode::Type::VARIABLE_ASSIGNMENT) {
+			call = ((VariableAssignment*)statement)->value;
+		}
+		if (statement->type == SyntaxNode::Type::RETURN_STATEMENT) {
+			call = ((ReturnStatement*)statement)->expression;
+		}
+		if (call && call->type == SyntaxNode::Type::PROCEDURE_CALL && !is_intrinsic(call)) {
+			max_inputs = std::max(max_inputs, (int)((ProcedureCall*)call)->inputs.size());
+		}
+		if (statement->type == SyntaxNode::Type::WHILE_STATEMENT) {
+			max_inputs = std::max(max_inputs, count_max_call_inputs(((WhileStatement*)statement)->body));
+		}
+		if (statement->type == SyntaxNode::Type::IF_STATEMENT) {
+			max_inputs = std::max(max_inputs, count_max_call_inputs(((IfStatement*)statement)->body));
+		}
+		if (statement->type == SyntaxNode::Type::BLOCK) {
+			max_inputs = std::max(max_inputs, count_max_call_inputs((Block*)statement));
+		}
+	}
+	return max_inputs;
+}
+
+// out of registers, spill whichever active interval of the same kind ends last. with a profile it's the one used
+// least often instead, which can be the new interval itself
+LiveInterval* choose_victim(std::vector<LiveInterval*>& active, LiveInterval& interval) {
+	bool weighted = has_profile();
+	LiveInterval* victim = nullptr;
+	for (LiveInterval* candidate : active) {
+		if (is_xmm_type(candidate->type) != is_xmm_type(interval.type)) continue;
+		bool usable = is_xmm_type(interval.type) ? !interval.crosses_call : is_callee_saved(candidate->location.reg) || !interval.crosses_call;
+		if (usable && (!victim || (weighted ? candidate->weight < victim->weight : candidate->end > victim->end))) {
+			victim = candidate;
+		}
+	}
+	if (weighted) {
+		return victim && victim->weight < interval.weight ? victim : nullptr;
+	}
+	return victim && victim->end > interval.end ? victim : nullptr;
+}
+
+RegisterAllocation allocate_registers(Procedure* procedure, ProcedureTypes& types) {
+	RegisterAllocation allocation;
+	std::vector<LiveInterval> intervals;
+	std::vector<std::pair<std::string, ArrayType>> stack_arrays;
+	for (LiveInterval& interval : build_live_intervals(procedure)) {
+		ArrayType* array = find_array(types, interval.name);
+		if (array && array->storage == ArrayType::Storage::STACK) stack_arrays.push_back({ interval.name, *array });
+		if (array && array->storage != ArrayType::Storage::INPUT) continue;
+		interval.type = array ? ValueType::INT : types.variables[interval.name];
+		intervals.push_back(interval);
+	}
+
+	// inputs past what the calling convention covers are passed in registers we'd otherwise allocate
+	std::set<Register> argument_set;
+	int argument_count = std::max((int)procedure->inputs.size(), count_max_call_inputs(procedure->body));
+	argument_count = std::min(argument_count, (int)target.argument_registers.size());
+	for (int i = 0; i < argument_count; i++) {
+		argument_set.insert(target.argument_registers[i]);
+	}
+	std::vector<Register> free_caller_saved;
+	std::vector<Register> free_callee_saved;
+	for (int i = target.caller_saved_registers.size() - 1; i >= 0; i--) {
+		if (argument_set.count(target.caller_saved_registers[i]) == 0) free_caller_saved.push_back(target.caller_saved_registers[i]);
+	}
+	for (int i = target.callee_saved_registers.size() - 1; i >= 0; i--) {
+		if (argument_set.count(target.callee_saved_registers[i]) == 0) free_callee_saved.push_back(target.callee_saved_registers[i]);
+	}
+	// which kind each input is isn't known for calls here, so as many float argument registers are kept free
+	int float_argument_count = std::min(argument_count, (int)target.float_argument_registers.size());
+	for (int i = 0; i < float_argument_count; i++) {
+		argument_set.insert(target.float_argument_registers[i]);
+	}
+	// vector code needs a second scratch register next to xmm0
+	bool vectors = is_vector(types.result);
+	for (LiveInterval& interval : intervals) {
+		if (is_vector(interval.type)) vectors = true;
+	}
+	if (vectors) {
+		argument_set.insert(target.vector_scratch);
+	}
+	std::vector<Register> free_float;
+	for (int i = target.float_registers.size() - 1; i >= 0; i--) {
+		if (argument_set.count(target.float_registers[i]) == 0) free_float.push_back(target.float_registers[i]);
+	}
+
+	std::sort(intervals.begin(), intervals.end(), [](const LiveInterval& a, const LiveInterval& b) {
+		return a.start < b.start;
+	});
+
+	std::vector<LiveInterval*> active;
+	std::vector<LiveInterval*> spilled;
+	std::set<Register> used_callee_saved;
+
+	for (LiveInterval& interval : intervals) {
+		// expire intervals that ended before this one starts
+		for (int i = active.size() - 1; i >= 0; i--) {
+			if (active[i]->end < interval.start) {
+				Register reg = active[i]->location.reg;
+				(is_xmm(reg) ? free_float : is_callee_saved(reg) ? free_callee_saved : free_caller_saved).push_back(reg);
+				active.erase(active.begin() + i);
+			}
+		}
+
+		int size = register_size(interval.type);
+		if (is_xmm_type(interval.type) && !interval.crosses_call && free_float.size() > 0) {
+			interval.location = register_operand(free_float.back(), size);
+			free_float.pop_back();
+		}
+		else if (!is_xmm_type(interval.type) && !interval.crosses_call && free_caller_saved.size() > 0) {
+			interval.location = register_operand(free_caller_saved.back());
+			free_caller_saved.pop_back();
+		}
+		else if (!is_xmm_type(interval.type) && free_callee_saved.size() > 0) {
+			interval.location = register_operand(free_callee_saved.back());
+			free_callee_saved.pop_back();
+		}
+		else {
+			LiveInterval* victim = choose_victim(active, interval);
+			if (victim) {
+				interval.location = register_operand(victim->location.reg, size);
+				victim->location = Operand();
+				spilled.push_back(victim);
+				active.erase(std::find(active.begin(), active.end(), victim));
+			}
+			else {
+				spilled.push_back(&interval);
+				continue;
+			}
+		}
+		if (is_callee_saved(interval.location.reg)) {
+			used_callee_saved.insert(interval.location.reg);
+		}
+		active.push_back(&interval);
+	}
+
+	// spilled variables whose lifetimes don't overlap share a slot, going in order of start is the interval
+	// graph colouring so this uses as few slots as there are variables live at once. slots are only as big as
+	// their type and aligned to it so narrow ones pack together, and narrow ones are only shared within a type
+	// since reading one widens it by its type
+	std::sort(spilled.begin(), spilled.end(), [](LiveInterval* a, LiveInterval* b) {
+		return a->start < b->start;
+	});
+	std::vector<StackSlot> slots;
+	int stack_size = 0;
+	for (LiveInterval* interval : spilled) {
+		int size = value_size(interval->type);
+		int found = -1;
+		for (int i = 0; i < slots.size() && found < 0; i++) {
+			bool shared = slots[i].size == size && (size == 8 || slots[i].type == interval->type);
+			if (shared && slots[i].free_after < interval->start) found = i;
+		}
+		if (found < 0) {
+			stack_size = (stack_size + size - 1) / size * size + size;
+			slots.push_back(StackSlot{ stack_size, interval->type, size, 0 });
+			found = slots.size() - 1;
+		}
+		slots[found].free_after = interval->end;
+		interval->location = memory_operand(Register::RBP, -slots[found].end, size);
+	}
+	// arrays go below the slots, each a multiple of 16 bytes so they can be cleared and worked on 16 at a time
+	for (auto& array : stack_arrays) {
+		stack_size = (stack_size + 15) / 16 * 16 + array_bytes(array.second);
+		allocation.locations[array.first] = memory_operand(Register::RBP, -stack_size, value_size(array.second.element));
+	}
+	stack_size = (stack_size + 7) / 8 * 8;
+	for (Register reg : target.callee_saved_registers) {
+		if (used_callee_saved.count(reg) > 0) {
+			stack_size += 8;
+			allocation.saved_registers.push_back(reg);
+			allocation.saved_slots.push_back(memory_operand(Register::RBP, -stack_size));
+		}
+	}
+	for (LiveInterval& interval : intervals) {
+		allocation.locations[interval.name] = interval.location;
+	}
+	allocation.stack_size = stack_size;
+	return allocation;
+}
+
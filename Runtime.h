@@ -0,0 +1,452 @@
+#pragma once
+#include <set>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+#include "Target.h"
+#include "Types.h"
+
+// RUNTIME
+// what a linux executable needs when it isn't linked against the c runtime: an entry point that calls main
+// and exits with its result, and a printf that understands %d, %f, %s, %c and %%. it takes its inputs the same
+// way our own procedures pass them, format in rdi then rsi, rdx, rcx, r8, r9, r10 ... r15, doubles in xmm0 to xmm7
+//
+// printf formats straight into output_buffer and only writes it when it's full, when main returns and when the
+// program calls flush(), which is output_flush. an object linked against the c runtime uses the same printf and
+// has atexit flush the buffer. programs are single threaded, so the one buffer is the thread's. on windows
+// printf stays the c runtime's, which buffers already, and flush() is fflush(NULL)
+
+const std::string output_buffer_label = "output_buffer";
+const std::string output_length_label = "output_length";
+const std::string output_registered_label = "output_registered";
+
+bool uses_output_buffer = false;
+bool uses_fflush = false;
+
+void runtime_start(std::vector<Instruction>& code) {
+	emit_label(code, "_start");
+	emit(code, Opcode::XOR, register_operand(Register::RBP, 4), register_operand(Register::RBP, 4));
+	emit(code, Opcode::CALL, label_operand("main"));
+	if (uses_output_buffer) {
+		emit(code, Opcode::MOV, register_operand(Register::RBX, 4), register_operand(Register::RAX, 4));
+		emit(code, Opcode::CALL, label_operand("output_flush"));
+		emit(code, Opcode::MOV, register_operand(Register::RAX, 4), register_operand(Register::RBX, 4));
+	}
+	emit(code, Opcode::MOV, register_operand(Register::RDI, 4), register_operand(Register::RAX, 4));
+	emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(60)); // exit
+	emit(code, Opcode::SYSCALL);
+}
+
+// write(1, rsi, rdx) until all of it is out, the pipe or terminal can take less than asked for
+void runtime_output_write(std::vector<Instruction>& code) {
+	emit_label(code, "output_write");
+	emit_label(code, ".again");
+	emit(code, Opcode::TEST, register_operand(Register::RDX), register_operand(Register::RDX));
+	emit_condition(code, Opcode::JCC, Condition::LE, label_operand(".written"));
+	emit(code, Opcode::MOV, register_operand(Register::RDI, 4), immediate_operand(1));
+	emit(code, Opcode::MOV, register_operand(Register::RAX, 4), immediate_operand(1));
+	emit(code, Opcode::SYSCALL);
+	emit(code, Opcode::TEST, register_operand(Register::RAX), register_operand(Register::RAX));
+	emit_condition(code, Opcode::JCC, Condition::LE, label_operand(".written")); // nowhere to write it, drop the rest
+	emit(code, Opcode::ADD, register_operand(Register::RSI), register_operand(Register::RAX));
+	emit(code, Opcode::SUB, register_operand(Register::RDX), register_operand(Register::RAX));
+	emit(code, Opcode::JMP, label_operand(".again"));
+	emit_label(code, ".written");
+	emit(code, Opcode::RET);
+}
+
+// writes out whatever printf has buffered and returns 0
+void runtime_output_flush(std::vector<Instruction>& code) {
+	emit_label(code, "output_flush");
+	if (target.platform == Platform::WINDOWS) {
+		emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(40)); // aligned, with shadow space
+		emit(code, Opcode::XOR, register_operand(Register::RCX, 4), register_operand(Register::RCX, 4));
+		emit(code, Opcode::CALL, label_operand("fflush"));
+		emit(code, Opcode::ADD, register_operand(Register::RSP), immediate_operand(40));
+	}
+	else {
+		emit(code, Opcode::LEA, register_operand(Register::RSI), label_memory_operand(output_buffer_label));
+		emit(code, Opcode::MOV, register_operand(Register::RDX), label_memory_operand(output_length_label));
+		emit(code, Opcode::MOV, label_memory_operand(output_length_label), immediate_operand(0));
+		emit(code, Opcode::CALL, label_operand("output_write"));
+	}
+	emit(code, Opcode::XOR, register_operand(Register::RAX, 4), register_operand(Register::RAX, 4));
+	emit(code, Opcode::RET);
+}
+
+// frame below rbp: the eleven value registers, rbx, 32 bytes to build digits in, the eight double registers,
+// where the next double is read from and where the buffer starts and ends
+void runtime_printf(std::vector<Instruction>& code, bool c_runtime) {
+	const Register value_registers[] = { Register::R15, Register::R14, Register::R13, Register::R12, Register::R11, Register::R10, Register::R9, Register::R8, Register::RCX, Register::RDX, Register::RSI };
+	const int first_value = -88;
+	const int saved_rbx = -96;
+	const int digits_end = -96;
+	const int first_double = -192;
+	const int next_double = -200;
+	const int buffer_start = -208;
+	const int buffer_end = -216;
+	const int frame_size = 224;
+
+	Operand format = register_operand(Register::RDI);
+	Operand next_value = register_operand(Register::RBX);
+	Operand cursor = register_operand(Register::RSI);
+	Operand character = register_operand(Register::RAX, 4);
+	Operand scan = register_operand(Register::R10); // survives the write syscall
+
+	emit_label(code, "output_printf");
+	emit(code, Opcode::PUSH, register_operand(Register::RBP));
+	emit(code, Opcode::MOV, register_operand(Register::RBP), register_operand(Register::RSP));
+	// in memory the values end up in order, first one lowest
+	for (Register value_register : value_registers) {
+		emit(code, Opcode::PUSH, register_operand(value_register));
+	}
+	emit(code, Opcode::PUSH, next_value);
+	emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(frame_size - 96));
+	for (int i = 0; i < 8; i++) {
+		emit(code, Opcode::MOVSD, memory_operand(Register::RBP, first_double + i * 8), register_operand((Register)((int)Register::XMM0 + i)));
+	}
+	if (c_runtime) {
+		// the c runtime's exit is what ends the program, it has to flush the buffer too. the stack is aligned here
+		emit(code, Opcode::CMP, label_memory_operand(output_registered_label), immediate_operand(0));
+		emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".registered"));
+		emit(code, Opcode::MOV, label_memory_operand(output_registered_label), immediate_operand(1));
+		emit(code, Opcode::MOV, next_value, format);
+		emit(code, Opcode::LEA, format, label_memory_operand("output_flush"));
+		emit(code, Opcode::CALL, label_operand("atexit"));
+		emit(code, Opcode::MOV, format, next_value);
+		emit_label(code, ".registered");
+	}
+	emit(code, Opcode::LEA, register_operand(Register::RAX), memory_operand(Register::RBP, first_double));
+	emit(code, Opcode::MOV, memory_operand(Register::RBP, next_double), register_operand(Register::RAX));
+	emit(code, Opcode::LEA, next_value, memory_operand(Register::RBP, first_value));
+	emit(code, Opcode::LEA, register_operand(Register::RAX), label_memory_operand(output_buffer_label));
+	emit(code, Opcode::MOV, memory_operand(Register::RBP, buffer_start), register_operand(Register::RAX));
+	emit(code, Opcode::MOV, cursor, register_operand(Register::RAX));
+	emit(code, Opcode::ADD, register_operand(Register::RAX), immediate_operand(output_buffer_size));
+	emit(code, Opcode::MOV, memory_operand(Register::RBP, buffer_end), register_operand(Register::RAX));
+	emit(code, Opcode::ADD, cursor, label_memory_operand(output_length_label));
+
+	emit_label(code, ".next");
+	emit(code, Opcode::MOVZX, character, memory_operand(Register::RDI, 0, 1));
+	emit(code, Opcode::TEST, character, character);
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".done"));
+	emit(code, Opcode::ADD, format, immediate_operand(1));
+	emit(code, Opcode::CMP, character, immediate_operand('%'));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".literal"));
+	emit(code, Opcode::MOVZX, character, memory_operand(Register::RDI, 0, 1));
+	emit(code, Opcode::TEST, character, character);
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".done"));
+	emit(code, Opcode::ADD, format, immediate_operand(1));
+	emit(code, Opcode::CMP, character, immediate_operand('d'));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".decimal"));
+	emit(code, Opcode::CMP, character, immediate_operand('f'));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".float"));
+	emit(code, Opcode::CMP, character, immediate_operand('s'));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".string"));
+	emit(code, Opcode::CMP, character, immediate_operand('c'));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".literal"));
+	emit(code, Opcode::MOV, character, memory_operand(next_value.reg, 0, 4));
+	emit(code, Opcode::ADD, next_value, immediate_operand(8));
+	emit_label(code, ".literal");
+	emit(code, Opcode::CALL, label_operand(".put"));
+	emit(code, Opcode::JMP, label_operand(".next"));
+
+	// %d prints the low 32 bits like c does
+	Operand number = register_operand(Register::R8);
+	Operand minimum_digits = register_operand(Register::R9);
+	emit_label(code, ".decimal");
+	emit(code, Opcode::MOVSX, number, memory_operand(next_value.reg, 0, 4));
+	emit(code, Opcode::ADD, next_value, immediate_operand(8));
+	emit(code, Opcode::TEST, number, number);
+	emit_condition(code, Opcode::JCC, Condition::GE, label_operand(".decimal_digits"));
+	emit(code, Opcode::MOV, character, immediate_operand('-'));
+	emit(code, Opcode::CALL, label_operand(".put"));
+	emit(code, Opcode::NEG, number);
+	emit_label(code, ".decimal_digits");
+	emit(code, Opcode::MOV, minimum_digits, immediate_operand(1));
+	emit(code, Opcode::CALL, label_operand(".number"));
+	emit(code, Opcode::JMP, label_operand(".next"));
+
+	// %f prints six decimals like c. below 2^63 the integer part and the fraction are split before the fraction is
+	// rounded to six digits, above it every double is a whole number, so its exact digits are worked out from the
+	// mantissa and exponent in 32 bit limbs below rsp. the sign comes from the sign bit, so -0 and -nan print it
+	Operand value = register_operand(Register::XMM0);
+	Operand scratch = register_operand(Register::XMM1);
+	Operand bits = register_operand(Register::RAX);
+	Operand exponent = register_operand(Register::RCX);
+	emit_label(code, ".float");
+	emit(code, Opcode::MOV, register_operand(Register::RAX), memory_operand(Register::RBP, next_double));
+	emit(code, Opcode::MOVSD, value, memory_operand(Register::RAX, 0));
+	emit(code, Opcode::ADD, register_operand(Register::RAX), immediate_operand(8));
+	emit(code, Opcode::MOV, memory_operand(Register::RBP, next_double), register_operand(Register::RAX));
+	emit(code, Opcode::MOVQ, bits, value);
+	emit(code, Opcode::TEST, bits, bits);
+	emit_condition(code, Opcode::JCC, Condition::GE, label_operand(".float_magnitude"));
+	emit(code, Opcode::MOV, character, immediate_operand('-'));
+	emit(code, Opcode::CALL, label_operand(".put"));
+	emit_label(code, ".float_magnitude");
+	emit(code, Opcode::MOVQ, bits, value);
+	emit(code, Opcode::SHL, bits, immediate_operand(1));
+	emit(code, Opcode::SHR, bits, immediate_operand(1));
+	emit(code, Opcode::MOVQ, value, bits);
+	emit(code, Opcode::MOV, exponent, bits);
+	emit(code, Opcode::SHR, exponent, immediate_operand(52));
+	emit(code, Opcode::CMP, exponent, immediate_operand(0x7ff));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".float_finite"));
+	emit(code, Opcode::SHL, bits, immediate_operand(12)); // leaves the mantissa, which only infinity has empty
+	emit(code, Opcode::TEST, bits, bits);
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".float_nan"));
+	for (char c : std::string("inf")) {
+		emit(code, Opcode::MOV, character, immediate_operand(c));
+		emit(code, Opcode::CALL, label_operand(".put"));
+	}
+	emit(code, Opcode::JMP, label_operand(".next"));
+	emit_label(code, ".float_nan");
+	for (char c : std::string("nan")) {
+		emit(code, Opcode::MOV, character, immediate_operand(c));
+		emit(code, Opcode::CALL, label_operand(".put"));
+	}
+	emit(code, Opcode::JMP, label_operand(".next"));
+
+	emit_label(code, ".float_finite");
+	emit(code, Opcode::CMP, exponent, immediate_operand(1023 + 63));
+	emit_condition(code, Opcode::JCC, Condition::AE, label_operand(".float_large"));
+	Operand whole = register_operand(Register::R11);
+	emit(code, Opcode::CVTTSD2SI, whole, value);
+	emit(code, Opcode::CVTSI2SD, scratch, whole);
+	emit(code, Opcode::SUBSD, value, scratch); // the fraction, exactly
+	// the fraction times a million in fixed point with 62 bits after the point, rounded half to even like c
+	emit(code, Opcode::MOV, register_operand(Register::RDX), immediate_operand(0x43d0000000000000)); // 2^62
+	emit(code, Opcode::MOVQ, scratch, register_operand(Register::RDX));
+	emit(code, Opcode::MULSD, value, scratch);
+	emit(code, Opcode::CVTTSD2SI, register_operand(Register::RAX), value);
+	emit(code, Opcode::MOV, register_operand(Register::RCX), immediate_operand(1000000));
+	emit(code, Opcode::IMUL, register_operand(Register::RCX));
+	emit(code, Opcode::MOV, register_operand(Register::RCX), register_operand(Register::RAX));
+	emit(code, Opcode::SHR, register_operand(Register::RCX), immediate_operand(62));
+	emit(code, Opcode::SHL, register_operand(Register::RDX), immediate_operand(2));
+	emit(code, Opcode::ADD, register_operand(Register::RDX), register_operand(Register::RCX));
+	emit(code, Opcode::SHL, register_operand(Register::RAX), immediate_operand(2)); // what's left over, a half is the top bit
+	emit(code, Opcode::MOV, register_operand(Register::RCX), immediate_operand((long long)0x8000000000000000ull));
+	emit(code, Opcode::CMP, register_operand(Register::RAX), register_operand(Register::RCX));
+	emit_condition(code, Opcode::JCC, Condition::B, label_operand(".float_rounded"));
+	emit_condition(code, Opcode::JCC, Condition::A, label_operand(".float_round_up"));
+	emit(code, Opcode::TEST, register_operand(Register::RDX), immediate_operand(1));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".float_rounded"));
+	emit_label(code, ".float_round_up");
+	emit(code, Opcode::ADD, register_operand(Register::RDX), immediate_operand(1));
+	emit_label(code, ".float_rounded");
+	emit(code, Opcode::CMP, register_operand(Register::RDX), immediate_operand(1000000));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".float_whole"));
+	emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4)); // rounded up into the integer part
+	emit(code, Opcode::ADD, whole, immediate_operand(1));
+	emit_label(code, ".float_whole");
+	emit(code, Opcode::PUSH, register_operand(Register::RDX));
+	emit(code, Opcode::MOV, number, whole);
+	emit(code, Opcode::MOV, minimum_digits, immediate_operand(1));
+	emit(code, Opcode::CALL, label_operand(".number"));
+	emit_label(code, ".float_point");
+	emit(code, Opcode::MOV, character, immediate_operand('.'));
+	emit(code, Opcode::CALL, label_operand(".put"));
+	emit(code, Opcode::POP, number);
+	emit(code, Opcode::MOV, minimum_digits, immediate_operand(6));
+	emit(code, Opcode::CALL, label_operand(".number"));
+	emit(code, Opcode::JMP, label_operand(".next"));
+
+	// the value is mantissa * 2^(exponent - 1075), under 2^1024 so 32 limbs hold it. it's shifted into place a
+	// bit at a time until what's left is a multiple of 16, then 16 bits at a time, then divided by 10^9 until
+	// nothing is left, each remainder being the next nine digits up
+	const int limbs = 32;
+	const int chunks = limbs * 4; // 36 chunks of nine digits after the limbs, more than the 309 digits there can be
+	const int chunks_left = chunks + 36 * 4;
+	const int large_frame = chunks_left + 16;
+	Operand limb = register_operand(Register::RAX, 4);
+	Operand index = register_operand(Register::RCX);
+	Operand carry = register_operand(Register::R9);
+	Operand shift = register_operand(Register::R11);
+	emit_label(code, ".float_large");
+	emit(code, Opcode::SUB, register_operand(Register::RSP), immediate_operand(large_frame));
+	emit(code, Opcode::MOV, shift, exponent);
+	emit(code, Opcode::SUB, shift, immediate_operand(1075));
+	emit(code, Opcode::XOR, register_operand(Register::RCX, 4), register_operand(Register::RCX, 4));
+	emit_label(code, ".float_clear");
+	emit(code, Opcode::MOV, indexed_memory_operand(Register::RSP, Register::RCX, 4, 0, 4), immediate_operand(0));
+	emit(code, Opcode::ADD, index, immediate_operand(1));
+	emit(code, Opcode::CMP, index, immediate_operand(limbs));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".float_clear"));
+	emit(code, Opcode::SHL, bits, immediate_operand(12));
+	emit(code, Opcode::SHR, bits, immediate_operand(12));
+	emit(code, Opcode::MOV, register_operand(Register::RDX), immediate_operand(1ll << 52)); // the implicit leading one
+	emit(code, Opcode::ADD, bits, register_operand(Register::RDX));
+	emit(code, Opcode::MOV, memory_operand(Register::RSP, 0, 4), limb);
+	emit(code, Opcode::SHR, bits, immediate_operand(32));
+	emit(code, Opcode::MOV, memory_operand(Register::RSP, 4, 4), limb);
+	auto shift_limbs = [&](const std::string& name, int by) {
+		emit(code, Opcode::XOR, register_operand(Register::RCX, 4), register_operand(Register::RCX, 4));
+		emit(code, Opcode::XOR, register_operand(Register::R9, 4), register_operand(Register::R9, 4));
+		emit_label(code, name);
+		emit(code, Opcode::MOV, limb, indexed_memory_operand(Register::RSP, Register::RCX, 4, 0, 4));
+		emit(code, Opcode::SHL, bits, immediate_operand(by));
+		emit(code, Opcode::ADD, bits, carry);
+		emit(code, Opcode::MOV, indexed_memory_operand(Register::RSP, Register::RCX, 4, 0, 4), limb);
+		emit(code, Opcode::SHR, bits, immediate_operand(32));
+		emit(code, Opcode::MOV, carry, bits);
+		emit(code, Opcode::ADD, index, immediate_operand(1));
+		emit(code, Opcode::CMP, index, immediate_operand(limbs));
+		emit_condition(code, Opcode::JCC, Condition::NE, label_operand(name));
+		emit(code, Opcode::SUB, shift, immediate_operand(by));
+	};
+	emit_label(code, ".float_by_one");
+	emit(code, Opcode::TEST, shift, immediate_operand(15));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".float_by_sixteen"));
+	shift_limbs(".float_shift_one", 1);
+	emit(code, Opcode::JMP, label_operand(".float_by_one"));
+	emit_label(code, ".float_by_sixteen");
+	emit(code, Opcode::TEST, shift, shift);
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".float_shifted"));
+	shift_limbs(".float_shift_sixteen", 16);
+	emit(code, Opcode::JMP, label_operand(".float_by_sixteen"));
+
+	Operand count = register_operand(Register::R8);
+	Operand remainder = register_operand(Register::RDX);
+	Operand quotients = register_operand(Register::R9); // zero once every limb is
+	Operand billion = register_operand(Register::R11);
+	emit_label(code, ".float_shifted");
+	emit(code, Opcode::XOR, register_operand(Register::R8, 4), register_operand(Register::R8, 4));
+	emit(code, Opcode::MOV, billion, immediate_operand(1000000000));
+	emit_label(code, ".float_divide");
+	emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4));
+	emit(code, Opcode::XOR, register_operand(Register::R9, 4), register_operand(Register::R9, 4));
+	emit(code, Opcode::MOV, index, immediate_operand(limbs - 1));
+	emit_label(code, ".float_divide_limb");
+	emit(code, Opcode::SHL, remainder, immediate_operand(32));
+	emit(code, Opcode::MOV, limb, indexed_memory_operand(Register::RSP, Register::RCX, 4, 0, 4));
+	emit(code, Opcode::ADD, bits, remainder);
+	emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4));
+	emit(code, Opcode::DIV, billion);
+	emit(code, Opcode::MOV, indexed_memory_operand(Register::RSP, Register::RCX, 4, 0, 4), limb);
+	emit(code, Opcode::ADD, quotients, bits);
+	emit(code, Opcode::SUB, index, immediate_operand(1));
+	emit_condition(code, Opcode::JCC, Condition::GE, label_operand(".float_divide_limb"));
+	emit(code, Opcode::MOV, indexed_memory_operand(Register::RSP, Register::R8, 4, chunks, 4), register_operand(Register::RDX, 4));
+	emit(code, Opcode::ADD, count, immediate_operand(1));
+	emit(code, Opcode::TEST, quotients, quotients);
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".float_divide"));
+
+	// the top chunk without leading zeros, every one after it with all nine digits
+	emit(code, Opcode::MOV, memory_operand(Register::RSP, chunks_left), count);
+	emit(code, Opcode::MOV, minimum_digits, immediate_operand(1));
+	emit(code, Opcode::JMP, label_operand(".float_chunk"));
+	emit_label(code, ".float_chunks");
+	emit(code, Opcode::MOV, minimum_digits, immediate_operand(9));
+	emit_label(code, ".float_chunk");
+	emit(code, Opcode::MOV, register_operand(Register::RAX), memory_operand(Register::RSP, chunks_left));
+	emit(code, Opcode::SUB, register_operand(Register::RAX), immediate_operand(1));
+	emit(code, Opcode::MOV, memory_operand(Register::RSP, chunks_left), register_operand(Register::RAX));
+	emit(code, Opcode::MOV, register_operand(Register::R8, 4), indexed_memory_operand(Register::RSP, Register::RAX, 4, chunks, 4));
+	emit(code, Opcode::CALL, label_operand(".number"));
+	emit(code, Opcode::CMP, memory_operand(Register::RSP, chunks_left), immediate_operand(0));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".float_chunks"));
+	emit(code, Opcode::ADD, register_operand(Register::RSP), immediate_operand(large_frame));
+	emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4));
+	emit(code, Opcode::PUSH, register_operand(Register::RDX)); // no fraction
+	emit(code, Opcode::JMP, label_operand(".float_point"));
+
+	emit_label(code, ".string");
+	emit(code, Opcode::MOV, scan, memory_operand(next_value.reg, 0));
+	emit(code, Opcode::ADD, next_value, immediate_operand(8));
+	emit_label(code, ".string_character");
+	emit(code, Opcode::MOVZX, character, memory_operand(Register::R10, 0, 1));
+	emit(code, Opcode::TEST, character, character);
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".next"));
+	emit(code, Opcode::CALL, label_operand(".put"));
+	emit(code, Opcode::ADD, scan, immediate_operand(1));
+	emit(code, Opcode::JMP, label_operand(".string_character"));
+
+	// what's left stays in the buffer for the next printf
+	emit_label(code, ".done");
+	emit(code, Opcode::SUB, cursor, memory_operand(Register::RBP, buffer_start));
+	emit(code, Opcode::MOV, label_memory_operand(output_length_label), cursor);
+	emit(code, Opcode::MOV, next_value, memory_operand(Register::RBP, saved_rbx));
+	emit(code, Opcode::XOR, character, character);
+	emit(code, Opcode::LEAVE);
+	emit(code, Opcode::RET);
+
+	// prints r8 as unsigned with at least r9 digits, they're built backwards from the end of the scratch space
+	emit_label(code, ".number");
+	emit(code, Opcode::LEA, scan, memory_operand(Register::RBP, digits_end));
+	emit(code, Opcode::MOV, register_operand(Register::RAX), number);
+	emit_label(code, ".digit");
+	emit(code, Opcode::MOV, register_operand(Register::RCX), immediate_operand(10));
+	emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4));
+	emit(code, Opcode::DIV, register_operand(Register::RCX));
+	emit(code, Opcode::ADD, register_operand(Register::RDX, 4), immediate_operand('0'));
+	emit(code, Opcode::SUB, scan, immediate_operand(1));
+	emit(code, Opcode::MOV, memory_operand(Register::R10, 0, 1), register_operand(Register::RDX, 1));
+	emit(code, Opcode::SUB, minimum_digits, immediate_operand(1));
+	emit(code, Opcode::TEST, register_operand(Register::RAX), register_operand(Register::RAX));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".digit"));
+	emit(code, Opcode::TEST, minimum_digits, minimum_digits);
+	emit_condition(code, Opcode::JCC, Condition::G, label_operand(".digit")); // leading zeros
+	emit_label(code, ".copy_digits");
+	emit(code, Opcode::MOVZX, character, memory_operand(Register::R10, 0, 1));
+	emit(code, Opcode::CALL, label_operand(".put"));
+	emit(code, Opcode::ADD, scan, immediate_operand(1));
+	emit(code, Opcode::LEA, register_operand(Register::RAX), memory_operand(Register::RBP, digits_end));
+	emit(code, Opcode::CMP, scan, register_operand(Register::RAX));
+	emit_condition(code, Opcode::JCC, Condition::NE, label_operand(".copy_digits"));
+	emit(code, Opcode::RET);
+
+	// appends al to the buffer, writing it out when full
+	emit_label(code, ".put");
+	emit(code, Opcode::MOV, memory_operand(Register::RSI, 0, 1), register_operand(Register::RAX, 1));
+	emit(code, Opcode::ADD, cursor, immediate_operand(1));
+	emit(code, Opcode::CMP, cursor, memory_operand(Register::RBP, buffer_end));
+	emit_condition(code, Opcode::JCC, Condition::E, label_operand(".flush"));
+	emit(code, Opcode::RET);
+
+	// the whole buffer goes out, keeps the format pointer
+	emit_label(code, ".flush");
+	emit(code, Opcode::PUSH, format);
+	emit(code, Opcode::MOV, register_operand(Register::RDX), cursor);
+	emit(code, Opcode::MOV, cursor, memory_operand(Register::RBP, buffer_start));
+	emit(code, Opcode::SUB, register_operand(Register::RDX), cursor);
+	emit(code, Opcode::CALL, label_operand("output_write"));
+	emit(code, Opcode::MOV, cursor, memory_operand(Register::RBP, buffer_start));
+	emit(code, Opcode::POP, format);
+	emit(code, Opcode::RET);
+}
+
+// the buffered output for whichever of printf and flush the code calls, however it's built
+std::vector<std::vector<Instruction>> output_procedures(const std::set<std::string>& called, bool c_runtime) {
+	std::vector<std::vector<Instruction>> procedures;
+	uses_output_buffer = false;
+	uses_fflush = false;
+	if (called.count("output_flush") == 0 && called.count("output_printf") == 0) return procedures;
+	std::vector<Instruction> flush;
+	runtime_output_flush(flush);
+	procedures.push_back(flush);
+	if (target.platform == Platform::WINDOWS) {
+		uses_fflush = true;
+		return procedures;
+	}
+	uses_output_buffer = true;
+	std::vector<Instruction> write;
+	runtime_output_write(write);
+	procedures.push_back(write);
+	if (called.count("output_printf") > 0) {
+		std::vector<Instruction> printf;
+		runtime_printf(printf, c_runtime);
+		procedures.push_back(printf);
+	}
+	return procedures;
+}
+
+// what a program needs when there's no c runtime to start it
+std::vector<std::vector<Instruction>> runtime_procedures() {
+	std::vector<std::vector<Instruction>> procedures;
+	std::vector<Instruction> start;
+	runtime_start(start);
+	procedures.push_back(start);
+	return procedures;
+}
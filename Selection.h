@@ -0,0 +1,315 @@
+#pragma once
+#include <vector>
+#include "Instructions.h"
+#include "Parsing.h"
+
+// INSTRUCTION SELECTION
+// picks the machine instructions for one arithmetic operation on flattened operands, writing the result into a
+// register. lea gives three operand adds, multiplies by constants become shifts or lea, and division by a
+// constant becomes a multiply by its reciprocal. idiv and the reciprocal multiply work in rax and rdx, which
+// never hold anything between statements
+
+const Operand rax_operand = register_operand(Register::RAX);
+const Operand rdx_operand = register_operand(Register::RDX);
+const Operand rcx_operand = register_operand(Register::RCX); // scratch for divisors that can't be immediates
+
+bool is_arithmetic_operator(BinaryOperator::Type operation) {
+	return operation == BinaryOperator::Type::ADD || operation == BinaryOperator::Type::SUBTRACT || operation == BinaryOperator::Type::MULTIPLY ||
+		operation == BinaryOperator::Type::DIVIDE || operation == BinaryOperator::Type::MODULO;
+}
+
+bool is_power_of_two(long long value) {
+	return value > 0 && (value & (value - 1)) == 0;
+}
+
+int log2_of(long long value) {
+	int shift = 0;
+	while ((1LL << shift) < value) shift++;
+	return shift;
+}
+
+bool is_int32(const Operand& operand) {
+	return operand.is_immediate() && operand.value >= INT32_MIN && operand.value <= INT32_MAX;
+}
+
+// constant operands are folded the way the interpreter would, unless that would trap
+bool fold_constants(long long left, long long right, BinaryOperator::Type operation, long long& result) {
+	switch (operation)
+	{
+	case BinaryOperator::Type::ADD: result = left + right; return true;
+	case BinaryOperator::Type::SUBTRACT: result = left - right; return true;
+	case BinaryOperator::Type::MULTIPLY: result = left * right; return true;
+	case BinaryOperator::Type::DIVIDE:
+		if (right == 0 || (right == -1 && left == INT64_MIN)) return false;
+		result = left / right;
+		return true;
+	case BinaryOperator::Type::MODULO:
+		if (right == 0 || (right == -1 && left == INT64_MIN)) return false;
+		result = left % right;
+		return true;
+	default:
+		return false;
+	}
+}
+
+struct Reciprocal {
+	long long multiplier;
+	int shift;
+};
+
+// the signed magic number from hacker's delight, n / d is the high half of n * multiplier shifted right, then
+// corrected for a negative n. d can't be -1, 0 or 1
+Reciprocal signed_reciprocal(long long d) {
+	const unsigned long long two63 = 0x8000000000000000ULL;
+	unsigned long long ad = d < 0 ? 0 - (unsigned long long)d : d;
+	unsigned long long t = two63 + ((unsigned long long)d >> 63);
+	unsigned long long anc = t - 1 - t % ad;
+	int p = 63;
+	unsigned long long q1 = two63 / anc;
+	unsigned long long r1 = two63 - q1 * anc;
+	unsigned long long q2 = two63 / ad;
+	unsigned long long r2 = two63 - q2 * ad;
+	unsigned long long delta;
+	do {
+		p++;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+
+	Reciprocal reciprocal;
+	reciprocal.multiplier = (long long)(q2 + 1);
+	if (d < 0) reciprocal.multiplier = -reciprocal.multiplier;
+	reciprocal.shift = p - 64;
+	return reciprocal;
+}
+
+// leaves the quotient of dividend / divisor in rdx
+void select_constant_quotient(std::vector<Instruction>& code, Operand dividend, long long divisor) {
+	long long magnitude = divisor < 0 ? -divisor : divisor;
+	if (is_power_of_two(magnitude)) {
+		// shifting rounds towards negative infinity, so negative dividends are biased by magnitude - 1 first
+		int shift = log2_of(magnitude);
+		emit(code, Opcode::MOV, rdx_operand, dividend);
+		emit(code, Opcode::SAR, rdx_operand, immediate_operand(63));
+		emit(code, Opcode::SHR, rdx_operand, immediate_operand(64 - shift));
+		emit(code, Opcode::ADD, rdx_operand, dividend);
+		emit(code, Opcode::SAR, rdx_operand, immediate_operand(shift));
+	}
+	else {
+		Reciprocal reciprocal = signed_reciprocal(divisor);
+		emit(code, Opcode::MOV, rax_operand, immediate_operand(reciprocal.multiplier));
+		emit(code, Opcode::IMUL, dividend);
+		if (divisor > 0 && reciprocal.multiplier < 0) emit(code, Opcode::ADD, rdx_operand, dividend);
+		if (divisor < 0 && reciprocal.multiplier > 0) emit(code, Opcode::SUB, rdx_operand, dividend);
+		if (reciprocal.shift > 0) emit(code, Opcode::SAR, rdx_operand, immediate_operand(reciprocal.shift));
+		// add one when the product was negative
+		emit(code, Opcode::MOV, rax_operand, rdx_operand);
+		emit(code, Opcode::SHR, rax_operand, immediate_operand(63));
+		emit(code, Opcode::ADD, rdx_operand, rax_operand);
+		return;
+	}
+	if (divisor < 0) emit(code, Opcode::NEG, rdx_operand);
+}
+
+void select_division(std::vector<Instruction>& code, Operand destination, BinaryOperator::Type operation, Operand left, Operand right) {
+	bool modulo = operation == BinaryOperator::Type::MODULO;
+
+	if (is_int32(right) && right.value != 0 && right.value != INT32_MIN) {
+		long long divisor = right.value;
+		if (divisor == 1 || divisor == -1) {
+			if (modulo) {
+				emit(code, Opcode::MOV, destination, immediate_operand(0));
+				return;
+			}
+			emit(code, Opcode::MOV, destination, left);
+			if (divisor == -1) emit(code, Opcode::NEG, destination);
+			return;
+		}
+		select_constant_quotient(code, left, divisor);
+		if (!modulo) {
+			emit(code, Opcode::MOV, destination, rdx_operand);
+			return;
+		}
+		// remainder = dividend - quotient * divisor
+		emit(code, Opcode::IMUL, rdx_operand, rdx_operand, immediate_operand(divisor));
+		emit(code, Opcode::MOV, rax_operand, left);
+		emit(code, Opcode::SUB, rax_operand, rdx_operand);
+		emit(code, Opcode::MOV, destination, rax_operand);
+		return;
+	}
+
+	if (right.is_immediate()) {
+		emit(code, Opcode::MOV, rcx_operand, right);
+		right = rcx_operand;
+	}
+	emit(code, Opcode::MOV, rax_operand, left);
+	emit(code, Opcode::CQO);
+	emit(code, Opcode::IDIV, right);
+	emit(code, Opcode::MOV, destination, modulo ? rdx_operand : rax_operand);
+}
+
+// u64 values can have the top bit set, so they can't go through idiv or the signed reciprocal. a power of two is
+// a shift or a mask and anything else is div
+void select_unsigned_division(std::vector<Instruction>& code, Operand destination, BinaryOperator::Type operation, Operand left, Operand right) {
+	bool modulo = operation == BinaryOperator::Type::MODULO;
+	if (is_int32(right) && is_power_of_two(right.value)) {
+		if (destination != left) emit(code, Opcode::MOV, destination, left);
+		if (modulo) emit(code, Opcode::AND, destination, immediate_operand(right.value - 1));
+		else if (right.value > 1) emit(code, Opcode::SHR, destination, immediate_operand(log2_of(right.value)));
+		return;
+	}
+	if (right.is_immediate()) {
+		emit(code, Opcode::MOV, rcx_operand, right);
+		right = rcx_operand;
+	}
+	emit(code, Opcode::MOV, rax_operand, left);
+	emit(code, Opcode::XOR, register_operand(Register::RDX, 4), register_operand(Register::RDX, 4));
+	emit(code, Opcode::DIV, right);
+	emit(code, Opcode::MOV, destination, modulo ? rdx_operand : rax_operand);
+}
+
+void select_multiply(std::vector<Instruction>& code, Operand destination, Operand left, Operand right) {
+	if (left.is_immediate()) std::swap(left, right);
+
+	if (is_int32(right)) {
+		long long factor = right.value;
+		if (factor == 0) {
+			emit(code, Opcode::MOV, destination, immediate_operand(0));
+			return;
+		}
+		if (factor == 1 || factor == -1) {
+			emit(code, Opcode::MOV, destination, left);
+			if (factor == -1) emit(code, Opcode::NEG, destination);
+			return;
+		}
+		if (is_power_of_two(factor)) {
+			emit(code, Opcode::MOV, destination, left);
+			emit(code, Opcode::SHL, destination, immediate_operand(log2_of(factor)));
+			return;
+		}
+		if ((factor == 3 || factor == 5 || factor == 9) && left.is_register()) {
+			emit(code, Opcode::LEA, destination, indexed_memory_operand(left.reg, left.reg, factor - 1, 0));
+			return;
+		}
+		emit(code, Opcode::IMUL, destination, left, right);
+		return;
+	}
+
+	if (destination == right) std::swap(left, right);
+	if (destination != left) emit(code, Opcode::MOV, destination, left);
+	emit(code, Opcode::IMUL, destination, right);
+}
+
+void select_add(std::vector<Instruction>& code, Operand destination, Operand left, Operand right) {
+	if (left.is_immediate()) std::swap(left, right);
+	if (destination == right) std::swap(left, right);
+	if (destination == left) {
+		emit(code, Opcode::ADD, destination, right);
+		return;
+	}
+	if (left.is_register() && right.is_register()) {
+		emit(code, Opcode::LEA, destination, indexed_memory_operand(left.reg, right.reg, 1, 0));
+		return;
+	}
+	if (left.is_register() && is_int32(right)) {
+		emit(code, Opcode::LEA, destination, memory_operand(left.reg, right.value));
+		return;
+	}
+	emit(code, Opcode::MOV, destination, left);
+	emit(code, Opcode::ADD, destination, right);
+}
+
+void select_subtract(std::vector<Instruction>& code, Operand destination, Operand left, Operand right) {
+	if (destination == right && destination != left) {
+		// destination = left - destination
+		emit(code, Opcode::NEG, destination);
+		emit(code, Opcode::ADD, destination, left);
+		return;
+	}
+	if (destination != left && left.is_register() && is_int32(right) && right.value != INT32_MIN) {
+		emit(code, Opcode::LEA, destination, memory_operand(left.reg, -right.value));
+		return;
+	}
+	if (destination != left) emit(code, Opcode::MOV, destination, left);
+	emit(code, Opcode::SUB, destination, right);
+}
+
+// operands are literals or variables, the destination is a register. narrower unsigned types are never negative
+// as 64 bit values, so only u64 needs unsigned division
+void select_arithmetic(std::vector<Instruction>& code, Operand destination, BinaryOperator::Type operation, Operand left, Operand right, bool unsigned_division = false) {
+	long long folded;
+	if (left.is_immediate() && right.is_immediate() && fold_constants(left.value, right.value, operation, folded)) {
+		emit(code, Opcode::MOV, destination, immediate_operand(folded));
+		return;
+	}
+
+	switch (operation)
+	{
+	case BinaryOperator::Type::ADD:
+		select_add(code, destination, left, right);
+		break;
+	case BinaryOperator::Type::SUBTRACT:
+		select_subtract(code, destination, left, right);
+		break;
+	case BinaryOperator::Type::MULTIPLY:
+		select_multiply(code, destination, left, right);
+		break;
+	case BinaryOperator::Type::DIVIDE:
+	case BinaryOperator::Type::MODULO:
+		if (unsigned_division) select_unsigned_division(code, destination, operation, left, right);
+		else select_division(code, destination, operation, left, right);
+		break;
+	default:
+		break;
+	}
+}
+
+Opcode float_opcode(BinaryOperator::Type operation) {
+	switch (operation)
+	{
+	case BinaryOperator::Type::ADD: return Opcode::ADDSD;
+	case BinaryOperator::Type::SUBTRACT: return Opcode::SUBSD;
+	case BinaryOperator::Type::MULTIPLY: return Opcode::MULSD;
+	case BinaryOperator::Type::DIVIDE: return Opcode::DIVSD;
+	default: return Opcode::NOP;
+	}
+}
+
+// register to register copies take the whole register so they don't depend on what was in the destination
+void emit_float_move(std::vector<Instruction>& code, Operand destination, Operand source) {
+	if (destination.size >= 16) {
+		emit(code, Opcode::MOVUPS, destination, source); // a whole vector
+		return;
+	}
+	emit(code, destination.is_register() && source.is_register() ? Opcode::MOVAPS : Opcode::MOVSD, destination, source);
+}
+
+// floats and doubles, the destination is an xmm register and xmm0 is the scratch. the operand size picks the ss
+// or sd form
+void select_float_arithmetic(std::vector<Instruction>& code, Operand destination, BinaryOperator::Type operation, Operand left, Operand right) {
+	Opcode opcode = float_opcode(operation);
+	if (destination == right && destination != left) {
+		if (operation == BinaryOperator::Type::ADD || operation == BinaryOperator::Type::MULTIPLY) {
+			emit(code, opcode, destination, left);
+			return;
+		}
+		Operand scratch = register_operand(Register::XMM0, destination.size);
+		emit_float_move(code, scratch, left);
+		emit(code, opcode, scratch, right);
+		emit_float_move(code, destination, scratch);
+		return;
+	}
+	if (destination != left) emit_float_move(code, destination, left);
+	emit(code, opcode, destination, right);
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Utils.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// COMPILER STATISTICS
+// -stats times each phase of a build, counts the allocations it made and notes the process's peak resident
+// memory when it finished, then prints them with counts of what the phases produced. -stats-json writes the same
+// thing as json for tracking over time. phases that run once per declaration or pass add up under one name.
+// allocations are counted by replacing the global operator new, which works because Main.cpp is the only
+// translation unit. the aligned forms of new and delete aren't replaced, so over-aligned allocations aren't counted
+
+#ifdef _WIN32
+// declared here rather than including windows.h, its TRUE and FALSE macros clash with the token names
+struct ProcessMemoryCounters {
+	unsigned long cb;
+	unsigned long page_fault_count;
+	size_t peak_working_set_size;
+	size_t working_set_size;
+	size_t quota_peak_paged_pool_usage;
+	size_t quota_paged_pool_usage;
+	size_t quota_peak_non_paged_pool_usage;
+	size_t quota_non_paged_pool_usage;
+	size_t pagefile_usage;
+	size_t peak_pagefile_usage;
+};
+extern "C" __declspec(dllimport) void* __stdcall GetCurrentProcess();
+extern "C" __declspec(dllimport) int __stdcall K32GetProcessMemoryInfo(void* process, ProcessMemoryCounters* counters, unsigned long size);
+#endif
+
+std::atomic<long long> allocation_count(0);
+std::atomic<long long> allocated_bytes(0);
+
+// kept out of line, gcc otherwise inlines them into the standard containers and warns that memory from
+// operator new is handed to free
+#if defined(__GNUC__)
+#define OUT_OF_LINE __attribute__((noinline))
+#else
+#define OUT_OF_LINE __declspec(noinline)
+#endif
+
+OUT_OF_LINE void* operator new(size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocated_bytes.fetch_add((long long)size, std::memory_order_relaxed);
+	void* memory = std::malloc(size > 0 ? size : 1);
+	if (!memory) throw std::bad_alloc();
+	return memory;
+}
+
+OUT_OF_LINE void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+OUT_OF_LINE void operator delete(void* memory, size_t) noexcept {
+	std::free(memory);
+}
+
+long long peak_rss_kilobytes() {
+#ifdef _WIN32
+	ProcessMemoryCounters counters = {};
+	counters.cb = sizeof(counters);
+	if (!K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return -1;
+	return (long long)(counters.peak_working_set_size / 1024);
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+	return usage.ru_maxrss; // already kilobytes on linux
+#endif
+}
+
+struct PhaseStats {
+	std::string name;
+	int runs = 0;
+	long long nanoseconds = 0;
+	long long allocations = 0;
+	long long bytes = 0;
+	long long peak_rss = 0; // kilobytes, as it stood when the phase last finished
+};
+
+struct PhaseStart {
+	std::chrono::steady_clock::time_point time;
+	long long allocations;
+	long long bytes;
+};
+
+bool collect_stats = false;
+std::vector<PhaseStats> phase_stats; // in the order they first ran
+std::vector<std::pair<std::string, long long>> stat_counts;
+PhaseStart build_start;
+
+PhaseStart begin_phase() {
+	PhaseStart start;
+	start.time = std::chrono::steady_clock::now();
+	start.allocations = allocation_count.load(std::memory_order_relaxed);
+	start.bytes = allocated_bytes.load(std::memory_order_relaxed);
+	return start;
+}
+
+void end_phase(const std::string& name, const PhaseStart& start) {
+	if (!collect_stats) return;
+	PhaseStart end = begin_phase();
+	PhaseStats* phase = nullptr;
+	for (PhaseStats& existing : phase_stats) {
+		if (existing.name == name) phase = &existing;
+	}
+	if (!phase) {
+		phase_stats.push_back(PhaseStats());
+		phase = &phase_stats.back();
+		phase->name = name;
+	}
+	phase->runs++;
+	phase->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end.time - start.time).count();
+	phase->allocations += end.allocations - start.allocations;
+	phase->bytes += end.bytes - start.bytes;
+	phase->peak_rss = peak_rss_kilobytes();
+}
+
+void add_count(const std::string& name, long long amount) {
+	if (!collect_stats) return;
+	for (auto& count : stat_counts) {
+		if (count.first == name) {
+			count.second += amount;
+			return;
+		}
+	}
+	stat_counts.push_back({ name, amount });
+}
+
+void reset_stats() {
+	phase_stats.clear();
+	stat_counts.clear();
+	build_start = begin_phase();
+}
+
+void print_stats(std::ostream& out) {
+	PhaseStart end = begin_phase();
+	out << string_format("%-20s %6s %10s %12s %14s %12s", "phase", "runs", "ms", "allocations", "bytes", "peak rss kb") << std::endl;
+	for (PhaseStats& phase : phase_stats) {
+		out << string_format("%-20s %6d %10.3f %12lld %14lld %12lld", phase.name.c_str(), phase.runs, phase.nanoseconds / 1e6, phase.allocations, phase.bytes, phase.peak_rss) << std::endl;
+	}
+	long long total = std::chrono::duration_cast<std::chrono::nanoseconds>(end.time - build_start.time).count();
+	out << string_format("%-20s %6s %10.3f %12lld %14lld %12lld", "total", "", total / 1e6, end.allocations - build_start.allocations, end.bytes - build_start.bytes, peak_rss_kilobytes()) << std::endl;
+	for (auto& count : stat_counts) {
+		out << string_format("%-24s %lld", count.first.c_str(), count.second) << std::endl;
+	}
+}
+
+void write_stats_json(const std::string& path) {
+	PhaseStart end = begin_phase();
+	std::ofstream out(path);
+	out << "{\n  \"phases\": [\n";
+	for (int i = 0; i < phase_stats.size(); i++) {
+		PhaseStats& phase = phase_stats[i];
+		out << string_format("    { \"name\": \"%s\", \"runs\": %d, \"milliseconds\": %.3f, \"allocations\": %lld, \"allocated_bytes\": %lld, \"peak_rss_kb\": %lld }",
+			phase.name.c_str(), phase.runs, phase.nanoseconds / 1e6, phase.allocations, phase.bytes, phase.peak_rss);
+		out << (i + 1 < phase_stats.size() ? ",\n" : "\n");
+	}
+	long long total = std::chrono::duration_cast<std::chrono::nanoseconds>(end.time - build_start.time).count();
+	out << string_format("  ],\n  \"total\": { \"milliseconds\": %.3f, \"allocations\": %lld, \"allocated_bytes\": %lld, \"peak_rss_kb\": %lld },\n",
+		total / 1e6, end.allocations - build_start.allocations, end.bytes - build_start.bytes, peak_rss_kilobytes());
+	out << "  \"counts\": {";
+	for (int i = 0; i < stat_counts.size(); i++) {
+		out << string_format("%s\n    \"%s\": %lld", i > 0 ? "," : "", stat_counts[i].first.c_str(), stat_counts[i].second);
+	}
+	out << "\n  }\n}\n";
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "Instructions.h"
+
+// TARGETS
+// everything the code generator and register allocator need to know about the platform calling convention.
+// inputs past what the convention passes in registers keep going up the argument list, that only works
+// between our own procedures
+
+enum class Platform {
+	WINDOWS, // nasm + msvc link, Win64 calling convention
+	LINUX // built in assembler writing ELF64, System V calling convention
+};
+
+struct Target {
+	Platform platform;
+	std::vector<Register> argument_registers;
+	std::vector<Register> caller_saved_registers; // handed out by the register allocator when nothing is live across a call
+	std::vector<Register> callee_saved_registers;
+	std::vector<Register> float_argument_registers;
+	std::vector<Register> float_registers; // handed out for floats and doubles, none of them survive a call
+	Register vector_scratch; // a second scratch for vector code, only kept from the allocator where there are vectors
+	bool floats_by_position; // windows gives input n the nth register of either kind, system v counts each kind separately
+	int shadow_space; // bytes the caller reserves above the return address for the callee
+	int red_zone; // bytes below rsp a procedure that makes no calls can use without moving rsp
+	std::string newline; // appended to every string literal
+};
+
+Target windows_target() {
+	Target target;
+	target.platform = Platform::WINDOWS;
+	target.argument_registers = { Register::RCX, Register::RDX, Register::R8, Register::R9, Register::R10, Register::R11, Register::R12, Register::R13, Register::R14, Register::R15 };
+	target.caller_saved_registers = { Register::R10, Register::R11 };
+	target.callee_saved_registers = { Register::RSI, Register::RDI, Register::R12, Register::R13, Register::R14, Register::R15 };
+	// xmm6 and up are callee saved, they're left alone rather than saved and restored
+	target.float_argument_registers = { Register::XMM0, Register::XMM1, Register::XMM2, Register::XMM3, Register::XMM4, Register::XMM5 };
+	target.float_registers = { Register::XMM5, Register::XMM4, Register::XMM3, Register::XMM2, Register::XMM1 };
+	target.vector_scratch = Register::XMM5;
+	target.floats_by_position = true;
+	target.shadow_space = 32;
+	target.red_zone = 0;
+	target.newline = "\r\n";
+	return target;
+}
+
+Target linux_target() {
+	Target target;
+	target.platform = Platform::LINUX;
+	target.argument_registers = { Register::RDI, Register::RSI, Register::RDX, Register::RCX, Register::R8, Register::R9, Register::R10, Register::R11, Register::R12, Register::R13, Register::R14, Register::R15 };
+	target.caller_saved_registers = { Register::R10, Register::R11, Register::R9, Register::R8, Register::RSI, Register::RDI };
+	target.callee_saved_registers = { Register::R12, Register::R13, Register::R14, Register::R15 };
+	target.float_argument_registers = { Register::XMM0, Register::XMM1, Register::XMM2, Register::XMM3, Register::XMM4, Register::XMM5, Register::XMM6, Register::XMM7 };
+	target.float_registers = {
+		Register::XMM8, Register::XMM9, Register::XMM10, Register::XMM11, Register::XMM12, Register::XMM13, Register::XMM14, Register::XMM15,
+		Register::XMM7, Register::XMM6, Register::XMM5, Register::XMM4, Register::XMM3, Register::XMM2, Register::XMM1
+	};
+	target.vector_scratch = Register::XMM15;
+	target.floats_by_position = false;
+	target.shadow_space = 0;
+	target.red_zone = 128;
+	target.newline = "\n";
+	return target;
+}
+
+#ifdef _WIN32
+Target target = windows_target();
+#else
+Target target = linux_target();
+#endif
+
+// the register each input is passed in, given which inputs are floats or doubles
+std::vector<Register> argument_locations(const std::vector<bool>& floating) {
+	std::vector<Register> locations;
+	int integers = 0;
+	int floats = 0;
+	for (int i = 0; i < floating.size(); i++) {
+		int integer_index = target.floats_by_position ? i : integers;
+		int float_index = target.floats_by_position ? i : floats;
+		if (floating[i]) {
+			if (float_index >= target.float_argument_registers.size()) throw std::runtime_error("too many float inputs to pass in registers");
+			locations.push_back(target.float_argument_registers[float_index]);
+			floats++;
+		}
+		else {
+			if (integer_index >= target.argument_registers.size()) throw std::runtime_error("too many inputs to pass in registers");
+			locations.push_back(target.argument_registers[integer_index]);
+			integers++;
+		}
+	}
+	return locations;
+}
+
+// how code is laid out for a particular processor, picked with -cpu
+struct CpuTuning {
+	std::string name;
+	int procedure_alignment;
+	int loop_alignment; // loop bodies are the target of the back edge, so they're worth starting on a fetch boundary
+	int loop_max_padding; // beyond this many nops the alignment costs more than it saves
+	int vector_bytes; // how wide loops are vectorized, 16 is sse4.1, 32 is avx2 and 0 leaves them alone
+};
+
+const CpuTuning cpu_tunings[] = {
+	{ "generic", 16, 16, 10, 16 },
+	{ "skylake", 16, 32, 15, 32 }, // the decoded icache works in 32 byte windows
+	{ "zen", 16, 32, 15, 32 },
+	{ "atom", 16, 16, 7, 16 },
+	{ "size", 1, 1, 0, 0 } // no padding at all, and no vector loop next to the scalar one
+};
+
+CpuTuning cpu = cpu_tunings[0];
+
+bool select_cpu(const std::string& name) {
+	for (const CpuTuning& tuning : cpu_tunings) {
+		if (tuning.name == name) {
+			cpu = tuning;
+			return true;
+		}
+	}
+	return false;
+}
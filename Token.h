@@ -10,6 +10,7 @@ enum class TokenType {
 	PLUS,
 	MINUS,
 	FORWARD_SLASH,
+	PERCENT,
 	STAR,
 	LESS_THAN,
 	GREATER_THAN,
@@ -30,6 +31,8 @@ enum class TokenType {
 	TAB,
 	OPEN_PARENTHESIS,
 	CLOSE_PARENTHESIS,
+	OPEN_BRACKET,
+	CLOSE_BRACKET,
 	FORWARD_ARROW,
 	BACK_ARROW,
 	WHILE,
@@ -73,6 +76,10 @@ std::string get_token_name(TokenType type) {
 		return "OPEN PARENTHESIS";
 	case TokenType::CLOSE_PARENTHESIS:
 		return "CLOSE PARENTHESIS";
+	case TokenType::OPEN_BRACKET:
+		return "OPEN BRACKET";
+	case TokenType::CLOSE_BRACKET:
+		return "CLOSE BRACKET";
 	case TokenType::FORWARD_ARROW:
 		return "FORWARD ARROW";
 	case TokenType::BACK_ARROW:
@@ -99,6 +106,7 @@ std::vector<std::pair<const std::string, TokenType>> token_map{
 	std::make_pair("+", TokenType::PLUS),
 	std::make_pair("-", TokenType::MINUS),
 	std::make_pair("/", TokenType::FORWARD_SLASH),
+	std::make_pair("%", TokenType::PERCENT),
 	std::make_pair("<", TokenType::LESS_THAN),
 	std::make_pair(">", TokenType::GREATER_THAN),
 	std::make_pair(">=", TokenType::GREATER_THAN_EQUAL),
@@ -115,6 +123,8 @@ std::vector<std::pair<const std::string, TokenType>> token_map{
 	std::make_pair("\t", TokenType::TAB),
 	std::make_pair("(", TokenType::OPEN_PARENTHESIS),
 	std::make_pair(")", TokenType::CLOSE_PARENTHESIS),
+	std::make_pair("[", TokenType::OPEN_BRACKET),
+	std::make_pair("]", TokenType::CLOSE_BRACKET),
 	std::make_pair(";", TokenType::SEMI_COLON)
 };
 
@@ -0,0 +1,937 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "Parsing.h"
+#include "Utils.h"
+
+// TYPES
+// every variable has the type it was declared with, compiler generated temporaries take the type of the value
+// first assigned to them. operands of an operator must agree. the implicit conversions are an integer literal
+// used where a float or double is expected, integer literals and arithmetic on them taking whichever integer
+// type is expected if the value fits, and a bool widening to any integer. int(x), i8(x) ... u64(x), float(x)
+// and double(x) convert explicitly, integers wrap to the narrower type like c. arrays, a: [16]i32, are a fixed
+// number of any one of those. they can be indexed and passed whole to procedures taking the same array type,
+// which get them by reference, but are never operands or assigned as a whole. ones declared outside any
+// procedure are static and shared by all of them. vectors, v4i32, v8i32, v4f32 and v8f32, are four or eight
+// i32 or float lanes worked on at once. + - * and, for floats, / go lane by lane, and comparisons give a mask
+// of the integer vector as wide, every bit of a lane set where it holds. they're made and taken apart with
+// the builtins below and can't be passed to c functions. a struct, Point :: struct { x: int; y: float; }, names
+// a record of those numbers. a variable of it, p: Point, is an array of one whose fields are p.x and p.y, and
+// an array of them, ps: [16]Point, has ps[i].x. an array of structs is laid out like c's unless the struct is
+// declared struct soa, which keeps each field of every element together instead
+
+enum class ValueType {
+	INT, // i64
+	I8,
+	I16,
+	I32,
+	U8,
+	U16,
+	U32,
+	U64,
+	BOOL,
+	FLOAT,
+	DOUBLE,
+	V4I32,
+	V8I32,
+	V4F32,
+	V8F32,
+	STRING,
+	ARRAY, // what the array is of and how long it is are in ArrayType
+	NONE
+};
+
+const char* value_type_names[] = { "int", "i8", "i16", "i32", "u8", "u16", "u32", "u64", "bool", "float", "double",
+	"v4i32", "v8i32", "v4f32", "v8f32", "string", "array", "none" };
+
+ValueType type_from_name(const std::string& name) {
+	if (name == "i64") return ValueType::INT;
+	for (int i = 0; i < (int)ValueType::ARRAY; i++) {
+		if (name == value_type_names[i]) return (ValueType)i;
+	}
+	return ValueType::NONE;
+}
+
+struct StructField {
+	std::string name;
+	ValueType type;
+	int offset; // from the start of an element, as c would put it
+};
+
+struct StructType {
+	std::vector<StructField> fields;
+	int size = 0; // of one element, padded so the next one is aligned too
+	int alignment = 1;
+	bool soa = false;
+};
+
+std::map<std::string, StructType> struct_types;
+
+struct ArrayType {
+	enum class Storage {
+		STACK, // in the frame of the procedure declaring it
+		STATIC, // declared outside any procedure, in the data segment as array_<name>
+		INPUT // a pointer to the caller's
+	};
+
+	ValueType element = ValueType::NONE;
+	std::string structure; // the struct each element is, element is NONE then
+	int length = 0;
+	Storage storage = Storage::STACK;
+
+	bool operator == (const ArrayType& other) const {
+		return element == other.element && structure == other.structure && length == other.length;
+	}
+};
+
+// a struct on its own is an array of one
+bool is_array_type_name(const std::string& name) {
+	return (name.length() > 0 && name[0] == '[') || struct_types.count(name) > 0;
+}
+
+// [16]i32, [16]Point or Point, false when the length or element type isn't one
+bool parse_array_type(const std::string& name, ArrayType& array) {
+	if (struct_types.count(name) > 0) {
+		array.structure = name;
+		array.length = 1;
+		return true;
+	}
+	size_t close = name.find(']');
+	if (!is_array_type_name(name) || close == std::string::npos || close == 1 || close > 10) return false;
+	long long length = std::stoll(name.substr(1, close - 1));
+	std::string element = name.substr(close + 1);
+	if (struct_types.count(element) > 0) array.structure = element;
+	else array.element = type_from_name(element);
+	array.length = (int)length;
+	if (array.structure.length() > 0) return length > 0 && length <= 0x10000000;
+	return length > 0 && length <= 0x10000000 && array.element != ValueType::NONE && array.element < ValueType::V4I32;
+}
+
+std::string array_type_name(const ArrayType& array) {
+	return string_format("[%d]%s", array.length, array.structure.length() > 0 ? array.structure.c_str() : value_type_names[(int)array.element]);
+}
+
+const StructField* find_field(const ArrayType& array, const std::string& name) {
+	if (array.structure.length() == 0) return nullptr;
+	for (const StructField& field : struct_types[array.structure].fields) {
+		if (field.name == name) return &field;
+	}
+	return nullptr;
+}
+
+// what an element, or the field of one, holds
+ValueType element_type(const ArrayType& array, const std::string& field) {
+	if (field.length() == 0) return array.element;
+	const StructField* found = find_field(array, field);
+	return found ? found->type : ValueType::NONE;
+}
+
+bool is_floating(ValueType type) {
+	return type == ValueType::FLOAT || type == ValueType::DOUBLE;
+}
+
+bool is_integer(ValueType type) {
+	return type >= ValueType::INT && type <= ValueType::BOOL;
+}
+
+bool is_unsigned(ValueType type) {
+	return type >= ValueType::U8 && type <= ValueType::BOOL;
+}
+
+bool is_vector(ValueType type) {
+	return type >= ValueType::V4I32 && type <= ValueType::V8F32;
+}
+
+// floats, doubles and vectors are kept in xmm registers
+bool is_xmm_type(ValueType type) {
+	return is_floating(type) || is_vector(type);
+}
+
+ValueType lane_type(ValueType vector) {
+	return vector == ValueType::V4F32 || vector == ValueType::V8F32 ? ValueType::FLOAT : ValueType::I32;
+}
+
+int lane_count(ValueType vector) {
+	return vector == ValueType::V8I32 || vector == ValueType::V8F32 ? 8 : 4;
+}
+
+// what comparing two of the vector gives
+ValueType mask_type(ValueType vector) {
+	return lane_count(vector) == 8 ? ValueType::V8I32 : ValueType::V4I32;
+}
+
+// bytes a value takes in memory, which is what its stack slot is
+int value_size(ValueType type) {
+	switch (type)
+	{
+	case ValueType::I8:
+	case ValueType::U8:
+	case ValueType::BOOL:
+		return 1;
+	case ValueType::I16:
+	case ValueType::U16:
+		return 2;
+	case ValueType::I32:
+	case ValueType::U32:
+	case ValueType::FLOAT:
+		return 4;
+	case ValueType::V4I32:
+	case ValueType::V4F32:
+		return 16;
+	case ValueType::V8I32:
+	case ValueType::V8F32:
+		return 32;
+	default:
+		return 8;
+	}
+}
+
+// integers are kept sign or zero extended to the whole register, so arithmetic and compares on them don't care
+// how narrow they are
+int register_size(ValueType type) {
+	return is_xmm_type(type) ? value_size(type) : 8;
+}
+
+// the value as the type holds it, what a store and reload does to it
+long long wrap_integer(long long value, ValueType type) {
+	switch (type)
+	{
+	case ValueType::I8: return (int8_t)value;
+	case ValueType::I16: return (int16_t)value;
+	case ValueType::I32: return (int32_t)value;
+	case ValueType::U8: return (uint8_t)value;
+	case ValueType::U16: return (uint16_t)value;
+	case ValueType::U32: return (uint32_t)value;
+	case ValueType::BOOL: return value != 0;
+	default: return value;
+	}
+}
+
+bool fits_integer(long long value, ValueType type) {
+	if (type == ValueType::U64) return value >= 0;
+	if (type == ValueType::BOOL) return value == 0 || value == 1;
+	return wrap_integer(value, type) == value;
+}
+
+// STRUCT LAYOUT
+// each field goes at the next multiple of its own size and the struct is padded out to a multiple of its widest
+// field, which is what c does, so an element of an array of them is always aligned. a struct of arrays is the
+// fields one after the other, each a run of every element's, so a loop over one field reads memory in order.
+// every run starts on 16 bytes like a whole array does
+
+void lay_out_struct(StructType& structure) {
+	int offset = 0;
+	for (StructField& field : structure.fields) {
+		int size = value_size(field.type);
+		offset = (offset + size - 1) / size * size;
+		field.offset = offset;
+		offset += size;
+		if (size > structure.alignment) structure.alignment = size;
+	}
+	structure.size = (offset + structure.alignment - 1) / structure.alignment * structure.alignment;
+}
+
+int field_run_bytes(const ArrayType& array, const StructField& field) {
+	return (array.length * value_size(field.type) + 15) / 16 * 16;
+}
+
+// arrays are a whole number of 16 byte blocks, so they can be cleared and worked on sixteen bytes at a time
+int array_bytes(const ArrayType& array) {
+	if (array.structure.length() == 0) return (array.length * value_size(array.element) + 15) / 16 * 16;
+	StructType& structure = struct_types[array.structure];
+	if (!structure.soa) return (array.length * structure.size + 15) / 16 * 16;
+	int bytes = 0;
+	for (const StructField& field : structure.fields) bytes += field_run_bytes(array, field);
+	return bytes;
+}
+
+// where the field of the first element is from the start of the array, and how far on the next element's is
+struct FieldPlacement {
+	int start = 0;
+	int stride = 0;
+};
+
+FieldPlacement place_field(const ArrayType& array, const std::string& name) {
+	FieldPlacement placement;
+	const StructField* field = find_field(array, name);
+	if (!field) {
+		placement.stride = value_size(array.element);
+		return placement;
+	}
+	StructType& structure = struct_types[array.structure];
+	if (!structure.soa) {
+		placement.start = field->offset;
+		placement.stride = structure.size;
+		return placement;
+	}
+	for (const StructField& before : structure.fields) {
+		if (&before == field) break;
+		placement.start += field_run_bytes(array, before);
+	}
+	placement.stride = value_size(field->type);
+	return placement;
+}
+
+struct ProcedureTypes {
+	std::vector<ValueType> inputs;
+	std::vector<ArrayType> input_arrays; // the array type of each input that is one
+	ValueType result = ValueType::INT;
+	std::map<std::string, ValueType> variables; // arrays are in here as ARRAY too
+	std::map<std::string, ArrayType> arrays;
+};
+
+std::map<std::string, ProcedureTypes> procedure_types;
+std::map<std::string, ArrayType> static_arrays;
+
+// a procedure's own variables hide static arrays of the same name
+ArrayType* find_array(ProcedureTypes& types, const std::string& name) {
+	auto local = types.arrays.find(name);
+	if (local != types.arrays.end()) return &local->second;
+	if (types.variables.count(name) > 0) return nullptr;
+	auto global = static_arrays.find(name);
+	return global == static_arrays.end() ? nullptr : &global->second;
+}
+
+bool is_conversion(const std::string& name) {
+	ValueType type = type_from_name(name);
+	return type != ValueType::NONE && type != ValueType::BOOL && type != ValueType::STRING && !is_vector(type);
+}
+
+bool is_conversion(SyntaxNode* expression) {
+	return expression->type == SyntaxNode::Type::PROCEDURE_CALL && is_conversion(((ProcedureCall*)expression)->name);
+}
+
+// v4i32(x) puts x in every lane, v4i32(a, b, c, d) gives each lane its own and v4i32(xs, i) loads xs[i] to
+// xs[i + 3]. lane(v, k) is lane k, shuffle(v, a, b, c, d) picks lanes by literal index like pshufd, within each
+// half of an 8 lane vector. hadd(v) adds the lanes up, min and max go lane by lane and store(xs, i, v) writes
+// v to xs[i] on. loads and stores are always checked. a procedure the program declares with one of these
+// names is called instead
+const char* vector_builtin_names[] = { "lane", "shuffle", "hadd", "min", "max", "store" };
+
+bool is_vector_builtin(const std::string& name) {
+	if (procedure_types.count(name) > 0) return false;
+	if (is_vector(type_from_name(name))) return true;
+	for (const char* builtin : vector_builtin_names) {
+		if (name == builtin) return true;
+	}
+	return false;
+}
+
+bool is_vector_builtin(SyntaxNode* expression) {
+	return expression->type == SyntaxNode::Type::PROCEDURE_CALL && is_vector_builtin(((ProcedureCall*)expression)->name);
+}
+
+// arena(bytes) makes a bump arena whose chunks are at least bytes long, arena_alloc(a, n) takes n bytes from it,
+// arena_mark(a) remembers where it's up to and arena_reset(a, mark) gives back everything taken since. pool(size)
+// makes a pool of blocks that size, pool_alloc(p) and pool_free(p, x) take and return one. cached_alloc(n) and
+// cached_free(x, n) share a pool for each 16 byte size class up to 512 and go to the system above that. handles
+// and blocks are addresses, peek(x) reads the 8 bytes at x and poke(x, v) writes them. every input is an int
+struct MemoryBuiltin {
+	const char* name;
+	int inputs;
+};
+
+const int cached_size_limit = 512; // bigger ones go straight to the system
+
+const MemoryBuiltin memory_builtins[] = {
+	{ "arena", 1 }, { "arena_alloc", 2 }, { "arena_mark", 1 }, { "arena_reset", 2 },
+	{ "pool", 1 }, { "pool_alloc", 1 }, { "pool_free", 2 },
+	{ "cached_alloc", 1 }, { "cached_free", 2 },
+	{ "peek", 1 }, { "poke", 2 }
+};
+
+const MemoryBuiltin* find_memory_builtin(const std::string& name) {
+	if (procedure_types.count(name) > 0) return nullptr;
+	for (const MemoryBuiltin& builtin : memory_builtins) {
+		if (name == builtin.name) return &builtin;
+	}
+	return nullptr;
+}
+
+bool is_memory_builtin(const std::string& name) {
+	return find_memory_builtin(name) != nullptr;
+}
+
+// peek and poke are a load and a store, the rest are calls into the runtime
+bool is_memory_access(SyntaxNode* expression) {
+	if (expression->type != SyntaxNode::Type::PROCEDURE_CALL) return false;
+	const std::string& name = ((ProcedureCall*)expression)->name;
+	return (name == "peek" || name == "poke") && is_memory_builtin(name);
+}
+
+// printf fills a buffer that's written out when it's full, when the program ends and when it calls flush()
+const int output_buffer_size = 1 << 16;
+
+bool is_flush_builtin(const std::string& name) {
+	return name == "flush" && procedure_types.count(name) == 0;
+}
+
+// calls that are worked out in line rather than made
+bool is_intrinsic(SyntaxNode* expression) {
+	return is_conversion(expression) || is_vector_builtin(expression) || is_memory_access(expression);
+}
+
+bool is_comparison(BinaryOperator::Type operation) {
+	return operation == BinaryOperator::Type::LESS_THAN || operation == BinaryOperator::Type::GREATER_THAN || operation == BinaryOperator::Type::EQUAL ||
+		operation == BinaryOperator::Type::LESS_THAN_EQUAL || operation == BinaryOperator::Type::GREATER_THAN_EQUAL;
+}
+
+// the declared result type, procedures without one return int
+ValueType procedure_result(Procedure* procedure) {
+	if (procedure->outputs.size() == 0) return ValueType::INT;
+	return type_from_name(((VariableDecleration*)procedure->outputs[0])->type_name);
+}
+
+// checked operands agree except for integer literals, which are int whatever they stand in for
+ValueType combined_type(ValueType left, ValueType right) {
+	return left == ValueType::INT ? right : left;
+}
+
+ValueType vector_call_type(ProcedureCall* procedure_call, std::map<std::string, ValueType>& variables);
+
+ValueType expression_type(SyntaxNode* expression, std::map<std::string, ValueType>& variables) {
+	switch (expression->type)
+	{
+	case SyntaxNode::Type::INTEGER_LITERAL:
+		return ValueType::INT;
+	case SyntaxNode::Type::BOOLEAN_LITERAL:
+		return ValueType::BOOL;
+	case SyntaxNode::Type::FLOAT_LITERAL:
+		return ((FloatLiteral*)expression)->size == 4 ? ValueType::FLOAT : ValueType::DOUBLE;
+	case SyntaxNode::Type::STRING_LITERAL:
+		return ValueType::STRING;
+	case SyntaxNode::Type::VARIABLE_CALL:
+	{
+		auto variable = variables.find(((VariableCall*)expression)->name);
+		if (variable == variables.end()) return static_arrays.count(((VariableCall*)expression)->name) > 0 ? ValueType::ARRAY : ValueType::NONE;
+		return variable->second;
+	}
+	case SyntaxNode::Type::PROCEDURE_CALL:
+	{
+		ProcedureCall* procedure_call = (ProcedureCall*)expression;
+		if (is_conversion(procedure_call->name)) return type_from_name(procedure_call->name);
+		if (is_vector_builtin(procedure_call->name)) return vector_call_type(procedure_call, variables);
+		auto procedure = procedure_types.find(procedure_call->name);
+		return procedure == procedure_types.end() ? ValueType::INT : procedure->second.result;
+	}
+	case SyntaxNode::Type::BINARY_OPERATOR:
+	{
+		BinaryOperator* binary_operator = (BinaryOperator*)expression;
+		ValueType type = combined_type(expression_type(binary_operator->left, variables), expression_type(binary_operator->right, variables));
+		if (is_comparison(binary_operator->operation)) return is_vector(type) ? mask_type(type) : ValueType::BOOL;
+		return type;
+	}
+	default:
+		return ValueType::NONE;
+	}
+}
+
+ValueType vector_call_type(ProcedureCall* procedure_call, std::map<std::string, ValueType>& variables) {
+	ValueType type = type_from_name(procedure_call->name);
+	if (is_vector(type)) return type;
+	if (procedure_call->name == "store" || procedure_call->inputs.size() == 0) return ValueType::NONE;
+	ValueType vector = expression_type(procedure_call->inputs[0], variables);
+	if (procedure_call->name == "lane" || procedure_call->name == "hadd") return is_vector(vector) ? lane_type(vector) : ValueType::NONE;
+	return vector;
+}
+
+struct TypeChecker {
+	std::string procedure_name;
+	ProcedureTypes* types;
+	std::map<std::string, ValueType>* variables;
+	std::map<std::string, VariableDecleration*> untyped; // generated temporaries waiting for their first assignment
+	std::map<std::string, VariableDecleration*> constants; // temporaries holding integer literal arithmetic, typed where they're read
+	std::vector<std::string> errors;
+
+	void error(const std::string& message) {
+		errors.push_back("type error in " + procedure_name + ": " + message);
+	}
+
+	// an integer literal where a float or double is expected becomes a float literal, so does one in arithmetic
+	// that is expected to give a float or double
+	SyntaxNode* coerce(SyntaxNode* expression, ValueType expected) {
+		if (!is_floating(expected)) return expression;
+		if (expression->type == SyntaxNode::Type::BINARY_OPERATOR && !is_comparison(((BinaryOperator*)expression)->operation)) {
+			BinaryOperator* binary_operator = (BinaryOperator*)expression;
+			binary_operator->left = coerce(binary_operator->left, expected);
+			binary_operator->right = coerce(binary_operator->right, expected);
+			return expression;
+		}
+		if (expression->type == SyntaxNode::Type::INTEGER_LITERAL) {
+			FloatLiteral* float_literal = new FloatLiteral();
+			float_literal->value = (double)((IntLiteral*)expression)->value;
+			expression = float_literal;
+		}
+		if (expression->type == SyntaxNode::Type::FLOAT_LITERAL) {
+			((FloatLiteral*)expression)->size = value_size(expected);
+		}
+		return expression;
+	}
+
+	bool is_integer_constant(SyntaxNode* expression) {
+		if (expression->type == SyntaxNode::Type::INTEGER_LITERAL) return true;
+		if (expression->type == SyntaxNode::Type::VARIABLE_CALL) return constants.count(((VariableCall*)expression)->name) > 0;
+		if (expression->type != SyntaxNode::Type::BINARY_OPERATOR) return false;
+		BinaryOperator* binary_operator = (BinaryOperator*)expression;
+		return !is_comparison(binary_operator->operation) && is_integer_constant(binary_operator->left) && is_integer_constant(binary_operator->right);
+	}
+
+	// an integer constant takes the integer type it's used as, a literal has to fit. arithmetic on literals wraps
+	// like it would on variables of the type
+	bool adopt(SyntaxNode* expression, ValueType expected) {
+		if (!is_integer(expected) || !is_integer_constant(expression)) return false;
+		if (expression->type == SyntaxNode::Type::INTEGER_LITERAL) {
+			long long value = ((IntLiteral*)expression)->value;
+			if (!fits_integer(value, expected)) error(string_format("%lld doesn't fit in %s", value, value_type_names[(int)expected]));
+			return true;
+		}
+		if (expression->type == SyntaxNode::Type::VARIABLE_CALL) {
+			auto constant = constants.find(((VariableCall*)expression)->name);
+			constant->second->type_name = value_type_names[(int)expected];
+			(*variables)[constant->first] = expected;
+			constants.erase(constant);
+		}
+		return true;
+	}
+
+	// whether a value of the found type can be used where the expected one is
+	bool accepts(ValueType expected, SyntaxNode* value, ValueType found) {
+		if (found == expected) return true;
+		if (found == ValueType::BOOL && is_integer(expected)) return true;
+		return adopt(value, expected);
+	}
+
+	ValueType check(SyntaxNode* expression) {
+		if (expression->type == SyntaxNode::Type::BINARY_OPERATOR) {
+			BinaryOperator* binary_operator = (BinaryOperator*)expression;
+			ValueType left = check(binary_operator->left);
+			ValueType right = check(binary_operator->right);
+			// a literal takes the type of the other side
+			if (binary_operator->left->type == SyntaxNode::Type::INTEGER_LITERAL || binary_operator->left->type == SyntaxNode::Type::FLOAT_LITERAL) {
+				binary_operator->left = coerce(binary_operator->left, right);
+				left = expression_type(binary_operator->left, *variables);
+			}
+			if (binary_operator->right->type == SyntaxNode::Type::INTEGER_LITERAL || binary_operator->right->type == SyntaxNode::Type::FLOAT_LITERAL) {
+				binary_operator->right = coerce(binary_operator->right, left);
+				right = expression_type(binary_operator->right, *variables);
+			}
+			if (left != right && is_integer(left) && is_integer(right)) {
+				if (adopt(binary_operator->left, right)) left = right;
+				else if (adopt(binary_operator->right, left)) right = left;
+			}
+			if (left == ValueType::NONE || right == ValueType::NONE) {
+				// something the parser already complained about
+			}
+			else if (left != right) {
+				error(string_format("%s and %s operands", value_type_names[(int)left], value_type_names[(int)right]));
+			}
+			else if ((is_floating(left) || is_vector(left)) && binary_operator->operation == BinaryOperator::Type::MODULO) {
+				error("% needs integer operands");
+			}
+			else if (is_vector(left) && binary_operator->operation == BinaryOperator::Type::DIVIDE && !is_floating(lane_type(left))) {
+				error("integer vectors can't be divided");
+			}
+			else if (is_vector(left) && (binary_operator->operation == BinaryOperator::Type::LESS_THAN_EQUAL || binary_operator->operation == BinaryOperator::Type::GREATER_THAN_EQUAL)) {
+				error("vectors only compare with <, > and ==");
+			}
+			else if (left == ValueType::STRING) {
+				error("strings can't be operands");
+			}
+			else if (left == ValueType::ARRAY) {
+				error("arrays can't be operands");
+			}
+			else if (left == ValueType::BOOL && !is_comparison(binary_operator->operation)) {
+				error("bools can only be compared");
+			}
+			if (is_comparison(binary_operator->operation)) return is_vector(left) ? mask_type(left) : ValueType::BOOL;
+			return left;
+		}
+		if (expression->type == SyntaxNode::Type::PROCEDURE_CALL) {
+			check_call((ProcedureCall*)expression);
+		}
+		if (expression->type == SyntaxNode::Type::ARRAY_INDEX) {
+			ArrayIndex* array_index = (ArrayIndex*)expression;
+			ArrayType* array = check_element(array_index->name, array_index->field, array_index->index);
+			return array ? element_type(*array, array_index->field) : ValueType::NONE;
+		}
+		if (expression->type == SyntaxNode::Type::VARIABLE_CALL && expression_type(expression, *variables) == ValueType::NONE) {
+			error("unknown variable " + ((VariableCall*)expression)->name);
+		}
+		return expression_type(expression, *variables);
+	}
+
+	// the array being indexed, or nullptr. an index that is a literal has to be in range, and an element of an
+	// array of structs is only ever one of its fields
+	ArrayType* check_element(const std::string& name, const std::string& field, SyntaxNode* index) {
+		ArrayType* array = find_array(*types, name);
+		if (!array) {
+			error(name + " isn't an array");
+			return nullptr;
+		}
+		if (field.length() > 0 && array->structure.length() == 0) {
+			error(name + " has no fields");
+			return nullptr;
+		}
+		if (field.length() > 0 && !find_field(*array, field)) {
+			error(array->structure + " has no field " + field);
+			return nullptr;
+		}
+		if (field.length() == 0 && array->structure.length() > 0) {
+			error(string_format("the elements of %s are %s, only their fields can be used", name.c_str(), array->structure.c_str()));
+			return nullptr;
+		}
+		ValueType index_type = check(index);
+		if (index_type != ValueType::NONE && (!is_integer(index_type) || index_type == ValueType::BOOL)) {
+			error(string_format("%s index into %s", value_type_names[(int)index_type], name.c_str()));
+		}
+		if (index->type == SyntaxNode::Type::INTEGER_LITERAL) {
+			long long value = ((IntLiteral*)index)->value;
+			if (value < 0 || value >= array->length) error(string_format("index %lld is outside %s, which has %d elements", value, name.c_str(), array->length));
+		}
+		return array;
+	}
+
+	void check_call(ProcedureCall* procedure_call) {
+		std::vector<SyntaxNode*>& inputs = procedure_call->inputs;
+		if (is_conversion(procedure_call->name)) {
+			if (inputs.size() != 1) {
+				error(procedure_call->name + "() takes one input");
+				return;
+			}
+			if (inputs[0]->type == SyntaxNode::Type::FLOAT_LITERAL) {
+				inputs[0] = coerce(inputs[0], ValueType::DOUBLE); // the literal's own precision doesn't matter
+			}
+			if (check(inputs[0]) == ValueType::STRING) error("can't convert a string");
+			return;
+		}
+
+		if (is_vector_builtin(procedure_call->name)) {
+			check_vector_call(procedure_call);
+			return;
+		}
+
+		if (is_flush_builtin(procedure_call->name)) {
+			if (inputs.size() > 0) error("flush() takes no inputs");
+			return;
+		}
+
+		if (const MemoryBuiltin* builtin = find_memory_builtin(procedure_call->name)) {
+			if (inputs.size() != builtin->inputs) {
+				error(string_format("%s() takes %d input%s", builtin->name, builtin->inputs, builtin->inputs == 1 ? "" : "s"));
+			}
+			for (int i = 0; i < inputs.size(); i++) {
+				ValueType found = check(inputs[i]);
+				if (!accepts(ValueType::INT, inputs[i], found)) {
+					error(string_format("input %d of %s() is %s, not int", i + 1, builtin->name, value_type_names[(int)found]));
+				}
+			}
+			return;
+		}
+
+		auto procedure = procedure_types.find(procedure_call->name);
+		for (int i = 0; i < inputs.size(); i++) {
+			if (procedure == procedure_types.end()) {
+				// c functions, float literals are passed as doubles like c's variadic promotion
+				if (inputs[i]->type == SyntaxNode::Type::FLOAT_LITERAL) inputs[i] = coerce(inputs[i], ValueType::DOUBLE);
+				if (is_vector(check(inputs[i]))) error("vectors can't be passed to " + procedure_call->name + "()");
+				continue;
+			}
+			if (i >= procedure->second.inputs.size()) {
+				error(procedure_call->name + "() called with too many inputs");
+				break;
+			}
+			ValueType expected = procedure->second.inputs[i];
+			inputs[i] = coerce(inputs[i], expected);
+			ValueType found = check(inputs[i]);
+			if (!accepts(expected, inputs[i], found)) {
+				error(string_format("input %d of %s() is %s, not %s", i + 1, procedure_call->name.c_str(), value_type_names[(int)found], value_type_names[(int)expected]));
+			}
+			else if (expected == ValueType::ARRAY) {
+				ArrayType* array = find_array(*types, ((VariableCall*)inputs[i])->name);
+				ArrayType& expected_array = procedure->second.input_arrays[i];
+				if (!(*array == expected_array)) {
+					error(string_format("input %d of %s() is %s, not %s", i + 1, procedure_call->name.c_str(), array_type_name(*array).c_str(), array_type_name(expected_array).c_str()));
+				}
+			}
+		}
+	}
+
+	// an integer literal in a range, for lane numbers
+	bool check_lane_literal(SyntaxNode* input, int lanes, const std::string& name) {
+		if (input->type != SyntaxNode::Type::INTEGER_LITERAL) {
+			error(name + "() needs literal lane numbers");
+			return false;
+		}
+		long long value = ((IntLiteral*)input)->value;
+		if (value < 0 || value >= lanes) error(string_format("lane %lld of %s() is outside 0 to %d", value, name.c_str(), lanes - 1));
+		return true;
+	}
+
+	// a load or store of a whole vector from an array of its lanes, a literal index has to leave room for all of them
+	void check_vector_element(const std::string& name, SyntaxNode* array_input, SyntaxNode* index, ValueType vector) {
+		if (array_input->type != SyntaxNode::Type::VARIABLE_CALL) {
+			error(name + "() needs an array");
+			return;
+		}
+		const std::string& array_name = ((VariableCall*)array_input)->name;
+		ArrayType* array = check_element(array_name, "", index);
+		if (!array || !is_vector(vector)) return;
+		if (array->element != lane_type(vector)) {
+			error(string_format("%s() of a %s needs %s elements, %s has %s", name.c_str(), value_type_names[(int)vector], value_type_names[(int)lane_type(vector)],
+				array_name.c_str(), value_type_names[(int)array->element]));
+		}
+		else if (array->length < lane_count(vector)) {
+			error(string_format("%s is too short for a %s", array_name.c_str(), value_type_names[(int)vector]));
+		}
+		else if (index->type == SyntaxNode::Type::INTEGER_LITERAL && ((IntLiteral*)index)->value + lane_count(vector) > array->length) {
+			error(string_format("index %lld leaves no room for a %s in %s", ((IntLiteral*)index)->value, value_type_names[(int)vector], array_name.c_str()));
+		}
+	}
+
+	ValueType check_vector_input(ProcedureCall* procedure_call, int i) {
+		ValueType type = check(procedure_call->inputs[i]);
+		if (!is_vector(type) && type != ValueType::NONE) {
+			error(string_format("input %d of %s() is %s, not a vector", i + 1, procedure_call->name.c_str(), value_type_names[(int)type]));
+			return ValueType::NONE;
+		}
+		return type;
+	}
+
+	void check_vector_call(ProcedureCall* procedure_call) {
+		std::vector<SyntaxNode*>& inputs = procedure_call->inputs;
+		const std::string& name = procedure_call->name;
+		ValueType constructed = type_from_name(name);
+		size_t expected_inputs = name == "shuffle" ? 5 : name == "store" ? 3 : name == "hadd" ? 1 : 2;
+		if (is_vector(constructed)) {
+			if (inputs.size() == 2 && inputs[0]->type == SyntaxNode::Type::VARIABLE_CALL && expression_type(inputs[0], *variables) == ValueType::ARRAY) {
+				check_vector_element(name, inputs[0], inputs[1], constructed);
+				return;
+			}
+			if (inputs.size() != 1 && inputs.size() != lane_count(constructed)) {
+				error(string_format("%s() takes one input, %d or an array and an index", name.c_str(), lane_count(constructed)));
+				return;
+			}
+			ValueType lane = lane_type(constructed);
+			for (int i = 0; i < inputs.size(); i++) {
+				inputs[i] = coerce(inputs[i], lane);
+				ValueType found = check(inputs[i]);
+				if (!accepts(lane, inputs[i], found)) {
+					error(string_format("input %d of %s() is %s, not %s", i + 1, name.c_str(), value_type_names[(int)found], value_type_names[(int)lane]));
+				}
+			}
+			return;
+		}
+		if (inputs.size() != expected_inputs) {
+			error(string_format("%s() takes %d inputs", name.c_str(), (int)expected_inputs));
+			return;
+		}
+		if (name == "store") {
+			ValueType vector = check_vector_input(procedure_call, 2);
+			check_vector_element(name, inputs[0], inputs[1], vector);
+			return;
+		}
+		ValueType vector = check_vector_input(procedure_call, 0);
+		if (name == "lane") {
+			check_lane_literal(inputs[1], is_vector(vector) ? lane_count(vector) : 8, name);
+		}
+		if (name == "shuffle") {
+			for (int i = 1; i < 5; i++) check_lane_literal(inputs[i], 4, name);
+		}
+		if (name == "min" || name == "max") {
+			ValueType other = check_vector_input(procedure_call, 1);
+			if (vector != ValueType::NONE && other != ValueType::NONE && vector != other) {
+				error(string_format("%s and %s inputs to %s()", value_type_names[(int)vector], value_type_names[(int)other], name.c_str()));
+			}
+		}
+	}
+
+	// a vector comparison gives a mask, not something to branch on
+	void check_condition(SyntaxNode* condition) {
+		if (is_vector(check(condition))) error("a vector can't be a condition");
+	}
+
+	void check_block(Block* block) {
+		for (SyntaxNode* statement : block->statements) {
+			switch (statement->type)
+			{
+			case SyntaxNode::Type::VARIABLE_DECLERATION:
+			{
+				VariableDecleration* decl = (VariableDecleration*)statement;
+				if (decl->type_name.length() == 0) {
+					untyped[decl->name] = decl;
+					break;
+				}
+				if (is_array_type_name(decl->type_name)) {
+					ArrayType array;
+					if (!parse_array_type(decl->type_name, array)) error("unknown array type " + decl->type_name);
+					types->arrays[decl->name] = array;
+					(*variables)[decl->name] = ValueType::ARRAY;
+					break;
+				}
+				ValueType type = type_from_name(decl->type_name);
+				if (type == ValueType::NONE) error("unknown type " + decl->type_name);
+				(*variables)[decl->name] = type;
+			}
+			break;
+			case SyntaxNode::Type::VARIABLE_ASSIGNMENT:
+			{
+				VariableAssignment* assignment = (VariableAssignment*)statement;
+				auto pending = untyped.find(assignment->name);
+				if (pending != untyped.end()) {
+					ValueType type = check(assignment->value);
+					pending->second->type_name = value_type_names[(int)type];
+					(*variables)[assignment->name] = type;
+					if (type == ValueType::INT && is_integer_constant(assignment->value)) constants[assignment->name] = pending->second;
+					untyped.erase(pending);
+					break;
+				}
+				if (variables->count(assignment->name) == 0) {
+					error("assignment to undeclared " + assignment->name);
+					break;
+				}
+				ValueType expected = (*variables)[assignment->name];
+				if (expected == ValueType::ARRAY) {
+					error("can't assign to the whole of " + assignment->name);
+					break;
+				}
+				assignment->value = coerce(assignment->value, expected);
+				ValueType found = check(assignment->value);
+				if (!accepts(expected, assignment->value, found)) {
+					error(string_format("%s value assigned to %s %s", value_type_names[(int)found], value_type_names[(int)expected], assignment->name.c_str()));
+				}
+			}
+			break;
+			case SyntaxNode::Type::ELEMENT_ASSIGNMENT:
+			{
+				ElementAssignment* element_assignment = (ElementAssignment*)statement;
+				ArrayType* array = check_element(element_assignment->name, element_assignment->field, element_assignment->index);
+				if (!array) break;
+				ValueType expected = element_type(*array, element_assignment->field);
+				element_assignment->value = coerce(element_assignment->value, expected);
+				ValueType found = check(element_assignment->value);
+				if (!accepts(expected, element_assignment->value, found)) {
+					error(string_format("%s value assigned to an element of %s", value_type_names[(int)found], element_assignment->name.c_str()));
+				}
+			}
+			break;
+			case SyntaxNode::Type::PROCEDURE_CALL:
+				check_call((ProcedureCall*)statement);
+				break;
+			case SyntaxNode::Type::RETURN_STATEMENT:
+			{
+				ReturnStatement* return_statement = (ReturnStatement*)statement;
+				ValueType expected = procedure_types[procedure_name].result;
+				return_statement->expression = coerce(return_statement->expression, expected);
+				ValueType found = check(return_statement->expression);
+				if (!accepts(expected, return_statement->expression, found)) {
+					error(string_format("returns %s, declared %s", value_type_names[(int)found], value_type_names[(int)expected]));
+				}
+			}
+			break;
+			case SyntaxNode::Type::WHILE_STATEMENT:
+				check_condition(((WhileStatement*)statement)->condition);
+				check_block(((WhileStatement*)statement)->body);
+				break;
+			case SyntaxNode::Type::IF_STATEMENT:
+				check_condition(((IfStatement*)statement)->condition);
+				check_block(((IfStatement*)statement)->body);
+				break;
+			case SyntaxNode::Type::BLOCK:
+				check_block((Block*)statement);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+};
+
+// the fields have to be numbers, each named once
+void check_struct(StructDecleration* decl, std::vector<std::string>& errors) {
+	if (struct_types.count(decl->name) > 0) {
+		errors.push_back("type error: struct " + decl->name + " is declared twice");
+		return;
+	}
+	if (type_from_name(decl->name) != ValueType::NONE) {
+		errors.push_back("type error: " + decl->name + " is already a type");
+		return;
+	}
+	StructType& structure = struct_types[decl->name];
+	structure.soa = decl->soa;
+	for (SyntaxNode* field : decl->fields) {
+		VariableDecleration* field_decl = (VariableDecleration*)field;
+		ValueType type = type_from_name(field_decl->type_name);
+		if (!is_integer(type) && !is_floating(type)) {
+			errors.push_back("type error in " + decl->name + ": field " + field_decl->name + " is " + field_decl->type_name + ", not a number");
+			continue;
+		}
+		for (StructField& other : structure.fields) {
+			if (other.name == field_decl->name) errors.push_back("type error in " + decl->name + ": " + field_decl->name + " is declared twice");
+		}
+		structure.fields.push_back(StructField{ field_decl->name, type, 0 });
+	}
+	if (decl->fields.size() == 0) errors.push_back("type error: struct " + decl->name + " has no fields");
+	lay_out_struct(structure);
+}
+
+// fills in struct_types, procedure_types and static_arrays, safe to run again after passes that add temporaries
+std::vector<std::string> check_types(Block* program) {
+	std::vector<ProcedureDecleration*> declerations;
+	std::vector<std::string> errors;
+	// structs first, arrays of them can be declared anywhere
+	struct_types.clear();
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::STRUCT_DECLERATION) check_struct((StructDecleration*)statement, errors);
+	}
+	static_arrays.clear();
+	for (SyntaxNode* statement : program->statements) {
+		if (statement->type == SyntaxNode::Type::PROCEDURE_DECLERATION) {
+			declerations.push_back((ProcedureDecleration*)statement);
+		}
+		if (statement->type == SyntaxNode::Type::VARIABLE_DECLERATION) {
+			VariableDecleration* decl = (VariableDecleration*)statement;
+			ArrayType array;
+			array.storage = ArrayType::Storage::STATIC;
+			if (!parse_array_type(decl->type_name, array)) errors.push_back("type error: only arrays can be declared outside a procedure, not " + decl->name);
+			else if (static_arrays.count(decl->name) > 0) errors.push_back("type error: " + decl->name + " is declared twice");
+			else static_arrays[decl->name] = array;
+		}
+	}
+
+	// signatures first so calls can be checked in any order
+	procedure_types.clear();
+	for (ProcedureDecleration* decl : declerations) {
+		ProcedureTypes& types = procedure_types[decl->name];
+		for (SyntaxNode* input : decl->procedure->inputs) {
+			VariableDecleration* input_decl = (VariableDecleration*)input;
+			ArrayType array;
+			array.storage = ArrayType::Storage::INPUT;
+			ValueType type = type_from_name(input_decl->type_name);
+			if (is_array_type_name(input_decl->type_name)) {
+				if (!parse_array_type(input_decl->type_name, array)) errors.push_back("type error in " + decl->name + ": unknown array type " + input_decl->type_name);
+				type = ValueType::ARRAY;
+				types.arrays[input_decl->name] = array;
+			}
+			else if (type == ValueType::NONE) errors.push_back("type error in " + decl->name + ": unknown type " + input_decl->type_name);
+			types.inputs.push_back(type);
+			types.input_arrays.push_back(array);
+			types.variables[input_decl->name] = type;
+		}
+		types.result = procedure_result(decl->procedure);
+		if (decl->procedure->outputs.size() > 0 && is_array_type_name(((VariableDecleration*)decl->procedure->outputs[0])->type_name)) {
+			errors.push_back("type error in " + decl->name + ": can't return " + ((VariableDecleration*)decl->procedure->outputs[0])->type_name);
+		}
+	}
+
+	for (ProcedureDecleration* decl : declerations) {
+		TypeChecker checker;
+		checker.procedure_name = decl->name;
+		checker.types = &procedure_types[decl->name];
+		checker.variables = &procedure_types[decl->name].variables;
+		checker.check_block(decl->procedure->body);
+		errors.insert(errors.end(), checker.errors.begin(), checker.errors.end());
+	}
+	return errors;
+}
@@ -10,4 +10,12 @@ std::string string_format(const std::string& format, Args ... args)
 	std::unique_ptr<char[]> buf(new char[size]);
 	std::snprintf(buf.get(), size, format.c_str(), args ...);
 	return std::string(buf.get(), buf.get() + size - 1); // We don't want the '\0' inside
-}
\ No newline at end of file
+}
+
+// fnv-1a, for cache keys and checking a profile fits its program
+unsigned long long hash_text(const std::string& text, unsigned long long hash = 0xcbf29ce484222325ULL) {
+	for (char c : text) {
+		hash = (hash ^ (unsigned char)c) * 0x100000001b3ULL;
+	}
+	return hash;
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+struct node {
+	long long value;
+	struct node* next;
+};
+
+__attribute__((noinline)) long long sum_list(struct node* head) {
+	long long total = 0;
+	for (struct node* node = head; node; node = node->next) {
+		total = total + node->value;
+	}
+	return total;
+}
+
+void free_list(struct node* head) {
+	while (head) {
+		struct node* next = head->next;
+		free(head);
+		head = next;
+	}
+}
+
+int main() {
+	long long checksum = 0;
+	for (int round = 0; round < 100; round++) {
+		struct node* head = 0;
+		for (int i = 0; i < 2000; i++) {
+			struct node* node = malloc(16);
+			node->value = round + i % 7;
+			node->next = head;
+			head = node;
+		}
+		checksum = checksum + sum_list(head) % 997;
+		free_list(head);
+
+		head = 0;
+		for (int i = 0; i < 2000; i++) {
+			struct node* cell = malloc(24);
+			cell->value = round * (i % 5);
+			cell->next = head;
+			head = cell;
+		}
+		checksum = checksum + sum_list(head) % 997;
+		free_list(head);
+	}
+	printf("alloc %d\n", (int)checksum);
+	return 0;
+}
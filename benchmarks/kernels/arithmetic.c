@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+int mix(int n) {
+	int total = 0;
+	for (int i = 1; i < n; i++) {
+		int x = i * 31 % 1009;
+		total = (total + x / 3) % 1000003;
+	}
+	return total;
+}
+
+int main() {
+	printf("arithmetic %d\n", mix(2000000));
+	return 0;
+}
@@ -0,0 +1,14 @@
+#include <stdio.h>
+
+__attribute__((noinline)) int step(int value, int k) {
+	return value * 3 + k % 11;
+}
+
+int main() {
+	int value = 1;
+	for (int i = 0; i < 2000000; i++) {
+		value = step(value, i) % 10007;
+	}
+	printf("calls %d\n", value);
+	return 0;
+}
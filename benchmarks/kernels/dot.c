@@ -0,0 +1,25 @@
+#include <stdio.h>
+
+int xs[4096];
+int ys[4096];
+
+int dot(void) {
+	int s = 0;
+	for (int i = 0; i < 4096; i++) {
+		s = s + xs[i] * ys[i];
+	}
+	return s;
+}
+
+int main() {
+	for (int i = 0; i < 4096; i++) {
+		xs[i] = i % 17 - 8;
+		ys[i] = i % 13;
+	}
+	int total = 0;
+	for (int round = 0; round < 800; round++) {
+		total = total + dot();
+	}
+	printf("dot %d\n", total);
+	return 0;
+}
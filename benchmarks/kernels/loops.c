@@ -0,0 +1,30 @@
+#include <stdio.h>
+
+int table(int n) {
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		for (int j = 0; j < n; j++) {
+			total = total + i * j % 7;
+		}
+	}
+	return total;
+}
+
+int carried(int n) {
+	int total = 0;
+	for (int i = 0; i < n; i++) {
+		int row = i * 3;
+		for (int j = 0; j < 4; j++) {
+			total = total + row + j;
+			int scratch = j * 77;
+			total = total + scratch % 5;
+		}
+	}
+	return total;
+}
+
+int main() {
+	printf("loops %d\n", table(2000));
+	printf("carried %d\n", carried(1000));
+	return 0;
+}
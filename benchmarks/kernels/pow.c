@@ -0,0 +1,17 @@
+#include <stdio.h>
+
+int power(int number, int to_power) {
+	if (to_power == 0) return 1;
+	int result = number;
+	for (int counter = 1; counter < to_power; counter++) result = result * number;
+	return result;
+}
+
+int main() {
+	int total = 0;
+	for (int i = 0; i < 600000; i++) {
+		total = total + power(i % 3 + 2, i % 15) % 1000;
+	}
+	printf("pow %d\n", total);
+	return 0;
+}
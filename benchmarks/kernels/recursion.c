@@ -0,0 +1,11 @@
+#include <stdio.h>
+
+int fib(int n) {
+	if (n < 2) return n;
+	return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+	printf("recursion %d\n", fib(28));
+	return 0;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+float xs[4096];
+float ys[4096];
+
+void saxpy(float a) {
+	for (int i = 0; i < 4096; i++) {
+		ys[i] = ys[i] + a * xs[i];
+	}
+}
+
+int main() {
+	for (int i = 0; i < 4096; i++) {
+		xs[i] = (float)(i % 16);
+		ys[i] = (float)(i % 5);
+	}
+	for (int round = 0; round < 800; round++) {
+		saxpy(0.5f);
+	}
+	int checksum = 0;
+	for (int i = 0; i < 4096; i++) {
+		checksum = checksum + (int)ys[i];
+	}
+	printf("saxpy %d\n", checksum);
+	return 0;
+}
@@ -0,0 +1,23 @@
+#include <stdio.h>
+
+long long xs[4096];
+
+long long sum(void) {
+	long long s = 0;
+	for (int i = 0; i < 4096; i++) {
+		s = s + xs[i];
+	}
+	return s;
+}
+
+int main() {
+	for (int i = 0; i < 4096; i++) {
+		xs[i] = i % 1000;
+	}
+	long long total = 0;
+	for (int round = 0; round < 800; round++) {
+		total = total + sum();
+	}
+	printf("sum %lld\n", total);
+	return 0;
+}